@@ -228,8 +228,8 @@ project "hiredis"
 		"./deps/hiredis/test.c",
 	}
 
-project "tengine"
-	kind "ConsoleApp"
+-- what tengine and the test programs, built from its sources, share
+local function tengine_settings()
 	language "C++"
 	targetdir "./bin"
 	defines {
@@ -277,19 +277,6 @@ project "tengine"
         end
 	end
 
-	files {
-		"./src/*.cpp",
-		"./src/*.hpp",
-		"./src/*.h",
-        "./src/*.c",
-	}
-
-	removefiles {
-		"./src/sandbox_*.cpp",
-        "./src/system_info_*.cpp",
-        "./src/process_info_*.cpp",
-	}
-
     links {"hiredis"}
 
 	if _OPTIONS["lua"] == "lua53" then
@@ -313,7 +300,7 @@ project "tengine"
 	libdirs {"./deps/mysql"}
 
 	if os.get() == "linux" then
-		links {"./deps/mysql/mysqlclient_fix", "pthread", "stdc++fs", "dl"}
+		links {"./deps/mysql/mysqlclient_fix", "crypto", "pthread", "stdc++fs", "dl", "rt"}
 	elseif os.get() == "windows" then
 		links {"libmySQL"}
 
@@ -324,6 +311,70 @@ project "tengine"
 
 		links {"./deps/openssl/libcrypto"}
     end
+end
+
+project "tengine"
+	kind "ConsoleApp"
+	tengine_settings()
+
+	files {
+		"./src/*.cpp",
+		"./src/*.hpp",
+		"./src/*.h",
+        "./src/*.c",
+	}
+
+	removefiles {
+		"./src/sandbox_*.cpp",
+        "./src/system_info_*.cpp",
+        "./src/process_info_*.cpp",
+	}
+
+-- bin/tests [name ...] runs the unit tests under test/
+project "tests"
+	kind "ConsoleApp"
+	tengine_settings()
+
+	includedirs {"./src"}
+
+	files {
+		"./src/*.cpp",
+		"./src/*.hpp",
+		"./src/*.h",
+        "./src/*.c",
+		"./test/*.cpp",
+		"./test/*.hpp",
+	}
+
+	removefiles {
+		"./src/main.cpp",
+		"./src/sandbox_*.cpp",
+        "./src/system_info_*.cpp",
+        "./src/process_info_*.cpp",
+		"./test/gossip_node.cpp",
+	}
+
+-- one gossip member, test/gossip.py runs a cluster of them
+project "gossip_node"
+	kind "ConsoleApp"
+	tengine_settings()
+
+	includedirs {"./src"}
+
+	files {
+		"./src/*.cpp",
+		"./src/*.hpp",
+		"./src/*.h",
+        "./src/*.c",
+		"./test/gossip_node.cpp",
+	}
+
+	removefiles {
+		"./src/main.cpp",
+		"./src/sandbox_*.cpp",
+        "./src/system_info_*.cpp",
+        "./src/process_info_*.cpp",
+	}
 
 if _ACTION == "clean" then
 	os.rmdir("build")
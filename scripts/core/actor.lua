@@ -135,6 +135,34 @@ function actor.self()
     return __Service__
 end
 
+-- this node's id, node.node in the config
+function actor.node()
+    return c.node()
+end
+
+-- a service on another node, by id or by registered name, for send, call
+-- and wrap; calls go over the link between the two nodes
+function actor.remote(node, service)
+    if type(service) == 'string' then
+        return service .. "@" .. node
+    end
+
+    return c.remote(node, service)
+end
+
+-- the nodes gossip knows of, this one included, as
+-- {node, host, port, gossip_port, state, incarnation, services}; state is
+-- "alive", "suspect" or "dead"
+function actor.members()
+    return c.members()
+end
+
+-- lists name in this node's services in members(), for the other nodes to
+-- find; they reach it as actor.remote(node, name)
+function actor.announce(name)
+    c.announce(name)
+end
+
 function actor.wrap(id)
     return setmetatable({}, {__index = function(t, key)
         local id = id
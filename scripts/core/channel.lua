@@ -30,11 +30,15 @@ local methods = {
     close = close,
 }
 
-local connect = function(address, read, closed)
+-- address: "host:port", "unix:/path" for a unix-domain socket, or
+-- "shm:name" for a shared memory channel to a process on the same host
+-- opts (optional): timeout, reconnect, reconnect_delay, reconnect_max_delay,
+-- size (shm ring bytes per direction)
+local connect = function(address, read, closed, opts)
     assert(type(address) == 'string', "channel address type error")
     assert(type(read) == "function" and type(closed) == 'function', "channel param error")
 
-    local address = string.split(address, ":")
+    opts = opts or {}
 
     local co = coroutine_running()
 
@@ -42,35 +46,50 @@ local connect = function(address, read, closed)
 
     local channel
 
-    channel = c.channel(address[1], tonumber(address[2]), {
-                                  on_connected = function()
-                                      self.channel = channel
-                                      actor.suspend(co, coroutine_resume(co, self, nil))
-                                  end,
-
-                                  on_read = function(data, size)
-                                      local co = co_pool.new(read)
-                                      local succ, err = coroutine_resume(co, data, size)
-                                      if not succ then
-                                          error(err)
-                                      end
-                                  end,
-
-                                  on_closed = function(err)
-                                      if not self.channel then
-                                          actor.suspend(co, coroutine_resume(co, nil, err))
-                                      else
-                                          local co = co_pool.new(closed)
-                                          local succ, myerr = coroutine_resume(co, err)
-                                          if not succ then
-                                              error(myerr)
-                                              self.channel = nil
-                                          end
-
-                                          self.channel = nil
-                                      end
-                                  end
-     })
+    local handlers = {
+        timeout = opts.timeout,
+        reconnect = opts.reconnect,
+        reconnect_delay = opts.reconnect_delay,
+        reconnect_max_delay = opts.reconnect_max_delay,
+        size = opts.size,
+
+        on_connected = function()
+            self.channel = channel
+            actor.suspend(co, coroutine_resume(co, self, nil))
+        end,
+
+        on_read = function(data, size)
+            local co = co_pool.new(read)
+            local succ, err = coroutine_resume(co, data, size)
+            if not succ then
+                error(err)
+            end
+        end,
+
+        on_closed = function(err)
+            if not self.channel then
+                actor.suspend(co, coroutine_resume(co, nil, err))
+            else
+                local co = co_pool.new(closed)
+                local succ, myerr = coroutine_resume(co, err)
+                if not succ then
+                    error(myerr)
+                    self.channel = nil
+                end
+
+                self.channel = nil
+            end
+        end
+    }
+
+    if string.sub(address, 1, 4) == "shm:" then
+        channel = c.shm_channel(string.sub(address, 5), handlers)
+    elseif string.sub(address, 1, 5) == "unix:" then
+        channel = c.channel(address, nil, handlers)
+    else
+        address = string.split(address, ":")
+        channel = c.channel(address[1], tonumber(address[2]), handlers)
+    end
 
      return coroutine_yield("CHANNEL")
 end
@@ -32,6 +32,7 @@ end
 return {
     actor = require (_PACKAGE.."/actor"),
     server = require(_PACKAGE.."/server"),
+    kcp = require(_PACKAGE.."/kcp"),
     channel = require(_PACKAGE.."/channel"),
     http = require(_PACKAGE.."/http"),
     web = require(_PACKAGE.."/web"),
@@ -3,7 +3,9 @@
 -------------------------------------------------------------------------------
 local _PACKAGE = (...):match("^(.+)[%./][^%./]+") or ""
 
-local setmetatable,string = setmetatable,string
+local setmetatable,string,error = setmetatable,string,error
+local select = select
+local table_unpack = unpack or table.unpack
 
 local coroutine_running = coroutine.running
 local coroutine_resume = coroutine.resume
@@ -23,6 +25,131 @@ local query = function(self, ...)
     return coroutine_yield("CONTINUE")
 end
 
+-- read through the section's query cache, ttl in ms (nil for the default)
+local cached = function(self, ttl, ...)
+    local mysql = self.mysql
+    local co = coroutine_running()
+
+    mysql:cached(string.format(...), ttl, function(...)
+        actor.suspend(co, coroutine_resume(co, ...))
+    end)
+
+    return coroutine_yield("CONTINUE")
+end
+
+local invalidate = function(self, ...)
+    return self.mysql:invalidate(...)
+end
+
+local cache_stats = function(self)
+    return self.mysql:cache_stats()
+end
+
+-- blocking engine: connections, grown/shrunk, wait/busy/latency histograms,
+-- one table per replica in .replicas
+local pool_stats = function(self)
+    return self.mysql:pool_stats()
+end
+
+-- rows stay in a mysql_result: res[i], res:value(i, col), res:column(col)
+local query_lazy = function(self, ...)
+    local mysql = self.mysql
+    local co = coroutine_running()
+
+    mysql:query(string.format(...), function(...)
+        actor.suspend(co, coroutine_resume(co, ...))
+    end, true)
+
+    return coroutine_yield("CONTINUE")
+end
+
+-- for res in db:cursor(1000, "SELECT ...") do ... end
+-- each res is a mysql_result of up to batch rows, errors are raised
+local cursor = function(self, batch, ...)
+    local co = coroutine_running()
+
+    local batches, head, tail = {}, 1, 0
+    local done, err, waiting = false, nil, false
+
+    self.mysql:stream(string.format(...), batch, function(e, res, more)
+        if e then
+            err = e
+        elseif res then
+            tail = tail + 1
+            batches[tail] = res
+        end
+
+        done = not more
+
+        if waiting then
+            waiting = false
+            actor.suspend(co, coroutine_resume(co))
+        end
+    end)
+
+    return function()
+        while head > tail do
+            if done then
+                if err then
+                    error(err)
+                end
+                return nil
+            end
+
+            waiting = true
+            coroutine_yield("CONTINUE")
+        end
+
+        local res = batches[head]
+        batches[head] = nil
+        head = head + 1
+        return res
+    end
+end
+
+local stmt_methods = {
+    -- stmt:execute(p1, p2, ...), params bound to the ? markers in order
+    execute = function(self, ...)
+        local co = coroutine_running()
+
+        -- trailing nils are params too, the callback goes after them
+        local n = select("#", ...) + 1
+        local args = {...}
+        args[n] = function(...)
+            actor.suspend(co, coroutine_resume(co, ...))
+        end
+
+        self.stmt:execute(table_unpack(args, 1, n))
+
+        return coroutine_yield("CONTINUE")
+    end,
+
+    -- stmt:cached(ttl, p1, p2, ...), read through the query cache
+    cached = function(self, ttl, ...)
+        local co = coroutine_running()
+
+        local n = select("#", ...) + 1
+        local args = {...}
+        args[n] = function(...)
+            actor.suspend(co, coroutine_resume(co, ...))
+        end
+
+        self.stmt:cached(ttl, table_unpack(args, 1, n))
+
+        return coroutine_yield("CONTINUE")
+    end,
+}
+
+local prepare = function(self, sql)
+    return setmetatable({stmt = self.mysql:prepare(sql)}, {__index = stmt_methods})
+end
+
+-- db:write("player", {id = 1}, {gold = 10}), returns at once; the row is
+-- merged with other writes to it and upserted by the write-behind queue
+local write = function(self, tbl, keys, values)
+    return self.mysql:write(tbl, keys, values)
+end
+
 local close = function(self)
     if self.mysql then
         self.mysql = nil
@@ -31,6 +158,14 @@ end
 
 local methods = {
     query = query,
+    query_lazy = query_lazy,
+    cached = cached,
+    invalidate = invalidate,
+    cache_stats = cache_stats,
+    pool_stats = pool_stats,
+    cursor = cursor,
+    prepare = prepare,
+    write = write,
     close = close,
 }
 
@@ -5,6 +5,8 @@ local _PACKAGE = (...):match("^(.+)[%./][^%./]+") or ""
 
 local assert, pcall, setmetatable = assert, pcall, setmetatable
 local table_insert = table.insert
+local table_unpack = table.unpack
+local type = type
 
 local setmetatable,string = setmetatable,string
 
@@ -41,11 +43,25 @@ local call = function(self, ...)
     return coroutine_yield("CONTINUE")
 end
 
+-- an array reply stays in a redis_reply: res[i], #res, ipairs/pairs,
+-- res:tomap() for field, value lists, res:totable()
+local call_lazy = function(self, ...)
+    assert(self.redis)
+
+    local thread = coroutine_running()
+
+    self.redis:callv_lazy(function(...)
+                        actor.suspend(thread, coroutine_resume(thread, ...))
+    end, ...)
+
+    return coroutine_yield("CONTINUE")
+end
+
 local queue = function(self, ...)
     table_insert(self.buff, {...})
 end
 
-local commit = function(self, ...)
+local commit = function(self, lazy)
     assert(self.redis)
 
     if #self.buff == 0 then
@@ -56,13 +72,44 @@ local commit = function(self, ...)
 
     self.redis:commit(function(...)
             actor.suspend(thread, coroutine_resume(thread, ...))
-    end, self.buff)
+    end, self.buff, lazy)
 
     self.buff = {}
 
     return coroutine_yield("CONTINUE")
 end
 
+-- a batch owned by one coroutine, committed in one round trip; with
+-- transaction set the commands run between MULTI and EXEC
+local pipeline_queue = function(self, ...)
+    self.pipeline:queue(...)
+end
+
+-- with lazy set array replies stay in a redis_reply, as for call_lazy
+local pipeline_commit = function(self, lazy)
+    if self.pipeline:size() == 0 then
+        return true, {}
+    end
+
+    local thread = coroutine_running()
+
+    self.redis:commit(function(...)
+            actor.suspend(thread, coroutine_resume(thread, ...))
+    end, self.pipeline, lazy)
+
+    return coroutine_yield("CONTINUE")
+end
+
+-- channels or patterns as arguments or as one array
+local names = function(...)
+    local first = ...
+    if type(first) == "table" then
+        return table_unpack(first)
+    end
+
+    return ...
+end
+
 local quit = function(self)
     if self.redis then
         call(self, "QUIT")
@@ -79,11 +126,29 @@ local _wrap_in_pcall = function(...)
     end
 end
 
+local pipeline_methods = {
+    queue = function(self, ...)
+        return _wrap_in_pcall(pipeline_queue, self, ...)
+    end,
+
+    size = function(self)
+        return self.pipeline:size()
+    end,
+
+    commit = function(self, ...)
+        return _wrap_in_pcall(pipeline_commit, self, ...)
+    end,
+}
+
 local methods = {
     call = function(self, ...)
         return _wrap_in_pcall(call, self, ...)
     end,
 
+    call_lazy = function(self, ...)
+        return _wrap_in_pcall(call_lazy, self, ...)
+    end,
+
     queue = function(self, ...)
         return _wrap_in_pcall(queue, self, ...)
     end,
@@ -92,6 +157,45 @@ local methods = {
         return _wrap_in_pcall(commit, self, ...)
     end,
 
+    pipeline = function(self, transaction)
+        assert(self.redis)
+
+        return setmetatable({
+            redis = self.redis,
+            pipeline = self.redis:pipeline(transaction),
+        }, {__index = pipeline_methods})
+    end,
+
+    -- callback(channel, message) on this service for every message on
+    -- the channels until unsubscribe(id); the subscriptions end with the
+    -- handle, keep it
+    subscribe = function(self, callback, ...)
+        assert(self.redis)
+
+        return self.redis:subscribe(callback, names(...))
+    end,
+
+    -- callback(channel, message, pattern), e.g. for keyspace events
+    -- with "__keyspace@0__:user:*"
+    psubscribe = function(self, callback, ...)
+        assert(self.redis)
+
+        return self.redis:psubscribe(callback, names(...))
+    end,
+
+    unsubscribe = function(self, id)
+        assert(self.redis)
+
+        self.redis:unsubscribe(id)
+    end,
+
+    -- near cache counters with hit_rate, nil when the section has none
+    cache_stats = function(self)
+        assert(self.redis)
+
+        return self.redis:cache_stats()
+    end,
+
     quit = function(self, ...)
         return _wrap_in_call(quit, self, ...)
     end,
@@ -48,6 +48,7 @@ local methods = {
     close = close,
 }
 
+-- port: a port number, or "unix:/path" for a unix-domain socket
 local new = function(port, accept, read, closed)
     local self = setmetatable({}, {__index = methods})
 
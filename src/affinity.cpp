@@ -0,0 +1,150 @@
+#include "affinity.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tengine
+{
+	namespace
+	{
+		std::mutex roles_mutex;
+
+		std::map<std::string, CpuSet> roles;
+	}
+
+	bool parse_cpu_set(const char *text, CpuSet& cpus)
+	{
+		cpus.clear();
+
+		if (text == nullptr)
+			return true;
+
+		const char *p = text;
+
+		while (*p)
+		{
+			if (*p == ' ' || *p == ',')
+			{
+				p++;
+				continue;
+			}
+
+			char *end;
+			long first = std::strtol(p, &end, 10);
+			if (end == p || first < 0)
+				return false;
+
+			long last = first;
+			p = end;
+
+			if (*p == '-')
+			{
+				p++;
+				last = std::strtol(p, &end, 10);
+				if (end == p || last < first)
+					return false;
+				p = end;
+			}
+
+			for (long cpu = first; cpu <= last; cpu++)
+				cpus.push_back((int)cpu);
+		}
+
+		return true;
+	}
+
+	std::string format_cpu_set(const CpuSet& cpus)
+	{
+		if (cpus.empty())
+			return "any";
+
+		std::ostringstream os;
+
+		for (std::size_t i = 0; i < cpus.size(); i++)
+		{
+			if (i > 0)
+				os << ",";
+			os << cpus[i];
+		}
+
+		return os.str();
+	}
+
+	bool set_thread_affinity(const CpuSet& cpus)
+	{
+		if (cpus.empty())
+			return true;
+
+#if defined(_WIN32)
+		DWORD_PTR mask = 0;
+		for (int cpu : cpus)
+		{
+			if (cpu < (int)(sizeof(mask) * 8))
+				mask |= (DWORD_PTR)1 << cpu;
+		}
+
+		return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+		{
+			if (cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		}
+
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	void set_thread_name(const char *name)
+	{
+#if defined(__linux__)
+		char buffer[16];
+		std::snprintf(buffer, sizeof(buffer), "%s", name);
+		pthread_setname_np(pthread_self(), buffer);
+#else
+		(void)name;
+#endif
+	}
+
+	void ThreadRoles::set(const std::string& role, const CpuSet& cpus)
+	{
+		std::lock_guard<std::mutex> lock(roles_mutex);
+		roles[role] = cpus;
+	}
+
+	CpuSet ThreadRoles::get(const std::string& role)
+	{
+		std::lock_guard<std::mutex> lock(roles_mutex);
+
+		auto iter = roles.find(role);
+		if (iter == roles.end())
+			return CpuSet();
+
+		return iter->second;
+	}
+
+	void ThreadRoles::enter(const char *role)
+	{
+		set_thread_name(role);
+
+		CpuSet cpus = get(role);
+
+		if (!set_thread_affinity(cpus))
+			std::fprintf(stderr, "failed to pin %s thread to cpus %s\n",
+				role, format_cpu_set(cpus).c_str());
+	}
+}
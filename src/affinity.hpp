@@ -0,0 +1,36 @@
+#ifndef TENGINE_AFFINITY_HPP
+#define TENGINE_AFFINITY_HPP
+
+#include <string>
+#include <vector>
+
+namespace tengine
+{
+	typedef std::vector<int> CpuSet;
+
+	// "2", "2,3", "4-7" or "0,2-3"; an empty string is an empty set
+	bool parse_cpu_set(const char *text, CpuSet& cpus);
+
+	std::string format_cpu_set(const CpuSet& cpus);
+
+	// pin the calling thread, an empty set leaves it floating
+	bool set_thread_affinity(const CpuSet& cpus);
+
+	// linux keeps the first 15 characters
+	void set_thread_name(const char *name);
+
+	// cpu sets per thread role ("worker", "net", "timer", ...), filled from
+	// the threads section of the config before any thread starts. a thread
+	// enters its role first thing, which names it and pins it.
+	class ThreadRoles
+	{
+	public:
+		static void set(const std::string& role, const CpuSet& cpus);
+
+		static CpuSet get(const std::string& role);
+
+		static void enter(const char *role);
+	};
+}
+
+#endif
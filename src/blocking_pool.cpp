@@ -0,0 +1,300 @@
+#include "blocking_pool.hpp"
+
+#include "affinity.hpp"
+
+#include <algorithm>
+
+namespace tengine
+{
+	namespace
+	{
+		// the queue whose task this pool thread is running
+		thread_local const BlockingPool::Queue *current_queue = nullptr;
+	}
+
+	BlockingPool::Queue::Queue(BlockingPool& pool, const char *name,
+		std::size_t limit, Priority priority)
+		: pool_(pool)
+		, name_(name)
+		, limit_(limit > 0 ? limit : 1)
+		, priority_(priority)
+		, running_(0)
+		, completed_(0)
+		, closed_(false)
+	{
+
+	}
+
+	BlockingPool::Queue::~Queue()
+	{
+		close();
+
+		pool_.remove(this);
+	}
+
+	bool BlockingPool::Queue::post(Task task)
+	{
+		return post(priority_, std::move(task));
+	}
+
+	bool BlockingPool::Queue::post(Priority priority, Task task)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool_.mutex_);
+
+			if (closed_)
+				return false;
+
+			if (pool_.stopped_)
+			{
+				// no worker will take it any more, the last log lines and
+				// writes still have to happen
+				lock.unlock();
+				task();
+				return true;
+			}
+
+			tasks_[priority].push_back(std::move(task));
+		}
+
+		pool_.cond_.notify_one();
+
+		return true;
+	}
+
+	void BlockingPool::Queue::close()
+	{
+		std::deque<Task> left;
+
+		{
+			std::unique_lock<std::mutex> lock(pool_.mutex_);
+
+			closed_ = true;
+
+			// taken out so no worker starts them, they run below in
+			// priority then fifo order
+			for (auto& tasks : tasks_)
+			{
+				for (auto& task : tasks)
+					left.push_back(std::move(task));
+				tasks.clear();
+			}
+
+			// our own slot ends only after we return
+			std::size_t self = current_queue == this ? 1 : 0;
+
+			while (running_ > self)
+				pool_.idle_.wait(lock);
+		}
+
+		// a queued write or log line must still happen
+		for (auto& task : left)
+			task();
+	}
+
+	BlockingPool::BlockingPool()
+		: mutex_()
+		, cond_()
+		, idle_()
+		, queues_()
+		, cursor_(0)
+		, skipped_()
+		, stopped_(false)
+		, threads_()
+	{
+
+	}
+
+	BlockingPool::~BlockingPool()
+	{
+		stop();
+		join();
+	}
+
+	void BlockingPool::run(std::size_t num_threads)
+	{
+		for (std::size_t i = 0; i < num_threads; i++)
+			threads_.emplace_back([this]() { worker(); });
+	}
+
+	void BlockingPool::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+		}
+
+		cond_.notify_all();
+	}
+
+	void BlockingPool::join()
+	{
+		for (auto& thread : threads_)
+		{
+			if (thread.joinable())
+				thread.join();
+		}
+	}
+
+	BlockingPool::QueuePtr BlockingPool::queue(const char *name,
+		std::size_t limit, Priority priority)
+	{
+		QueuePtr queue = std::make_shared<Queue>(*this, name, limit, priority);
+		queue->self_ = queue;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		queues_.push_back(queue.get());
+
+		return queue;
+	}
+
+	void BlockingPool::remove(Queue *queue)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto iter = std::find(queues_.begin(), queues_.end(), queue);
+		if (iter != queues_.end())
+			queues_.erase(iter);
+	}
+
+	std::vector<BlockingPool::Stats> BlockingPool::stats()
+	{
+		std::vector<Stats> result;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (Queue *queue : queues_)
+		{
+			auto iter = std::find_if(result.begin(), result.end(),
+				[queue](const Stats& stats) { return stats.name == queue->name_; });
+
+			if (iter == result.end())
+			{
+				result.push_back(Stats{ queue->name_, 0, 0, 0, 0, 0 });
+				iter = result.end() - 1;
+			}
+
+			iter->queues++;
+			for (auto& tasks : queue->tasks_)
+				iter->queued += tasks.size();
+			iter->running += queue->running_;
+			iter->limit += queue->limit_;
+			iter->completed += queue->completed_;
+		}
+
+		return result;
+	}
+
+	bool BlockingPool::take(int priority, Task *task, Queue **queue)
+	{
+		std::size_t count = queues_.size();
+
+		// round robin between queues within a priority
+		for (std::size_t i = 0; i < count; i++)
+		{
+			std::size_t index = (cursor_ + i) % count;
+			Queue *q = queues_[index];
+
+			if (q->running_ >= q->limit_ || q->tasks_[priority].empty())
+				continue;
+
+			// only looking
+			if (!task)
+				return true;
+
+			*task = std::move(q->tasks_[priority].front());
+			q->tasks_[priority].pop_front();
+			cursor_ = index + 1;
+			*queue = q;
+			return true;
+		}
+
+		return false;
+	}
+
+	bool BlockingPool::next(Task& task, Queue *&queue)
+	{
+		// a priority passed over kAging times gets the next thread, so a
+		// busy high queue cannot starve the logger for good
+		for (int priority = kPriorityCount - 1; priority > 0; priority--)
+		{
+			if (skipped_[priority] >= kAging && take(priority, &task, &queue))
+			{
+				skipped_[priority] = 0;
+				return true;
+			}
+		}
+
+		// highest priority first
+		for (int priority = 0; priority < kPriorityCount; priority++)
+		{
+			if (!take(priority, &task, &queue))
+				continue;
+
+			skipped_[priority] = 0;
+
+			for (int lower = priority + 1; lower < kPriorityCount; lower++)
+			{
+				if (take(lower, nullptr, nullptr))
+					skipped_[lower]++;
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	void BlockingPool::worker()
+	{
+		ThreadRoles::enter("pool");
+
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		for (;;)
+		{
+			Task task;
+			Queue *queue = nullptr;
+
+			// once stopped, only after everything queued has run
+			while (!next(task, queue))
+			{
+				if (stopped_)
+					return;
+
+				cond_.wait(lock);
+			}
+
+			queue->running_++;
+
+			// null when the last QueuePtr is already going away
+			QueuePtr hold = queue->self_.lock();
+
+			lock.unlock();
+
+			current_queue = queue;
+			task();
+			task = nullptr;
+			current_queue = nullptr;
+
+			lock.lock();
+
+			queue->running_--;
+			queue->completed_++;
+
+			if (queue->closed_)
+				idle_.notify_all();
+
+			// the slot we held may be what another task was waiting for
+			cond_.notify_one();
+
+			if (hold)
+			{
+				// the destructor takes the lock
+				lock.unlock();
+				hold.reset();
+				lock.lock();
+			}
+		}
+	}
+}
@@ -0,0 +1,148 @@
+#ifndef TENGINE_BLOCKING_POOL_HPP
+#define TENGINE_BLOCKING_POOL_HPP
+
+#include "allocator.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tengine
+{
+	// one set of threads for every blocking call in the process: database
+	// drivers, http requests, log files. each subsystem gets a queue with a
+	// priority and a concurrency limit, so a flood of slow queries can take
+	// at most its own share of the threads. tasks of one queue start in fifo
+	// order; a queue with limit 1 is a strand. higher priorities go first,
+	// but a lower one that has been passed over kAging times runs next.
+	class BlockingPool : public Allocator
+	{
+	public:
+		enum Priority
+		{
+			kHigh = 0,
+			kNormal,
+			kLow,
+			kPriorityCount,
+		};
+
+		enum { kAging = 8 };
+
+		typedef std::function<void()> Task;
+
+		class Queue : public Allocator
+		{
+		public:
+			Queue(BlockingPool& pool, const char *name, std::size_t limit, Priority priority);
+
+			Queue(const Queue&) = delete;
+
+			Queue& operator=(const Queue&) = delete;
+
+			~Queue();
+
+			// false once the queue is closed; after the pool stopped the task
+			// runs on the calling thread
+			bool post(Task task);
+
+			bool post(Priority priority, Task task);
+
+			// wait for running tasks, then run whatever has not started on
+			// the calling thread. from a task of this queue only the other
+			// running tasks are waited for
+			void close();
+
+		private:
+			friend class BlockingPool;
+
+			BlockingPool& pool_;
+
+			// a worker holds the queue while running one of its tasks, so
+			// the last QueuePtr released inside a task frees it after
+			std::weak_ptr<Queue> self_;
+
+			std::string name_;
+
+			std::size_t limit_;
+
+			Priority priority_;
+
+			std::deque<Task> tasks_[kPriorityCount];
+
+			std::size_t running_;
+
+			uint64_t completed_;
+
+			bool closed_;
+		};
+
+		typedef std::shared_ptr<Queue> QueuePtr;
+
+		// per subsystem, queues of the same name are summed
+		struct Stats
+		{
+			std::string name;
+			std::size_t queues;
+			std::size_t queued;
+			std::size_t running;
+			std::size_t limit;
+			uint64_t completed;
+		};
+
+		BlockingPool();
+
+		BlockingPool(const BlockingPool&) = delete;
+
+		BlockingPool& operator=(const BlockingPool&) = delete;
+
+		~BlockingPool();
+
+		void run(std::size_t num_threads);
+
+		// workers finish every queued task before they return
+		void stop();
+
+		void join();
+
+		std::size_t size() const { return threads_.size(); }
+
+		QueuePtr queue(const char *name, std::size_t limit, Priority priority = kNormal);
+
+		std::vector<Stats> stats();
+
+	private:
+		void worker();
+
+		// the next runnable task of a priority; with task null only
+		// whether there is one
+		bool take(int priority, Task *task, Queue **queue);
+
+		bool next(Task& task, Queue *&queue);
+
+		void remove(Queue *queue);
+
+		std::mutex mutex_;
+
+		std::condition_variable cond_;
+
+		std::condition_variable idle_;
+
+		std::vector<Queue*> queues_;
+
+		std::size_t cursor_;
+
+		int skipped_[kPriorityCount];
+
+		bool stopped_;
+
+		std::vector<std::thread> threads_;
+	};
+}
+
+#endif
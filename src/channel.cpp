@@ -4,6 +4,8 @@
 #include "service.hpp"
 #include "executor.hpp"
 #include "dispatch.hpp"
+#include "resolver.hpp"
+#include "affinity.hpp"
 
 #include "asio/ts/executor.hpp"
 
@@ -19,15 +21,26 @@ namespace tengine
 		, socket_(io_service_)
 		, address_()
 		, port_()
+		, timer_(io_service_)
+		, connect_timeout_(s->context().config("channel.connect_timeout", 5000))
+		, reconnect_attempts_(s->context().config("channel.reconnect_attempts", 0))
+		, reconnect_delay_(s->context().config("channel.reconnect_delay", 200))
+		, reconnect_max_delay_(s->context().config("channel.reconnect_max_delay", 10000))
+		, attempts_(0)
 		, read_message_()
 		, write_messages_()
+		, uring_(s->context().uring())
+		, uring_socket_()
+		, reader_()
+		, closed_(false)
 	{
 
 	}
 
 	Channel::~Channel()
 	{
-		close();
+		// nothing is in flight any more, every handler holds a reference
+		close_socket();
 	}
 
 	void Channel::connect(const char *address, const char *port)
@@ -35,19 +48,36 @@ namespace tengine
 		this->address_.assign(address);
 		this->port_.assign(port);
 
-		asio::ip::tcp::resolver resolver(io_service_);
-		auto endpoint_iterator = resolver.resolve({ address_, port_ });
-		do_connect(endpoint_iterator);
+		auto self(this->shared_from_this());
+
+		// after any close posted before us
+		asio::post(io_service_,
+			[this, self]()
+		{
+			closed_ = false;
+			attempts_ = 0;
+			do_resolve();
+		});
 	}
 
 	void Channel::async_connect(const char *address, const char *port)
 	{
-		this->address_.assign(address);
-		this->port_.assign(port);
+		connect(address, port);
+	}
+
+	void Channel::connect_timeout(int milliseconds)
+	{
+		connect_timeout_ = milliseconds;
+	}
 
-		asio::ip::tcp::resolver resolver(io_service_);
-		auto endpoint_iterator = resolver.resolve({ address_, port_ });
-		do_connect(endpoint_iterator);
+	void Channel::reconnect(int attempts, int delay, int max_delay)
+	{
+		if (attempts >= 0)
+			reconnect_attempts_ = attempts;
+		if (delay >= 0)
+			reconnect_delay_ = delay;
+		if (max_delay >= 0)
+			reconnect_max_delay_ = max_delay;
 	}
 
 	void Channel::write(const char *data, size_t size)
@@ -61,9 +91,20 @@ namespace tengine
 
 	void Channel::write(const Message& message)
 	{
+		auto self(this->shared_from_this());
+
 		asio::post(io_service_,
-			[this, message]()
+			[this, self, message]()
 		{
+			if (closed_)
+				return;
+
+			if (uring_socket_)
+			{
+				uring_->send(uring_socket_, message.data(), message.length());
+				return;
+			}
+
 			bool write_in_progress = !write_messages_.empty();
 			write_messages_.push_back(message);
 			if (!write_in_progress)
@@ -74,37 +115,164 @@ namespace tengine
 	}
 
 	void Channel::close()
+	{
+		if (closed_.exchange(true))
+			return;
+
+		auto self(this->shared_from_this());
+
+		asio::post(io_service_,
+			[this, self]()
+		{
+			do_close();
+		});
+	}
+
+	bool Channel::is_open()
+	{
+		return !closed_ && socket_.is_open();
+	}
+
+	void Channel::do_close()
+	{
+		closed_ = true;
+
+		if (!uring_socket_)
+		{
+			close_socket();
+			return;
+		}
+
+		// the fd number stays ours until the recv has completed for the last
+		// time, closing it earlier could let a queued send reach a reused fd
+		asio::error_code ignored_ec;
+		socket_.shutdown(asio::socket_base::shutdown_both, ignored_ec);
+
+		uring_->close(uring_socket_);
+		uring_socket_.reset();
+	}
+
+	void Channel::close_socket()
 	{
 		if (!socket_.is_open())
 			return;
 
 		asio::error_code ignored_ec;
-		socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+		socket_.shutdown(asio::socket_base::shutdown_both, ignored_ec);
 		socket_.close(ignored_ec);
 	}
 
-	bool Channel::is_open()
+	void Channel::do_resolve()
 	{
-		return socket_.is_open();
+		std::string path;
+		if (unix_address(address_, path))
+		{
+			Endpoints endpoints(1);
+			if (!unix_endpoint(path, endpoints[0]))
+			{
+				do_reconnect(asio::error::address_family_not_supported);
+				return;
+			}
+
+			do_connect(endpoints);
+			return;
+		}
+
+		auto self(this->shared_from_this());
+
+		host_->context().resolver().async_resolve(address_,
+			[this, self](const asio::error_code& ec,
+				const Resolver::Addresses& addresses)
+		{
+			if (ec)
+			{
+				do_reconnect(ec);
+				return;
+			}
+
+			uint16_t port = (uint16_t)std::atoi(port_.c_str());
+
+			Endpoints endpoints;
+			for (auto& address : addresses)
+			{
+				endpoints.push_back(asio::ip::tcp::endpoint(address, port));
+			}
+
+			do_connect(endpoints);
+		});
 	}
 
-	void Channel::do_connect(
-		const asio::ip::tcp::resolver::iterator& endpoint_iterator)
+	void Channel::do_connect(const Endpoints& endpoints)
 	{
 		auto self(this->shared_from_this());
 
-		asio::async_connect(socket_, endpoint_iterator,
-			[this, self](std::error_code ec, asio::ip::tcp::resolver::iterator)
+		auto holder = std::make_shared<Endpoints>(endpoints);
+		auto timed_out = std::make_shared<bool>(false);
+
+		if (connect_timeout_ > 0)
+		{
+			timer_.expires_from_now(std::chrono::milliseconds(connect_timeout_));
+			timer_.async_wait(
+				[this, self, timed_out](const asio::error_code& ec)
+			{
+				if (!ec)
+				{
+					*timed_out = true;
+
+					asio::error_code ignored_ec;
+					socket_.close(ignored_ec);
+				}
+			});
+		}
+
+		asio::async_connect(socket_, holder->begin(), holder->end(),
+			[this, self, holder, timed_out](std::error_code ec, Endpoints::iterator)
 		{
+			timer_.cancel();
+
 			if (!ec)
 			{
+				attempts_ = 0;
+
 				asyncNotifyConnected();
 
-				do_read_header();
+				if (uring_)
+					do_uring_read();
+				else
+					do_read_header();
 			}
 			else
 			{
-				asyncNotifyClosed(ec.message().c_str());
+				do_reconnect(*timed_out ? asio::error::timed_out : ec);
+			}
+		});
+	}
+
+	void Channel::do_reconnect(const asio::error_code& ec)
+	{
+		if (closed_ || attempts_ >= reconnect_attempts_)
+		{
+			asyncNotifyClosed(ec.message().c_str());
+			return;
+		}
+
+		// exponential backoff: delay, 2*delay, 4*delay ... capped at max_delay
+		int shift = attempts_ < 16 ? attempts_ : 16;
+		int64_t delay = (int64_t)reconnect_delay_ << shift;
+		if (delay > reconnect_max_delay_)
+			delay = reconnect_max_delay_;
+
+		attempts_++;
+
+		auto self(this->shared_from_this());
+
+		timer_.expires_from_now(std::chrono::milliseconds(delay));
+		timer_.async_wait(
+			[this, self](const asio::error_code& ec)
+		{
+			if (!ec)
+			{
+				do_resolve();
 			}
 		});
 	}
@@ -124,7 +292,7 @@ namespace tengine
 			}
 			else
 			{
-				close();
+				do_close();
 				asyncNotifyClosed(ec.message().c_str());
 			}
 		}));
@@ -146,13 +314,53 @@ namespace tengine
 			}
 			else
 			{
-				//socket_.close();
-				close();
+				do_close();
 				asyncNotifyClosed(ec.message().c_str());
 			}
 		});
 	}
 
+	void Channel::do_uring_read()
+	{
+		auto self(this->shared_from_this());
+
+		reader_ = MessageReader();
+		uring_socket_ = uring_->attach(socket_.native_handle());
+
+		uring_->recv(uring_socket_,
+			[this, self](const char *data, std::size_t size, const asio::error_code& ec)
+		{
+			if (size > 0)
+			{
+				if (closed_)
+					return;
+
+				bool ok = reader_.feed(data, size,
+					[this](const char *body, std::size_t length)
+				{
+					asyncNotifyRead(body, length);
+				});
+
+				// cancels this recv, whose final completion lands below
+				if (!ok)
+					do_close();
+				return;
+			}
+
+			// the last completion of the recv, only now the fd may go
+			if (uring_socket_)
+			{
+				uring_->close(uring_socket_);
+				uring_socket_.reset();
+			}
+
+			closed_ = true;
+			close_socket();
+			asyncNotifyClosed(ec ? ec.message().c_str()
+				: asio::error_code(asio::error::eof).message().c_str());
+		});
+	}
+
 	void Channel::do_write()
 	{
 		auto self(this->shared_from_this());
@@ -172,7 +380,7 @@ namespace tengine
 			}
 			else
 			{
-				socket_.close();
+				do_close();
 				asyncNotifyClosed(ec.message().c_str());
 			}
 		});
@@ -199,11 +407,15 @@ namespace tengine
 
 	void Channel::asyncNotifyClosed(const char *error)
 	{
-		const char *tmp = (char*)ccmalloc(strlen(error));
+		std::size_t size = strlen(error);
+		char *tmp = (char*)ccmalloc(size + 1);
 		if (tmp)
 		{
+			memcpy(tmp, error, size);
+			tmp[size] = '\0';
+
 			dispatch<MessageType::kMessageChannelClosed, SandBox>(
-				host(), host(), (void*)this, tmp);
+				host(), host(), (void*)this, (const char*)tmp);
 		}
 	}
 
@@ -216,17 +428,23 @@ namespace tengine
 		: ServiceProxy(s)
 		, io_service_(s->context().net_executor().io_service())
 		, socket_(io_service_, asio::ip::udp::endpoint(asio::ip::udp::v4(), 0))
+		, address_(address)
+		, port_(port)
+		, timer_(io_service_)
+		, reconnect_delay_(s->context().config("channel.reconnect_delay", 200))
+		, reconnect_max_delay_(s->context().config("channel.reconnect_max_delay", 10000))
+		, attempts_(0)
 		, endpoint_()
+		, resolved_(false)
+		, closed_(false)
 		, message_holder_()
+		, receiver_(socket_,
+			s->context().config("udp.ring", 4),
+			s->context().config("udp.batch", 32),
+			s->context().config("udp.max_datagram", 2048))
+		, sender_(socket_)
 	{
-		asio::ip::udp::resolver resolver(io_service_);
-		asio::ip::udp::resolver::query query(
-			asio::ip::udp::v4(), address, port);
-		asio::ip::udp::resolver::iterator itr = resolver.resolve(query);
 
-		endpoint_ = *itr;
-
-		do_receive();
 	}
 
 	UdpChannel::~UdpChannel()
@@ -234,100 +452,157 @@ namespace tengine
 		close();
 	}
 
-	void UdpChannel::do_receive()
+	int UdpChannel::start()
 	{
-		socket_.async_receive(asio::null_buffers(),
-			[this](const asio::error_code& error, unsigned int)
+		std::weak_ptr<UdpChannel> weak(this->shared_from_this());
+
+		asio::post(io_service_, [weak]()
+		{
+			if (auto self = weak.lock())
+				self->do_resolve();
+		});
+
+		receiver_.start(
+			[this](const DatagramBatchPtr& batch)
 		{
-			if (error)
+			dispatch<MessageType::kMessageUdpChannelRead, SandBox>(
+				host(), host(), (void*)this, batch);
+		});
+
+		return 0;
+	}
+
+	// on the network thread; a lookup in flight does not keep us alive
+	void UdpChannel::do_resolve()
+	{
+		if (closed_)
+			return;
+
+		std::weak_ptr<UdpChannel> weak(this->shared_from_this());
+
+		host_->context().resolver().async_resolve(address_,
+			[weak](const asio::error_code& ec,
+				const Resolver::Addresses& addresses)
+		{
+			auto self = weak.lock();
+			if (!self || self->closed_)
+				return;
+
+			if (ec)
 			{
-				std::cerr << error.message() << std::endl;
+				self->do_retry(ec);
+				return;
 			}
-			else
+
+			uint16_t port = (uint16_t)std::atoi(self->port_.c_str());
+
+			for (auto& address : addresses)
 			{
-				size_t bytes_available = socket_.available();
-
-				auto receive_buffer =
-					std::make_shared<std::vector<char>>(bytes_available);
-				auto sender_endpoint =
-					std::make_shared<asio::ip::udp::endpoint>();
-
-				socket_.async_receive_from(
-					asio::buffer(receive_buffer->data(),
-						receive_buffer->size()), *sender_endpoint,
-					[this, receive_buffer, sender_endpoint]
-				(const asio::error_code& error, size_t bytes_recvd)
+				if (address.is_v4())
 				{
-					if (error)
-					{
-						std::cerr << error.message() << std::endl;
-					}
-					else
-					{
-						//this->handle_message({ receive_buffer->data(), receive_buffer->data() + bytes_recvd }, *sender_endpoint);
-						//std::string message = { receive_buffer->data(), receive_buffer->data() + bytes_recvd };
+					self->endpoint_ = asio::ip::udp::endpoint(address, port);
+					self->resolved_ = true;
+					break;
+				}
+			}
 
-						const std::string& address =
-							sender_endpoint->address().to_string();
-						uint16_t port = sender_endpoint->port();
+			if (!self->resolved_)
+			{
+				self->do_retry(asio::error::host_not_found);
+				return;
+			}
 
-						dispatch<MessageType::kMessageUdpChannelRead, SandBox>(
-							host(), host(), (void*)this, address, port,
-							(const char*)receive_buffer->data(), bytes_recvd);
+			self->attempts_ = 0;
 
-						do_receive();
-					}
-				});
+			for (auto& message : self->message_holder_)
+			{
+				self->sender_.async_send(message.data.data(), message.data.size(), self->endpoint_);
 			}
+
+			self->message_holder_.clear();
 		});
 	}
 
-	int UdpChannel::send_to(const char* data, std::size_t size)
+	void UdpChannel::do_retry(const asio::error_code& ec)
 	{
-		return send_to({data, size});
-	}
+		message_holder_.clear();
+		asyncNotifyError(ec.message().c_str());
 
-	int UdpChannel::send_to(const std::string& data)
-	{
-		return socket_.send_to(asio::buffer(data), endpoint_);
+		// the same backoff as a channel reconnecting, but without an end:
+		// a datagram peer has no connection to give up on
+		int shift = attempts_ < 16 ? attempts_ : 16;
+		int64_t delay = (int64_t)reconnect_delay_ << shift;
+		if (delay > reconnect_max_delay_)
+			delay = reconnect_max_delay_;
+
+		attempts_++;
+
+		std::weak_ptr<UdpChannel> weak(this->shared_from_this());
+
+		timer_.expires_from_now(std::chrono::milliseconds(delay));
+		timer_.async_wait(
+			[weak](const asio::error_code& ec)
+		{
+			auto self = weak.lock();
+			if (!ec && self)
+				self->do_resolve();
+		});
 	}
 
-	void UdpChannel::do_write()
+	void UdpChannel::asyncNotifyError(const char *error)
 	{
-		if (!message_holder_.empty())
+		std::size_t size = strlen(error);
+		char *tmp = (char*)ccmalloc(size + 1);
+		if (tmp)
 		{
-			socket_.async_send_to(
-				asio::buffer(message_holder_.front().data), endpoint_,
-				[this](const asio::error_code& error,
-					std::size_t bytes_transferred)
-				{
-					if (!error)
-					{
-						message_holder_.pop_front();
+			memcpy(tmp, error, size);
+			tmp[size] = '\0';
 
-						do_receive();
+			dispatch<MessageType::kMessageUdpChannelError, SandBox>(
+				host(), host(), (void*)this, (const char*)tmp);
+		}
+	}
 
-						do_write();
-					}
+	int UdpChannel::send_to(const char* data, std::size_t size)
+	{
+		return send_to({data, size});
+	}
 
-				}
-			);
-		}
+	int UdpChannel::send_to(const std::string& data)
+	{
+		if (!resolved_)
+			return -1;
+
+		return (int)socket_.send_to(asio::buffer(data), endpoint_);
 	}
 
 	void UdpChannel::do_write(const MessageData& data)
 	{
-		message_holder_.push_back(data);
-		do_write();
+		if (resolved_)
+			sender_.async_send(data.data.data(), data.data.size(), endpoint_);
+		else
+			message_holder_.push_back(data);
 	}
 
 	int UdpChannel::async_send_to(const char* data, std::size_t size)
 	{
+		if (resolved_)
+		{
+			sender_.async_send(data, size, endpoint_);
+			return 0;
+		}
+
 		return async_send_to({ data, size });
 	}
 
 	int UdpChannel::async_send_to(const std::string& data)
 	{
+		if (resolved_)
+		{
+			sender_.async_send(data.data(), data.size(), endpoint_);
+			return 0;
+		}
+
 		io_service_.post([=]
 		{
 			do_write({ data });
@@ -338,7 +613,10 @@ namespace tengine
 
 	void UdpChannel::close()
 	{
-		socket_.close();
+		closed_ = true;
+
+		asio::error_code ignored_ec;
+		socket_.close(ignored_ec);
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -348,9 +626,18 @@ namespace tengine
 		: ServiceProxy(s)
 		, io_service_(s->context().net_executor().io_service())
 		, socket_(io_service_, asio::ip::udp::endpoint(asio::ip::udp::v4(), 0))
-		, message_holder_()
-	{
-		do_receive();
+		, receiver_(socket_,
+			s->context().config("udp.ring", 4),
+			s->context().config("udp.batch", 32),
+			s->context().config("udp.max_datagram", 2048))
+		, sender_(socket_)
+	{
+		receiver_.start(
+			[this](const DatagramBatchPtr& batch)
+		{
+			dispatch<MessageType::kMessageUdpSenderRead, SandBox>(
+				host(), host(), (void*)this, batch);
+		});
 	}
 
 	UdpSender::~UdpSender()
@@ -358,54 +645,6 @@ namespace tengine
 		close();
 	}
 
-	void UdpSender::do_receive()
-	{
-		socket_.async_receive(asio::null_buffers(),
-			[this](const asio::error_code& error, unsigned int)
-		{
-			if (error)
-			{
-				std::cerr << error.message() << std::endl;
-			}
-			else
-			{
-				size_t bytes_available = socket_.available();
-
-				auto receive_buffer =
-					std::make_shared<std::vector<char>>(bytes_available);
-				auto sender_endpoint =
-					std::make_shared<asio::ip::udp::endpoint>();
-
-				socket_.async_receive_from(
-					asio::buffer(receive_buffer->data(),
-					receive_buffer->size()), *sender_endpoint,
-					[this, receive_buffer, sender_endpoint]
-				(const asio::error_code& error, size_t bytes_recvd)
-				{
-					if (error)
-					{
-						std::cerr << error.message() << std::endl;
-					}
-					else
-					{
-						//this->handle_message({ receive_buffer->data(), receive_buffer->data() + bytes_recvd }, *sender_endpoint);
-						//std::string message = { receive_buffer->data(), receive_buffer->data() + bytes_recvd };
-
-						const std::string& address =
-							sender_endpoint->address().to_string();
-						uint16_t port = sender_endpoint->port();
-
-						dispatch<MessageType::kMessageUdpSenderRead, SandBox>(
-							host(), host(), (void*)this, address, port,
-							(const char*)receive_buffer->data(), bytes_recvd);
-
-						do_receive();
-					}
-				});
-			}
-		});
-	}
-
 	int UdpSender::send_to(const char* data, std::size_t size,
 		const std::string& address, uint16_t port)
 	{
@@ -421,57 +660,244 @@ namespace tengine
 		return socket_.send_to(asio::buffer(data), endpoint);
 	}
 
-	void UdpSender::do_write()
+	int UdpSender::async_send_to(const char* data, std::size_t size,
+		const std::string& address, uint16_t port)
+	{
+		asio::error_code ec;
+		asio::ip::address ip = asio::ip::address::from_string(address, ec);
+		if (ec)
+			return -1;
+
+		sender_.async_send(data, size, { ip, port });
+
+		return 0;
+	}
+
+	int UdpSender::async_send_to(
+		const std::string& data, asio::ip::udp::endpoint& endpoint)
+	{
+		sender_.async_send(data.data(), data.size(), endpoint);
+
+		return 0;
+	}
+
+	void UdpSender::close()
 	{
-		if (!message_holder_.empty())
+		socket_.close();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+
+	constexpr int ShmChannel::SHMCHANNEL_KEY;
+
+	ShmChannel::ShmChannel(Service *s)
+		: ServiceProxy(s)
+		, io_service_(s->context().net_executor().io_service())
+		, segment_()
+		, size_(s->context().config("shm.size", 4 * 1024 * 1024))
+		, connect_timeout_(s->context().config("channel.connect_timeout", 5000))
+		, thread_()
+		, closing_(false)
+		, closed_(true)
+		, lock_()
+		, pending_()
+		, flushing_(false)
+		, timer_(io_service_)
+	{
+
+	}
+
+	ShmChannel::~ShmChannel()
+	{
+		close();
+	}
+
+	void ShmChannel::connect(const char *name, std::size_t size)
+	{
+		if (size > 0)
+			size_ = size;
+
+		std::string error;
+		if (!segment_.open(name, size_, error))
 		{
-			socket_.async_send_to(
-				asio::buffer(message_holder_.front().data),
-					message_holder_.front().endpoint,
-				[this](const asio::error_code& error, std::size_t bytes_transferred)
+			asyncNotifyClosed(error.c_str());
+			return;
+		}
+
+		closed_ = false;
+
+		thread_ = std::thread(
+			[this]()
+		{
+			ThreadRoles::enter("shm");
+
+			run();
+		});
+	}
+
+	void ShmChannel::connect_timeout(int milliseconds)
+	{
+		connect_timeout_ = milliseconds;
+	}
+
+	bool ShmChannel::write(const char *data, std::size_t size)
+	{
+		SpinHolder holder(lock_);
+
+		if (closed_ || size + 4 > segment_.max_message())
+			return false;
+
+		// keep ordering: once something is pending everything queues behind it
+		if (pending_.empty() && segment_.push(data, size))
+			return true;
+
+		pending_.emplace_back(data, size);
+
+		if (!flushing_)
+		{
+			flushing_ = true;
+
+			auto self(this->shared_from_this());
+
+			asio::post(io_service_,
+				[this, self]()
 			{
-				if (!error)
-				{
-					message_holder_.pop_front();
+				do_flush();
+			});
+		}
 
-					do_receive();
+		return true;
+	}
 
-					do_write();
-				}
+	void ShmChannel::close()
+	{
+		if (closing_.exchange(true))
+			return;
 
-			}
-			);
+		{
+			SpinHolder holder(lock_);
+			closed_ = true;
+			pending_.clear();
 		}
+
+		segment_.wake();
+
+		if (thread_.joinable())
+			thread_.join();
+
+		segment_.close();
 	}
 
-	void UdpSender::do_write(const MessageData& data)
+	bool ShmChannel::is_open()
 	{
-		message_holder_.push_back(data);
-		do_write();
+		return !closed_;
 	}
 
-	int UdpSender::async_send_to(const char* data, std::size_t size,
-		const std::string& address, uint16_t port)
+	void ShmChannel::run()
 	{
-		asio::ip::udp::endpoint endpoint =
-		{ asio::ip::address::from_string(address), port };
+		auto deadline = std::chrono::steady_clock::now()
+			+ std::chrono::milliseconds(connect_timeout_);
+
+		bool connected = false;
+
+		while (!closing_)
+		{
+			if (!connected)
+			{
+				if (!segment_.peer_attached())
+				{
+					if (connect_timeout_ > 0 && std::chrono::steady_clock::now() >= deadline)
+					{
+						closed_ = true;
+						asyncNotifyClosed(asio::error_code(asio::error::timed_out).message().c_str());
+						return;
+					}
+
+					segment_.wait(100);
+					continue;
+				}
+
+				connected = true;
+				asyncNotifyConnected();
+			}
+
+			char *data;
+			std::size_t size;
+
+			if (segment_.pop(data, size))
+			{
+				asyncNotifyRead(data, size);
+				continue;
+			}
 
-		return async_send_to({ data, size }, endpoint);
+			// only checked when idle, so a peer's last messages are delivered first
+			if (!segment_.peer_attached())
+			{
+				closed_ = true;
+				asyncNotifyClosed("peer closed");
+				return;
+			}
+
+			segment_.wait(100);
+		}
 	}
 
-	int UdpSender::async_send_to(
-		const std::string& data, asio::ip::udp::endpoint& endpoint)
+	void ShmChannel::do_flush()
 	{
-		io_service_.post([=]
 		{
-			do_write({ data, endpoint });
+			SpinHolder holder(lock_);
+
+			while (!closed_ && !pending_.empty())
+			{
+				const std::string& message = pending_.front();
+				if (!segment_.push(message.data(), message.size()))
+					break;
+
+				pending_.pop_front();
+			}
+
+			if (closed_ || pending_.empty())
+			{
+				flushing_ = false;
+				return;
+			}
+		}
+
+		// the peer is behind, retry shortly
+		auto self(this->shared_from_this());
+
+		timer_.expires_from_now(std::chrono::milliseconds(1));
+		timer_.async_wait(
+			[this, self](const asio::error_code& ec)
+		{
+			if (!ec)
+				do_flush();
 		});
+	}
 
-		return 0;
+	void ShmChannel::asyncNotifyConnected()
+	{
+		dispatch<MessageType::kMessageShmChannelConnected, SandBox>(
+			host(), host(), (void*)this);
 	}
 
-	void UdpSender::close()
+	void ShmChannel::asyncNotifyRead(const char *data, std::size_t size)
 	{
-		socket_.close();
+		dispatch<MessageType::kMessageShmChannelRead, SandBox>(
+			host(), host(), (void*)this, data, size);
+	}
+
+	void ShmChannel::asyncNotifyClosed(const char *error)
+	{
+		std::size_t size = strlen(error);
+		char *tmp = (char*)ccmalloc(size + 1);
+		if (tmp)
+		{
+			memcpy(tmp, error, size);
+			tmp[size] = '\0';
+
+			dispatch<MessageType::kMessageShmChannelClosed, SandBox>(
+				host(), host(), (void*)this, (const char*)tmp);
+		}
 	}
 }
@@ -6,10 +6,18 @@
 #include "message.hpp"
 #include "service_proxy.hpp"
 #include "allocator.hpp"
+#include "datagram.hpp"
+#include "stream.hpp"
+#include "shm.hpp"
+#include "spin_lock.hpp"
+#include "uring.hpp"
 
+#include <atomic>
 #include <string>
 #include <deque>
 #include <memory>
+#include <thread>
+#include <vector>
 
 namespace tengine
 {
@@ -30,10 +38,16 @@ namespace tengine
 
 		~Channel();
 
+		// address is a host name/ip, or "unix:/path" with port ignored
 		void connect(const char *address, const char *port);
 
 		void async_connect(const char *address, const char *port);
 
+		void connect_timeout(int milliseconds);
+
+		// a negative value keeps the one from the channel config section
+		void reconnect(int attempts, int delay, int max_delay);
+
 		void write(const char *data, size_t size);
 
 		void write(const Message& message);
@@ -43,15 +57,27 @@ namespace tengine
 		bool is_open();
 
 	private:
-		void do_connect(
-			const asio::ip::tcp::resolver::iterator& endpoint_iterator);
+		typedef std::vector<StreamEndpoint> Endpoints;
+
+		void do_resolve();
+
+		void do_connect(const Endpoints& endpoints);
+
+		void do_reconnect(const asio::error_code& ec);
 
 		void do_read_header();
 
 		void do_read_body();
 
+		void do_uring_read();
+
 		void do_write();
 
+		// on the network thread
+		void do_close();
+
+		void close_socket();
+
 		void asyncNotifyConnected();
 
 		void asyncNotifyRead(const char *data, std::size_t size);
@@ -60,17 +86,38 @@ namespace tengine
 
 		asio::io_service& io_service_;
 
-		asio::ip::tcp::socket socket_;
+		StreamSocket socket_;
 
 		std::string address_;
 
 		std::string port_;
 
+		asio::steady_timer timer_;
+
+		int connect_timeout_;
+
+		int reconnect_attempts_;
+
+		int reconnect_delay_;
+
+		int reconnect_max_delay_;
+
+		int attempts_;
+
 		Message read_message_;
 
 		MessageDeque write_messages_;
 
 		HandlerAllocator allocator_;
+
+		// set while a connected socket is driven by the io_uring engine
+		UringEngine *uring_;
+
+		UringEngine::SocketPtr uring_socket_;
+
+		MessageReader reader_;
+
+		std::atomic<bool> closed_;
 	};
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -92,6 +139,10 @@ namespace tengine
 
 		~UdpChannel();
 
+		// resolves the peer and starts receiving, once a shared_ptr owns us
+		virtual int start();
+
+		// -1 while the peer address is unknown
 		int send_to(const char* data, std::size_t size);
 
 		int send_to(const std::string& data);
@@ -108,19 +159,44 @@ namespace tengine
 			std::string data;
 		};
 
-		void do_write();
+		void do_resolve();
+
+		// reports the failure and tries again after the channel backoff
+		void do_retry(const asio::error_code& ec);
 
 		void do_write(const MessageData& data);
 
-		void do_receive();
+		void asyncNotifyError(const char *error);
 
 		asio::io_service& io_service_;
 
 		asio::ip::udp::socket socket_;
 
+		std::string address_;
+
+		std::string port_;
+
+		asio::steady_timer timer_;
+
+		int reconnect_delay_;
+
+		int reconnect_max_delay_;
+
+		int attempts_;
+
 		asio::ip::udp::endpoint endpoint_;
 
+		std::atomic<bool> resolved_;
+
+		std::atomic<bool> closed_;
+
+		// sends issued before the peer address is resolved, dropped when a
+		// lookup fails
 		std::deque<MessageData> message_holder_;
+
+		DatagramReceiver receiver_;
+
+		DatagramSender sender_;
 	};
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -154,24 +230,82 @@ namespace tengine
 		void close();
 
 	private:
-		struct MessageData {
-			std::string data;
-			asio::ip::udp::endpoint endpoint;
-		};
+		asio::io_service& io_service_;
 
-		void do_write();
+		asio::ip::udp::socket socket_;
 
-		void do_write(const MessageData& data);
+		DatagramReceiver receiver_;
+
+		DatagramSender sender_;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	class ShmChannel;
+
+	typedef std::shared_ptr<ShmChannel> ShmChannelPtr;
+
+	// a channel to a process on the same host over a shared memory ring pair,
+	// both ends connect to the same name and see each other as the peer.
+	// a reader thread drains the inbound ring and hands every batch of
+	// messages to the sandbox in one message.
+	class ShmChannel :
+		public ServiceProxy, public std::enable_shared_from_this<ShmChannel>
+	{
+	public:
+
+		static constexpr int SHMCHANNEL_KEY = 0;
+
+		ShmChannel(Service *s);
+
+		~ShmChannel();
+
+		// size is the ring capacity per direction, 0 for shm.size
+		void connect(const char *name, std::size_t size);
+
+		// how long to wait for the peer to attach, 0 waits forever
+		void connect_timeout(int milliseconds);
+
+		// false if the message can never fit into the ring
+		bool write(const char *data, std::size_t size);
+
+		void close();
+
+		bool is_open();
 
-		void do_receive();
+	private:
+		void run();
+
+		void do_flush();
+
+		void asyncNotifyConnected();
+
+		void asyncNotifyRead(const char *data, std::size_t size);
+
+		void asyncNotifyClosed(const char *error);
 
 		asio::io_service& io_service_;
 
-		asio::ip::udp::socket socket_;
+		ShmSegment segment_;
 
-		std::deque<MessageData> message_holder_;
-	};
+		std::size_t size_;
+
+		int connect_timeout_;
+
+		std::thread thread_;
+
+		std::atomic<bool> closing_;
+
+		std::atomic<bool> closed_;
 
+		// messages that did not fit while the peer was behind
+		SpinLock lock_;
+
+		std::deque<std::string> pending_;
+
+		bool flushing_;
+
+		asio::steady_timer timer_;
+	};
 }
 
 #endif
@@ -7,9 +7,19 @@
 #include "network.hpp"
 #include "sandbox.hpp"
 #include "executor.hpp"
+#include "blocking_pool.hpp"
+#include "resolver.hpp"
+#include "uring.hpp"
+#include "affinity.hpp"
+#include "mysql_writer.hpp"
+#include "mysql_cache.hpp"
+#include "redis_cache.hpp"
+#include "redis_subscriber.hpp"
 
 #include "asio/ts/executor.hpp"
 
+#include <cstring>
+
 #ifdef LUA_JIT
 #include "c-api/compat-5.3.h"
 #else
@@ -27,10 +37,16 @@ namespace tengine
 
 			void operator()()
 			{
+				ThreadRoles::enter("worker");
+
 				asio::error_code ec;
 				io_service_->run(ec);
 			}
 		};
+
+		const char* const kThreadRoles[] = {
+			"worker", "net", "service", "pool", "web", "shm",
+		};
 	}
 
 	Context::Context()
@@ -51,6 +67,19 @@ namespace tengine
 		, service_lock_()
 		, conf_lock_()
 		, net_executor_(nullptr)
+		, blocking_pool_(nullptr)
+		, service_executor_(nullptr)
+		, resolver_(nullptr)
+		, uring_(nullptr)
+		, node_(nullptr)
+		, writer_lock_()
+		, mysql_writers_()
+		, cache_lock_()
+		, mysql_caches_()
+		, subscriber_lock_()
+		, redis_subscribers_()
+		, redis_cache_lock_()
+		, redis_caches_()
 	{
 		signals_.add(SIGINT);
 		signals_.add(SIGTERM);
@@ -72,11 +101,65 @@ namespace tengine
 
 		join();
 
+		if (service_executor_ != nullptr)
+			service_executor_->join();
+
+		// the pool keeps running while services go away, each one closes
+		// its queue first so no task outlives the object it works on
 		for (std::size_t i = 0; i < services_.size(); i++) {
 			delete services_[i];
 		}
 
 		services_.clear();
+		node_ = nullptr;
+
+		// last flush of pending writes, on this thread
+		for (auto& writer : mysql_writers_)
+			delete writer.second;
+
+		mysql_writers_.clear();
+
+		// after the writers, whose last flush still invalidates
+		for (auto& cache : mysql_caches_)
+			delete cache.second;
+
+		mysql_caches_.clear();
+
+		if (service_executor_ != nullptr)
+		{
+			delete service_executor_;
+			service_executor_ = nullptr;
+		}
+
+		if (blocking_pool_ != nullptr)
+		{
+			delete blocking_pool_;
+			blocking_pool_ = nullptr;
+		}
+
+		if (net_executor_ != nullptr)
+			net_executor_->join();
+
+		// their sockets belong to the net io_service, which stopped above
+		redis_subscribers_.clear();
+
+		// after the subscribers, which invalidate them
+		for (auto& cache : redis_caches_)
+			delete cache.second;
+
+		redis_caches_.clear();
+
+		if (resolver_ != nullptr)
+		{
+			delete resolver_;
+			resolver_ = nullptr;
+		}
+
+		if (uring_ != nullptr)
+		{
+			delete uring_;
+			uring_ = nullptr;
+		}
 
 		if (net_executor_ != nullptr)
 		{
@@ -119,12 +202,49 @@ namespace tengine
 		if (thread_num_ <= 0)
 			thread_num_ = asio::detail::thread::hardware_concurrency() * 2;
 
+		configure_threads();
+
 		ThreadFunction f = { &io_service_ };
 		threads_.create_threads(f, thread_num_ ? thread_num_ : 2);
 
-		net_executor_ = new Executor();
+		net_executor_ = new Executor("net");
+
+		// spinning on the only core starves the threads that post to us
+		int busy_poll = this->config("net.busy_poll", 0);
+		if (busy_poll > 0 && asio::detail::thread::hardware_concurrency() <= 1)
+		{
+			fprintf(stderr, "net.busy_poll needs more than one cpu, disabled\n");
+			busy_poll = 0;
+		}
+		net_executor_->busy_poll(busy_poll);
+
+		// sessions fall back to plain asio sockets when io_uring is unavailable
+		if (std::strcmp(this->config("net.engine", "asio"), "uring") == 0)
+		{
+			std::string error;
+			uring_ = UringEngine::create(net_executor_->io_service(),
+				this->config("net.uring_entries", 1024),
+				this->config("net.uring_buffers", 4096),
+				this->config("net.uring_buffer_size", 4096), error);
+
+			if (uring_ == nullptr)
+				fprintf(stderr, "io_uring unavailable (%s), using asio sockets\n", error.c_str());
+		}
+
 		net_executor_->run();
 
+		resolver_ = new Resolver(net_executor_->io_service(),
+			this->config("dns.ttl", 60), this->config("dns.negative_ttl", 5));
+
+		int pool_threads = this->config("pool.threads", 4);
+		blocking_pool_ = new BlockingPool();
+		blocking_pool_->run(pool_threads > 0 ? pool_threads : 1);
+
+		service_executor_ = new Executor("service");
+		service_executor_->run();
+
+		start_mysql_writers();
+
 		Logger *logger = new Logger(*this);
 		if (logger == nullptr)
 			return -1;
@@ -164,6 +284,8 @@ namespace tengine
 			delete node;
 			return -1;
 		}
+
+		node_ = node;
 		
 		HttpClient *network = new HttpClient(*this);
 		if (network == nullptr)
@@ -190,6 +312,191 @@ namespace tengine
 		return 0;
 	}
 
+	void Context::configure_threads()
+	{
+		char key[64];
+
+		// every role on one line, so an unpinned start still shows the mapping
+		std::string summary = "threads";
+
+		for (const char *role : kThreadRoles)
+		{
+			snprintf(key, sizeof(key), "threads.%s", role);
+
+			const char *value = this->config(key, "");
+
+			CpuSet cpus;
+			if (!parse_cpu_set(value, cpus))
+			{
+				fprintf(stderr, "invalid %s \"%s\", not pinning\n", key, value);
+				cpus.clear();
+			}
+
+			ThreadRoles::set(role, cpus);
+
+			summary += " ";
+			summary += role;
+			summary += "=";
+			summary += cpus.empty() ? "unpinned" : format_cpu_set(cpus);
+		}
+
+		fprintf(stdout, "%s\n", summary.c_str());
+	}
+
+	void Context::start_mysql_writers()
+	{
+		std::vector<std::string> sections;
+
+		{
+			SpinHolder holder(conf_lock_);
+			lua_State *L = config_;
+
+			// any global table can be a mysql section
+			lua_pushglobaltable(L);
+			lua_pushnil(L);
+			while (lua_next(L, -2) != 0)
+			{
+				if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1))
+				{
+					lua_getfield(L, -1, "write_behind");
+					if (lua_istable(L, -1))
+					{
+						lua_getfield(L, -1, "journal");
+						const char *journal = lua_tostring(L, -1);
+						if (journal != nullptr && *journal != '\0')
+							sections.push_back(lua_tostring(L, -4));
+						lua_pop(L, 1);
+					}
+					lua_pop(L, 1);
+				}
+				lua_pop(L, 1);
+			}
+			lua_pop(L, 1);
+		}
+
+		for (auto& section : sections)
+		{
+			if (mysql_writer(section.c_str()) == nullptr)
+				fprintf(stderr, "mysql write-behind of %s not started\n", section.c_str());
+		}
+	}
+
+	MySqlWriter *Context::mysql_writer(const char *conf)
+	{
+		std::lock_guard<std::mutex> lock(writer_lock_);
+
+		auto iter = mysql_writers_.find(conf);
+		if (iter != mysql_writers_.end())
+			return iter->second;
+
+		MySqlWriter::Options options;
+		MySqlWriter::load(*this, conf, options);
+
+		MySqlWriter *writer = new MySqlWriter(
+			service_executor_->io_service(), *blocking_pool_, options);
+
+		MySqlCache *cache = mysql_cache(conf);
+		if (cache->enabled())
+		{
+			writer->on_commit(
+				[cache](const std::vector<std::string>& tables)
+			{
+				cache->invalidate(tables);
+			});
+		}
+
+		if (writer->start() != 0)
+		{
+			delete writer;
+			return nullptr;
+		}
+
+		mysql_writers_[conf] = writer;
+
+		return writer;
+	}
+
+	MySqlCache *Context::mysql_cache(const char *conf)
+	{
+		std::lock_guard<std::mutex> lock(cache_lock_);
+
+		auto iter = mysql_caches_.find(conf);
+		if (iter != mysql_caches_.end())
+			return iter->second;
+
+		MySqlCache::Options options;
+		MySqlCache::load(*this, conf, options);
+
+		MySqlCache *cache = new MySqlCache(options);
+		mysql_caches_[conf] = cache;
+
+		return cache;
+	}
+
+	std::shared_ptr<RedisSubscriber> Context::redis_subscriber(const char *conf)
+	{
+#if !defined(_WIN32)
+		std::lock_guard<std::mutex> lock(subscriber_lock_);
+
+		auto iter = redis_subscribers_.find(conf);
+		if (iter != redis_subscribers_.end())
+			return iter->second;
+
+		RedisSubscriber::Options options;
+		RedisSubscriber::load(*this, conf, options);
+		if (options.server.host.empty())
+			return nullptr;
+
+		auto subscriber = std::make_shared<RedisSubscriber>(
+			net_executor_->io_service(), *resolver_, options);
+		redis_subscribers_[conf] = subscriber;
+
+		return subscriber;
+#else
+		return nullptr;
+#endif
+	}
+
+	RedisCache *Context::redis_cache(const char *conf)
+	{
+		std::lock_guard<std::mutex> lock(redis_cache_lock_);
+
+		auto iter = redis_caches_.find(conf);
+		if (iter != redis_caches_.end())
+			return iter->second;
+
+		RedisCache::Options options;
+		RedisCache::load(*this, conf, options);
+
+		// without a way to hear about writes nothing can be kept
+		std::shared_ptr<RedisSubscriber> subscriber;
+		if (options.capacity > 0 && !options.prefixes.empty())
+			subscriber = redis_subscriber(conf);
+		if (!subscriber)
+			options.capacity = 0;
+
+		RedisCache *cache = new RedisCache(options);
+		redis_caches_[conf] = cache;
+
+		if (cache->enabled())
+		{
+			std::vector<std::string> prefixes;
+			for (auto& prefix : cache->prefixes())
+				prefixes.push_back(prefix.prefix);
+
+			subscriber->track(prefixes,
+				[cache](const std::vector<std::string>& keys)
+			{
+				if (keys.empty())
+					cache->clear();
+				else
+					cache->invalidate(keys);
+			});
+		}
+
+		return cache;
+	}
+
 	asio::io_service& Context::io_service()
 	{
 		return io_service_;
@@ -211,6 +518,9 @@ namespace tengine
 
 		if (net_executor_)
 			net_executor_->stop();
+
+		if (service_executor_)
+			service_executor_->stop();
 	}
 
 	SandBox *Context::launch(const char *name, const char *args)
@@ -9,14 +9,25 @@
 
 #include <unordered_map>
 #include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
 
 struct lua_State;
 
 namespace tengine
 {
 	class Executor;
+	class BlockingPool;
+	class Resolver;
+	class UringEngine;
+	class Node;
 	class Service;
 	class SandBox;
+	class MySqlWriter;
+	class MySqlCache;
+	class RedisSubscriber;
+	class RedisCache;
 
 	class Context : public Allocator
 	{
@@ -60,7 +71,47 @@ namespace tengine
 
 		Executor &net_executor() { return *net_executor_; }
 
+		// every blocking call (database drivers, http, log files) goes
+		// through a bounded queue on this pool
+		BlockingPool &blocking_pool() { return *blocking_pool_; }
+
+		// one thread for timers and housekeeping services
+		Executor &service_executor() { return *service_executor_; }
+
+		Resolver &resolver() { return *resolver_; }
+
+		// null unless net.engine is "uring" and the kernel supports it
+		UringEngine *uring() { return uring_; }
+
+		// the node service, which routes messages to other nodes
+		Node *node() { return node_; }
+
+		// the write-behind queue of a mysql section, made at start for a
+		// section with a journal, else on first use; shared by every
+		// service, null if its journal can't be opened
+		MySqlWriter *mysql_writer(const char *conf);
+
+		// the query cache of a mysql section, made on first use and shared
+		// by every service; disabled unless [section].cache.capacity is set
+		MySqlCache *mysql_cache(const char *conf);
+
+		// the pub/sub connection of a redis section, made on first use and
+		// shared by every service; null where the async engine can't run
+		std::shared_ptr<RedisSubscriber> redis_subscriber(const char *conf);
+
+		// the near cache of a redis section, made on first use and shared
+		// by every service, kept fresh by its subscriber; disabled unless
+		// [section].cache.capacity and prefixes are set
+		RedisCache *redis_cache(const char *conf);
+
 	private:
+		// cpu sets for each thread role from the threads section, printed
+		// once so the mapping is visible in the startup log
+		void configure_threads();
+
+		// a writer for every section with write_behind.journal set, so
+		// what the last run left in its journal is replayed right away
+		void start_mysql_writers();
 
 		asio::io_service io_service_;
 
@@ -87,6 +138,32 @@ namespace tengine
 		SpinLock conf_lock_;
 
 		Executor *net_executor_;
+
+		BlockingPool *blocking_pool_;
+
+		Executor *service_executor_;
+
+		Resolver *resolver_;
+
+		UringEngine *uring_;
+
+		Node *node_;
+
+		std::mutex writer_lock_;
+
+		std::unordered_map<std::string, MySqlWriter*> mysql_writers_;
+
+		std::mutex cache_lock_;
+
+		std::unordered_map<std::string, MySqlCache*> mysql_caches_;
+
+		std::mutex subscriber_lock_;
+
+		std::unordered_map<std::string, std::shared_ptr<RedisSubscriber>> redis_subscribers_;
+
+		std::mutex redis_cache_lock_;
+
+		std::unordered_map<std::string, RedisCache*> redis_caches_;
 	};
 
 	template<class T>
@@ -0,0 +1,458 @@
+#include "datagram.hpp"
+
+#include "asio/ts/executor.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace tengine
+{
+	namespace
+	{
+		// sendmmsg accepts at most UIO_MAXIOV messages per call
+		constexpr std::size_t kMaxSendBatch = 64;
+	}
+
+	DatagramBatch::DatagramBatch(std::size_t capacity, std::size_t max_size)
+		: capacity_(capacity)
+		, max_size_(max_size)
+		, size_(0)
+		, buffer_((char*)ccmalloc(capacity * max_size))
+		, lengths_(capacity)
+		, endpoints_(capacity)
+#if defined(__linux__)
+		, headers_(capacity)
+		, iovecs_(capacity)
+#endif
+		, in_use_(false)
+	{
+#if defined(__linux__)
+		for (std::size_t i = 0; i < capacity_; i++)
+		{
+			iovecs_[i].iov_base = buffer_ + i * max_size_;
+			iovecs_[i].iov_len = max_size_;
+		}
+#endif
+	}
+
+	DatagramBatch::~DatagramBatch()
+	{
+		ccfree(buffer_);
+	}
+
+	std::size_t DatagramBatch::receive(asio::ip::udp::socket& socket, asio::error_code& ec)
+	{
+		size_ = 0;
+
+#if defined(__linux__)
+		for (std::size_t i = 0; i < capacity_; i++)
+		{
+			std::memset(&headers_[i], 0, sizeof(headers_[i]));
+			headers_[i].msg_hdr.msg_name = endpoints_[i].data();
+			headers_[i].msg_hdr.msg_namelen = (socklen_t)endpoints_[i].capacity();
+			headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+			headers_[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int n = ::recvmmsg(socket.native_handle(), headers_.data(),
+			(unsigned int)capacity_, MSG_DONTWAIT, nullptr);
+
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				ec = asio::error::would_block;
+			else
+				ec = asio::error_code(errno, asio::error::get_system_category());
+
+			return 0;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			// oversized datagrams are dropped rather than delivered cut short
+			if (headers_[i].msg_hdr.msg_flags & MSG_TRUNC)
+				continue;
+
+			if (size_ != (std::size_t)i)
+			{
+				std::memcpy(buffer_ + size_ * max_size_,
+					buffer_ + i * max_size_, headers_[i].msg_len);
+				endpoints_[size_] = endpoints_[i];
+			}
+
+			endpoints_[size_].resize(headers_[i].msg_hdr.msg_namelen);
+			lengths_[size_] = headers_[i].msg_len;
+			size_++;
+		}
+#else
+		while (size_ < capacity_ && socket.available(ec) > 0)
+		{
+			std::size_t n = socket.receive_from(
+				asio::buffer(buffer_ + size_ * max_size_, max_size_),
+				endpoints_[size_], 0, ec);
+
+			if (ec)
+				break;
+
+			lengths_[size_] = n;
+			size_++;
+		}
+
+		if (size_ > 0)
+			ec.clear();
+#endif
+
+		return size_;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+
+	class DatagramRing : public Allocator
+	{
+	public:
+		DatagramRing(std::size_t slots, std::size_t batch, std::size_t max_size)
+			: lock_()
+			, batches_()
+			, next_(0)
+			, paused_(false)
+			, resume_()
+		{
+			for (std::size_t i = 0; i < slots; i++)
+			{
+				batches_.push_back(new DatagramBatch(batch, max_size));
+			}
+		}
+
+		~DatagramRing()
+		{
+			for (auto batch : batches_)
+			{
+				delete batch;
+			}
+
+			batches_.clear();
+		}
+
+		DatagramBatch* acquire()
+		{
+			SpinHolder holder(lock_);
+
+			for (std::size_t i = 0; i < batches_.size(); i++)
+			{
+				std::size_t index = (next_ + i) % batches_.size();
+
+				DatagramBatch *batch = batches_[index];
+				if (!batch->in_use_)
+				{
+					batch->in_use_ = true;
+					next_ = index + 1;
+					return batch;
+				}
+			}
+
+			paused_ = true;
+			return nullptr;
+		}
+
+		void release(DatagramBatch *batch)
+		{
+			std::function<void()> resume;
+			{
+				SpinHolder holder(lock_);
+
+				batch->in_use_ = false;
+
+				if (paused_)
+				{
+					paused_ = false;
+					resume = resume_;
+				}
+			}
+
+			if (resume)
+				resume();
+		}
+
+		void resume(std::function<void()> f)
+		{
+			SpinHolder holder(lock_);
+			resume_ = f;
+		}
+
+	private:
+		SpinLock lock_;
+
+		std::vector<DatagramBatch*> batches_;
+
+		std::size_t next_;
+
+		bool paused_;
+
+		std::function<void()> resume_;
+	};
+
+	// a sandbox may release its last batch while the receiver is being
+	// destroyed; the resume that posts then finds receiver null instead
+	// of a freed object
+	struct DatagramReceiver::Waker
+	{
+		SpinLock lock;
+
+		DatagramReceiver *receiver;
+	};
+
+	DatagramReceiver::DatagramReceiver(asio::ip::udp::socket& socket,
+		std::size_t slots, std::size_t batch, std::size_t max_size)
+		: socket_(socket)
+		, ring_(std::make_shared<DatagramRing>(
+			slots > 0 ? slots : 1, batch > 0 ? batch : 1, max_size))
+		, waker_(std::make_shared<Waker>())
+		, handler_()
+	{
+		waker_->receiver = this;
+	}
+
+	DatagramReceiver::~DatagramReceiver()
+	{
+		ring_->resume(nullptr);
+
+		// waits out a resume running on the network thread
+		SpinHolder holder(waker_->lock);
+		waker_->receiver = nullptr;
+	}
+
+	void DatagramReceiver::start(Handler handler)
+	{
+		handler_ = handler;
+
+		std::shared_ptr<Waker> waker = waker_;
+		asio::io_service& io_service = socket_.get_io_service();
+
+		ring_->resume(
+			[waker, &io_service]()
+		{
+			asio::post(io_service,
+				[waker]()
+			{
+				SpinHolder holder(waker->lock);
+				if (waker->receiver)
+					waker->receiver->do_receive();
+			});
+		});
+
+		do_receive();
+	}
+
+	void DatagramReceiver::do_receive()
+	{
+		socket_.async_receive(asio::null_buffers(),
+			[this](const asio::error_code& error, std::size_t)
+		{
+			if (error)
+			{
+				if (error != asio::error::operation_aborted)
+					std::cerr << error.message() << std::endl;
+
+				return;
+			}
+
+			for (;;)
+			{
+				DatagramBatch *batch = ring_->acquire();
+				if (!batch)
+					return; // resumed by DatagramRing::release
+
+				asio::error_code ec;
+				std::size_t n = batch->receive(socket_, ec);
+
+				if (n == 0)
+				{
+					ring_->release(batch);
+
+					if (ec && ec != asio::error::would_block)
+						std::cerr << ec.message() << std::endl;
+
+					break;
+				}
+
+				auto ring = ring_;
+				handler_(DatagramBatchPtr(batch,
+					[ring](DatagramBatch *b)
+				{
+					ring->release(b);
+				}));
+
+				if (n < batch->capacity())
+					break;
+			}
+
+			do_receive();
+		});
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+
+	DatagramSender::DatagramSender(asio::ip::udp::socket& socket)
+		: socket_(socket)
+		, lock_()
+		, pending_()
+		, pending_entries_()
+		, scheduled_(false)
+		, sending_()
+		, sending_entries_()
+		, sent_(0)
+		, waiting_(false)
+	{
+
+	}
+
+	DatagramSender::~DatagramSender()
+	{
+
+	}
+
+	void DatagramSender::async_send(const char *data, std::size_t size,
+		const asio::ip::udp::endpoint& endpoint)
+	{
+		bool post = false;
+		{
+			SpinHolder holder(lock_);
+
+			Entry entry = { pending_.size(), size, endpoint };
+			pending_.insert(pending_.end(), data, data + size);
+			pending_entries_.push_back(entry);
+
+			if (!scheduled_)
+			{
+				scheduled_ = true;
+				post = true;
+			}
+		}
+
+		if (post)
+		{
+			asio::post(socket_.get_io_service(),
+				[this]()
+			{
+				do_write();
+			});
+		}
+	}
+
+	void DatagramSender::do_write()
+	{
+		if (waiting_)
+			return;
+
+		asio::error_code ec;
+		if (flush(ec))
+			return;
+
+		waiting_ = true;
+
+		socket_.async_send(asio::null_buffers(),
+			[this](const asio::error_code& error, std::size_t)
+		{
+			if (error == asio::error::operation_aborted)
+				return;
+
+			waiting_ = false;
+
+			if (!error)
+				do_write();
+		});
+	}
+
+	bool DatagramSender::flush(asio::error_code& ec)
+	{
+		for (;;)
+		{
+			if (sent_ == sending_entries_.size())
+			{
+				sending_.clear();
+				sending_entries_.clear();
+				sent_ = 0;
+
+				SpinHolder holder(lock_);
+
+				if (pending_entries_.empty())
+				{
+					scheduled_ = false;
+					return true;
+				}
+
+				pending_.swap(sending_);
+				pending_entries_.swap(sending_entries_);
+			}
+
+			sent_ += send_batch(ec);
+
+			if (ec == asio::error::would_block)
+				return false;
+
+			if (ec)
+			{
+				// the error belongs to the first unsent datagram, drop it
+				std::cerr << ec.message() << std::endl;
+				ec.clear();
+				sent_++;
+			}
+		}
+	}
+
+	std::size_t DatagramSender::send_batch(asio::error_code& ec)
+	{
+		std::size_t count = sending_entries_.size() - sent_;
+		if (count > kMaxSendBatch)
+			count = kMaxSendBatch;
+
+#if defined(__linux__)
+		struct mmsghdr headers[kMaxSendBatch];
+		struct iovec iovecs[kMaxSendBatch];
+
+		for (std::size_t i = 0; i < count; i++)
+		{
+			Entry& entry = sending_entries_[sent_ + i];
+
+			iovecs[i].iov_base = sending_.data() + entry.offset;
+			iovecs[i].iov_len = entry.size;
+
+			std::memset(&headers[i], 0, sizeof(headers[i]));
+			headers[i].msg_hdr.msg_name = entry.endpoint.data();
+			headers[i].msg_hdr.msg_namelen = (socklen_t)entry.endpoint.size();
+			headers[i].msg_hdr.msg_iov = &iovecs[i];
+			headers[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int n = ::sendmmsg(socket_.native_handle(), headers,
+			(unsigned int)count, MSG_DONTWAIT);
+
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				ec = asio::error::would_block;
+			else
+				ec = asio::error_code(errno, asio::error::get_system_category());
+
+			return 0;
+		}
+
+		return (std::size_t)n;
+#else
+		for (std::size_t i = 0; i < count; i++)
+		{
+			Entry& entry = sending_entries_[sent_ + i];
+
+			socket_.send_to(
+				asio::buffer(sending_.data() + entry.offset, entry.size),
+				entry.endpoint, 0, ec);
+
+			if (ec)
+				return i;
+		}
+
+		return count;
+#endif
+	}
+}
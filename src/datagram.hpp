@@ -0,0 +1,156 @@
+#ifndef TENGINE_DATAGRAM_HPP
+#define TENGINE_DATAGRAM_HPP
+
+#include "asio.hpp"
+
+#include "allocator.hpp"
+#include "spin_lock.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+
+namespace tengine
+{
+	class DatagramRing;
+
+	// a batch of datagrams read by one recvmmsg call into preallocated slots
+	class DatagramBatch : public Allocator
+	{
+	public:
+		DatagramBatch(std::size_t capacity, std::size_t max_size);
+
+		DatagramBatch(const DatagramBatch&) = delete;
+
+		DatagramBatch& operator=(const DatagramBatch&) = delete;
+
+		~DatagramBatch();
+
+		std::size_t size() const { return size_; }
+
+		std::size_t capacity() const { return capacity_; }
+
+		const char* data(std::size_t i) const { return buffer_ + i * max_size_; }
+
+		std::size_t length(std::size_t i) const { return lengths_[i]; }
+
+		const asio::ip::udp::endpoint& endpoint(std::size_t i) const { return endpoints_[i]; }
+
+		std::size_t receive(asio::ip::udp::socket& socket, asio::error_code& ec);
+
+	private:
+		friend class DatagramRing;
+
+		std::size_t capacity_;
+
+		std::size_t max_size_;
+
+		std::size_t size_;
+
+		char *buffer_;
+
+		std::vector<std::size_t> lengths_;
+
+		std::vector<asio::ip::udp::endpoint> endpoints_;
+
+#if defined(__linux__)
+		std::vector<struct mmsghdr> headers_;
+
+		std::vector<struct iovec> iovecs_;
+#endif
+
+		bool in_use_;
+	};
+
+	typedef std::shared_ptr<DatagramBatch> DatagramBatchPtr;
+
+	// reads datagrams in batches and hands each batch over in one call.
+	// a batch returns to the ring when the last DatagramBatchPtr goes away;
+	// when every slot is in flight, receiving pauses until one comes back.
+	class DatagramReceiver : public Allocator
+	{
+	public:
+		typedef std::function<void(const DatagramBatchPtr&)> Handler;
+
+		DatagramReceiver(asio::ip::udp::socket& socket,
+			std::size_t slots, std::size_t batch, std::size_t max_size);
+
+		DatagramReceiver(const DatagramReceiver&) = delete;
+
+		DatagramReceiver& operator=(const DatagramReceiver&) = delete;
+
+		~DatagramReceiver();
+
+		void start(Handler handler);
+
+	private:
+		struct Waker;
+
+		void do_receive();
+
+		asio::ip::udp::socket& socket_;
+
+		std::shared_ptr<DatagramRing> ring_;
+
+		// what a returning batch resumes through, cleared on destruction
+		std::shared_ptr<Waker> waker_;
+
+		Handler handler_;
+	};
+
+	// queues outgoing datagrams from any thread and flushes them from the
+	// network thread with sendmmsg. payloads are appended to a reusable
+	// arena, so steady-state sends do not allocate.
+	class DatagramSender : public Allocator
+	{
+	public:
+		DatagramSender(asio::ip::udp::socket& socket);
+
+		DatagramSender(const DatagramSender&) = delete;
+
+		DatagramSender& operator=(const DatagramSender&) = delete;
+
+		~DatagramSender();
+
+		void async_send(const char *data, std::size_t size,
+			const asio::ip::udp::endpoint& endpoint);
+
+	private:
+		struct Entry
+		{
+			std::size_t offset;
+			std::size_t size;
+			asio::ip::udp::endpoint endpoint;
+		};
+
+		void do_write();
+
+		bool flush(asio::error_code& ec);
+
+		std::size_t send_batch(asio::error_code& ec);
+
+		asio::ip::udp::socket& socket_;
+
+		SpinLock lock_;
+
+		std::vector<char> pending_;
+
+		std::vector<Entry> pending_entries_;
+
+		bool scheduled_;
+
+		std::vector<char> sending_;
+
+		std::vector<Entry> sending_entries_;
+
+		std::size_t sent_;
+
+		bool waiting_;
+	};
+}
+
+#endif
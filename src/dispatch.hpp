@@ -56,6 +56,22 @@ namespace tengine
 			self->handler(MessageTypeTrait<MessageType>(), from, args...);
 		});
 	}
+
+	// from a service known only by its id, e.g. one on another node
+	template<int MessageType, class T, class... Args>
+	static void dispatch(int from, Service* sto, Args&&... args)
+	{
+		if (!sto)
+			return;
+
+		asio::post(sto->executor(),
+			[=]
+		{
+			T* self = reinterpret_cast<T*>(sto);
+
+			self->handler(MessageTypeTrait<MessageType>(), from, args...);
+		});
+	}
 }
 
 #endif // !TENGINE_DISPATCH_HPP
@@ -2,27 +2,31 @@
 
 #include "asio/ts/executor.hpp"
 
+#include <chrono>
+
 namespace tengine
 {
 	namespace
 	{
-		struct ThreadFunction
-		{
-			asio::io_service* io_service_;
+		typedef std::chrono::steady_clock Clock;
 
-			void operator()()
-			{
-				asio::error_code ec;
-				io_service_->run(ec);
-			}
-		};
+		inline uint64_t elapsed(Clock::time_point from, Clock::time_point to)
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+		}
 	}
 
-	Executor::Executor()
+	Executor::Executor(const char *role)
 		: io_service_()
 		, work_(io_service_)
 		, thread_num_(0)
 		, threads_()
+		, busy_poll_(0)
+		, role_(role)
+		, spin_time_(0)
+		, idle_time_(0)
+		, spin_handlers_(0)
+		, idle_waits_(0)
 	{
 		// ThreadFunction f = { &io_service_ };
 		// std::size_t num_threads = asio::detail::thread::hardware_concurrency() * 2;
@@ -35,10 +39,14 @@ namespace tengine
 		join();
 	}
 
+	void Executor::busy_poll(int microseconds)
+	{
+		busy_poll_ = microseconds > 0 ? microseconds : 0;
+	}
+
 	int Executor::run(std::size_t num_threads)
 	{
-		ThreadFunction f = { &io_service_ };
-		threads_.create_threads(f, num_threads);
+		threads_.create_threads([this]() { thread_main(); }, num_threads);
 
 		return 0;
 	}
@@ -63,4 +71,69 @@ namespace tengine
 		io_service_.stop();
 	}
 
+	Executor::Stats Executor::stats() const
+	{
+		Stats stats;
+		stats.spin_time = spin_time_.load(std::memory_order_relaxed);
+		stats.idle_time = idle_time_.load(std::memory_order_relaxed);
+		stats.spin_handlers = spin_handlers_.load(std::memory_order_relaxed);
+		stats.idle_waits = idle_waits_.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void Executor::thread_main()
+	{
+		ThreadRoles::enter(role_.c_str());
+
+		if (busy_poll_ > 0)
+		{
+			poll_loop();
+			return;
+		}
+
+		asio::error_code ec;
+		io_service_.run(ec);
+	}
+
+	void Executor::poll_loop()
+	{
+		asio::error_code ec;
+
+		const uint64_t budget = (uint64_t)busy_poll_ * 1000;
+
+		// poll() runs whatever is ready and checks the reactor without
+		// blocking; once nothing has turned up for the whole budget the
+		// thread parks in run_one() like a plain run() would
+		Clock::time_point last = Clock::now();
+
+		while (!io_service_.stopped())
+		{
+			Clock::time_point before = Clock::now();
+
+			std::size_t n = io_service_.poll(ec);
+
+			Clock::time_point after = Clock::now();
+
+			if (n > 0)
+			{
+				spin_time_.fetch_add(elapsed(last, before), std::memory_order_relaxed);
+				spin_handlers_.fetch_add(n, std::memory_order_relaxed);
+				last = after;
+				continue;
+			}
+
+			if (elapsed(last, after) < budget)
+				continue;
+
+			spin_time_.fetch_add(elapsed(last, after), std::memory_order_relaxed);
+			idle_waits_.fetch_add(1, std::memory_order_relaxed);
+
+			// the handler that wakes us runs inside run_one and counts as idle
+			io_service_.run_one(ec);
+
+			last = Clock::now();
+			idle_time_.fetch_add(elapsed(after, last), std::memory_order_relaxed);
+		}
+	}
+
 }
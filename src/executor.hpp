@@ -2,15 +2,32 @@
 #define TENGINE_EXECUTOR_HPP
 
 #include "allocator.hpp"
+#include "affinity.hpp"
 
 #include "asio.hpp"
 
+#include <atomic>
+#include <cstdint>
+#include <string>
+
 namespace tengine
 {
 	class Executor : public Allocator
 	{
 	public:
-		Executor();
+		// where the run threads spent their time, nanoseconds
+		struct Stats
+		{
+			uint64_t spin_time;
+			uint64_t idle_time;
+			// handlers picked up while spinning
+			uint64_t spin_handlers;
+			// times a thread gave up spinning and blocked
+			uint64_t idle_waits;
+		};
+
+		// role names the run threads and picks their cpus, see ThreadRoles
+		Executor(const char *role = "executor");
 
 		virtual ~Executor();
 
@@ -18,13 +35,25 @@ namespace tengine
 
 		asio::executor executor();
 
+		// keep polling for this many microseconds after the last handler
+		// before blocking in the reactor. trades a core for wakeup latency,
+		// 0 blocks straight away. set before run().
+		void busy_poll(int microseconds);
+
+		int busy_poll() const { return busy_poll_; }
+
 		int run(std::size_t num_threads = 1);
 
 		void join();
 
 		void stop();
 
+		Stats stats() const;
+
 	private:
+		void thread_main();
+
+		void poll_loop();
 
 		asio::io_service io_service_;
 
@@ -33,6 +62,18 @@ namespace tengine
 		int thread_num_;
 
 		asio::detail::thread_group threads_;
+
+		int busy_poll_;
+
+		std::string role_;
+
+		std::atomic<uint64_t> spin_time_;
+
+		std::atomic<uint64_t> idle_time_;
+
+		std::atomic<uint64_t> spin_handlers_;
+
+		std::atomic<uint64_t> idle_waits_;
 	};
 
 }
@@ -0,0 +1,86 @@
+#ifndef TENGINE_HISTOGRAM_HPP
+#define TENGINE_HISTOGRAM_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace tengine
+{
+	// power of two buckets: 0 holds zero, bucket i holds [2^(i-1), 2^i).
+	// cheap enough to record on every call, coarse enough that percentiles
+	// are upper bounds within a factor of two. not thread safe, the owner
+	// records and copies it under its own lock.
+	class Histogram
+	{
+	public:
+		static constexpr std::size_t kBuckets = 65;
+
+		Histogram()
+			: buckets_()
+			, count_(0)
+			, sum_(0)
+			, max_(0)
+		{
+
+		}
+
+		void record(uint64_t value)
+		{
+			std::size_t bucket = 0;
+			while (bucket < 64 && (value >> bucket) != 0)
+				bucket++;
+
+			buckets_[bucket]++;
+			count_++;
+			sum_ += value;
+			if (value > max_)
+				max_ = value;
+		}
+
+		uint64_t count() const { return count_; }
+
+		uint64_t sum() const { return sum_; }
+
+		uint64_t max() const { return max_; }
+
+		uint64_t bucket(std::size_t i) const { return buckets_[i]; }
+
+		// upper bound of the bucket holding the p-th fraction, 0 < p <= 1
+		uint64_t percentile(double p) const
+		{
+			if (count_ == 0)
+				return 0;
+
+			uint64_t rank = (uint64_t)(p * (double)count_);
+			if (rank == 0)
+				rank = 1;
+
+			uint64_t seen = 0;
+			for (std::size_t i = 0; i < kBuckets; i++)
+			{
+				seen += buckets_[i];
+				if (seen >= rank)
+				{
+					if (i == 0)
+						return 0;
+
+					uint64_t upper = i >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << i) - 1;
+					return upper < max_ ? upper : max_;
+				}
+			}
+
+			return max_;
+		}
+
+	private:
+		uint64_t buckets_[kBuckets];
+
+		uint64_t count_;
+
+		uint64_t sum_;
+
+		uint64_t max_;
+	};
+}
+
+#endif
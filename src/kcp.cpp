@@ -0,0 +1,740 @@
+#include "kcp.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace tengine
+{
+	namespace
+	{
+		constexpr uint32_t kRtoNoDelay = 30;
+		constexpr uint32_t kRtoMin = 100;
+		constexpr uint32_t kRtoDefault = 200;
+		constexpr uint32_t kRtoMax = 60000;
+
+		constexpr uint32_t kCmdPush = 81;
+		constexpr uint32_t kCmdAck = 82;
+		constexpr uint32_t kCmdWask = 83;
+		constexpr uint32_t kCmdWins = 84;
+
+		constexpr uint32_t kAskSend = 1;
+		constexpr uint32_t kAskTell = 2;
+
+		constexpr uint32_t kWndSnd = 32;
+		constexpr uint32_t kWndRcv = 128;
+		constexpr uint32_t kMtuDefault = 1400;
+		constexpr uint32_t kInterval = 100;
+		constexpr uint32_t kDeadLink = 20;
+		constexpr uint32_t kThreshInit = 2;
+		constexpr uint32_t kThreshMin = 2;
+		constexpr uint32_t kProbeInit = 7000;
+		constexpr uint32_t kProbeLimit = 120000;
+		constexpr uint32_t kFastackLimit = 5;
+
+		// sequence numbers and timestamps wrap, compare them by distance
+		inline int32_t diff(uint32_t later, uint32_t earlier)
+		{
+			return (int32_t)(later - earlier);
+		}
+
+		inline char* encode8(char *p, uint8_t v)
+		{
+			*(uint8_t*)p = v;
+			return p + 1;
+		}
+
+		inline char* encode16(char *p, uint16_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)(v >> 8);
+			return p + 2;
+		}
+
+		inline char* encode32(char *p, uint32_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)((v >> 8) & 0xff);
+			p[2] = (char)((v >> 16) & 0xff);
+			p[3] = (char)(v >> 24);
+			return p + 4;
+		}
+
+		inline const char* decode8(const char *p, uint32_t& v)
+		{
+			v = *(const uint8_t*)p;
+			return p + 1;
+		}
+
+		inline const char* decode16(const char *p, uint32_t& v)
+		{
+			const uint8_t *u = (const uint8_t*)p;
+			v = (uint32_t)u[0] | ((uint32_t)u[1] << 8);
+			return p + 2;
+		}
+
+		inline const char* decode32(const char *p, uint32_t& v)
+		{
+			const uint8_t *u = (const uint8_t*)p;
+			v = (uint32_t)u[0] | ((uint32_t)u[1] << 8)
+				| ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+			return p + 4;
+		}
+	}
+
+	Kcp::Kcp(uint32_t conv, Output output)
+		: conv_(conv)
+		, mtu_(kMtuDefault)
+		, mss_(kMtuDefault - kOverhead)
+		, snd_una_(0)
+		, snd_nxt_(0)
+		, rcv_nxt_(0)
+		, ssthresh_(kThreshInit)
+		, rx_rttval_(0)
+		, rx_srtt_(0)
+		, rx_rto_(kRtoDefault)
+		, rx_minrto_(kRtoMin)
+		, snd_wnd_(kWndSnd)
+		, rcv_wnd_(kWndRcv)
+		, rmt_wnd_(kWndRcv)
+		, cwnd_(0)
+		, probe_(0)
+		, current_(0)
+		, interval_(kInterval)
+		, ts_flush_(kInterval)
+		, nodelay_(0)
+		, updated_(false)
+		, ts_probe_(0)
+		, probe_wait_(0)
+		, dead_link_(kDeadLink)
+		, incr_(0)
+		, fastresend_(0)
+		, fastlimit_(kFastackLimit)
+		, nocwnd_(false)
+		, dead_(false)
+		, snd_queue_()
+		, rcv_queue_()
+		, snd_buf_()
+		, rcv_buf_()
+		, acks_()
+		, buffer_((kMtuDefault + kOverhead) * 3)
+		, output_(output)
+	{
+
+	}
+
+	Kcp::~Kcp()
+	{
+
+	}
+
+	uint32_t Kcp::conv(const char *data, std::size_t size)
+	{
+		if (size < kOverhead)
+			return 0;
+
+		uint32_t conv;
+		decode32(data, conv);
+		return conv;
+	}
+
+	int Kcp::send(const char *data, std::size_t size)
+	{
+		std::size_t count = size <= mss_ ? 1 : (size + mss_ - 1) / mss_;
+
+		// every fragment has to fit into the peer's receive queue at once
+		if (count >= kWndRcv)
+			return -2;
+
+		for (std::size_t i = 0; i < count; i++)
+		{
+			std::size_t len = std::min<std::size_t>(size, mss_);
+
+			Segment seg;
+			seg.data.assign(data, len);
+			seg.frg = (uint32_t)(count - i - 1);
+			snd_queue_.push_back(std::move(seg));
+
+			data += len;
+			size -= len;
+		}
+
+		return 0;
+	}
+
+	int Kcp::peek_size() const
+	{
+		if (rcv_queue_.empty())
+			return -1;
+
+		const Segment& front = rcv_queue_.front();
+		if (front.frg == 0)
+			return (int)front.data.size();
+
+		if (rcv_queue_.size() < front.frg + 1)
+			return -1;
+
+		int length = 0;
+		for (const Segment& seg : rcv_queue_)
+		{
+			length += (int)seg.data.size();
+			if (seg.frg == 0)
+				break;
+		}
+
+		return length;
+	}
+
+	int Kcp::recv(std::string& message)
+	{
+		int size = peek_size();
+		if (size < 0)
+			return -1;
+
+		bool recover = rcv_queue_.size() >= rcv_wnd_;
+
+		message.clear();
+		message.reserve(size);
+
+		while (!rcv_queue_.empty())
+		{
+			Segment& seg = rcv_queue_.front();
+			uint32_t frg = seg.frg;
+			message.append(seg.data);
+			rcv_queue_.pop_front();
+
+			if (frg == 0)
+				break;
+		}
+
+		move_to_queue();
+
+		// the window reopened, tell the peer instead of waiting for a probe
+		if (rcv_queue_.size() < rcv_wnd_ && recover)
+			probe_ |= kAskTell;
+
+		return size;
+	}
+
+	void Kcp::move_to_queue()
+	{
+		while (!rcv_buf_.empty())
+		{
+			Segment& seg = rcv_buf_.front();
+			if (seg.sn != rcv_nxt_ || rcv_queue_.size() >= rcv_wnd_)
+				break;
+
+			rcv_queue_.push_back(std::move(seg));
+			rcv_buf_.pop_front();
+			rcv_nxt_++;
+		}
+	}
+
+	void Kcp::update_ack(int32_t rtt)
+	{
+		if (rx_srtt_ == 0)
+		{
+			rx_srtt_ = rtt;
+			rx_rttval_ = rtt / 2;
+		}
+		else
+		{
+			int32_t delta = rtt - rx_srtt_;
+			if (delta < 0)
+				delta = -delta;
+
+			rx_rttval_ = (3 * rx_rttval_ + delta) / 4;
+			rx_srtt_ = (7 * rx_srtt_ + rtt) / 8;
+			if (rx_srtt_ < 1)
+				rx_srtt_ = 1;
+		}
+
+		int32_t rto = rx_srtt_ + std::max<int32_t>(interval_, 4 * rx_rttval_);
+		rx_rto_ = std::min<int32_t>(std::max<int32_t>(rx_minrto_, rto), kRtoMax);
+	}
+
+	void Kcp::shrink_buf()
+	{
+		snd_una_ = snd_buf_.empty() ? snd_nxt_ : snd_buf_.front().sn;
+	}
+
+	void Kcp::parse_ack(uint32_t sn)
+	{
+		if (diff(sn, snd_una_) < 0 || diff(sn, snd_nxt_) >= 0)
+			return;
+
+		for (auto iter = snd_buf_.begin(); iter != snd_buf_.end(); ++iter)
+		{
+			if (iter->sn == sn)
+			{
+				snd_buf_.erase(iter);
+				break;
+			}
+
+			if (diff(sn, iter->sn) < 0)
+				break;
+		}
+	}
+
+	void Kcp::parse_una(uint32_t una)
+	{
+		while (!snd_buf_.empty() && diff(una, snd_buf_.front().sn) > 0)
+		{
+			snd_buf_.pop_front();
+		}
+	}
+
+	void Kcp::parse_fastack(uint32_t sn)
+	{
+		if (diff(sn, snd_una_) < 0 || diff(sn, snd_nxt_) >= 0)
+			return;
+
+		// every segment sent before an acked one was skipped once more
+		for (Segment& seg : snd_buf_)
+		{
+			if (diff(sn, seg.sn) < 0)
+				break;
+
+			if (sn != seg.sn)
+				seg.fastack++;
+		}
+	}
+
+	void Kcp::parse_data(Segment& newseg)
+	{
+		uint32_t sn = newseg.sn;
+
+		if (diff(sn, rcv_nxt_ + rcv_wnd_) >= 0 || diff(sn, rcv_nxt_) < 0)
+			return;
+
+		auto iter = rcv_buf_.end();
+		while (iter != rcv_buf_.begin())
+		{
+			auto prev = std::prev(iter);
+			if (prev->sn == sn)
+				return; // duplicate
+
+			if (diff(sn, prev->sn) > 0)
+				break;
+
+			iter = prev;
+		}
+
+		rcv_buf_.insert(iter, std::move(newseg));
+
+		move_to_queue();
+	}
+
+	int Kcp::input(const char *data, std::size_t size)
+	{
+		uint32_t prev_una = snd_una_;
+		uint32_t maxack = 0;
+		bool acked = false;
+
+		if (size < kOverhead)
+			return -1;
+
+		while (size >= kOverhead)
+		{
+			Segment seg;
+			uint32_t len;
+
+			data = decode32(data, seg.conv);
+			if (seg.conv != conv_)
+				return -1;
+
+			data = decode8(data, seg.cmd);
+			data = decode8(data, seg.frg);
+			data = decode16(data, seg.wnd);
+			data = decode32(data, seg.ts);
+			data = decode32(data, seg.sn);
+			data = decode32(data, seg.una);
+			data = decode32(data, len);
+
+			size -= kOverhead;
+
+			if (size < len)
+				return -2;
+
+			if (seg.cmd != kCmdPush && seg.cmd != kCmdAck
+				&& seg.cmd != kCmdWask && seg.cmd != kCmdWins)
+				return -3;
+
+			rmt_wnd_ = seg.wnd;
+			parse_una(seg.una);
+			shrink_buf();
+
+			if (seg.cmd == kCmdAck)
+			{
+				if (diff(current_, seg.ts) >= 0)
+					update_ack(diff(current_, seg.ts));
+
+				parse_ack(seg.sn);
+				shrink_buf();
+
+				if (!acked || diff(seg.sn, maxack) > 0)
+				{
+					acked = true;
+					maxack = seg.sn;
+				}
+			}
+			else if (seg.cmd == kCmdPush)
+			{
+				if (diff(seg.sn, rcv_nxt_ + rcv_wnd_) < 0)
+				{
+					acks_.push_back(std::make_pair(seg.sn, seg.ts));
+
+					if (diff(seg.sn, rcv_nxt_) >= 0)
+					{
+						seg.data.assign(data, len);
+						parse_data(seg);
+					}
+				}
+			}
+			else if (seg.cmd == kCmdWask)
+			{
+				probe_ |= kAskTell;
+			}
+
+			data += len;
+			size -= len;
+		}
+
+		if (acked)
+			parse_fastack(maxack);
+
+		// new data was acknowledged, grow the congestion window
+		if (diff(snd_una_, prev_una) > 0 && cwnd_ < rmt_wnd_)
+		{
+			if (cwnd_ < ssthresh_)
+			{
+				cwnd_++;
+				incr_ += mss_;
+			}
+			else
+			{
+				if (incr_ < mss_)
+					incr_ = mss_;
+
+				incr_ += (mss_ * mss_) / incr_ + (mss_ / 16);
+
+				if ((cwnd_ + 1) * mss_ <= incr_)
+					cwnd_ = (incr_ + mss_ - 1) / mss_;
+			}
+
+			if (cwnd_ > rmt_wnd_)
+			{
+				cwnd_ = rmt_wnd_;
+				incr_ = rmt_wnd_ * mss_;
+			}
+		}
+
+		return 0;
+	}
+
+	uint32_t Kcp::wnd_unused() const
+	{
+		if (rcv_queue_.size() < rcv_wnd_)
+			return rcv_wnd_ - (uint32_t)rcv_queue_.size();
+
+		return 0;
+	}
+
+	char* Kcp::encode(char *ptr, const Segment& seg) const
+	{
+		ptr = encode32(ptr, seg.conv);
+		ptr = encode8(ptr, (uint8_t)seg.cmd);
+		ptr = encode8(ptr, (uint8_t)seg.frg);
+		ptr = encode16(ptr, (uint16_t)seg.wnd);
+		ptr = encode32(ptr, seg.ts);
+		ptr = encode32(ptr, seg.sn);
+		ptr = encode32(ptr, seg.una);
+		ptr = encode32(ptr, (uint32_t)seg.data.size());
+		return ptr;
+	}
+
+	void Kcp::output(char *end)
+	{
+		std::size_t size = end - buffer_.data();
+		if (size > 0 && output_)
+			output_(buffer_.data(), size);
+	}
+
+	void Kcp::flush()
+	{
+		if (!updated_)
+			return;
+
+		char *buffer = buffer_.data();
+		char *ptr = buffer;
+
+		Segment seg;
+		seg.conv = conv_;
+		seg.cmd = kCmdAck;
+		seg.wnd = wnd_unused();
+		seg.una = rcv_nxt_;
+
+		// acks first, several per datagram
+		for (auto& ack : acks_)
+		{
+			if ((std::size_t)(ptr - buffer) + kOverhead > mtu_)
+			{
+				output(ptr);
+				ptr = buffer;
+			}
+
+			seg.sn = ack.first;
+			seg.ts = ack.second;
+			ptr = encode(ptr, seg);
+		}
+
+		acks_.clear();
+
+		// the peer's window is closed, probe it with backoff
+		if (rmt_wnd_ == 0)
+		{
+			if (probe_wait_ == 0)
+			{
+				probe_wait_ = kProbeInit;
+				ts_probe_ = current_ + probe_wait_;
+			}
+			else if (diff(current_, ts_probe_) >= 0)
+			{
+				if (probe_wait_ < kProbeInit)
+					probe_wait_ = kProbeInit;
+
+				probe_wait_ += probe_wait_ / 2;
+				if (probe_wait_ > kProbeLimit)
+					probe_wait_ = kProbeLimit;
+
+				ts_probe_ = current_ + probe_wait_;
+				probe_ |= kAskSend;
+			}
+		}
+		else
+		{
+			ts_probe_ = 0;
+			probe_wait_ = 0;
+		}
+
+		if (probe_ & kAskSend)
+		{
+			seg.cmd = kCmdWask;
+			if ((std::size_t)(ptr - buffer) + kOverhead > mtu_)
+			{
+				output(ptr);
+				ptr = buffer;
+			}
+			ptr = encode(ptr, seg);
+		}
+
+		if (probe_ & kAskTell)
+		{
+			seg.cmd = kCmdWins;
+			if ((std::size_t)(ptr - buffer) + kOverhead > mtu_)
+			{
+				output(ptr);
+				ptr = buffer;
+			}
+			ptr = encode(ptr, seg);
+		}
+
+		probe_ = 0;
+
+		uint32_t cwnd = std::min(snd_wnd_, rmt_wnd_);
+		if (!nocwnd_)
+			cwnd = std::min(cwnd_, cwnd);
+
+		// admit queued segments that fit into the window
+		while (diff(snd_nxt_, snd_una_ + cwnd) < 0 && !snd_queue_.empty())
+		{
+			Segment& newseg = snd_queue_.front();
+			newseg.conv = conv_;
+			newseg.cmd = kCmdPush;
+			newseg.wnd = seg.wnd;
+			newseg.ts = current_;
+			newseg.sn = snd_nxt_++;
+			newseg.una = rcv_nxt_;
+			newseg.resendts = current_;
+			newseg.rto = rx_rto_;
+			newseg.fastack = 0;
+			newseg.xmit = 0;
+
+			snd_buf_.push_back(std::move(newseg));
+			snd_queue_.pop_front();
+		}
+
+		uint32_t resent = fastresend_ > 0 ? fastresend_ : 0xffffffff;
+		uint32_t rtomin = nodelay_ == 0 ? (rx_rto_ >> 3) : 0;
+
+		bool change = false;
+		bool lost = false;
+
+		for (Segment& segment : snd_buf_)
+		{
+			bool needsend = false;
+
+			if (segment.xmit == 0)
+			{
+				needsend = true;
+				segment.xmit++;
+				segment.rto = rx_rto_;
+				segment.resendts = current_ + segment.rto + rtomin;
+			}
+			else if (diff(current_, segment.resendts) >= 0)
+			{
+				needsend = true;
+				segment.xmit++;
+
+				if (nodelay_ == 0)
+				{
+					segment.rto += std::max<uint32_t>(segment.rto, rx_rto_);
+				}
+				else
+				{
+					uint32_t step = nodelay_ < 2 ? segment.rto : rx_rto_;
+					segment.rto += step / 2;
+				}
+
+				segment.resendts = current_ + segment.rto;
+				lost = true;
+			}
+			else if (segment.fastack >= resent)
+			{
+				if (segment.xmit <= fastlimit_ || fastlimit_ == 0)
+				{
+					needsend = true;
+					segment.xmit++;
+					segment.fastack = 0;
+					segment.resendts = current_ + segment.rto;
+					change = true;
+				}
+			}
+
+			if (needsend)
+			{
+				segment.ts = current_;
+				segment.wnd = seg.wnd;
+				segment.una = rcv_nxt_;
+
+				std::size_t need = kOverhead + segment.data.size();
+
+				if ((std::size_t)(ptr - buffer) + need > mtu_)
+				{
+					output(ptr);
+					ptr = buffer;
+				}
+
+				ptr = encode(ptr, segment);
+
+				if (!segment.data.empty())
+				{
+					std::memcpy(ptr, segment.data.data(), segment.data.size());
+					ptr += segment.data.size();
+				}
+
+				if (segment.xmit >= dead_link_)
+					dead_ = true;
+			}
+		}
+
+		output(ptr);
+
+		// fast retransmit halves the window, a timeout collapses it
+		if (change)
+		{
+			uint32_t inflight = snd_nxt_ - snd_una_;
+			ssthresh_ = std::max(inflight / 2, kThreshMin);
+			cwnd_ = ssthresh_ + resent;
+			incr_ = cwnd_ * mss_;
+		}
+
+		if (lost)
+		{
+			ssthresh_ = std::max(cwnd / 2, kThreshMin);
+			cwnd_ = 1;
+			incr_ = mss_;
+		}
+
+		if (cwnd_ < 1)
+		{
+			cwnd_ = 1;
+			incr_ = mss_;
+		}
+	}
+
+	void Kcp::update(uint32_t current)
+	{
+		current_ = current;
+
+		if (!updated_)
+		{
+			updated_ = true;
+			ts_flush_ = current_;
+		}
+
+		int32_t slap = diff(current_, ts_flush_);
+
+		if (slap >= 10000 || slap < -10000)
+		{
+			ts_flush_ = current_;
+			slap = 0;
+		}
+
+		if (slap >= 0)
+		{
+			ts_flush_ += interval_;
+			if (diff(current_, ts_flush_) >= 0)
+				ts_flush_ = current_ + interval_;
+
+			flush();
+		}
+	}
+
+	void Kcp::nodelay(int nodelay, int interval, int resend, int nc)
+	{
+		if (nodelay >= 0)
+		{
+			nodelay_ = nodelay;
+			rx_minrto_ = nodelay ? kRtoNoDelay : kRtoMin;
+		}
+
+		if (interval >= 0)
+		{
+			if (interval > 5000)
+				interval = 5000;
+			else if (interval < 10)
+				interval = 10;
+
+			interval_ = interval;
+		}
+
+		if (resend >= 0)
+			fastresend_ = resend;
+
+		if (nc >= 0)
+			nocwnd_ = nc != 0;
+	}
+
+	void Kcp::window(int sndwnd, int rcvwnd)
+	{
+		if (sndwnd > 0)
+			snd_wnd_ = sndwnd;
+
+		// never below the fragment limit, or large messages could not complete
+		if (rcvwnd > 0)
+			rcv_wnd_ = std::max<uint32_t>(rcvwnd, kWndRcv);
+	}
+
+	int Kcp::mtu(int mtu)
+	{
+		if (mtu < 50 || mtu < (int)kOverhead)
+			return -1;
+
+		buffer_.resize((mtu + kOverhead) * 3);
+		mtu_ = mtu;
+		mss_ = mtu_ - kOverhead;
+
+		return 0;
+	}
+}
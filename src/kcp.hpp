@@ -0,0 +1,185 @@
+#ifndef TENGINE_KCP_HPP
+#define TENGINE_KCP_HPP
+
+#include "allocator.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tengine
+{
+	// kcp-style arq over an unreliable datagram transport: selective ack,
+	// fast retransmit, congestion/flow windows and nodelay mode. segments
+	// are laid out as in ikcp, but KcpServer only opens a session after
+	// its conv handshake: the client sends [uint32 0]["tkcp"] and builds
+	// its ikcp with the conv in the [uint32 0]["tkcp"][uint32 conv] reply,
+	// so a stock kcp client needs that step added before it can connect.
+	// not thread safe, every call must come from the same thread.
+	class Kcp : public Allocator
+	{
+	public:
+		typedef std::function<void(const char*, std::size_t)> Output;
+
+		enum { kOverhead = 24 };
+
+		Kcp(uint32_t conv, Output output);
+
+		Kcp(const Kcp&) = delete;
+
+		Kcp& operator=(const Kcp&) = delete;
+
+		~Kcp();
+
+		// conversation id of a raw packet, 0 if it is too short
+		static uint32_t conv(const char *data, std::size_t size);
+
+		uint32_t conv() const { return conv_; }
+
+		// queue a message, returns <0 if it is too large for the window
+		int send(const char *data, std::size_t size);
+
+		// pop one complete message, returns <0 if none is ready
+		int recv(std::string& message);
+
+		// feed a packet from the transport, returns <0 if it is malformed
+		int input(const char *data, std::size_t size);
+
+		// drive timers; current is a millisecond clock
+		void update(uint32_t current);
+
+		void flush();
+
+		// nodelay: 0 normal, 1 fast rto, 2 faster backoff
+		// interval: internal flush interval in ms
+		// resend: fast retransmit after this many skipping acks, 0 off
+		// nc: 1 disables congestion control
+		void nodelay(int nodelay, int interval, int resend, int nc);
+
+		void window(int sndwnd, int rcvwnd);
+
+		int mtu(int mtu);
+
+		int waiting() const { return (int)(snd_buf_.size() + snd_queue_.size()); }
+
+		// a segment exceeded dead_link retransmissions
+		bool dead() const { return dead_; }
+
+	private:
+		struct Segment
+		{
+			uint32_t conv = 0;
+			uint32_t cmd = 0;
+			uint32_t frg = 0;
+			uint32_t wnd = 0;
+			uint32_t ts = 0;
+			uint32_t sn = 0;
+			uint32_t una = 0;
+			uint32_t resendts = 0;
+			uint32_t rto = 0;
+			uint32_t fastack = 0;
+			uint32_t xmit = 0;
+			std::string data;
+		};
+
+		int peek_size() const;
+
+		char* encode(char *ptr, const Segment& seg) const;
+
+		void output(char *end);
+
+		void update_ack(int32_t rtt);
+
+		void shrink_buf();
+
+		void parse_ack(uint32_t sn);
+
+		void parse_una(uint32_t una);
+
+		void parse_fastack(uint32_t sn);
+
+		void parse_data(Segment& seg);
+
+		void move_to_queue();
+
+		uint32_t wnd_unused() const;
+
+		uint32_t conv_;
+
+		uint32_t mtu_;
+
+		uint32_t mss_;
+
+		uint32_t snd_una_;
+
+		uint32_t snd_nxt_;
+
+		uint32_t rcv_nxt_;
+
+		uint32_t ssthresh_;
+
+		int32_t rx_rttval_;
+
+		int32_t rx_srtt_;
+
+		int32_t rx_rto_;
+
+		int32_t rx_minrto_;
+
+		uint32_t snd_wnd_;
+
+		uint32_t rcv_wnd_;
+
+		uint32_t rmt_wnd_;
+
+		uint32_t cwnd_;
+
+		uint32_t probe_;
+
+		uint32_t current_;
+
+		uint32_t interval_;
+
+		uint32_t ts_flush_;
+
+		uint32_t nodelay_;
+
+		bool updated_;
+
+		uint32_t ts_probe_;
+
+		uint32_t probe_wait_;
+
+		uint32_t dead_link_;
+
+		uint32_t incr_;
+
+		uint32_t fastresend_;
+
+		uint32_t fastlimit_;
+
+		bool nocwnd_;
+
+		bool dead_;
+
+		std::deque<Segment> snd_queue_;
+
+		std::deque<Segment> rcv_queue_;
+
+		std::list<Segment> snd_buf_;
+
+		std::list<Segment> rcv_buf_;
+
+		std::vector<std::pair<uint32_t, uint32_t>> acks_;
+
+		std::vector<char> buffer_;
+
+		Output output_;
+	};
+}
+
+#endif
@@ -1,7 +1,6 @@
 #include "logger.hpp"
 
 #include "context.hpp"
-#include "executor.hpp"
 #include "timer.hpp"
 #include "dispatch.hpp"
 
@@ -23,7 +22,7 @@ namespace tengine
 
 	Logger::Logger(Context& context)
 		: Service(context)
-		, executor_(new Executor())
+		, queue_(context.blocking_pool().queue("logger", 1, BlockingPool::kLow))
 		, logger_(NULL)
         , loggers_()
 	{
@@ -32,8 +31,7 @@ namespace tengine
 
 	Logger::~Logger()
 	{
-		delete executor_;
-		executor_ = nullptr;
+		queue_->close();
 
 		if (logger_)
 		{
@@ -76,8 +74,6 @@ namespace tengine
 
 		context_.register_name(this, "Logger");
 
-		executor_->run();
-
 		return 0;
 	}
 
@@ -96,7 +92,7 @@ namespace tengine
 		asio::post(executor(),
 			[=]
 		{
-			asio::post(executor_->executor(),
+			queue_->post(
 				[=]
 			{
 				this->do_log(level, msg.c_str(), msg.size(), sender->name());
@@ -106,7 +102,7 @@ namespace tengine
 
 	int Logger::async_log(ServiceAddress src, const char *msg)
 	{
-		asio::post(executor_->executor(),
+		queue_->post(
 			[=]
 		{
 			this->do_log(-1, msg, std::strlen(msg), src->name());
@@ -126,7 +122,7 @@ namespace tengine
 		return 0;
 		*/
 
-		asio::post(executor_->executor(),
+		queue_->post(
 			[=]
 		{
 			this->do_log(-1, msg.c_str(), msg.size(), src->name());
@@ -138,7 +134,7 @@ namespace tengine
 	int Logger::async_log(
 		ServiceAddress src, int level, const char *msg, int size)
 	{
-		asio::post(executor_->executor(),
+		queue_->post(
 			[=]
 		{
 			this->do_log(level, msg, size, src->name());
@@ -4,12 +4,12 @@
 #include "service.hpp"
 #include "context.hpp"
 
+#include "blocking_pool.hpp"
+
 #include <map>
 
 namespace tengine
 {
-	class Executor;
-
 	struct logger;
 
 	class Logger : public Service
@@ -39,7 +39,8 @@ namespace tengine
 
 		int do_log(int level, const char *msg, int size, const char *name);
 
-		Executor *executor_;
+		// limit 1 keeps lines in the order they were logged
+		BlockingPool::QueuePtr queue_;
 
 		logger *logger_;
 
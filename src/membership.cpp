@@ -0,0 +1,994 @@
+#include "membership.hpp"
+
+#include "context.hpp"
+#include "node.hpp"
+#include "resolver.hpp"
+
+#include "openssl/crypto.h"
+#include "openssl/hmac.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace tengine
+{
+	namespace
+	{
+		// [uint8 type][uint8 0][uint16 from][uint32 seq][uint16 target]
+		// [uint16 members], then the members and the tag, big endian like
+		// the node frames
+		const std::size_t kPacketHeader = 12;
+
+		// where the member count goes, filled in once they are written
+		const std::size_t kPacketCount = 10;
+
+		// [uint8 state][uint8 host size][uint16 node][uint32 incarnation]
+		// [uint16 port][uint16 router port][uint8 services size][host]
+		// [services, comma separated]
+		const std::size_t kMemberHeader = 13;
+
+		// every packet ends with hmac-sha256 of the rest under the cluster
+		// key, cut to this many bytes
+		const std::size_t kTag = 16;
+
+		void put16(std::string& packet, uint16_t value)
+		{
+			packet += (char)(value >> 8);
+			packet += (char)value;
+		}
+
+		void put32(std::string& packet, uint32_t value)
+		{
+			put16(packet, (uint16_t)(value >> 16));
+			put16(packet, (uint16_t)value);
+		}
+
+		uint16_t get16(const char *p)
+		{
+			const uint8_t *u = (const uint8_t*)p;
+			return (uint16_t)((u[0] << 8) | u[1]);
+		}
+
+		uint32_t get32(const char *p)
+		{
+			return ((uint32_t)get16(p) << 16) | get16(p + 2);
+		}
+
+		void set_count(std::string& packet, uint16_t count)
+		{
+			packet[kPacketCount] = (char)(count >> 8);
+			packet[kPacketCount + 1] = (char)count;
+		}
+
+		void sign(const std::string& key, const char *data, std::size_t size, char *tag)
+		{
+			unsigned char digest[EVP_MAX_MD_SIZE];
+			unsigned int digest_size = sizeof(digest);
+			HMAC(EVP_sha256(), key.data(), (int)key.size(), (const unsigned char*)data, size,
+				digest, &digest_size);
+			std::memcpy(tag, digest, kTag);
+		}
+
+		std::vector<std::string> split(const std::string& list)
+		{
+			std::vector<std::string> items;
+
+			std::size_t begin = 0;
+			while (begin < list.size())
+			{
+				std::size_t end = list.find(',', begin);
+				if (end == std::string::npos)
+					end = list.size();
+
+				std::string item = list.substr(begin, end - begin);
+				item.erase(0, item.find_first_not_of(" \t"));
+				item.erase(item.find_last_not_of(" \t") + 1);
+
+				if (!item.empty())
+					items.push_back(item);
+
+				begin = end + 1;
+			}
+
+			return items;
+		}
+	}
+
+	void Membership::load(Context& context, const char *conf, Options& options)
+	{
+		char key[256];
+
+		snprintf(key, sizeof(key), "%s.node", conf);
+		options.node = context.config(key, options.node);
+
+		snprintf(key, sizeof(key), "%s.gossip_port", conf);
+		options.port = context.config(key, options.port);
+
+		snprintf(key, sizeof(key), "%s.address", conf);
+		options.address = context.config(key, options.address.c_str());
+
+		// the key the node links authenticate with
+		snprintf(key, sizeof(key), "%s.key", conf);
+		options.key = context.config(key, options.key.c_str());
+
+		snprintf(key, sizeof(key), "%s.advertise", conf);
+		options.advertise = context.config(key, options.advertise.c_str());
+
+		snprintf(key, sizeof(key), "%s.port", conf);
+		options.router_port = context.config(key, options.router_port);
+
+		// "10.0.0.2:30001, 10.0.0.3:30001"
+		snprintf(key, sizeof(key), "%s.seeds", conf);
+		options.seeds = split(context.config(key, ""));
+
+		snprintf(key, sizeof(key), "%s.probe_interval", conf);
+		options.probe_interval = std::max(10, context.config(key, options.probe_interval));
+
+		snprintf(key, sizeof(key), "%s.probe_timeout", conf);
+		options.probe_timeout = std::max(1, context.config(key, options.probe_timeout));
+
+		// the indirect probes need the rest of the period
+		options.probe_timeout = std::min(options.probe_timeout, options.probe_interval / 2);
+
+		snprintf(key, sizeof(key), "%s.indirect_probes", conf);
+		options.indirect_probes = std::max(0, context.config(key, options.indirect_probes));
+
+		snprintf(key, sizeof(key), "%s.suspicion_mult", conf);
+		options.suspicion_mult = std::max(1, context.config(key, options.suspicion_mult));
+
+		snprintf(key, sizeof(key), "%s.retransmit_mult", conf);
+		options.retransmit_mult = std::max(1, context.config(key, options.retransmit_mult));
+
+		snprintf(key, sizeof(key), "%s.sync_interval", conf);
+		options.sync_interval = std::max(options.probe_interval, context.config(key, options.sync_interval));
+
+		snprintf(key, sizeof(key), "%s.dead_timeout", conf);
+		options.dead_timeout = std::max(0, context.config(key, options.dead_timeout));
+
+		snprintf(key, sizeof(key), "%s.max_packet", conf);
+		options.max_packet = std::min(65507, std::max(512, context.config(key, options.max_packet)));
+	}
+
+	const char *Membership::state_name(State state)
+	{
+		switch (state)
+		{
+		case kAlive:
+			return "alive";
+		case kSuspect:
+			return "suspect";
+		default:
+			return "dead";
+		}
+	}
+
+	Membership::Membership(Resolver& resolver, asio::io_service& io_service, const Options& options)
+		: resolver_(resolver)
+		, io_service_(io_service)
+		, options_(options)
+		, socket_(io_service)
+		, probe_timer_(io_service)
+		, indirect_timer_(io_service)
+		, buffer_(65536)
+		, sender_()
+		, mutex_()
+		, self_()
+		, peers_()
+		, broadcasts_()
+		, round_()
+		, round_index_(0)
+		, probing_(0)
+		, probe_seq_(0)
+		, probe_acked_(false)
+		, seq_(0)
+		, relays_()
+		, next_sync_()
+		, random_((unsigned)Clock::now().time_since_epoch().count())
+		, listener_()
+		, stats_()
+		, closed_(false)
+	{
+		self_.node = options_.node;
+		self_.port = options_.port;
+		self_.router_port = options_.router_port;
+		self_.state = kAlive;
+
+		// past any incarnation our previous run reached, so news of its
+		// death does not stick to us
+		self_.incarnation = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	Membership::~Membership()
+	{
+
+	}
+
+	int Membership::start()
+	{
+		asio::error_code ec;
+		asio::ip::udp::endpoint endpoint(asio::ip::address::from_string(options_.address, ec),
+			(unsigned short)options_.port);
+
+		if (!ec)
+			socket_.open(endpoint.protocol(), ec);
+		if (!ec)
+			socket_.bind(endpoint, ec);
+		if (!ec)
+			socket_.non_blocking(true, ec);
+
+		if (ec)
+		{
+			fprintf(stderr, "node %d: can't bind gossip to %s:%d: %s\n", options_.node,
+				options_.address.c_str(), options_.port, ec.message().c_str());
+
+			socket_.close(ec);
+			return -1;
+		}
+
+		if (options_.key.empty() && !endpoint.address().is_loopback())
+		{
+			fprintf(stderr, "node %d: gossip on %s:%d without node.key, anyone who can "
+				"reach the port can rewrite the membership\n", options_.node, options_.address.c_str(), options_.port);
+		}
+
+		// a wildcard address is no use to the others, the host name is
+		std::string host = options_.advertise;
+		if (host.empty())
+			host = endpoint.address().is_unspecified() ? asio::ip::host_name(ec) : options_.address;
+
+		// members are told an ip, nobody resolves names on the probe path
+		auto self(shared_from_this());
+		resolver_.async_resolve(host,
+			[this, self, host](const asio::error_code& ec, const Resolver::Addresses& addresses)
+		{
+			asio::error_code error = ec;
+			if (!error && addresses.empty())
+				error = asio::error::host_not_found;
+
+			on_resolved(error, error ? host : addresses.front().to_string());
+		});
+
+		do_receive();
+
+		return 0;
+	}
+
+	void Membership::on_resolved(const asio::error_code& ec, const std::string& host)
+	{
+		if (ec)
+		{
+			fprintf(stderr, "node %d: can't resolve gossip address %s: %s\n", options_.node,
+				host.c_str(), ec.message().c_str());
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (closed_)
+				return;
+
+			self_.host = host;
+			gossip(self_.node);
+			next_sync_ = Clock::now() + std::chrono::milliseconds(options_.sync_interval);
+
+			join();
+		}
+
+		on_probe_timer();
+	}
+
+	// under mutex_
+	void Membership::join()
+	{
+		auto self(shared_from_this());
+
+		for (auto& seed : options_.seeds)
+		{
+			std::size_t colon = seed.rfind(':');
+			if (colon == std::string::npos)
+			{
+				fprintf(stderr, "node %d: bad seed \"%s\", expected host:port\n", options_.node, seed.c_str());
+				continue;
+			}
+
+			std::string host = seed.substr(0, colon);
+			unsigned short port = (unsigned short)atoi(seed.c_str() + colon + 1);
+
+			resolver_.async_resolve(host,
+				[this, self, seed, port](const asio::error_code& ec, const Resolver::Addresses& addresses)
+			{
+				if (ec || addresses.empty())
+				{
+					fprintf(stderr, "node %d: can't resolve seed %s: %s\n", options_.node,
+						seed.c_str(), ec ? ec.message().c_str() : "no address");
+					return;
+				}
+
+				asio::ip::udp::endpoint endpoint(addresses.front(), port);
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (closed_)
+					return;
+
+				// target 0: whoever is there answers with its view
+				std::string packet = header(kPing, ++seq_, 0);
+				if (put_member(packet, self_, options_.max_packet))
+					set_count(packet, 1);
+				send(endpoint, packet);
+			});
+		}
+	}
+
+	void Membership::close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (closed_)
+			return;
+		closed_ = true;
+
+		// the net thread may be gone already, this goes out from here
+		if (socket_.is_open() && !self_.host.empty())
+		{
+			Member leaving = self_;
+			leaving.state = kDead;
+
+			std::string packet = header(kSync, 0, 0);
+			if (put_member(packet, leaving, options_.max_packet))
+				set_count(packet, 1);
+
+			std::vector<const Peer*> live;
+			for (auto& peer : peers_)
+			{
+				if (peer.second.member.state != kDead)
+					live.push_back(&peer.second);
+			}
+
+			std::shuffle(live.begin(), live.end(), random_);
+			live.resize(std::min(live.size(), (std::size_t)options_.indirect_probes + 1));
+
+			for (auto peer : live)
+				send(peer->endpoint, packet);
+		}
+
+		auto self(shared_from_this());
+		asio::post(io_service_, [this, self]()
+		{
+			asio::error_code ec;
+			probe_timer_.cancel(ec);
+			indirect_timer_.cancel(ec);
+			socket_.close(ec);
+		});
+	}
+
+	void Membership::announce(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (std::find(self_.services.begin(), self_.services.end(), name) != self_.services.end())
+			return;
+
+		self_.services.push_back(name);
+
+		// a fresh incarnation so the others take the new list
+		self_.incarnation++;
+		gossip(self_.node);
+	}
+
+	std::vector<Membership::Member> Membership::members()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		std::vector<Member> members;
+		members.push_back(self_);
+
+		for (auto& peer : peers_)
+			members.push_back(peer.second.member);
+
+		return members;
+	}
+
+	Membership::Stats Membership::stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return stats_;
+	}
+
+	void Membership::do_receive()
+	{
+		auto self(shared_from_this());
+
+		socket_.async_receive_from(asio::buffer(buffer_), sender_,
+			[this, self](const asio::error_code& ec, std::size_t size)
+		{
+			if (ec == asio::error::operation_aborted || !socket_.is_open())
+				return;
+
+			// icmp unreachable from a dead peer shows up as an error here
+			if (!ec)
+				on_packet(buffer_.data(), size, sender_);
+
+			do_receive();
+		});
+	}
+
+	void Membership::on_packet(const char *data, std::size_t size, const asio::ip::udp::endpoint& from)
+	{
+		if (size < kPacketHeader + kTag)
+			return;
+
+		char tag[kTag];
+		size -= kTag;
+		sign(options_.key, data, size, tag);
+
+		// forged, or from a cluster with another key
+		if (CRYPTO_memcmp(tag, data + size, kTag) != 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stats_.packets_rejected++;
+			return;
+		}
+
+		PacketType type = (PacketType)(uint8_t)data[0];
+		int node = get16(data + 2);
+		uint32_t seq = get32(data + 4);
+		int target = get16(data + 8);
+		int count = get16(data + kPacketCount);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (closed_ || self_.host.empty() || node == self_.node)
+			return;
+
+		stats_.packets_received++;
+
+		std::size_t offset = kPacketHeader;
+		for (int i = 0; i < count; i++)
+		{
+			Member member;
+			std::size_t used = get_member(data + offset, size - offset, member);
+			if (used == 0)
+				break;
+
+			merge(member);
+			offset += used;
+		}
+
+		switch (type)
+		{
+		case kPing:
+		{
+			// an old address of some other node
+			if (target != 0 && target != self_.node)
+				break;
+
+			std::string packet = header(kAck, seq, 0);
+			piggyback(packet);
+			send(from, packet);
+
+			if (target == 0)
+				sync(from, false);
+		}
+		break;
+		case kPingReq:
+		{
+			auto iter = peers_.find(target);
+			if (iter == peers_.end() || iter->second.member.state == kDead)
+				break;
+
+			Relay& relay = relays_[++seq_];
+			relay.asker = from;
+			relay.seq = seq;
+			relay.expires = Clock::now() + std::chrono::milliseconds(options_.probe_interval);
+
+			std::string packet = header(kPing, seq_, target);
+			piggyback(packet);
+			send(iter->second.endpoint, packet);
+		}
+		break;
+		case kAck:
+		{
+			auto relay = relays_.find(seq);
+			if (relay != relays_.end())
+			{
+				std::string packet = header(kAck, relay->second.seq, 0);
+				piggyback(packet);
+				send(relay->second.asker, packet);
+
+				relays_.erase(relay);
+			}
+			else if (probing_ != 0 && seq == probe_seq_)
+			{
+				probe_acked_ = true;
+			}
+		}
+		break;
+		case kSync:
+		{
+			if (seq != 0)
+				sync(from, false);
+		}
+		break;
+		default:
+			break;
+		}
+	}
+
+	void Membership::on_probe_timer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (closed_)
+				return;
+
+			// the last probe went unanswered, directly and through the others
+			if (probing_ != 0 && !probe_acked_)
+			{
+				auto iter = peers_.find(probing_);
+				if (iter != peers_.end() && iter->second.member.state == kAlive)
+				{
+					change(iter->second, kSuspect, iter->second.member.incarnation);
+					stats_.suspected++;
+				}
+			}
+			probing_ = 0;
+
+			Clock::time_point now = Clock::now();
+
+			for (auto iter = peers_.begin(); iter != peers_.end();)
+			{
+				Peer& peer = iter->second;
+
+				if (peer.member.state == kSuspect && now >= peer.deadline)
+				{
+					change(peer, kDead, peer.member.incarnation);
+				}
+				else if (peer.member.state == kDead && now >= peer.deadline)
+				{
+					int node = iter->first;
+					broadcasts_.erase(std::remove_if(broadcasts_.begin(), broadcasts_.end(),
+						[node](const Broadcast& broadcast) { return broadcast.node == node; }), broadcasts_.end());
+
+					iter = peers_.erase(iter);
+					continue;
+				}
+
+				++iter;
+			}
+
+			for (auto iter = relays_.begin(); iter != relays_.end();)
+			{
+				if (now >= iter->second.expires)
+					iter = relays_.erase(iter);
+				else
+					++iter;
+			}
+
+			if (now >= next_sync_)
+			{
+				next_sync_ = now + std::chrono::milliseconds(options_.sync_interval);
+
+				std::vector<const Peer*> live;
+				for (auto& peer : peers_)
+				{
+					if (peer.second.member.state != kDead)
+						live.push_back(&peer.second);
+				}
+
+				// alone, maybe after a partition: back through the seeds
+				if (live.empty())
+					join();
+				else
+					sync(live[random_() % live.size()]->endpoint, true);
+			}
+
+			probe();
+		}
+
+		auto self(shared_from_this());
+		probe_timer_.expires_from_now(std::chrono::milliseconds(options_.probe_interval));
+		probe_timer_.async_wait([this, self](const asio::error_code& ec)
+		{
+			if (!ec)
+				on_probe_timer();
+		});
+	}
+
+	// under mutex_
+	void Membership::probe()
+	{
+		// every member once per round, in an order new each round
+		int target = 0;
+		for (int attempts = 0; target == 0 && attempts < 2; attempts++)
+		{
+			while (round_index_ < round_.size())
+			{
+				int node = round_[round_index_++];
+
+				auto iter = peers_.find(node);
+				if (iter != peers_.end() && iter->second.member.state != kDead)
+				{
+					target = node;
+					break;
+				}
+			}
+
+			if (target == 0)
+			{
+				round_.clear();
+				round_index_ = 0;
+
+				for (auto& peer : peers_)
+				{
+					if (peer.second.member.state != kDead)
+						round_.push_back(peer.first);
+				}
+
+				std::shuffle(round_.begin(), round_.end(), random_);
+			}
+		}
+
+		if (target == 0)
+			return;
+
+		probing_ = target;
+		probe_seq_ = ++seq_;
+		probe_acked_ = false;
+		stats_.probes++;
+
+		std::string packet = header(kPing, probe_seq_, target);
+		piggyback(packet);
+		send(peers_[target].endpoint, packet);
+
+		auto self(shared_from_this());
+		indirect_timer_.expires_from_now(std::chrono::milliseconds(options_.probe_timeout));
+		indirect_timer_.async_wait([this, self](const asio::error_code& ec)
+		{
+			if (!ec)
+				on_indirect_timer();
+		});
+	}
+
+	void Membership::on_indirect_timer()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (closed_ || probing_ == 0 || probe_acked_)
+			return;
+
+		std::vector<const Peer*> helpers;
+		for (auto& peer : peers_)
+		{
+			if (peer.first != probing_ && peer.second.member.state == kAlive)
+				helpers.push_back(&peer.second);
+		}
+
+		std::shuffle(helpers.begin(), helpers.end(), random_);
+		helpers.resize(std::min(helpers.size(), (std::size_t)options_.indirect_probes));
+
+		for (auto helper : helpers)
+		{
+			std::string packet = header(kPingReq, probe_seq_, probing_);
+			piggyback(packet);
+			send(helper->endpoint, packet);
+
+			stats_.indirect_probes++;
+		}
+	}
+
+	// under mutex_; several packets when the view does not fit one
+	void Membership::sync(const asio::ip::udp::endpoint& to, bool reply)
+	{
+		std::vector<const Member*> members;
+		members.push_back(&self_);
+
+		for (auto& item : peers_)
+			members.push_back(&item.second.member);
+
+		std::size_t next = 0;
+		while (next < members.size())
+		{
+			std::string packet = header(kSync, reply ? ++seq_ : 0, 0);
+			uint16_t count = 0;
+
+			while (next < members.size() && put_member(packet, *members[next], options_.max_packet))
+			{
+				count++;
+				next++;
+			}
+
+			// one member larger than a packet
+			if (count == 0)
+			{
+				next++;
+				continue;
+			}
+
+			set_count(packet, count);
+			send(to, packet);
+
+			// one answer is enough
+			reply = false;
+		}
+	}
+
+	bool Membership::put_member(std::string& packet, const Member& member, std::size_t max_packet)
+	{
+		std::string services;
+		for (auto& name : member.services)
+		{
+			if (services.size() + name.size() + 1 > 255)
+				break;
+
+			if (!services.empty())
+				services += ',';
+			services += name;
+		}
+
+		std::size_t size = kMemberHeader + member.host.size() + services.size();
+		// room left for the tag
+		if (member.host.size() > 255 || packet.size() + size + kTag > max_packet)
+			return false;
+
+		packet += (char)member.state;
+		packet += (char)(uint8_t)member.host.size();
+		put16(packet, (uint16_t)member.node);
+		put32(packet, member.incarnation);
+		put16(packet, (uint16_t)member.port);
+		put16(packet, (uint16_t)member.router_port);
+		packet += (char)(uint8_t)services.size();
+		packet += member.host;
+		packet += services;
+		return true;
+	}
+
+	std::size_t Membership::get_member(const char *data, std::size_t size, Member& member)
+	{
+		if (size < kMemberHeader)
+			return 0;
+
+		std::size_t host_size = (uint8_t)data[1];
+		std::size_t services_size = (uint8_t)data[12];
+		if (size < kMemberHeader + host_size + services_size)
+			return 0;
+
+		member.state = (State)(uint8_t)data[0];
+		member.node = get16(data + 2);
+		member.incarnation = get32(data + 4);
+		member.port = get16(data + 8);
+		member.router_port = get16(data + 10);
+		member.host.assign(data + kMemberHeader, host_size);
+		member.services = split(std::string(data + kMemberHeader + host_size, services_size));
+
+		return kMemberHeader + host_size + services_size;
+	}
+
+	// under mutex_
+	void Membership::piggyback(std::string& packet)
+	{
+		std::stable_sort(broadcasts_.begin(), broadcasts_.end(),
+			[](const Broadcast& a, const Broadcast& b) { return a.transmits < b.transmits; });
+
+		int limit = retransmits();
+		uint16_t count = 0;
+
+		for (auto& broadcast : broadcasts_)
+		{
+			const Member *member = nullptr;
+			if (broadcast.node == self_.node)
+			{
+				member = &self_;
+			}
+			else
+			{
+				auto iter = peers_.find(broadcast.node);
+				if (iter == peers_.end())
+				{
+					broadcast.transmits = limit;
+					continue;
+				}
+				member = &iter->second.member;
+			}
+
+			if (!put_member(packet, *member, options_.max_packet))
+				break;
+
+			broadcast.transmits++;
+			count++;
+		}
+
+		broadcasts_.erase(std::remove_if(broadcasts_.begin(), broadcasts_.end(),
+			[limit](const Broadcast& broadcast) { return broadcast.transmits >= limit; }), broadcasts_.end());
+
+		set_count(packet, count);
+	}
+
+	// under mutex_
+	void Membership::send(const asio::ip::udp::endpoint& to, const std::string& packet)
+	{
+		char tag[kTag];
+		sign(options_.key, packet.data(), packet.size(), tag);
+
+		std::array<asio::const_buffer, 2> buffers = { { asio::buffer(packet), asio::buffer(tag) } };
+
+		// a full socket buffer loses the datagram like the network would
+		asio::error_code ec;
+		socket_.send_to(buffers, to, 0, ec);
+		stats_.packets_sent++;
+	}
+
+	std::string Membership::header(PacketType type, uint32_t seq, int target)
+	{
+		std::string packet;
+		packet.reserve(options_.max_packet);
+
+		packet += (char)type;
+		packet += (char)0;
+		put16(packet, (uint16_t)self_.node);
+		put32(packet, seq);
+		put16(packet, (uint16_t)target);
+		put16(packet, 0);
+		return packet;
+	}
+
+	// under mutex_
+	void Membership::merge(const Member& member)
+	{
+		if (member.node == self_.node)
+		{
+			if (member.state != kAlive && member.incarnation >= self_.incarnation)
+				refute(member.incarnation);
+			return;
+		}
+
+		if (member.node < 1 || member.node > Node::kMaxNode || member.state > kDead)
+			return;
+
+		auto iter = peers_.find(member.node);
+		if (iter == peers_.end())
+		{
+			// news of a suspect or dead node we never knew is no use
+			if (member.state != kAlive)
+				return;
+
+			asio::error_code ec;
+			asio::ip::address address = asio::ip::address::from_string(member.host, ec);
+			if (ec)
+				return;
+
+			Peer& peer = peers_[member.node];
+			peer.member = member;
+			peer.endpoint = asio::ip::udp::endpoint(address, (unsigned short)member.port);
+
+			// somewhere in this round, not a whole round away
+			std::size_t left = round_.size() - round_index_;
+			round_.insert(round_.begin() + round_index_ + random_() % (left + 1), member.node);
+
+			gossip(member.node);
+
+			if (listener_)
+				listener_(peer.member);
+			return;
+		}
+
+		Peer& peer = iter->second;
+
+		switch (member.state)
+		{
+		case kAlive:
+		{
+			if (member.incarnation <= peer.member.incarnation)
+				break;
+
+			asio::error_code ec;
+			asio::ip::address address = asio::ip::address::from_string(member.host, ec);
+			if (ec)
+				break;
+
+			peer.member.host = member.host;
+			peer.member.port = member.port;
+			peer.member.router_port = member.router_port;
+			peer.member.services = member.services;
+			peer.endpoint = asio::ip::udp::endpoint(address, (unsigned short)member.port);
+
+			change(peer, kAlive, member.incarnation);
+		}
+		break;
+		case kSuspect:
+		{
+			if (peer.member.state == kDead)
+				break;
+
+			if (member.incarnation > peer.member.incarnation
+				|| (member.incarnation == peer.member.incarnation && peer.member.state == kAlive))
+				change(peer, kSuspect, member.incarnation);
+		}
+		break;
+		case kDead:
+		{
+			if (peer.member.state != kDead && member.incarnation >= peer.member.incarnation)
+				change(peer, kDead, member.incarnation);
+		}
+		break;
+		}
+	}
+
+	// under mutex_
+	void Membership::change(Peer& peer, State state, uint32_t incarnation)
+	{
+		State was = peer.member.state;
+
+		peer.member.state = state;
+		peer.member.incarnation = incarnation;
+
+		if (state == kSuspect)
+			peer.deadline = Clock::now() + suspicion_timeout();
+		else if (state == kDead)
+			peer.deadline = Clock::now() + std::chrono::milliseconds(options_.dead_timeout);
+
+		if (state == kDead && was != kDead)
+		{
+			stats_.dead++;
+
+			fprintf(stderr, "node %d: node %d (%s:%d) is dead\n", options_.node,
+				peer.member.node, peer.member.host.c_str(), peer.member.port);
+		}
+
+		gossip(peer.member.node);
+
+		if (listener_)
+			listener_(peer.member);
+	}
+
+	// under mutex_
+	void Membership::refute(uint32_t incarnation)
+	{
+		self_.incarnation = incarnation + 1;
+		stats_.refuted++;
+
+		gossip(self_.node);
+	}
+
+	// under mutex_
+	void Membership::gossip(int node)
+	{
+		for (auto& broadcast : broadcasts_)
+		{
+			if (broadcast.node == node)
+			{
+				broadcast.transmits = 0;
+				return;
+			}
+		}
+
+		Broadcast broadcast;
+		broadcast.node = node;
+		broadcast.transmits = 0;
+		broadcasts_.push_back(broadcast);
+	}
+
+	int Membership::live_members() const
+	{
+		int count = 1;
+		for (auto& peer : peers_)
+		{
+			if (peer.second.member.state != kDead)
+				count++;
+		}
+		return count;
+	}
+
+	std::chrono::milliseconds Membership::suspicion_timeout() const
+	{
+		double scale = std::max(1.0, std::log10((double)live_members()));
+		return std::chrono::milliseconds((int64_t)(options_.suspicion_mult * scale * options_.probe_interval));
+	}
+
+	int Membership::retransmits() const
+	{
+		double scale = std::max(1.0, std::ceil(std::log10((double)live_members() + 1)));
+		return (int)(options_.retransmit_mult * scale);
+	}
+}
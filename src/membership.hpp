@@ -0,0 +1,275 @@
+#ifndef TENGINE_MEMBERSHIP_HPP
+#define TENGINE_MEMBERSHIP_HPP
+
+#include "asio.hpp"
+
+#include "allocator.hpp"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Context;
+	class Resolver;
+
+	// swim membership over udp. every probe period one member, taken in
+	// a shuffled round, is pinged; when no ack comes in probe_timeout a few
+	// others are asked to ping it for us, and when none of them hears back
+	// either it is suspected. a suspect that does not refute, by gossiping
+	// a higher incarnation of itself, is declared dead once the suspicion
+	// timeout runs out. news rides on the pings and acks, each update sent
+	// a number of times that grows with the log of the cluster. nodes join
+	// through any seed, which answers with its whole view; now and then
+	// the views of two members are exchanged whole to repair what gossip
+	// missed. a node that closes tells a few members it is leaving.
+	// packets carry an hmac under the cluster key and anything else is
+	// ignored
+	class Membership : public Allocator, public std::enable_shared_from_this<Membership>
+	{
+	public:
+		enum State : uint8_t
+		{
+			kAlive,
+			kSuspect,
+			kDead,
+		};
+
+		struct Options
+		{
+			// this node, from node.node
+			int node = 1;
+			// udp port gossip listens on, 0 disables membership
+			int port = 0;
+			// only this host by default, like the node router
+			std::string address = "127.0.0.1";
+			// shared by the cluster, node.key
+			std::string key;
+			// the address other nodes reach us at, host or ip; address, or
+			// the host name when that is a wildcard, when empty
+			std::string advertise;
+			// the tcp port of the node router, handed to the other nodes
+			int router_port = 0;
+			// "host:port, ..." gossip ports of nodes to join through
+			std::vector<std::string> seeds;
+			// milliseconds between probes
+			int probe_interval = 500;
+			// milliseconds to wait for an ack before probing indirectly
+			int probe_timeout = 200;
+			// members asked to probe for us
+			int indirect_probes = 3;
+			// a suspect is dead after suspicion_mult * log10(members) probe
+			// intervals, at least suspicion_mult
+			int suspicion_mult = 4;
+			// each update is piggybacked retransmit_mult * log10(members + 1)
+			// times, at least retransmit_mult
+			int retransmit_mult = 4;
+			// milliseconds between whole view exchanges with a random member,
+			// and between joins through the seeds while we know no one
+			int sync_interval = 30000;
+			// milliseconds a dead member is remembered, so stale news of it
+			// being alive is not believed
+			int dead_timeout = 60000;
+			// bytes in a datagram
+			int max_packet = 1400;
+		};
+
+		struct Member
+		{
+			int node;
+			std::string host;
+			int port;
+			int router_port;
+			uint32_t incarnation;
+			State state;
+			// names announced there
+			std::vector<std::string> services;
+		};
+
+		struct Stats
+		{
+			uint64_t probes;
+			uint64_t indirect_probes;
+			uint64_t suspected;
+			uint64_t refuted;
+			uint64_t dead;
+			uint64_t packets_sent;
+			uint64_t packets_received;
+			// with a bad tag
+			uint64_t packets_rejected;
+		};
+
+		// on the network thread, with the membership locked, when a member
+		// comes up, changes state or address, or goes down; suspects are
+		// still up
+		typedef std::function<void(const Member& member)> Listener;
+
+		static void load(Context& context, const char *conf, Options& options);
+
+		static const char *state_name(State state);
+
+		// encodes a member at the end of the packet, false when it and the
+		// tag do not fit in max_packet
+		static bool put_member(std::string& packet, const Member& member, std::size_t max_packet);
+
+		// decodes a member, the bytes it took or 0 when it is cut short
+		static std::size_t get_member(const char *data, std::size_t size, Member& member);
+
+		Membership(Resolver& resolver, asio::io_service& io_service, const Options& options);
+
+		Membership(const Membership&) = delete;
+
+		Membership& operator=(const Membership&) = delete;
+
+		~Membership();
+
+		void listen(Listener listener) { listener_ = std::move(listener); }
+
+		// binds the port and joins through the seeds; 0 on success
+		int start();
+
+		// tells some members we are leaving
+		void close();
+
+		// from any thread; this node's services as the others see them
+		void announce(const std::string& name);
+
+		// from any thread, this node included
+		std::vector<Member> members();
+
+		Stats stats();
+
+	private:
+		enum PacketType : uint8_t
+		{
+			kPing,
+			kPingReq,
+			kAck,
+			// a whole view, answered in kind when seq is set
+			kSync,
+		};
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct Peer
+		{
+			Member member;
+			asio::ip::udp::endpoint endpoint;
+			// when a suspect is declared dead, or a dead member forgotten
+			Clock::time_point deadline;
+		};
+
+		struct Broadcast
+		{
+			int node;
+			int transmits;
+		};
+
+		// a ping-req we are serving: its ack goes back to the asker
+		struct Relay
+		{
+			asio::ip::udp::endpoint asker;
+			uint32_t seq;
+			Clock::time_point expires;
+		};
+
+		void on_resolved(const asio::error_code& ec, const std::string& host);
+
+		void join();
+
+		void do_receive();
+
+		void on_packet(const char *data, std::size_t size, const asio::ip::udp::endpoint& from);
+
+		void on_probe_timer();
+
+		void on_indirect_timer();
+
+		void probe();
+
+		void sync(const asio::ip::udp::endpoint& to, bool reply);
+
+		// fills the packet with the least sent news
+		void piggyback(std::string& packet);
+
+		void send(const asio::ip::udp::endpoint& to, const std::string& packet);
+
+		std::string header(PacketType type, uint32_t seq, int target);
+
+		// applies news of a member, under mutex_
+		void merge(const Member& member);
+
+		void change(Peer& peer, State state, uint32_t incarnation);
+
+		void refute(uint32_t incarnation);
+
+		void gossip(int node);
+
+		int live_members() const;
+
+		std::chrono::milliseconds suspicion_timeout() const;
+
+		int retransmits() const;
+
+		Resolver& resolver_;
+
+		asio::io_service& io_service_;
+
+		Options options_;
+
+		asio::ip::udp::socket socket_;
+
+		asio::steady_timer probe_timer_;
+
+		asio::steady_timer indirect_timer_;
+
+		std::vector<char> buffer_;
+
+		asio::ip::udp::endpoint sender_;
+
+		std::mutex mutex_;
+
+		// ourselves as we tell it
+		Member self_;
+
+		std::map<int, Peer> peers_;
+
+		std::vector<Broadcast> broadcasts_;
+
+		// this round's probe order
+		std::vector<int> round_;
+
+		std::size_t round_index_;
+
+		// the member being probed, 0 between probes
+		int probing_;
+
+		uint32_t probe_seq_;
+
+		bool probe_acked_;
+
+		uint32_t seq_;
+
+		std::map<uint32_t, Relay> relays_;
+
+		Clock::time_point next_sync_;
+
+		std::minstd_rand random_;
+
+		Listener listener_;
+
+		Stats stats_;
+
+		bool closed_;
+	};
+}
+
+#endif // ! TENGINE_MEMBERSHIP_HPP
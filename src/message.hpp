@@ -3,6 +3,7 @@
 
 #include "allocator.hpp"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -95,6 +96,78 @@ namespace tengine
 
 	typedef std::deque<Message> MessageDeque;
 
+	// reassembles [uint16 length][body] frames from arbitrary stream chunks.
+	// frames that arrive whole are handed out in place, only a frame split
+	// across chunks is copied.
+	class MessageReader : public Allocator
+	{
+	public:
+		MessageReader()
+			: message_()
+			, have_(0)
+		{
+		}
+
+		// false on a length above max_body_length, the stream is then unusable
+		template<class Handler>
+		bool feed(const char *data, std::size_t size, Handler handler)
+		{
+			while (size > 0)
+			{
+				if (have_ == 0 && size >= Message::header_length)
+				{
+					uint16_t length;
+					std::memcpy(&length, data, Message::header_length);
+					if (length > Message::max_body_length)
+						return false;
+
+					std::size_t frame = Message::header_length + length;
+					if (size >= frame)
+					{
+						handler(data + Message::header_length, (std::size_t)length);
+						data += frame;
+						size -= frame;
+						continue;
+					}
+				}
+
+				if (have_ < Message::header_length)
+				{
+					std::size_t n = std::min(size, Message::header_length - have_);
+					std::memcpy(message_.data() + have_, data, n);
+					have_ += n;
+					data += n;
+					size -= n;
+
+					if (have_ < Message::header_length)
+						break;
+
+					if (!message_.decode_header())
+						return false;
+				}
+
+				std::size_t n = std::min(size, (std::size_t)message_.length() - have_);
+				std::memcpy(message_.data() + have_, data, n);
+				have_ += n;
+				data += n;
+				size -= n;
+
+				if (have_ == message_.length())
+				{
+					handler(message_.body(), (std::size_t)message_.body_length());
+					have_ = 0;
+				}
+			}
+
+			return true;
+		}
+
+	private:
+		Message message_;
+
+		std::size_t have_;
+	};
+
 }
 
 #endif
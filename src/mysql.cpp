@@ -2,51 +2,156 @@
 
 #include "context.hpp"
 #include "executor.hpp"
+#include "blocking_pool.hpp"
 #include "service.hpp"
 #include "message.hpp"
 
 #include "asio/ts/executor.hpp"
 
+#include "errmsg.h"
+
+#include <algorithm>
+#include <cstring>
+
 namespace tengine
 {
 	constexpr int MySql::MYSQL_KEY;
 
 	MySql::MySql(Service* s)
 		: ServiceProxy(s)
-		, executor_(new Executor())
-		, mysql_mutex_()
-		, mysql_used_()
-		, mysql_free_()
-		, mysql_cond_()
+		, conf_()
+		, cache_(nullptr)
+		, clients_()
+		, queue_()
+		, replicas_()
+		, replica_policy_(kWeighted)
+		, rotation_(0)
+		, read_your_writes_(1000)
+		, replica_retry_(5000)
+		, pinned_until_()
+		, user_()
+		, password_()
+		, db_()
+		, min_connections_(2)
+		, max_connections_(2)
+		, ping_interval_(30000)
+		, idle_timeout_(300000)
+		, timer_(s->context().service_executor().io_service())
+		, maintaining_(false)
+		, pools_()
+		, statement_cache_(256)
+		, self_(std::make_shared<MySql*>(this))
 	{
 
 	}
 
 	MySql::~MySql()
 	{
-		if (this->executor_ != nullptr)
-		{
-			delete executor_;
-			executor_ = nullptr;
-		}
+		self_.reset();
 
-		for (auto mysql : mysql_free_)
+		for (auto& client : clients_)
+			client->close();
+
+		// queries still running hold a connection, wait for them
+		if (queue_)
+			queue_->close();
+
+		asio::error_code ec;
+		timer_.cancel(ec);
+
+		for (auto pool : pools_)
 		{
-			mysql_close(mysql);
+			for (auto conn : pool->idle)
+			{
+				close(conn);
+			}
+
+			for (auto conn : pool->used)
+			{
+				close(conn);
+			}
+
+			delete pool;
 		}
-		mysql_free_.clear();
+		pools_.clear();
+	}
+
+	void MySql::load_replicas(const char *conf, uint16_t port)
+	{
+		Context& context = host_->context();
+
+		char key[256];
+		snprintf(key, sizeof(key), "%s.replicas", conf);
+
+		// "10.0.0.2:3306*2, 10.0.0.3", port and weight optional
+		std::string spec = context.config(key, "");
 
-		for (auto mysql : mysql_used_)
+		std::size_t begin = 0;
+		while (begin < spec.size())
 		{
-			mysql_close(mysql);
+			std::size_t end = spec.find(',', begin);
+			if (end == std::string::npos)
+				end = spec.size();
+
+			std::string item = spec.substr(begin, end - begin);
+			begin = end + 1;
+
+			item.erase(0, item.find_first_not_of(" \t"));
+			item.erase(item.find_last_not_of(" \t") + 1);
+			if (item.empty())
+				continue;
+
+			Replica replica;
+			replica.port = port;
+			replica.weight = 1;
+			replica.current = 0;
+
+			std::size_t star = item.find('*');
+			if (star != std::string::npos)
+			{
+				replica.weight = std::max(1, std::atoi(item.c_str() + star + 1));
+				item.erase(star);
+			}
+
+			std::size_t colon = item.rfind(':');
+			if (colon != std::string::npos)
+			{
+				replica.port = (uint16_t)std::atoi(item.c_str() + colon + 1);
+				item.erase(colon);
+			}
+
+			replica.host = item;
+			replicas_.push_back(replica);
 		}
-		mysql_used_.clear();
+
+		snprintf(key, sizeof(key), "%s.replica_policy", conf);
+		if (std::strcmp(context.config(key, "weighted"), "least_load") == 0)
+			replica_policy_ = kLeastLoad;
+
+		snprintf(key, sizeof(key), "%s.read_your_writes", conf);
+		read_your_writes_ = std::max(0, context.config(key, read_your_writes_));
+
+		snprintf(key, sizeof(key), "%s.replica_retry", conf);
+		replica_retry_ = std::max(0, context.config(key, replica_retry_));
 	}
 
 	int MySql::start(const char *conf)
 	{
+		conf_ = conf;
+
+		MySqlCache *cache = host_->context().mysql_cache(conf);
+		if (cache->enabled())
+			cache_ = cache;
 
 		char key[256];
+		snprintf(key, sizeof(key), "%s.port", conf);
+		load_replicas(conf, (uint16_t)host_->context().config(key, 3306));
+
+		snprintf(key, sizeof(key), "%s.engine", conf);
+
+		if (std::strcmp(host_->context().config(key, "blocking"), "async") == 0)
+			return start_async(conf);
+
 		snprintf(key, sizeof(key), "%s.host", conf);
 
 		std::string host = host_->context().config(key, "");
@@ -54,18 +159,18 @@ namespace tengine
 			return 1;
 
 		snprintf(key, sizeof(key), "%s.user", conf);
-		std::string user = host_->context().config(key, "");
-		if (user.empty())
+		user_ = host_->context().config(key, "");
+		if (user_.empty())
 			return 1;
 
 		snprintf(key, sizeof(key), "%s.password", conf);
-		std::string password = host_->context().config(key, "");
-		if (password.empty())
+		password_ = host_->context().config(key, "");
+		if (password_.empty())
 			return 1;
 
 		snprintf(key, sizeof(key), "%s.db", conf);
-		std::string db = host_->context().config(key, "");
-		if (db.empty())
+		db_ = host_->context().config(key, "");
+		if (db_.empty())
 			return 1;
 
 		snprintf(key, sizeof(key), "%s.port", conf);
@@ -75,102 +180,1379 @@ namespace tengine
 
 		int connection_num = host_->context().config(key, 2);
 
-		for (int i = 0; i < connection_num; i++)
+		// connection_pool alone keeps the pool at a fixed size
+		snprintf(key, sizeof(key), "%s.min_connections", conf);
+		int min_connections = std::max(1, host_->context().config(key, connection_num));
+
+		snprintf(key, sizeof(key), "%s.max_connections", conf);
+		int max_connections = std::max(min_connections, host_->context().config(key, min_connections));
+
+		min_connections_ = (std::size_t)min_connections;
+		max_connections_ = (std::size_t)max_connections;
+
+		snprintf(key, sizeof(key), "%s.ping_interval", conf);
+		ping_interval_ = std::max(0, host_->context().config(key, ping_interval_));
+
+		snprintf(key, sizeof(key), "%s.idle_timeout", conf);
+		idle_timeout_ = std::max(0, host_->context().config(key, idle_timeout_));
+
+		// min and max hold for each server
+		for (std::size_t i = 0; i <= replicas_.size(); i++)
+		{
+			Pool *pool = new Pool();
+			pool->host = i == 0 ? host : replicas_[i - 1].host;
+			pool->port = i == 0 ? (uint16_t)port : replicas_[i - 1].port;
+			pool->total = 0;
+			pool->load = 0;
+			pool->down_until = 0;
+			pool->stats.host = pool->host;
+			pool->stats.port = pool->port;
+			pools_.push_back(pool);
+		}
+
+		for (auto pool : pools_)
+		{
+			for (std::size_t i = 0; i < min_connections_; i++)
+			{
+				MySqlResult failure;
+				MYSQL *mysql = open(*pool, failure);
+				if (mysql == nullptr)
+				{
+					fprintf(stderr, "mysql can't connect to %s:%d: %s\n",
+						pool->host.c_str(), (int)pool->port, failure.error.c_str());
+
+					// a replica may come up later, reads go to the primary meanwhile
+					if (pool == pools_[0])
+						return 1;
+
+					pool->down_until = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+						(Clock::now() + std::chrono::milliseconds(replica_retry_)).time_since_epoch()).count();
+					break;
+				}
+
+				Connection *conn = new Connection();
+				conn->pool = pool;
+				conn->mysql = mysql;
+				conn->since = conn->pinged = Clock::now();
+
+				pool->idle.push_back(conn);
+				pool->total++;
+			}
+		}
+
+		snprintf(key, sizeof(key), "%s.statement_cache", conf);
+		statement_cache_ = (std::size_t)std::max(1, host_->context().config(key, 256));
+
+		snprintf(key, sizeof(key), "%s.thread_num", conf);
+
+		int thread_num = host_->context().config(key, 1);
+
+		// never more running than connections can grow to, so get() only
+		// parks a pool thread when max_connections are all busy
+		int servers = (int)pools_.size();
+		std::size_t limit = (std::size_t)std::max(1, std::min(thread_num, max_connections * servers));
+		queue_ = host_->context().blocking_pool().queue("mysql", limit);
+
+		arm_timer();
+
+		return 0;
+	}
+
+	namespace
+	{
+		uint64_t elapsed_us(std::chrono::steady_clock::time_point from,
+			std::chrono::steady_clock::time_point to)
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+		}
+
+		int64_t epoch_ms(std::chrono::steady_clock::time_point time)
+		{
+			return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+				time.time_since_epoch()).count();
+		}
+
+		// the session died before the statement reached the server, e.g.
+		// killed by wait_timeout while idle, so running it again is safe.
+		// CR_SERVER_LOST may come after the server ran it and is not retried
+		bool is_gone(unsigned int code)
+		{
+			return code == CR_SERVER_GONE_ERROR;
+		}
+
+		// a connection that failed like this is not handed out again
+		bool is_broken(const MYSQL *mysql, const MySqlResult& result)
+		{
+			return mysql == nullptr || result.error_code == CR_SERVER_GONE_ERROR ||
+				result.error_code == CR_SERVER_LOST;
+		}
+
+		// the miss one caller runs for every caller that joined it; if the
+		// handler is dropped unrun, with its queue closed or its service
+		// gone, they are woken with an error rather than left waiting
+		class CacheFill
 		{
-			MYSQL *mysql = mysql_init(NULL);
+		public:
+			CacheFill(MySqlCache *cache, std::string key, std::vector<std::string> tags, int ttl)
+				: cache_(cache)
+				, key_(std::move(key))
+				, tags_(std::move(tags))
+				, ttl_(ttl)
+			{
+
+			}
 
-			if (!mysql)
-				return 1;
+			CacheFill(const CacheFill&) = delete;
 
-			char timeout = 10;
-			mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+			CacheFill& operator=(const CacheFill&) = delete;
 
-			if (0 != mysql_options(mysql, MYSQL_SET_CHARSET_NAME, "utf8"))
+			~CacheFill()
 			{
-				mysql_error(mysql);
-				return 1;
+				if (cache_ != nullptr)
+				{
+					MySqlResultPtr result = std::make_shared<MySqlResult>();
+					result->fail(CR_UNKNOWN_ERROR, "result dropped");
+					complete(result);
+				}
 			}
 
-			if (mysql_real_connect(mysql, host.c_str(), user.c_str(),
-				password.c_str(), db.c_str(), port, NULL, 0) == NULL)
+			void complete(const MySqlResultPtr& result)
 			{
-				mysql_error(mysql);
-				return 1;
+				MySqlCache *cache = cache_;
+				if (cache == nullptr)
+					return;
+
+				cache_ = nullptr;
+				cache->complete(key_, tags_, ttl_, result);
 			}
-			else
+
+		private:
+			MySqlCache *cache_;
+
+			std::string key_;
+
+			std::vector<std::string> tags_;
+
+			int ttl_;
+		};
+
+		// batches of a blocking stream posted to the service at once; the
+		// fetch waits for one to be handled before reading more rows, so a
+		// slow consumer leaves the rest on the server
+		const std::size_t kStreamWindow = 2;
+
+		struct StreamWindow
+		{
+			std::mutex mutex;
+
+			std::condition_variable cond;
+
+			// posted and not yet handled
+			std::size_t out = 0;
+		};
+
+		// one batch's place in the window, given back once its handler is
+		// done with it or dropped unrun
+		class StreamSlot
+		{
+		public:
+			explicit StreamSlot(const std::shared_ptr<StreamWindow>& window)
+				: window_(window)
+			{
+				std::lock_guard<std::mutex> lock(window_->mutex);
+				window_->out++;
+			}
+
+			StreamSlot(const StreamSlot&) = delete;
+
+			StreamSlot& operator=(const StreamSlot&) = delete;
+
+			~StreamSlot()
 			{
-				const char sql[] = "set interactive_timeout=24*3600";
-				int ret = mysql_real_query(
-					mysql, sql, (unsigned long)sizeof(sql));
-				if (ret != 0)
 				{
-					mysql_error(mysql);
-					return 1;
+					std::lock_guard<std::mutex> lock(window_->mutex);
+					window_->out--;
 				}
+				window_->cond.notify_one();
 			}
 
-			mysql_free_.push_back(mysql);
+		private:
+			std::shared_ptr<StreamWindow> window_;
+		};
+	}
+
+	MYSQL* MySql::open(Pool& pool, MySqlResult& result)
+	{
+		MYSQL *mysql = mysql_init(NULL);
+		if (mysql == nullptr)
+		{
+			result.fail(CR_OUT_OF_MEMORY, "mysql_init failed");
+			return nullptr;
 		}
 
-		snprintf(key, sizeof(key), "%s.thread_num", conf);
+		unsigned int timeout = 10;
+		mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
 
-		int thread_num = host_->context().config(key, 1);
+		const char sql[] = "set interactive_timeout=24*3600";
 
-		this->executor_->run(thread_num);
+		if (mysql_options(mysql, MYSQL_SET_CHARSET_NAME, "utf8") != 0 ||
+			mysql_real_connect(mysql, pool.host.c_str(), user_.c_str(),
+				password_.c_str(), db_.c_str(), pool.port, NULL, 0) == NULL ||
+			mysql_real_query(mysql, sql, (unsigned long)(sizeof(sql) - 1)) != 0)
+		{
+			result.fail(mysql_errno(mysql), mysql_error(mysql), mysql_sqlstate(mysql));
+			mysql_close(mysql);
+			return nullptr;
+		}
 
-		return 0;
+		return mysql;
 	}
 
-	MYSQL* MySql::get()
+	bool MySql::reconnect(Connection& conn, MySqlResult& result)
 	{
-		std::unique_lock<std::mutex> lock(mysql_mutex_);
+		// the server side of every statement went with the old session
+		for (auto& statement : conn.statements.statements)
+			mysql_stmt_close(statement.second);
+		conn.statements.statements.clear();
+		conn.statements.order.clear();
+
+		if (conn.mysql != nullptr)
+			mysql_close(conn.mysql);
+
+		Pool& pool = *conn.pool;
+		conn.mysql = open(pool, result);
 
-		while (mysql_free_.empty())
-			mysql_cond_.wait(lock);
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			pool.stats.reconnects++;
+		}
+
+		if (conn.mysql == nullptr)
+		{
+			fprintf(stderr, "mysql can't reconnect to %s:%d: %s\n",
+				pool.host.c_str(), (int)pool.port, result.error.c_str());
 
-		auto conn = mysql_free_.front();
-		mysql_used_.insert(conn);
-		mysql_free_.pop_front();
+			if (&pool != pools_[0])
+			{
+				pool.down_until = epoch_ms(Clock::now() +
+					std::chrono::milliseconds(replica_retry_));
+			}
+			return false;
+		}
 
-		return conn;
+		conn.pinged = Clock::now();
+		return true;
 	}
 
-	void MySql::put(MYSQL* mysql)
+	bool MySql::real_query(Connection& conn, const std::string& sql, MySqlResult& result)
 	{
-		std::unique_lock<std::mutex> lock(mysql_mutex_);
+		if (mysql_real_query(conn.mysql, sql.data(), (unsigned long)sql.size()) == 0)
+			return true;
+
+		if (is_gone(mysql_errno(conn.mysql)))
+		{
+			if (!reconnect(conn, result))
+				return false;
 
-		mysql_used_.erase(mysql);
-		mysql_free_.push_back(mysql);
+			if (mysql_real_query(conn.mysql, sql.data(), (unsigned long)sql.size()) == 0)
+				return true;
+		}
 
-		mysql_cond_.notify_one();
+		result.fail(mysql_errno(conn.mysql), mysql_error(conn.mysql), mysql_sqlstate(conn.mysql));
+		return false;
 	}
 
-	void MySql::query(const char *sql, std::size_t size, Handler handler)
+	void MySql::close(Connection *conn)
 	{
-		asio::post(executor_->executor(),
-			[=]
+		for (auto& statement : conn->statements.statements)
+			mysql_stmt_close(statement.second);
+
+		if (conn->mysql != nullptr)
+			mysql_close(conn->mysql);
+
+		delete conn;
+	}
+
+	MySql::Connection* MySql::get(Pool& pool, MySqlResult& result)
+	{
+		Clock::time_point begin = Clock::now();
+
+		std::unique_lock<std::mutex> lock(pool.mutex);
+
+		auto take = [&](Connection *conn)
 		{
-			MYSQL *mysql = get();
+			Clock::time_point now = Clock::now();
+			conn->since = now;
+			pool.used.insert(conn);
+
+			pool.stats.wait.record(elapsed_us(begin, now));
+			pool.stats.busy.record(pool.used.size());
 
-			int ret = mysql_real_query(mysql, sql, size);
+			return conn;
+		};
 
-			if (ret != 0)
+		while (pool.idle.empty())
+		{
+			// grow instead of waiting while below max_connections
+			if (pool.total < max_connections_)
 			{
-				put(mysql);
+				pool.total++;
+				lock.unlock();
+
+				MySqlResult failure;
+				MYSQL *mysql = open(pool, failure);
+
+				lock.lock();
+
+				if (mysql != nullptr)
+				{
+					Connection *conn = new Connection();
+					conn->pool = &pool;
+					conn->mysql = mysql;
+					conn->pinged = Clock::now();
+
+					if (pool.total > min_connections_)
+						pool.stats.grown++;
+
+					return take(conn);
+				}
+
+				pool.total--;
+
+				// nothing busy, so nothing will come back to wait for
+				if (pool.used.empty() && pool.idle.empty())
+				{
+					result = failure;
+					return nullptr;
+				}
+
+				if (!pool.idle.empty())
+					break;
+			}
+
+			pool.cond.wait(lock);
+		}
+
+		Connection *conn = pool.idle.front();
+		pool.idle.pop_front();
+
+		return take(conn);
+	}
+
+	MySql::Connection* MySql::acquire(std::size_t server, MySqlResult& result)
+	{
+		Connection *conn = get(*pools_[server], result);
+		if (conn != nullptr || server == 0)
+			return conn;
+
+		// the replica refused, its reads go to the primary for a while
+		pools_[server]->down_until = epoch_ms(Clock::now() +
+			std::chrono::milliseconds(replica_retry_));
+
+		result = MySqlResult();
+		return get(*pools_[0], result);
+	}
 
-				handler(this, nullptr, mysql_error(mysql));
+	void MySql::put(Connection *conn, bool broken)
+	{
+		Clock::time_point now = Clock::now();
+
+		Pool& pool = *conn->pool;
+		std::unique_lock<std::mutex> lock(pool.mutex);
+
+		pool.used.erase(conn);
+		pool.stats.latency.record(elapsed_us(conn->since, now));
+
+		if (broken)
+		{
+			// the next get() opens a fresh one in its place
+			pool.total--;
+			pool.cond.notify_one();
+
+			lock.unlock();
+			close(conn);
+			return;
+		}
+
+		conn->since = now;
+		pool.idle.push_front(conn);
+
+		pool.cond.notify_one();
+	}
+
+	void MySql::arm_timer()
+	{
+		int tick = ping_interval_;
+		if (idle_timeout_ > 0 && max_connections_ > min_connections_ &&
+			(tick == 0 || idle_timeout_ < tick))
+			tick = idle_timeout_;
+
+		if (tick == 0)
+			return;
+
+		// half the shorter period, so neither is overshot by more than that
+		timer_.expires_from_now(std::chrono::milliseconds(std::max(100, tick / 2)));
+		timer_.async_wait(
+			[this](const asio::error_code& ec)
+		{
+			if (ec == asio::error::operation_aborted)
 				return;
+
+			// behind queries, and only one waiting at a time
+			if (!maintaining_.exchange(true))
+			{
+				queue_->post(BlockingPool::kLow,
+					[this]
+				{
+					maintain();
+				});
 			}
 
-			asio::post(host_->executor(),
-				[=]
+			arm_timer();
+		});
+	}
+
+	void MySql::maintain()
+	{
+		maintaining_ = false;
+
+		for (auto pool : pools_)
+			maintain(*pool);
+	}
+
+	void MySql::maintain(Pool& pool)
+	{
+		Clock::time_point now = Clock::now();
+
+		std::vector<Connection*> expired;
+		std::vector<Connection*> idle;
+
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+
+			// from the tail, the longest idle are shrunk first
+			auto iter = pool.idle.end();
+			while (iter != pool.idle.begin())
 			{
-				handler(this, mysql, nullptr);
+				--iter;
+				Connection *conn = *iter;
 
-				this->put(mysql);
-			});
+				if (idle_timeout_ > 0 && pool.total > min_connections_ &&
+					now - conn->since >= std::chrono::milliseconds(idle_timeout_))
+				{
+					expired.push_back(conn);
+					pool.total--;
+					pool.stats.shrunk++;
+					iter = pool.idle.erase(iter);
+					continue;
+				}
 
-		});
+				Clock::time_point last = std::max(conn->since, conn->pinged);
+				if (ping_interval_ > 0 &&
+					now - last >= std::chrono::milliseconds(ping_interval_))
+				{
+					// out of the free list while pinged, get() won't see it
+					idle.push_back(conn);
+					pool.used.insert(conn);
+					iter = pool.idle.erase(iter);
+				}
+			}
+		}
+
+		for (auto conn : expired)
+			close(conn);
+
+		for (auto conn : idle)
+		{
+			bool alive = mysql_ping(conn->mysql) == 0;
+			if (alive)
+			{
+				conn->pinged = Clock::now();
+			}
+			else
+			{
+				{
+					std::lock_guard<std::mutex> lock(pool.mutex);
+					pool.stats.ping_failures++;
+				}
+
+				MySqlResult failure;
+				alive = reconnect(*conn, failure);
+			}
+
+			std::unique_lock<std::mutex> lock(pool.mutex);
+
+			pool.used.erase(conn);
+
+			if (alive)
+			{
+				// still the idlest, back at the tail
+				pool.idle.push_back(conn);
+			}
+			else
+			{
+				pool.total--;
+				lock.unlock();
+				close(conn);
+				lock.lock();
+			}
+
+			pool.cond.notify_one();
+		}
+
+		// a replica sitting out is not dialed again until its time is up
+		if (pool.down_until > epoch_ms(Clock::now()))
+			return;
+
+		// refill what failed pings or broken calls took below the min
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(pool.mutex);
+				if (pool.total >= min_connections_)
+					break;
+				pool.total++;
+			}
+
+			MySqlResult failure;
+			MYSQL *mysql = open(pool, failure);
+
+			std::lock_guard<std::mutex> lock(pool.mutex);
+
+			if (mysql == nullptr)
+			{
+				pool.total--;
+				if (&pool != pools_[0])
+				{
+					pool.down_until = epoch_ms(Clock::now() +
+						std::chrono::milliseconds(replica_retry_));
+				}
+				break;
+			}
+
+			Connection *conn = new Connection();
+			conn->pool = &pool;
+			conn->mysql = mysql;
+			conn->since = conn->pinged = Clock::now();
+
+			pool.idle.push_back(conn);
+			pool.cond.notify_one();
+		}
+	}
+
+	std::vector<MySql::PoolStats> MySql::pool_stats()
+	{
+		std::vector<PoolStats> stats;
+
+		for (auto pool : pools_)
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+
+			stats.push_back(pool->stats);
+			stats.back().connections = pool->idle.size() + pool->used.size();
+			stats.back().idle = pool->idle.size();
+			stats.back().in_flight = pool->used.size();
+		}
+
+		return stats;
+	}
+
+	void MySql::pin()
+	{
+		if (read_your_writes_ > 0)
+			pinned_until_ = Clock::now() + std::chrono::milliseconds(read_your_writes_);
+	}
+
+	std::size_t MySql::route(const char *sql, std::size_t size, Handler& handler)
+	{
+		if (replicas_.empty())
+			return 0;
+
+		if (!MySqlCache::read_only(sql, size))
+		{
+			// from now, so reads sent behind the write wait for it, and
+			// again once it is done to cover the replication lag
+			pin();
+
+			Handler inner = std::move(handler);
+			handler = [inner](MySql *self, const MySqlResultPtr& result)
+			{
+				self->pin();
+				inner(self, result);
+			};
+			return 0;
+		}
+
+		if (Clock::now() < pinned_until_)
+			return 0;
+
+		int64_t now = epoch_ms(Clock::now());
+
+		std::size_t best = 0;
+		std::size_t best_load = 0;
+		int total = 0;
+
+		std::size_t count = replicas_.size();
+		rotation_++;
+
+		for (std::size_t n = 0; n < count; n++)
+		{
+			std::size_t i = replica_policy_ == kLeastLoad ? (rotation_ + n) % count : n;
+			Replica& replica = replicas_[i];
+
+			std::size_t load;
+			if (!clients_.empty())
+			{
+				MySqlClient::Stats stats = clients_[i + 1]->stats();
+				if (stats.ready == 0)
+					continue;
+				load = stats.queued + stats.in_flight;
+			}
+			else
+			{
+				if (pools_[i + 1]->down_until > now)
+					continue;
+				load = pools_[i + 1]->load;
+			}
+
+			if (replica_policy_ == kLeastLoad)
+			{
+				// fewest calls per unit of weight
+				if (best == 0 || load * (std::size_t)replicas_[best - 1].weight <
+					best_load * (std::size_t)replica.weight)
+				{
+					best = i + 1;
+					best_load = load;
+				}
+			}
+			else
+			{
+				replica.current += replica.weight;
+				total += replica.weight;
+
+				if (best == 0 || replica.current > replicas_[best - 1].current)
+					best = i + 1;
+			}
+		}
+
+		// every replica down or still connecting, the primary answers
+		if (best != 0 && replica_policy_ == kWeighted)
+			replicas_[best - 1].current -= total;
+
+		return best;
+	}
+
+	int MySql::start_async(const char *conf)
+	{
+		Context& context = host_->context();
+
+		char key[256];
+		MySqlClient::Options options;
+
+		snprintf(key, sizeof(key), "%s.host", conf);
+		options.host = context.config(key, "");
+		if (options.host.empty())
+			return 1;
+
+		snprintf(key, sizeof(key), "%s.port", conf);
+		options.port = (uint16_t)context.config(key, 3306);
+
+		snprintf(key, sizeof(key), "%s.user", conf);
+		options.user = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.password", conf);
+		options.password = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.db", conf);
+		options.db = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.connection_pool", conf);
+		options.connections = context.config(key, 2);
+
+		snprintf(key, sizeof(key), "%s.pipeline", conf);
+		options.pipeline = context.config(key, options.pipeline);
+
+		snprintf(key, sizeof(key), "%s.queue_limit", conf);
+		options.queue_limit = context.config(key, options.queue_limit);
+
+		snprintf(key, sizeof(key), "%s.timeout", conf);
+		options.timeout = context.config(key, options.timeout);
+
+		snprintf(key, sizeof(key), "%s.connect_timeout", conf);
+		options.connect_timeout = context.config(key, options.connect_timeout);
+
+		snprintf(key, sizeof(key), "%s.reconnect_delay", conf);
+		options.reconnect_delay = context.config(key, options.reconnect_delay);
+
+		snprintf(key, sizeof(key), "%s.statement_cache", conf);
+		options.statement_cache = std::max(1, context.config(key, options.statement_cache));
+
+		// the same login and pipeline settings on every replica
+		for (std::size_t i = 0; i <= replicas_.size(); i++)
+		{
+			if (i > 0)
+			{
+				options.host = replicas_[i - 1].host;
+				options.port = replicas_[i - 1].port;
+			}
+
+			auto client = std::make_shared<MySqlClient>(
+				context.net_executor().io_service(), context.resolver(), options);
+			client->start();
+			clients_.push_back(client);
+		}
+
+		return 0;
+	}
+
+	namespace
+	{
+		// copy out the reply while still on the connection's thread, so the
+		// connection goes back to the pool before lua sees the rows
+		MySqlResultPtr fetch_result(MYSQL *mysql)
+		{
+			MySqlResultPtr result = std::make_shared<MySqlResult>();
+
+			if (mysql_field_count(mysql) == 0)
+			{
+				result->affected_rows = mysql_affected_rows(mysql);
+				result->insert_id = mysql_insert_id(mysql);
+				result->warnings = (uint16_t)mysql_warning_count(mysql);
+				result->sqlstate = mysql_sqlstate(mysql);
+				return result;
+			}
+
+			MYSQL_RES *res = mysql_store_result(mysql);
+			if (res == nullptr)
+			{
+				result->fail(mysql_errno(mysql), mysql_error(mysql), mysql_sqlstate(mysql));
+				return result;
+			}
+
+			unsigned int num_fields = mysql_num_fields(res);
+			MYSQL_FIELD *fields = mysql_fetch_fields(res);
+
+			for (unsigned int i = 0; i < num_fields; i++)
+			{
+				MySqlResult::Field field;
+				field.name = fields[i].name;
+				field.type = (uint8_t)fields[i].type;
+				field.flags = (uint16_t)fields[i].flags;
+				field.decimals = (uint8_t)fields[i].decimals;
+				result->add_field(field);
+			}
+
+			MYSQL_ROW row;
+			while ((row = mysql_fetch_row(res)))
+			{
+				unsigned long *lengths = mysql_fetch_lengths(res);
+
+				for (unsigned int i = 0; i < num_fields; i++)
+				{
+					if (row[i] == nullptr)
+						result->add_null();
+					else
+						result->add_value(row[i], lengths[i]);
+				}
+			}
+
+			mysql_free_result(res);
+
+			return result;
+		}
+	}
+
+	void MySql::query(const char *sql, std::size_t size, Handler handler)
+	{
+		handler = invalidating(sql, size, std::move(handler));
+
+		std::size_t server = route(sql, size, handler);
+
+		if (!clients_.empty())
+		{
+			clients_[server]->query(std::string(sql, size),
+				[this, handler](const MySqlResultPtr& result)
+			{
+				asio::post(host_->executor(),
+					[this, handler, result]
+				{
+					handler(this, result);
+				});
+			});
+			return;
+		}
+
+		// the caller's buffer is gone by the time a pool thread gets here
+		std::string statement(sql, size);
+
+		pools_[server]->load++;
+
+		queue_->post(
+			[=]
+		{
+			MySqlResultPtr result = std::make_shared<MySqlResult>();
+
+			Connection *conn = acquire(server, *result);
+			if (conn != nullptr)
+			{
+				if (real_query(*conn, statement, *result))
+					result = fetch_result(conn->mysql);
+
+				put(conn, is_broken(conn->mysql, *result));
+			}
+
+			pools_[server]->load--;
+
+			asio::post(host_->executor(),
+				[=]
+			{
+				handler(this, result);
+			});
+
+		});
+	}
+
+	MYSQL_STMT* MySql::prepare(Connection& conn, const std::string& sql, MySqlResult& result)
+	{
+		MYSQL *mysql = conn.mysql;
+		StatementCache& cache = conn.statements;
+
+		auto iter = cache.statements.find(sql);
+		if (iter != cache.statements.end())
+			return iter->second;
+
+		MYSQL_STMT *stmt = mysql_stmt_init(mysql);
+		if (stmt == nullptr)
+		{
+			result.fail(mysql_errno(mysql), mysql_error(mysql), mysql_sqlstate(mysql));
+			return nullptr;
+		}
+
+		if (mysql_stmt_prepare(stmt, sql.data(), (unsigned long)sql.size()) != 0)
+		{
+			result.fail(mysql_stmt_errno(stmt), mysql_stmt_error(stmt), mysql_stmt_sqlstate(stmt));
+			mysql_stmt_close(stmt);
+			return nullptr;
+		}
+
+		// the server caps statements per session, close the oldest first
+		while (cache.order.size() >= statement_cache_)
+			drop(conn, cache.order.front());
+
+		my_bool update_max_length = 1;
+		mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+
+		cache.statements[sql] = stmt;
+		cache.order.push_back(sql);
+
+		return stmt;
+	}
+
+	void MySql::drop(Connection& conn, const std::string& sql)
+	{
+		StatementCache& cache = conn.statements;
+
+		auto iter = cache.statements.find(sql);
+		if (iter == cache.statements.end())
+			return;
+
+		mysql_stmt_close(iter->second);
+		cache.statements.erase(iter);
+
+		auto order = std::find(cache.order.begin(), cache.order.end(), sql);
+		if (order != cache.order.end())
+			cache.order.erase(order);
+	}
+
+	MySqlResultPtr MySql::run_statement(Connection& conn, const std::string& sql,
+		const MySqlParams& params)
+	{
+		MYSQL *mysql = conn.mysql;
+		MySqlResultPtr result = std::make_shared<MySqlResult>();
+
+		MYSQL_STMT *stmt = prepare(conn, sql, *result);
+		if (stmt == nullptr)
+			return result;
+
+		if (mysql_stmt_param_count(stmt) != params.size())
+		{
+			result->fail(CR_PARAMS_NOT_BOUND, "statement expects " +
+				std::to_string(mysql_stmt_param_count(stmt)) + " parameters, got " +
+				std::to_string(params.size()));
+			return result;
+		}
+
+		std::vector<MYSQL_BIND> binds(params.size());
+		std::vector<unsigned long> lengths(params.size());
+
+		for (std::size_t i = 0; i < params.size(); i++)
+		{
+			const MySqlParam& param = params[i];
+			MYSQL_BIND& bind = binds[i];
+			std::memset(&bind, 0, sizeof(bind));
+
+			switch (param.type)
+			{
+			case MySqlResult::kInteger:
+				bind.buffer_type = MYSQL_TYPE_LONGLONG;
+				bind.buffer = const_cast<int64_t*>(&param.integer);
+				break;
+
+			case MySqlResult::kNumber:
+				bind.buffer_type = MYSQL_TYPE_DOUBLE;
+				bind.buffer = const_cast<double*>(&param.number);
+				break;
+
+			case MySqlResult::kString:
+				lengths[i] = (unsigned long)param.string.size();
+				bind.buffer_type = MYSQL_TYPE_STRING;
+				bind.buffer = const_cast<char*>(param.string.data());
+				bind.buffer_length = lengths[i];
+				bind.length = &lengths[i];
+				break;
+
+			default:
+				bind.buffer_type = MYSQL_TYPE_NULL;
+				break;
+			}
+		}
+
+		// a failed statement may have lost its server side half, e.g. after a
+		// reconnect or a schema change, so it is prepared again next time
+		auto fail = [&]()
+		{
+			result->fail(mysql_stmt_errno(stmt), mysql_stmt_error(stmt), mysql_stmt_sqlstate(stmt));
+			drop(conn, sql);
+			return result;
+		};
+
+		if ((!binds.empty() && mysql_stmt_bind_param(stmt, binds.data()) != 0) ||
+			mysql_stmt_execute(stmt) != 0)
+			return fail();
+
+		MYSQL_RES *meta = mysql_stmt_result_metadata(stmt);
+		if (meta == nullptr)
+		{
+			result->affected_rows = mysql_stmt_affected_rows(stmt);
+			result->insert_id = mysql_stmt_insert_id(stmt);
+			result->warnings = (uint16_t)mysql_warning_count(mysql);
+			result->sqlstate = mysql_stmt_sqlstate(stmt);
+			return result;
+		}
+
+		if (mysql_stmt_store_result(stmt) != 0)
+		{
+			mysql_free_result(meta);
+			return fail();
+		}
+
+		unsigned int num_fields = mysql_num_fields(meta);
+		MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+
+		struct Column
+		{
+			int64_t integer;
+			double number;
+			std::string string;
+			unsigned long length;
+			my_bool is_null;
+		};
+
+		std::vector<Column> columns(num_fields);
+		std::vector<MYSQL_BIND> outputs(num_fields);
+
+		for (unsigned int i = 0; i < num_fields; i++)
+		{
+			MySqlResult::Field field;
+			field.name = fields[i].name;
+			field.type = (uint8_t)fields[i].type;
+			field.flags = (uint16_t)fields[i].flags;
+			field.decimals = (uint8_t)fields[i].decimals;
+			result->add_field(field);
+
+			MYSQL_BIND& bind = outputs[i];
+			Column& column = columns[i];
+			std::memset(&bind, 0, sizeof(bind));
+			bind.is_null = &column.is_null;
+			bind.length = &column.length;
+
+			switch (fields[i].type)
+			{
+			case MYSQL_TYPE_TINY:
+			case MYSQL_TYPE_SHORT:
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:
+			case MYSQL_TYPE_LONGLONG:
+			case MYSQL_TYPE_YEAR:
+				bind.buffer_type = MYSQL_TYPE_LONGLONG;
+				bind.buffer = &column.integer;
+				bind.is_unsigned = (fields[i].flags & UNSIGNED_FLAG) != 0;
+				break;
+
+			case MYSQL_TYPE_FLOAT:
+			case MYSQL_TYPE_DOUBLE:
+				bind.buffer_type = MYSQL_TYPE_DOUBLE;
+				bind.buffer = &column.number;
+				break;
+
+			default:
+				// max_length is known after store_result, plus the terminator
+				column.string.resize(fields[i].max_length + 1);
+				bind.buffer_type = MYSQL_TYPE_STRING;
+				bind.buffer = &column.string[0];
+				bind.buffer_length = (unsigned long)column.string.size();
+				break;
+			}
+		}
+
+		if (mysql_stmt_bind_result(stmt, outputs.data()) != 0)
+		{
+			mysql_free_result(meta);
+			mysql_stmt_free_result(stmt);
+			return fail();
+		}
+
+		int status;
+		while ((status = mysql_stmt_fetch(stmt)) == 0 || status == MYSQL_DATA_TRUNCATED)
+		{
+			for (unsigned int i = 0; i < num_fields; i++)
+			{
+				const Column& column = columns[i];
+
+				if (column.is_null)
+					result->add_null();
+				else if (outputs[i].buffer_type == MYSQL_TYPE_DOUBLE)
+					result->add_number(column.number);
+				else if (outputs[i].buffer_type != MYSQL_TYPE_LONGLONG)
+					result->add_value(column.string.data(), column.length);
+				// lua has no unsigned 64 bit integer, the top half turns into a float
+				else if (outputs[i].is_unsigned && column.integer < 0)
+					result->add_number((double)(uint64_t)column.integer);
+				else
+					result->add_integer(column.integer);
+			}
+		}
+
+		mysql_free_result(meta);
+		mysql_stmt_free_result(stmt);
+
+		if (status == 1)
+		{
+			MySqlResultPtr failed = std::make_shared<MySqlResult>();
+			failed->fail(mysql_stmt_errno(stmt), mysql_stmt_error(stmt), mysql_stmt_sqlstate(stmt));
+			drop(conn, sql);
+			return failed;
+		}
+
+		return result;
+	}
+
+	void MySql::execute(const char *sql, std::size_t size, MySqlParams params, Handler handler)
+	{
+		handler = invalidating(sql, size, std::move(handler));
+
+		std::size_t server = route(sql, size, handler);
+
+		if (!clients_.empty())
+		{
+			clients_[server]->execute(std::string(sql, size), std::move(params),
+				[this, handler](const MySqlResultPtr& result)
+			{
+				asio::post(host_->executor(),
+					[this, handler, result]
+				{
+					handler(this, result);
+				});
+			});
+			return;
+		}
+
+		std::string statement(sql, size);
+
+		pools_[server]->load++;
+
+		queue_->post(
+			[=]
+		{
+			MySqlResultPtr result = std::make_shared<MySqlResult>();
+
+			Connection *conn = acquire(server, *result);
+			if (conn != nullptr)
+			{
+				result = run_statement(*conn, statement, params);
+
+				// dead before the prepare or execute went out, safe to repeat
+				if (is_gone(result->error_code) && reconnect(*conn, *result))
+					result = run_statement(*conn, statement, params);
+
+				put(conn, is_broken(conn->mysql, *result));
+			}
+
+			pools_[server]->load--;
+
+			asio::post(host_->executor(),
+				[=]
+			{
+				handler(this, result);
+			});
+
+		});
+	}
+
+	void MySql::stream(const char *sql, std::size_t size, std::size_t batch_rows, Handler handler)
+	{
+		if (batch_rows == 0)
+			batch_rows = 1;
+
+		std::size_t server = route(sql, size, handler);
+
+		if (!clients_.empty())
+		{
+			clients_[server]->stream(std::string(sql, size), batch_rows,
+				[this, handler](const MySqlResultPtr& result)
+			{
+				asio::post(host_->executor(),
+					[this, handler, result]
+				{
+					handler(this, result);
+				});
+			});
+			return;
+		}
+
+		std::string statement(sql, size);
+
+		// checked by the fetch while it waits, the handle may go away
+		// with batches still coming
+		std::weak_ptr<MySql*> handle = self_;
+
+		pools_[server]->load++;
+
+		queue_->post(
+			[=]
+		{
+			auto window = std::make_shared<StreamWindow>();
+
+			auto deliver = [=](const MySqlResultPtr& result)
+			{
+				auto slot = std::make_shared<StreamSlot>(window);
+
+				asio::post(host_->executor(),
+					[this, handler, result, slot]
+				{
+					handler(this, result);
+				});
+			};
+
+			// false when no one is left to take the next batch
+			auto wait = [&]() -> bool
+			{
+				std::unique_lock<std::mutex> lock(window->mutex);
+				while (window->out >= kStreamWindow)
+				{
+					if (handle.expired())
+						return false;
+
+					window->cond.wait_for(lock, std::chrono::milliseconds(100));
+				}
+				return true;
+			};
+
+			// the last batch, the call stops counting against its server
+			auto finish = [=](const MySqlResultPtr& result)
+			{
+				pools_[server]->load--;
+				deliver(result);
+			};
+
+			MySqlResultPtr result = std::make_shared<MySqlResult>();
+
+			Connection *conn = acquire(server, *result);
+			if (conn == nullptr)
+			{
+				finish(result);
+				return;
+			}
+
+			if (!real_query(*conn, statement, *result))
+			{
+				put(conn, is_broken(conn->mysql, *result));
+				finish(result);
+				return;
+			}
+
+			MYSQL *mysql = conn->mysql;
+
+			if (mysql_field_count(mysql) == 0)
+			{
+				result = fetch_result(mysql);
+				put(conn, is_broken(mysql, *result));
+				finish(result);
+				return;
+			}
+
+			// rows stay on the server side of the socket until fetched, at
+			// most kStreamWindow batches are out and one is filling here
+			MYSQL_RES *res = mysql_use_result(mysql);
+			if (res == nullptr)
+			{
+				result->fail(mysql_errno(mysql), mysql_error(mysql), mysql_sqlstate(mysql));
+				put(conn, is_broken(mysql, *result));
+				finish(result);
+				return;
+			}
+
+			unsigned int num_fields = mysql_num_fields(res);
+			MYSQL_FIELD *fields = mysql_fetch_fields(res);
+
+			for (unsigned int i = 0; i < num_fields; i++)
+			{
+				MySqlResult::Field field;
+				field.name = fields[i].name;
+				field.type = (uint8_t)fields[i].type;
+				field.flags = (uint16_t)fields[i].flags;
+				field.decimals = (uint8_t)fields[i].decimals;
+				result->add_field(field);
+			}
+
+			MYSQL_ROW row;
+			while ((row = mysql_fetch_row(res)))
+			{
+				unsigned long *lengths = mysql_fetch_lengths(res);
+
+				for (unsigned int i = 0; i < num_fields; i++)
+				{
+					if (row[i] == nullptr)
+						result->add_null();
+					else
+						result->add_value(row[i], lengths[i]);
+				}
+
+				if (result->row_count() >= batch_rows)
+				{
+					if (!wait())
+						break;
+
+					MySqlResultPtr batch = result->next();
+					batch.swap(result);
+					batch->more = true;
+					deliver(batch);
+				}
+			}
+
+			bool abandoned = row != nullptr;
+
+			// a null row is either the end or a lost connection
+			if (!abandoned && mysql_errno(mysql) != 0)
+				result->fail(mysql_errno(mysql), mysql_error(mysql), mysql_sqlstate(mysql));
+
+			// reads and drops what the server still has to send
+			mysql_free_result(res);
+
+			put(conn, is_broken(mysql, *result));
+
+			if (abandoned)
+				pools_[server]->load--;
+			else
+				finish(result);
+		});
+	}
+
+	bool MySql::write(const std::string& table, const MySqlWriter::Columns& keys,
+		const MySqlWriter::Columns& values, std::string& error)
+	{
+		MySqlWriter *writer = host_->context().mysql_writer(conf_.c_str());
+		if (writer == nullptr)
+		{
+			error = "mysql write-behind unavailable, see the journal error";
+			return false;
+		}
+
+		return writer->put(table, keys, values, error);
+	}
+
+	MySql::Handler MySql::invalidating(const char *sql, std::size_t size, Handler handler)
+	{
+		if (cache_ == nullptr)
+			return handler;
+
+		std::vector<std::string> tables;
+		if (!MySqlCache::write_tables(sql, size, tables))
+			return handler;
+
+		// on completion, failed or not, so a read racing the write is not
+		// kept; a write whose tables could not be read drops everything
+		MySqlCache *cache = cache_;
+		return [cache, tables, handler](MySql *self, const MySqlResultPtr& result)
+		{
+			if (tables.empty())
+				cache->clear();
+			else
+				cache->invalidate(tables);
+			handler(self, result);
+		};
+	}
+
+	void MySql::cached(const char *sql, std::size_t size, const MySqlParams *params,
+		int ttl, Handler handler)
+	{
+		if (cache_ == nullptr)
+		{
+			if (params != nullptr)
+				execute(sql, size, *params, handler);
+			else
+				query(sql, size, handler);
+			return;
+		}
+
+		std::string key = MySqlCache::make_key(sql, size, params);
+		std::vector<std::string> tags = MySqlCache::read_tables(sql, size);
+
+		std::weak_ptr<MySql*> handle = self_;
+		Service::ServiceExecutor executor = host_->executor();
+
+		MySqlResultPtr result;
+		MySqlCache::Lookup lookup = cache_->lookup(key, tags, result,
+			[handle, executor, handler](const MySqlResultPtr& result)
+		{
+			asio::post(executor, [handle, handler, result]()
+			{
+				auto self = handle.lock();
+				if (self)
+					handler(*self, result);
+			});
+		});
+
+		if (lookup == MySqlCache::kHit)
+		{
+			asio::post(host_->executor(),
+				[this, handler, result]
+			{
+				handler(this, result);
+			});
+			return;
+		}
+
+		if (lookup == MySqlCache::kJoined)
+			return;
+
+		auto fill = std::make_shared<CacheFill>(cache_, std::move(key), std::move(tags), ttl);
+		auto store = [fill, handler](MySql *self, const MySqlResultPtr& result)
+		{
+			fill->complete(result);
+			handler(self, result);
+		};
+
+		if (params != nullptr)
+			execute(sql, size, *params, store);
+		else
+			query(sql, size, store);
+	}
+
+	void MySql::invalidate(const std::vector<std::string>& tables)
+	{
+		if (cache_ != nullptr)
+			cache_->invalidate(tables);
 	}
 
 }
@@ -2,23 +2,33 @@
 #define TENGINE_MYSQL_HPP
 
 #include "service_proxy.hpp"
+#include "blocking_pool.hpp"
+#include "mysql_client.hpp"
+#include "mysql_result.hpp"
+#include "mysql_writer.hpp"
+#include "mysql_cache.hpp"
+#include "histogram.hpp"
 
 #include "asio.hpp"
+#include "asio/steady_timer.hpp"
 
 #include "mysql.h"
 
 #include <string>
 #include <set>
+#include <vector>
 #include <list>
+#include <deque>
+#include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 
 namespace tengine
 {
 	class Service;
 
-	class Executor;
-
 	class MySql : public ServiceProxy
 	{
 	public:
@@ -30,25 +40,248 @@ namespace tengine
 
 		int start(const char *conf);
 
-		typedef std::function<void(MySql*, MYSQL*, const char*)> Handler;
+		// called on the owning service's strand, result->ok() tells success
+		typedef std::function<void(MySql*, const MySqlResultPtr&)> Handler;
 
 		void query(const char *sql, std::size_t size, Handler handler);
 
-		MYSQL* get();
+		// prepared once per connection and kept, params bound in order
+		void execute(const char *sql, std::size_t size, MySqlParams params, Handler handler);
+
+		// rows in batches of batch_rows, read with mysql_use_result on the
+		// blocking engine; the handler runs once per batch, result->more
+		// tells whether another follows. the blocking engine reads on only
+		// while two batches at most wait for the handler, the async one
+		// does not throttle (see MySqlClient::stream)
+		void stream(const char *sql, std::size_t size, std::size_t batch_rows, Handler handler);
+
+		// read through the section's MySqlCache, params null for plain sql;
+		// ttl in ms, 0 for the configured one. uncached when disabled
+		void cached(const char *sql, std::size_t size, const MySqlParams *params,
+			int ttl, Handler handler);
+
+		// drop cached results of these tables
+		void invalidate(const std::vector<std::string>& tables);
+
+		// null when the section has no cache
+		MySqlCache *cache() { return cache_; }
 
-		void put(MYSQL* mysql);
+		// queue a row upsert on the section's write-behind, see MySqlWriter
+		bool write(const std::string& table, const MySqlWriter::Columns& keys,
+			const MySqlWriter::Columns& values, std::string& error);
+
+		bool async() const { return !clients_.empty(); }
+
+		// blocking engine only, one per server
+		struct PoolStats
+		{
+			std::string host;
+			uint16_t port;
+			std::size_t connections;
+			std::size_t idle;
+			std::size_t in_flight;
+			// opened past min_connections because every one was busy
+			uint64_t grown;
+			// closed after idle_timeout above min_connections
+			uint64_t shrunk;
+			uint64_t reconnects;
+			uint64_t ping_failures;
+			// microseconds get() waited for a connection
+			Histogram wait;
+			// connections busy, sampled on every get()
+			Histogram busy;
+			// microseconds a call held its connection
+			Histogram latency;
+		};
+
+		// the primary first, then the replicas in configured order
+		std::vector<PoolStats> pool_stats();
 
 	private:
+		int start_async(const char *conf);
+
+		// replicas, replica_policy, read_your_writes and replica_retry
+		void load_replicas(const char *conf, uint16_t port);
+
+		typedef std::chrono::steady_clock Clock;
+
+		// writes drop the cached reads of the table they change
+		Handler invalidating(const char *sql, std::size_t size, Handler handler);
+
+		// the server a statement goes to, 0 for the primary. writes pin
+		// this handle's reads to the primary for read_your_writes ms
+		// after they complete, so its own changes are never read stale
+		std::size_t route(const char *sql, std::size_t size, Handler& handler);
+
+		void pin();
+
+		std::string conf_;
+
+		MySqlCache *cache_;
+
+		// statements prepared on one blocking connection, only touched by
+		// the pool thread holding that connection
+		struct StatementCache
+		{
+			std::unordered_map<std::string, MYSQL_STMT*> statements;
+
+			std::deque<std::string> order;
+		};
+
+		struct Pool;
+
+		// one blocking connection, owned by whoever took it from the pool
+		struct Connection : public Allocator
+		{
+			Pool *pool;
+
+			MYSQL *mysql;
+
+			StatementCache statements;
+
+			// when it was taken, or when it went back to the free list
+			Clock::time_point since;
+
+			Clock::time_point pinged;
+		};
+
+		// the blocking connections to one server
+		struct Pool : public Allocator
+		{
+			std::string host;
+
+			uint16_t port;
+
+			std::mutex mutex;
+
+			std::set<Connection*> used;
+
+			// most recently returned first, so the tail is what has idled longest
+			std::list<Connection*> idle;
+
+			// free, used and being opened
+			std::size_t total;
+
+			std::condition_variable cond;
+
+			// calls routed here and not finished, for least_load
+			std::atomic<std::size_t> load;
+
+			// a replica that refused connections takes no reads until this
+			// many ms of Clock's epoch
+			std::atomic<int64_t> down_until;
+
+			// counters and histograms, guarded by mutex
+			PoolStats stats;
+		};
+
+		// a new connection, or null with the reason in result
+		MYSQL* open(Pool& pool, MySqlResult& result);
+
+		// replaces a dead handle in place, its statements go with it
+		bool reconnect(Connection& conn, MySqlResult& result);
+
+		// once more on a fresh session when the old one was found dead,
+		// false with the error in result
+		bool real_query(Connection& conn, const std::string& sql, MySqlResult& result);
+
+		void close(Connection *conn);
+
+		// null with the connect error in result when the pool is empty and
+		// no connection can be opened
+		Connection* get(Pool& pool, MySqlResult& result);
+
+		// from the routed server, or from the primary when a replica can't
+		// be reached
+		Connection* acquire(std::size_t server, MySqlResult& result);
+
+		// a broken connection is closed instead of going back
+		void put(Connection *conn, bool broken = false);
+
+		// on the pool queue: pings idle connections, reconnects the dead,
+		// closes the ones idle past idle_timeout and refills to the min
+		void maintain();
+
+		void maintain(Pool& pool);
+
+		void arm_timer();
+
+		MYSQL_STMT* prepare(Connection& conn, const std::string& sql, MySqlResult& result);
+
+		void drop(Connection& conn, const std::string& sql);
+
+		MySqlResultPtr run_statement(Connection& conn, const std::string& sql,
+			const MySqlParams& params);
+
+		// set when the section says engine = "async": statements go out
+		// pipelined on the network thread, the blocking pool is not used.
+		// the primary first, then the replicas
+		std::vector<std::shared_ptr<MySqlClient>> clients_;
+
+		// thread_num bounds how many calls run at once on the shared pool
+		BlockingPool::QueuePtr queue_;
+
+		enum ReplicaPolicy
+		{
+			kWeighted,
+			kLeastLoad,
+		};
+
+		struct Replica
+		{
+			std::string host;
+
+			uint16_t port;
+
+			int weight;
+
+			// smooth weighted round robin, on the owning service's strand
+			int current;
+		};
+
+		// servers 1.. in order, from "host[:port][*weight], ..."
+		std::vector<Replica> replicas_;
+
+		ReplicaPolicy replica_policy_;
+
+		// where least_load starts looking, so ties take turns
+		std::size_t rotation_;
+
+		int read_your_writes_;
+
+		// ms a replica that refused connections sits out
+		int replica_retry_;
+
+		Clock::time_point pinned_until_;
+
+		std::string user_;
+
+		std::string password_;
+
+		std::string db_;
+
+		std::size_t min_connections_;
+
+		std::size_t max_connections_;
+
+		// milliseconds, 0 turns either off
+		int ping_interval_;
+
+		int idle_timeout_;
 
-		Executor *executor_;
+		asio::steady_timer timer_;
 
-		std::mutex mysql_mutex_;
+		// a maintain() is on the queue, the timer does not stack another
+		std::atomic<bool> maintaining_;
 
-		std::set<MYSQL*> mysql_used_;
+		// blocking engine, the primary first, then the replicas
+		std::vector<Pool*> pools_;
 
-		std::list<MYSQL*> mysql_free_;
+		std::size_t statement_cache_;
 
-		std::condition_variable mysql_cond_;
+		// joined cache waiters hold it weakly, another handle's query may
+		// wake them after this one is gone
+		std::shared_ptr<MySql*> self_;
 
 	};
 }
@@ -0,0 +1,623 @@
+#include "mysql_cache.hpp"
+
+#include "context.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+namespace tengine
+{
+	namespace
+	{
+		// words, quoted identifiers and single punctuation marks, string
+		// literals and comments are skipped
+		void tokenize(const char *sql, std::size_t size, std::vector<std::string>& tokens,
+			std::size_t limit)
+		{
+			std::size_t i = 0;
+			while (i < size && tokens.size() < limit)
+			{
+				char c = sql[i];
+
+				if (std::isspace((unsigned char)c))
+				{
+					i++;
+				}
+				else if (c == '\'' || c == '"')
+				{
+					for (i++; i < size && sql[i] != c; i++)
+					{
+						if (sql[i] == '\\')
+							i++;
+					}
+					i++;
+				}
+				else if (c == '-' && i + 1 < size && sql[i + 1] == '-')
+				{
+					while (i < size && sql[i] != '\n')
+						i++;
+				}
+				else if (c == '/' && i + 1 < size && sql[i + 1] == '*')
+				{
+					const char close[] = "*/";
+					const char *end = std::search(sql + i + 2, sql + size, close, close + 2);
+					i = end != sql + size ? end - sql + 2 : size;
+				}
+				else if (std::isalnum((unsigned char)c) || c == '_' || c == '$' || c == '`')
+				{
+					std::size_t start = i;
+					while (i < size)
+					{
+						if (sql[i] == '`')
+						{
+							for (i++; i < size && sql[i] != '`'; i++);
+							i++;
+						}
+						else if (std::isalnum((unsigned char)sql[i]) || sql[i] == '_'
+							|| sql[i] == '$' || sql[i] == '.')
+						{
+							i++;
+						}
+						else
+						{
+							break;
+						}
+					}
+					tokens.emplace_back(sql + start, std::min(i, size) - start);
+				}
+				else
+				{
+					tokens.emplace_back(1, c);
+					i++;
+				}
+			}
+		}
+
+		bool is(const std::string& token, const char *word)
+		{
+			if (token.size() != std::strlen(word))
+				return false;
+
+			for (std::size_t i = 0; i < token.size(); i++)
+			{
+				if (std::toupper((unsigned char)token[i]) != word[i])
+					return false;
+			}
+			return true;
+		}
+
+		bool is_identifier(const std::string& token)
+		{
+			return !token.empty() && (std::isalpha((unsigned char)token[0])
+				|| token[0] == '_' || token[0] == '$' || token[0] == '`');
+		}
+
+		// words that end a table reference rather than alias it
+		bool is_clause(const std::string& token)
+		{
+			static const char *const kWords[] = {
+				"WHERE", "JOIN", "LEFT", "RIGHT", "INNER", "OUTER", "CROSS",
+				"NATURAL", "STRAIGHT_JOIN", "ON", "USING", "GROUP", "ORDER",
+				"LIMIT", "HAVING", "UNION", "FOR", "LOCK", "WINDOW", "INTO",
+				"PROCEDURE", "SET", "VALUES", "SELECT",
+			};
+
+			for (const char *word : kWords)
+			{
+				if (is(token, word))
+					return true;
+			}
+			return false;
+		}
+
+		// `db`.`t` and db.t are t, names compare in lower case
+		std::string table_name(const std::string& token)
+		{
+			std::string name;
+			for (char c : token)
+			{
+				if (c == '`')
+					continue;
+				if (c == '.')
+					name.clear();
+				else
+					name.push_back((char)std::tolower((unsigned char)c));
+			}
+			return name;
+		}
+
+		void add(std::vector<std::string>& tables, const std::string& table)
+		{
+			if (!table.empty() && std::find(tables.begin(), tables.end(), table) == tables.end())
+				tables.push_back(table);
+		}
+
+		// the tables named from tokens[j] on, each with an optional alias:
+		// a x, b AS y. one only unless list; where the references end
+		std::size_t references(const std::vector<std::string>& tokens, std::size_t j,
+			bool list, std::vector<std::string>& tables)
+		{
+			while (j < tokens.size() && is_identifier(tokens[j]) && !is_clause(tokens[j]))
+			{
+				add(tables, table_name(tokens[j++]));
+
+				if (j < tokens.size() && is(tokens[j], "AS"))
+					j++;
+				if (j < tokens.size() && is_identifier(tokens[j]) && !is_clause(tokens[j]))
+					j++;
+
+				if (!list || j >= tokens.size() || tokens[j] != ",")
+					break;
+				j++;
+			}
+			return j;
+		}
+
+		// every table after a FROM or JOIN, subqueries included
+		void from_tables(const std::vector<std::string>& tokens, std::vector<std::string>& tables)
+		{
+			for (std::size_t i = 0; i < tokens.size(); i++)
+			{
+				bool from = is(tokens[i], "FROM");
+				if (from || is(tokens[i], "JOIN"))
+					references(tokens, i + 1, from, tables);
+			}
+		}
+	}
+
+	void MySqlCache::load(Context& context, const char *conf, Options& options)
+	{
+		char key[256];
+
+		snprintf(key, sizeof(key), "%s.cache.capacity", conf);
+		options.capacity = std::max(0, context.config(key, options.capacity));
+
+		snprintf(key, sizeof(key), "%s.cache.max_bytes", conf);
+		options.max_bytes = std::max(0, context.config(key, options.max_bytes));
+
+		snprintf(key, sizeof(key), "%s.cache.ttl", conf);
+		options.ttl = std::max(1, context.config(key, options.ttl));
+	}
+
+	MySqlCache::MySqlCache(const Options& options)
+		: options_(options)
+		, mutex_()
+		, entries_()
+		, index_()
+		, tagged_()
+		, generations_()
+		, pending_()
+		, bytes_(0)
+		, hits_(0)
+		, misses_(0)
+		, joined_(0)
+		, stores_(0)
+		, evictions_(0)
+		, invalidations_(0)
+	{
+
+	}
+
+	MySqlCache::Lookup MySqlCache::lookup(const std::string& key,
+		const std::vector<std::string>& tags, MySqlResultPtr& result, Waiter waiter)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto iter = index_.find(key);
+		if (iter != index_.end())
+		{
+			if (Clock::now() < iter->second->expires)
+			{
+				entries_.splice(entries_.begin(), entries_, iter->second);
+				result = iter->second->result;
+				hits_++;
+				return kHit;
+			}
+
+			erase(iter->second);
+		}
+
+		auto pending = pending_.find(key);
+		if (pending != pending_.end())
+		{
+			pending->second.waiters.push_back(std::move(waiter));
+			joined_++;
+			return kJoined;
+		}
+
+		Pending& entry = pending_[key];
+		for (auto& tag : tags)
+			entry.generations.push_back(generation(tag));
+
+		misses_++;
+		return kMiss;
+	}
+
+	void MySqlCache::complete(const std::string& key, const std::vector<std::string>& tags,
+		int ttl, const MySqlResultPtr& result)
+	{
+		std::vector<Waiter> waiters;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto pending = pending_.find(key);
+			if (pending == pending_.end())
+				return;
+
+			waiters.swap(pending->second.waiters);
+
+			// a write to one of the tables landed while this was in flight
+			bool fresh = pending->second.generations.size() == tags.size();
+			for (std::size_t i = 0; fresh && i < tags.size(); i++)
+				fresh = pending->second.generations[i] == generation(tags[i]);
+
+			pending_.erase(pending);
+
+			std::size_t bytes = result->bytes() + key.size();
+
+			if (fresh && result->ok() && !result->empty() && bytes <= (std::size_t)options_.max_bytes)
+			{
+				auto iter = index_.find(key);
+				if (iter != index_.end())
+					erase(iter->second);
+
+				Entry entry;
+				entry.key = key;
+				entry.result = result;
+				entry.tags = tags;
+				entry.bytes = bytes;
+				entry.expires = Clock::now() + std::chrono::milliseconds(ttl > 0 ? ttl : options_.ttl);
+
+				entries_.push_front(std::move(entry));
+				index_[key] = entries_.begin();
+				for (auto& tag : tags)
+					tagged_[tag].insert(key);
+
+				bytes_ += bytes;
+				stores_++;
+
+				while (!entries_.empty() && (entries_.size() > (std::size_t)options_.capacity
+					|| bytes_ > (std::size_t)options_.max_bytes))
+				{
+					erase(std::prev(entries_.end()));
+					evictions_++;
+				}
+			}
+		}
+
+		for (auto& waiter : waiters)
+			waiter(result);
+	}
+
+	void MySqlCache::invalidate(const std::vector<std::string>& tags)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto& raw : tags)
+		{
+			std::string tag = table_name(raw);
+			if (tag.empty())
+				continue;
+
+			generations_[tag]++;
+
+			auto tagged = tagged_.find(tag);
+			if (tagged == tagged_.end())
+				continue;
+
+			// erase() edits the set we would be walking
+			std::vector<std::string> keys(tagged->second.begin(), tagged->second.end());
+			for (auto& key : keys)
+			{
+				auto iter = index_.find(key);
+				if (iter != index_.end())
+				{
+					erase(iter->second);
+					invalidations_++;
+				}
+			}
+		}
+	}
+
+	void MySqlCache::clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		entries_.clear();
+		index_.clear();
+		tagged_.clear();
+		bytes_ = 0;
+
+		// whatever is in flight now may predate the reason for clearing
+		for (auto& pending : pending_)
+		{
+			for (auto& generation : pending.second.generations)
+				generation = UINT64_MAX;
+		}
+	}
+
+	MySqlCache::Stats MySqlCache::stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Stats stats;
+		stats.entries = entries_.size();
+		stats.bytes = bytes_;
+		stats.hits = hits_;
+		stats.misses = misses_;
+		stats.joined = joined_;
+		stats.stores = stores_;
+		stats.evictions = evictions_;
+		stats.invalidations = invalidations_;
+		return stats;
+	}
+
+	void MySqlCache::erase(Entries::iterator iter)
+	{
+		for (auto& tag : iter->tags)
+		{
+			auto tagged = tagged_.find(tag);
+			if (tagged == tagged_.end())
+				continue;
+
+			tagged->second.erase(iter->key);
+			if (tagged->second.empty())
+				tagged_.erase(tagged);
+		}
+
+		bytes_ -= iter->bytes;
+		index_.erase(iter->key);
+		entries_.erase(iter);
+	}
+
+	uint64_t MySqlCache::generation(const std::string& tag) const
+	{
+		auto iter = generations_.find(tag);
+		return iter != generations_.end() ? iter->second : 0;
+	}
+
+	std::string MySqlCache::make_key(const char *sql, std::size_t size,
+		const MySqlParams *params)
+	{
+		std::string key;
+		key.reserve(size + 16);
+
+		// runs of white space outside quotes count as one space
+		char quote = 0;
+		for (std::size_t i = 0; i < size; i++)
+		{
+			char c = sql[i];
+
+			if (quote != 0)
+			{
+				key.push_back(c);
+				if (c == '\\' && i + 1 < size)
+					key.push_back(sql[++i]);
+				else if (c == quote)
+					quote = 0;
+			}
+			else if (std::isspace((unsigned char)c))
+			{
+				if (!key.empty() && key.back() != ' ')
+					key.push_back(' ');
+			}
+			else
+			{
+				if (c == '\'' || c == '"' || c == '`')
+					quote = c;
+				key.push_back(c);
+			}
+		}
+
+		while (!key.empty() && (key.back() == ' ' || key.back() == ';'))
+			key.pop_back();
+
+		if (params != nullptr)
+		{
+			for (auto& param : *params)
+			{
+				key.push_back('\0');
+				key.push_back((char)('0' + param.type));
+
+				switch (param.type)
+				{
+				case MySqlResult::kInteger:
+					key += std::to_string(param.integer);
+					break;
+
+				case MySqlResult::kNumber:
+				{
+					char buffer[32];
+					snprintf(buffer, sizeof(buffer), "%.17g", param.number);
+					key += buffer;
+					break;
+				}
+
+				case MySqlResult::kString:
+					key += std::to_string(param.string.size());
+					key.push_back(':');
+					key += param.string;
+					break;
+
+				default:
+					break;
+				}
+			}
+		}
+
+		return key;
+	}
+
+	std::vector<std::string> MySqlCache::read_tables(const char *sql, std::size_t size)
+	{
+		std::vector<std::string> tokens;
+		tokenize(sql, size, tokens, (std::size_t)-1);
+
+		std::vector<std::string> tables;
+		from_tables(tokens, tables);
+
+		return tables;
+	}
+
+	bool MySqlCache::write_tables(const char *sql, std::size_t size,
+		std::vector<std::string>& tables)
+	{
+		std::vector<std::string> tokens;
+		tokenize(sql, size, tokens, (std::size_t)-1);
+
+		if (tokens.empty())
+			return false;
+
+		// words allowed between the verb and the tables
+		static const struct
+		{
+			const char *verb;
+			const char *const modifiers[5];
+		} kVerbs[] = {
+			{ "INSERT", { "LOW_PRIORITY", "DELAYED", "HIGH_PRIORITY", "IGNORE", "INTO" } },
+			{ "REPLACE", { "LOW_PRIORITY", "DELAYED", "INTO" } },
+			{ "UPDATE", { "LOW_PRIORITY", "IGNORE" } },
+			{ "DELETE", { "LOW_PRIORITY", "QUICK", "IGNORE" } },
+			{ "TRUNCATE", { "TABLE" } },
+			{ "ALTER", { "ONLINE", "IGNORE", "TABLE" } },
+			{ "DROP", { "TEMPORARY", "TABLE", "IF", "EXISTS" } },
+			{ "RENAME", { "TABLE" } },
+		};
+
+		for (auto& verb : kVerbs)
+		{
+			if (!is(tokens[0], verb.verb))
+				continue;
+
+			std::size_t i = 1;
+			for (; i < tokens.size(); i++)
+			{
+				bool modifier = false;
+				for (const char *word : verb.modifiers)
+					modifier = modifier || (word != nullptr && is(tokens[i], word));
+
+				if (!modifier)
+					break;
+			}
+
+			if (is(verb.verb, "INSERT") || is(verb.verb, "REPLACE")
+				|| is(verb.verb, "TRUNCATE") || is(verb.verb, "ALTER"))
+			{
+				// what an INSERT ... SELECT reads is not written
+				references(tokens, i, false, tables);
+			}
+			else if (is(verb.verb, "DROP"))
+			{
+				references(tokens, i, true, tables);
+			}
+			else if (is(verb.verb, "RENAME"))
+			{
+				// a TO b, c TO d: both names of each pair
+				for (; i < tokens.size(); i++)
+				{
+					if (is_identifier(tokens[i]) && !is(tokens[i], "TO"))
+						add(tables, table_name(tokens[i]));
+				}
+			}
+			else
+			{
+				// UPDATE a, b JOIN c ... SET, DELETE a, b.* FROM ... and
+				// DELETE FROM a USING ...: targets may be aliases, the
+				// tables behind them are in the FROM, JOIN or USING lists
+				while (i < tokens.size() && is_identifier(tokens[i]) && !is_clause(tokens[i])
+					&& !is(tokens[i], "FROM"))
+				{
+					std::string name = tokens[i++];
+					if (name.back() == '.')
+						name.pop_back();
+					add(tables, table_name(name));
+
+					if (i < tokens.size() && tokens[i] == "*")
+						i++;
+					if (i < tokens.size() && is(tokens[i], "AS"))
+						i++;
+					if (i < tokens.size() && is_identifier(tokens[i]) && !is_clause(tokens[i])
+						&& !is(tokens[i], "FROM"))
+						i++;
+
+					if (i >= tokens.size() || tokens[i] != ",")
+						break;
+					i++;
+				}
+
+				from_tables(tokens, tables);
+
+				for (std::size_t j = i; j < tokens.size(); j++)
+				{
+					if (is(tokens[j], "USING"))
+						references(tokens, j + 1, true, tables);
+				}
+			}
+
+			// a write all the same, the caller drops everything
+			return true;
+		}
+
+		return false;
+	}
+
+	bool MySqlCache::read_only(const char *sql, std::size_t size)
+	{
+		std::vector<std::string> tokens;
+		tokenize(sql, size, tokens, (std::size_t)-1);
+
+		std::size_t first = 0;
+		while (first < tokens.size() && tokens[first] == "(")
+			first++;
+
+		if (first == tokens.size())
+			return false;
+
+		const std::string& verb = tokens[first];
+		bool with = is(verb, "WITH");
+
+		if (!with && !is(verb, "SELECT") && !is(verb, "SHOW") && !is(verb, "DESC")
+			&& !is(verb, "DESCRIBE") && !is(verb, "EXPLAIN"))
+			return false;
+
+		// answered from the connection's own state, not the data
+		static const char *const kSession[] = {
+			"LAST_INSERT_ID", "FOUND_ROWS", "ROW_COUNT", "CONNECTION_ID",
+			"GET_LOCK", "RELEASE_LOCK", "RELEASE_ALL_LOCKS", "IS_FREE_LOCK",
+			"IS_USED_LOCK",
+		};
+
+		for (std::size_t i = first + 1; i < tokens.size(); i++)
+		{
+			const std::string& token = tokens[i];
+			const std::string *next = i + 1 < tokens.size() ? &tokens[i + 1] : nullptr;
+
+			// FOR UPDATE, FOR SHARE, LOCK IN SHARE MODE
+			if (next != nullptr && ((is(token, "FOR") && (is(*next, "UPDATE") || is(*next, "SHARE")))
+				|| (is(token, "LOCK") && is(*next, "IN"))))
+				return false;
+
+			if (is(token, "INTO"))
+				return false;
+
+			// WITH ... UPDATE/DELETE
+			if (with && (is(token, "UPDATE") || is(token, "DELETE") || is(token, "INSERT")
+				|| is(token, "REPLACE")))
+				return false;
+
+			if (next != nullptr && *next == "(")
+			{
+				for (const char *word : kSession)
+				{
+					if (is(token, word))
+						return false;
+				}
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,167 @@
+#ifndef TENGINE_MYSQL_CACHE_HPP
+#define TENGINE_MYSQL_CACHE_HPP
+
+#include "allocator.hpp"
+#include "mysql_result.hpp"
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Context;
+
+	// read-through cache of SELECT results for one mysql section, shared
+	// by every sandbox. entries are keyed by the whitespace-normalized sql
+	// plus bound params and tagged with the tables the sql reads. a write
+	// through the same section (query, execute or write-behind) drops the
+	// entries tagged with its tables, and a read that was in flight across
+	// such a write is not stored. concurrent misses on one key share a
+	// single query.
+	class MySqlCache : public Allocator
+	{
+	public:
+		struct Options
+		{
+			// entries kept, 0 disables the cache
+			int capacity = 0;
+			// bytes of results kept, least recently used go first
+			int max_bytes = 64 << 20;
+			// milliseconds an entry lives unless the query says otherwise
+			int ttl = 60000;
+		};
+
+		struct Stats
+		{
+			std::size_t entries;
+			std::size_t bytes;
+			uint64_t hits;
+			uint64_t misses;
+			// misses that joined a query already in flight
+			uint64_t joined;
+			uint64_t stores;
+			uint64_t evictions;
+			uint64_t invalidations;
+		};
+
+		typedef std::function<void(const MySqlResultPtr& result)> Waiter;
+
+		enum Lookup
+		{
+			kHit,
+			// the caller runs the query and hands the result to complete(),
+			// an error included, or the callers that joined wait for good
+			kMiss,
+			// another caller runs it, the waiter gets its result
+			kJoined,
+		};
+
+		static void load(Context& context, const char *conf, Options& options);
+
+		explicit MySqlCache(const Options& options);
+
+		MySqlCache(const MySqlCache&) = delete;
+
+		MySqlCache& operator=(const MySqlCache&) = delete;
+
+		bool enabled() const { return options_.capacity > 0; }
+
+		// the calls below may be made from any thread
+
+		Lookup lookup(const std::string& key, const std::vector<std::string>& tags,
+			MySqlResultPtr& result, Waiter waiter);
+
+		// stores result for ttl ms (<= 0 for the default) and wakes the
+		// callers that joined; failures are handed on but not stored
+		void complete(const std::string& key, const std::vector<std::string>& tags,
+			int ttl, const MySqlResultPtr& result);
+
+		void invalidate(const std::vector<std::string>& tags);
+
+		void clear();
+
+		Stats stats();
+
+		// cache key of a statement and its params
+		static std::string make_key(const char *sql, std::size_t size,
+			const MySqlParams *params = nullptr);
+
+		// tables a SELECT reads, from its FROM and JOIN clauses
+		static std::vector<std::string> read_tables(const char *sql, std::size_t size);
+
+		// false unless an INSERT/UPDATE/DELETE/REPLACE/TRUNCATE/ALTER/DROP/
+		// RENAME; tables gets every table it may write, multi table UPDATE
+		// and DELETE included. empty when they can't be told, the caller
+		// then has to assume any
+		static bool write_tables(const char *sql, std::size_t size,
+			std::vector<std::string>& tables);
+
+		// a SELECT/SHOW/DESCRIBE/EXPLAIN that neither locks rows, writes
+		// through INTO nor asks about the session, so any replica may answer
+		static bool read_only(const char *sql, std::size_t size);
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Entry
+		{
+			std::string key;
+			MySqlResultPtr result;
+			std::vector<std::string> tags;
+			std::size_t bytes;
+			Clock::time_point expires;
+		};
+
+		typedef std::list<Entry> Entries;
+
+		struct Pending
+		{
+			std::vector<Waiter> waiters;
+			// tag generations when the query went out
+			std::vector<uint64_t> generations;
+		};
+
+		void erase(Entries::iterator iter);
+
+		uint64_t generation(const std::string& tag) const;
+
+		Options options_;
+
+		std::mutex mutex_;
+
+		// most recently used first
+		Entries entries_;
+
+		std::unordered_map<std::string, Entries::iterator> index_;
+
+		std::unordered_map<std::string, std::unordered_set<std::string>> tagged_;
+
+		std::unordered_map<std::string, uint64_t> generations_;
+
+		std::unordered_map<std::string, Pending> pending_;
+
+		std::size_t bytes_;
+
+		uint64_t hits_;
+
+		uint64_t misses_;
+
+		uint64_t joined_;
+
+		uint64_t stores_;
+
+		uint64_t evictions_;
+
+		uint64_t invalidations_;
+	};
+}
+
+#endif
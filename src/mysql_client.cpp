@@ -0,0 +1,1649 @@
+#include "mysql_client.hpp"
+
+#include "mysql_packet.hpp"
+#include "resolver.hpp"
+
+#include "asio/ts/executor.hpp"
+
+#include "openssl/evp.h"
+#include "openssl/pem.h"
+#include "openssl/rsa.h"
+#include "openssl/sha.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace tengine
+{
+	namespace
+	{
+		enum
+		{
+			kClientLongPassword = 0x00000001,
+			kClientLongFlag = 0x00000004,
+			kClientConnectWithDb = 0x00000008,
+			kClientProtocol41 = 0x00000200,
+			kClientTransactions = 0x00002000,
+			kClientSecureConnection = 0x00008000,
+			kClientMultiResults = 0x00020000,
+			kClientPsMultiResults = 0x00040000,
+			kClientPluginAuth = 0x00080000,
+			kClientPluginAuthLenencData = 0x00200000,
+		};
+
+		enum
+		{
+			kServerMoreResultsExists = 0x0008,
+		};
+
+		enum
+		{
+			kComQuery = 0x03,
+			kComStmtPrepare = 0x16,
+			kComStmtExecute = 0x17,
+			kComStmtClose = 0x19,
+		};
+
+		// the server forgot the statement, prepare it again
+		enum
+		{
+			kErrorUnknownStatement = 1243,
+			kErrorNeedReprepare = 1615,
+		};
+
+		// enum_field_types and column flags from mysql_com.h
+		enum
+		{
+			kTypeDecimal = 0,
+			kTypeTiny = 1,
+			kTypeShort = 2,
+			kTypeLong = 3,
+			kTypeFloat = 4,
+			kTypeDouble = 5,
+			kTypeNull = 6,
+			kTypeTimestamp = 7,
+			kTypeLongLong = 8,
+			kTypeInt24 = 9,
+			kTypeDate = 10,
+			kTypeTime = 11,
+			kTypeDateTime = 12,
+			kTypeYear = 13,
+			kTypeVarString = 253,
+
+			kFlagUnsigned = 32,
+		};
+
+		enum
+		{
+			kPacketOk = 0x00,
+			kPacketAuthMoreData = 0x01,
+			kPacketLocalInfile = 0xfb,
+			kPacketEof = 0xfe,
+			kPacketError = 0xff,
+		};
+
+		// client error codes as libmysqlclient reports them
+		enum
+		{
+			kErrorConnection = 2003,
+			kErrorServerLost = 2013,
+			kErrorMalformed = 2027,
+			kErrorQueueFull = 2048,
+			kErrorTimeout = 2062,
+		};
+
+		const std::size_t kMaxPacket = 0xffffff;
+
+		const std::size_t kScrambleSize = 20;
+
+		const uint8_t kCharsetUtf8 = 33;
+
+		// lenenc marker for a NULL column in a text row
+		const uint8_t kNullColumn = 0xfb;
+
+		// SHA1(password) ^ SHA1(scramble + SHA1(SHA1(password)))
+		std::string scramble_native(const std::string& password, const std::string& scramble)
+		{
+			if (password.empty())
+				return std::string();
+
+			unsigned char stage1[SHA_DIGEST_LENGTH];
+			unsigned char stage2[SHA_DIGEST_LENGTH];
+			unsigned char digest[SHA_DIGEST_LENGTH];
+
+			SHA1((const unsigned char*)password.data(), password.size(), stage1);
+			SHA1(stage1, sizeof(stage1), stage2);
+
+			std::string salted(scramble, 0, 20);
+			salted.append((const char*)stage2, sizeof(stage2));
+			SHA1((const unsigned char*)salted.data(), salted.size(), digest);
+
+			std::string result(SHA_DIGEST_LENGTH, '\0');
+			for (int i = 0; i < SHA_DIGEST_LENGTH; i++)
+				result[i] = (char)(stage1[i] ^ digest[i]);
+			return result;
+		}
+
+		// SHA256(password) ^ SHA256(SHA256(SHA256(password)) + scramble)
+		std::string scramble_sha256(const std::string& password, const std::string& scramble)
+		{
+			if (password.empty())
+				return std::string();
+
+			unsigned char stage1[SHA256_DIGEST_LENGTH];
+			unsigned char stage2[SHA256_DIGEST_LENGTH];
+			unsigned char digest[SHA256_DIGEST_LENGTH];
+
+			SHA256((const unsigned char*)password.data(), password.size(), stage1);
+			SHA256(stage1, sizeof(stage1), stage2);
+
+			std::string salted((const char*)stage2, sizeof(stage2));
+			salted.append(scramble, 0, 20);
+			SHA256((const unsigned char*)salted.data(), salted.size(), digest);
+
+			std::string result(SHA256_DIGEST_LENGTH, '\0');
+			for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+				result[i] = (char)(stage1[i] ^ digest[i]);
+			return result;
+		}
+
+		// caching_sha2_password full authentication without tls: the
+		// nul terminated password xor the scramble, rsa-oaep encrypted
+		bool encrypt_password(const std::string& password, const std::string& scramble,
+			const std::string& pem, std::string& out)
+		{
+			std::string plain(password);
+			plain.push_back('\0');
+			for (std::size_t i = 0; i < plain.size() && !scramble.empty(); i++)
+				plain[i] ^= scramble[i % std::min(scramble.size(), kScrambleSize)];
+
+			BIO *bio = BIO_new_mem_buf((void*)pem.data(), (int)pem.size());
+			if (bio == nullptr)
+				return false;
+
+			EVP_PKEY *key = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
+			BIO_free(bio);
+			if (key == nullptr)
+				return false;
+
+			bool ok = false;
+			EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, nullptr);
+			std::size_t size = 0;
+
+			if (ctx != nullptr
+				&& EVP_PKEY_encrypt_init(ctx) > 0
+				&& EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) > 0
+				&& EVP_PKEY_encrypt(ctx, nullptr, &size,
+					(const unsigned char*)plain.data(), plain.size()) > 0)
+			{
+				out.resize(size);
+				ok = EVP_PKEY_encrypt(ctx, (unsigned char*)&out[0], &size,
+					(const unsigned char*)plain.data(), plain.size()) > 0;
+				out.resize(size);
+			}
+
+			EVP_PKEY_CTX_free(ctx);
+			EVP_PKEY_free(key);
+			return ok;
+		}
+
+		// temporal values arrive packed in the binary protocol, spell them
+		// the way the text protocol would
+		std::string format_temporal(uint8_t type, MySqlPacket::Reader& reader)
+		{
+			std::size_t length = (std::size_t)reader.uint(1);
+			const char *data = reader.bytes(length);
+			MySqlPacket::Reader value(data, reader.ok() ? length : 0);
+			char buff[64];
+
+			if (type == kTypeTime)
+			{
+				bool negative = value.uint(1) != 0;
+				uint64_t days = value.uint(4);
+				unsigned hour = (unsigned)value.uint(1);
+				unsigned minute = (unsigned)value.uint(1);
+				unsigned second = (unsigned)value.uint(1);
+				unsigned micro = (unsigned)value.uint(4);
+
+				int n = snprintf(buff, sizeof(buff), "%s%02llu:%02u:%02u",
+					negative ? "-" : "", (unsigned long long)(days * 24 + hour), minute, second);
+				if (length > 8)
+					snprintf(buff + n, sizeof(buff) - n, ".%06u", micro);
+				return buff;
+			}
+
+			unsigned year = (unsigned)value.uint(2);
+			unsigned month = (unsigned)value.uint(1);
+			unsigned day = (unsigned)value.uint(1);
+			unsigned hour = (unsigned)value.uint(1);
+			unsigned minute = (unsigned)value.uint(1);
+			unsigned second = (unsigned)value.uint(1);
+			unsigned micro = (unsigned)value.uint(4);
+
+			int n = snprintf(buff, sizeof(buff), "%04u-%02u-%02u", year, month, day);
+			if (type != kTypeDate)
+			{
+				n += snprintf(buff + n, sizeof(buff) - n, " %02u:%02u:%02u", hour, minute, second);
+				if (length > 7)
+					snprintf(buff + n, sizeof(buff) - n, ".%06u", micro);
+			}
+			return buff;
+		}
+
+		void read_binary_value(const MySqlResult::Field& field, MySqlPacket::Reader& reader,
+			MySqlResult& result)
+		{
+			bool is_unsigned = (field.flags & kFlagUnsigned) != 0;
+
+			switch (field.type)
+			{
+			case kTypeTiny:
+			{
+				uint64_t value = reader.uint(1);
+				result.add_integer(is_unsigned ? (int64_t)value : (int64_t)(int8_t)value);
+				break;
+			}
+
+			case kTypeShort:
+			case kTypeYear:
+			{
+				uint64_t value = reader.uint(2);
+				result.add_integer(is_unsigned ? (int64_t)value : (int64_t)(int16_t)value);
+				break;
+			}
+
+			case kTypeLong:
+			case kTypeInt24:
+			{
+				uint64_t value = reader.uint(4);
+				result.add_integer(is_unsigned ? (int64_t)value : (int64_t)(int32_t)value);
+				break;
+			}
+
+			case kTypeLongLong:
+			{
+				uint64_t value = reader.uint(8);
+				// lua has no unsigned 64 bit integer, the top half turns into a float
+				if (is_unsigned && value > (uint64_t)INT64_MAX)
+					result.add_number((double)value);
+				else
+					result.add_integer((int64_t)value);
+				break;
+			}
+
+			case kTypeFloat:
+			{
+				uint32_t bits = (uint32_t)reader.uint(4);
+				float value;
+				std::memcpy(&value, &bits, sizeof(value));
+				result.add_number(value);
+				break;
+			}
+
+			case kTypeDouble:
+			{
+				uint64_t bits = reader.uint(8);
+				double value;
+				std::memcpy(&value, &bits, sizeof(value));
+				result.add_number(value);
+				break;
+			}
+
+			case kTypeDate:
+			case kTypeDateTime:
+			case kTypeTimestamp:
+			case kTypeTime:
+			{
+				std::string value = format_temporal(field.type, reader);
+				result.add_value(value.data(), value.size());
+				break;
+			}
+
+			default:
+			{
+				std::size_t length = (std::size_t)reader.lenenc();
+				result.add_value(reader.bytes(length), length);
+				break;
+			}
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+
+	class MySqlClient::Connection :
+		public Allocator, public std::enable_shared_from_this<Connection>
+	{
+	public:
+		Connection(MySqlClient& client)
+			: client_(client)
+			, socket_(client.io_service_)
+			, timer_(client.io_service_)
+			, timer_armed_(false)
+			, state_(kDisconnected)
+			, deadline_(Clock::time_point::max())
+			, attempts_(0)
+			, in_(16 * 1024)
+			, in_size_(0)
+			, large_()
+			, seq_(0)
+			, outbox_()
+			, writing_()
+			, write_pending_(false)
+			, capabilities_(0)
+			, scramble_()
+			, plugin_()
+			, in_flight_()
+			, phase_(kHeader)
+			, columns_(0)
+			, captured_(false)
+			, result_()
+			, statements_()
+			, statement_order_()
+			, preparing_()
+		{
+
+		}
+
+		bool ready() const { return state_ == kReady; }
+
+		std::size_t in_flight() const { return in_flight_.size(); }
+
+		void start()
+		{
+			if (state_ != kDisconnected)
+				return;
+
+			state_ = kConnecting;
+			arm_deadline(Clock::now() + std::chrono::milliseconds(client_.options_.connect_timeout));
+
+			auto self = shared_from_this();
+			client_.resolver_.async_resolve(client_.options_.host,
+				[this, self](const asio::error_code& ec, const Resolver::Addresses& addresses)
+			{
+				if (state_ != kConnecting)
+					return;
+
+				if (ec || addresses.empty())
+				{
+					disconnect(kErrorConnection, "resolve " + client_.options_.host + ": "
+						+ (ec ? ec.message() : std::string("no address")));
+					return;
+				}
+
+				do_connect(addresses, 0);
+			});
+		}
+
+		void close()
+		{
+			state_ = kClosed;
+
+			asio::error_code ec;
+			socket_.close(ec);
+			timer_.cancel(ec);
+
+			in_flight_.clear();
+		}
+
+		void send(Request& request)
+		{
+			std::string payload;
+
+			if (!request.prepared)
+			{
+				payload.reserve(request.sql.size() + 1);
+				payload.push_back((char)kComQuery);
+				payload.append(request.sql);
+				request.command = kComQuery;
+			}
+			else
+			{
+				auto iter = statements_.find(request.sql);
+				if (iter != statements_.end())
+				{
+					execute_payload(iter->second, request.params, payload);
+					request.command = kComStmtExecute;
+				}
+				else
+				{
+					// the execute follows once the statement id is known
+					payload.reserve(request.sql.size() + 1);
+					payload.push_back((char)kComStmtPrepare);
+					payload.append(request.sql);
+					request.command = kComStmtPrepare;
+				}
+			}
+
+			write_packet(0, payload);
+
+			in_flight_.push_back(std::move(request));
+			client_.in_flight_++;
+
+			if (!timer_armed_)
+				arm_deadline(in_flight_.front().deadline);
+		}
+
+	private:
+		struct Statement
+		{
+			uint32_t id;
+			uint16_t params;
+			uint16_t columns;
+		};
+
+		enum State
+		{
+			kDisconnected,
+			kConnecting,
+			kHandshake,
+			kAuth,
+			kReady,
+			kClosed,
+		};
+
+		// where the reply to the statement at the front stands
+		enum Phase
+		{
+			kHeader,
+			kColumns,
+			kColumnsEof,
+			kRows,
+			// definitions sent after a prepare ok, only counted
+			kPrepareDefinitions,
+		};
+
+		void do_connect(const Resolver::Addresses& addresses, std::size_t index)
+		{
+			asio::ip::tcp::endpoint endpoint(addresses[index], client_.options_.port);
+
+			auto self = shared_from_this();
+			socket_.async_connect(endpoint,
+				[this, self, addresses, index](const asio::error_code& ec)
+			{
+				if (state_ != kConnecting)
+					return;
+
+				if (ec)
+				{
+					asio::error_code ignored;
+					socket_.close(ignored);
+
+					if (index + 1 < addresses.size())
+						do_connect(addresses, index + 1);
+					else
+						disconnect(kErrorConnection, "connect " + client_.options_.host
+							+ ": " + ec.message());
+					return;
+				}
+
+				asio::error_code ignored;
+				socket_.set_option(asio::ip::tcp::no_delay(true), ignored);
+
+				state_ = kHandshake;
+				do_read();
+			});
+		}
+
+		void do_read()
+		{
+			if (in_.size() - in_size_ < 4096)
+				in_.resize(in_.size() * 2);
+
+			auto self = shared_from_this();
+			socket_.async_read_some(asio::buffer(in_.data() + in_size_, in_.size() - in_size_),
+				[this, self](const asio::error_code& ec, std::size_t bytes)
+			{
+				if (state_ == kClosed || state_ == kDisconnected)
+					return;
+
+				if (ec)
+				{
+					disconnect(kErrorServerLost, "lost connection to mysql server: " + ec.message());
+					return;
+				}
+
+				in_size_ += bytes;
+
+				if (!parse())
+					return;
+
+				do_read();
+			});
+		}
+
+		// false once the connection went away under a packet handler
+		bool parse()
+		{
+			std::size_t pos = 0;
+
+			while (in_size_ - pos >= 4)
+			{
+				const uint8_t *header = (const uint8_t*)in_.data() + pos;
+				std::size_t size = header[0] | (header[1] << 8) | (header[2] << 16);
+
+				if (in_size_ - pos < 4 + size)
+				{
+					if (in_.size() < 4 + size)
+						in_.resize(4 + size + 4096);
+					break;
+				}
+
+				seq_ = header[3];
+
+				const char *payload = in_.data() + pos + 4;
+				pos += 4 + size;
+
+				// payloads of 16M and more come split, the last part is shorter
+				if (size == kMaxPacket || !large_.empty())
+				{
+					large_.append(payload, size);
+					if (size == kMaxPacket)
+						continue;
+
+					std::string packet;
+					packet.swap(large_);
+					on_packet(packet.data(), packet.size());
+				}
+				else
+				{
+					on_packet(payload, size);
+				}
+
+				if (state_ == kClosed || state_ == kDisconnected)
+					return false;
+			}
+
+			if (pos > 0)
+			{
+				std::memmove(in_.data(), in_.data() + pos, in_size_ - pos);
+				in_size_ -= pos;
+			}
+
+			return true;
+		}
+
+		void on_packet(const char *data, std::size_t size)
+		{
+			switch (state_)
+			{
+			case kHandshake:
+				on_handshake(data, size);
+				break;
+
+			case kAuth:
+				on_auth(data, size);
+				break;
+
+			case kReady:
+				on_reply(data, size);
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		void on_handshake(const char *data, std::size_t size)
+		{
+			MySqlPacket::Reader reader(data, size);
+
+			if (reader.peek() == kPacketError)
+			{
+				on_auth_error(data, size);
+				return;
+			}
+
+			uint8_t protocol = (uint8_t)reader.uint(1);
+			reader.null_string();
+			reader.uint(4);
+			std::string scramble(reader.bytes(8), 8);
+			reader.skip(1);
+			uint32_t capabilities = (uint32_t)reader.uint(2);
+			reader.uint(1);
+			reader.uint(2);
+			capabilities |= (uint32_t)reader.uint(2) << 16;
+			std::size_t scramble_size = (std::size_t)reader.uint(1);
+			reader.skip(10);
+
+			if (capabilities & kClientSecureConnection)
+			{
+				std::size_t rest = std::max<std::size_t>(13, scramble_size > 8 ? scramble_size - 8 : 0);
+				rest = std::min(rest, reader.left());
+				scramble.append(reader.bytes(rest), rest);
+			}
+
+			// 20 bytes, the second part comes nul terminated
+			if (scramble.size() > kScrambleSize)
+				scramble.resize(kScrambleSize);
+
+			std::string plugin = (capabilities & kClientPluginAuth)
+				? reader.null_string() : std::string("mysql_native_password");
+
+			if (protocol != 10 || !reader.ok() || !(capabilities & kClientProtocol41))
+			{
+				disconnect(kErrorMalformed, "unsupported mysql handshake");
+				return;
+			}
+
+			uint32_t wanted = kClientLongPassword | kClientLongFlag | kClientProtocol41
+				| kClientTransactions | kClientSecureConnection | kClientMultiResults
+				| kClientPsMultiResults | kClientPluginAuth | kClientPluginAuthLenencData;
+
+			if (!client_.options_.db.empty())
+				wanted |= kClientConnectWithDb;
+
+			capabilities_ = wanted & capabilities;
+			scramble_ = scramble;
+			plugin_ = plugin;
+
+			std::string auth;
+			if (!auth_response(plugin_, auth))
+				return;
+
+			std::string payload;
+			MySqlPacket::put_uint(payload, capabilities_, 4);
+			MySqlPacket::put_uint(payload, kMaxPacket, 4);
+			MySqlPacket::put_uint(payload, kCharsetUtf8, 1);
+			payload.append(23, '\0');
+			payload.append(client_.options_.user);
+			payload.push_back('\0');
+
+			if (capabilities_ & kClientPluginAuthLenencData)
+				MySqlPacket::put_lenenc(payload, auth.size());
+			else
+				MySqlPacket::put_uint(payload, auth.size(), 1);
+			payload.append(auth);
+
+			if (capabilities_ & kClientConnectWithDb)
+			{
+				payload.append(client_.options_.db);
+				payload.push_back('\0');
+			}
+
+			if (capabilities_ & kClientPluginAuth)
+			{
+				payload.append(plugin_);
+				payload.push_back('\0');
+			}
+
+			state_ = kAuth;
+			write_packet(seq_ + 1, payload);
+		}
+
+		bool auth_response(const std::string& plugin, std::string& auth)
+		{
+			if (plugin == "mysql_native_password")
+				auth = scramble_native(client_.options_.password, scramble_);
+			else if (plugin == "caching_sha2_password")
+				auth = scramble_sha256(client_.options_.password, scramble_);
+			else
+			{
+				disconnect(kErrorConnection, "unsupported auth plugin " + plugin);
+				return false;
+			}
+
+			return true;
+		}
+
+		void on_auth(const char *data, std::size_t size)
+		{
+			MySqlPacket::Reader reader(data, size);
+
+			switch (reader.peek())
+			{
+			case kPacketOk:
+				on_ready();
+				break;
+
+			case kPacketError:
+				on_auth_error(data, size);
+				break;
+
+			case kPacketEof:
+			{
+				// auth switch request: plugin name, then fresh scramble
+				reader.uint(1);
+				plugin_ = reader.null_string();
+				scramble_ = reader.rest();
+				if (scramble_.size() > kScrambleSize)
+					scramble_.resize(kScrambleSize);
+
+				std::string auth;
+				if (auth_response(plugin_, auth))
+					write_packet(seq_ + 1, auth);
+				break;
+			}
+
+			case kPacketAuthMoreData:
+			{
+				reader.uint(1);
+
+				if (plugin_ != "caching_sha2_password")
+				{
+					disconnect(kErrorConnection, "unexpected auth data for " + plugin_);
+					break;
+				}
+
+				// 3: fast auth succeeded, an ok follows
+				// 4: full auth, ask for the server's public key
+				// otherwise: the key itself
+				if (reader.left() == 1 && reader.peek() == 3)
+					break;
+
+				if (reader.left() == 1 && reader.peek() == 4)
+				{
+					write_packet(seq_ + 1, std::string(1, '\2'));
+					break;
+				}
+
+				std::string encrypted;
+				if (!encrypt_password(client_.options_.password, scramble_, reader.rest(), encrypted))
+				{
+					disconnect(kErrorConnection, "caching_sha2_password: bad server public key");
+					break;
+				}
+
+				write_packet(seq_ + 1, encrypted);
+				break;
+			}
+
+			default:
+				disconnect(kErrorMalformed, "malformed auth packet");
+				break;
+			}
+		}
+
+		void on_auth_error(const char *data, std::size_t size)
+		{
+			MySqlResult error;
+			parse_error(data, size, error);
+
+			fprintf(stderr, "mysql %s:%d %s\n", client_.options_.host.c_str(),
+				(int)client_.options_.port, error.error.c_str());
+
+			disconnect(error.error_code, error.error);
+		}
+
+		void on_ready()
+		{
+			state_ = kReady;
+			attempts_ = 0;
+			phase_ = kHeader;
+			client_.ready_++;
+
+			// drop the connect timeout, statements arm their own
+			asio::error_code ec;
+			timer_.cancel(ec);
+			timer_armed_ = false;
+			deadline_ = Clock::time_point::max();
+
+			client_.dispatch();
+		}
+
+		void on_reply(const char *data, std::size_t size)
+		{
+			if (in_flight_.empty())
+			{
+				disconnect(kErrorMalformed, "unexpected packet from mysql server");
+				return;
+			}
+
+			if (in_flight_.front().command == kComStmtPrepare)
+			{
+				on_prepare_reply(data, size);
+				return;
+			}
+
+			if (!result_)
+			{
+				result_ = std::make_shared<MySqlResult>();
+				captured_ = false;
+			}
+
+			MySqlPacket::Reader reader(data, size);
+			uint8_t first = reader.peek();
+
+			switch (phase_)
+			{
+			case kHeader:
+				if (first == kPacketOk)
+				{
+					reader.uint(1);
+					uint64_t affected_rows = reader.lenenc();
+					uint64_t insert_id = reader.lenenc();
+					uint16_t status = (uint16_t)reader.uint(2);
+					uint16_t warnings = (uint16_t)reader.uint(2);
+
+					if (!captured_)
+					{
+						result_->affected_rows = affected_rows;
+						result_->insert_id = insert_id;
+						result_->warnings = warnings;
+					}
+
+					result_->status = status;
+					if (!(status & kServerMoreResultsExists))
+						finish();
+				}
+				else if (first == kPacketError)
+				{
+					parse_error(data, size, *result_);
+
+					if (!retry_prepare())
+						finish();
+				}
+				else if (first == kPacketLocalInfile)
+				{
+					// refuse, the server answers with an error
+					write_packet(seq_ + 1, std::string());
+				}
+				else
+				{
+					columns_ = (std::size_t)reader.lenenc();
+					phase_ = columns_ > 0 ? kColumns : kColumnsEof;
+				}
+				break;
+
+			case kColumns:
+				if (!captured_)
+				{
+					MySqlResult::Field field;
+					reader.lenenc_string();
+					reader.lenenc_string();
+					reader.lenenc_string();
+					reader.lenenc_string();
+					field.name = reader.lenenc_string();
+					reader.lenenc_string();
+					reader.lenenc();
+					reader.uint(2);
+					reader.uint(4);
+					field.type = (uint8_t)reader.uint(1);
+					field.flags = (uint16_t)reader.uint(2);
+					field.decimals = (uint8_t)reader.uint(1);
+					result_->add_field(field);
+				}
+
+				if (--columns_ == 0)
+					phase_ = kColumnsEof;
+				break;
+
+			case kColumnsEof:
+				phase_ = kRows;
+				break;
+
+			case kRows:
+				if (first == kPacketEof && size < 9)
+				{
+					reader.uint(1);
+					if (!captured_)
+						result_->warnings = (uint16_t)reader.uint(2);
+					else
+						reader.uint(2);
+					result_->status = (uint16_t)reader.uint(2);
+
+					// later result sets of a multi statement are read and dropped
+					captured_ = true;
+
+					if (result_->status & kServerMoreResultsExists)
+						phase_ = kHeader;
+					else
+						finish();
+				}
+				else if (first == kPacketError)
+				{
+					parse_error(data, size, *result_);
+					finish();
+				}
+				else if (!captured_ && in_flight_.front().command == kComStmtExecute)
+				{
+					// 0x00, then a null bitmap offset by two bits
+					const std::vector<MySqlResult::Field>& fields = result_->fields();
+					std::size_t count = fields.size();
+
+					reader.uint(1);
+					const uint8_t *nulls = (const uint8_t*)reader.bytes((count + 9) / 8);
+
+					for (std::size_t i = 0; i < count && reader.ok(); i++)
+					{
+						std::size_t bit = i + 2;
+						if (nulls[bit / 8] & (1 << (bit % 8)))
+							result_->add_null();
+						else
+							read_binary_value(fields[i], reader, *result_);
+					}
+
+					if (!reader.ok())
+						disconnect(kErrorMalformed, "malformed row from mysql server");
+				}
+				else if (!captured_)
+				{
+					std::size_t count = result_->field_count();
+					for (std::size_t i = 0; i < count; i++)
+					{
+						if (reader.peek() == kNullColumn)
+						{
+							reader.uint(1);
+							result_->add_null();
+						}
+						else
+						{
+							std::size_t length = (std::size_t)reader.lenenc();
+							result_->add_value(reader.bytes(length), length);
+						}
+					}
+
+					if (!reader.ok())
+						disconnect(kErrorMalformed, "malformed row from mysql server");
+				}
+
+				// a malformed row may have just disconnected
+				if (result_ && !captured_ && !in_flight_.empty())
+					flush_batch();
+				break;
+
+			default:
+				// the prepare phases are read by on_prepare_reply
+				disconnect(kErrorMalformed, "unexpected packet from mysql server");
+				break;
+			}
+		}
+
+		// hand a full batch to a streaming request, keep reading into a new one
+		void flush_batch()
+		{
+			Request& request = in_flight_.front();
+			if (request.batch_rows == 0 || result_->row_count() < request.batch_rows)
+				return;
+
+			MySqlResultPtr batch = result_->next();
+			batch.swap(result_);
+			batch->more = true;
+
+			if (request.handler)
+				request.handler(batch);
+		}
+
+		void on_prepare_reply(const char *data, std::size_t size)
+		{
+			MySqlPacket::Reader reader(data, size);
+
+			if (phase_ == kPrepareDefinitions)
+			{
+				if (--columns_ == 0)
+					prepared();
+				return;
+			}
+
+			if (reader.peek() == kPacketError)
+			{
+				result_ = std::make_shared<MySqlResult>();
+				parse_error(data, size, *result_);
+				finish();
+				return;
+			}
+
+			reader.uint(1);
+			preparing_.id = (uint32_t)reader.uint(4);
+			preparing_.columns = (uint16_t)reader.uint(2);
+			preparing_.params = (uint16_t)reader.uint(2);
+
+			if (!reader.ok())
+			{
+				disconnect(kErrorMalformed, "malformed prepare reply from mysql server");
+				return;
+			}
+
+			// each non-empty definition block ends with an eof
+			columns_ = 0;
+			if (preparing_.params > 0)
+				columns_ += preparing_.params + 1;
+			if (preparing_.columns > 0)
+				columns_ += preparing_.columns + 1;
+
+			if (columns_ > 0)
+				phase_ = kPrepareDefinitions;
+			else
+				prepared();
+		}
+
+		void prepared()
+		{
+			phase_ = kHeader;
+
+			Request request = std::move(in_flight_.front());
+			in_flight_.pop_front();
+			client_.in_flight_--;
+
+			const std::string& sql = request.sql;
+
+			// two requests raced to prepare the same sql, keep the first
+			auto existing = statements_.find(sql);
+			if (existing != statements_.end())
+			{
+				close_statement(preparing_.id);
+				preparing_ = existing->second;
+			}
+
+			while (existing == statements_.end() && !statement_order_.empty()
+				&& statement_order_.size() >= (std::size_t)client_.options_.statement_cache)
+			{
+				auto iter = statements_.find(statement_order_.front());
+				if (iter != statements_.end())
+				{
+					close_statement(iter->second.id);
+					statements_.erase(iter);
+				}
+				statement_order_.pop_front();
+			}
+
+			if (existing == statements_.end())
+			{
+				statements_[sql] = preparing_;
+				statement_order_.push_back(sql);
+			}
+
+			if (request.params.size() != preparing_.params)
+			{
+				MySqlResultPtr result = std::make_shared<MySqlResult>();
+				result->fail(2031, "statement expects " + std::to_string(preparing_.params)
+					+ " parameters, got " + std::to_string(request.params.size()));
+				client_.complete(request, result);
+
+				if (state_ == kReady)
+					client_.dispatch();
+				return;
+			}
+
+			// goes out behind whatever was pipelined meanwhile
+			send(request);
+		}
+
+		// the statement vanished on the server side (ddl, flush), forget it
+		// and run the request again through a fresh prepare
+		bool retry_prepare()
+		{
+			Request& request = in_flight_.front();
+
+			if (request.command != kComStmtExecute || request.retried
+				|| (result_->error_code != kErrorUnknownStatement
+					&& result_->error_code != kErrorNeedReprepare))
+				return false;
+
+			auto iter = statements_.find(request.sql);
+			if (iter != statements_.end())
+			{
+				close_statement(iter->second.id);
+				statements_.erase(iter);
+				statement_order_.erase(std::find(statement_order_.begin(),
+					statement_order_.end(), request.sql));
+			}
+
+			Request retry = std::move(request);
+			in_flight_.pop_front();
+			client_.in_flight_--;
+			result_.reset();
+			phase_ = kHeader;
+
+			retry.retried = true;
+			send(retry);
+			return true;
+		}
+
+		// no reply comes for a close, it can go out at any time
+		void close_statement(uint32_t id)
+		{
+			std::string payload;
+			payload.push_back((char)kComStmtClose);
+			MySqlPacket::put_uint(payload, id, 4);
+			write_packet(0, payload);
+		}
+
+		void execute_payload(const Statement& statement, const MySqlParams& params,
+			std::string& payload)
+		{
+			payload.push_back((char)kComStmtExecute);
+			MySqlPacket::put_uint(payload, statement.id, 4);
+			// no cursor, one iteration
+			MySqlPacket::put_uint(payload, 0, 1);
+			MySqlPacket::put_uint(payload, 1, 4);
+
+			std::size_t count = std::min<std::size_t>(params.size(), statement.params);
+			if (statement.params == 0)
+				return;
+
+			std::size_t bitmap = payload.size();
+			payload.append((statement.params + 7) / 8, '\0');
+			for (std::size_t i = 0; i < statement.params; i++)
+			{
+				if (i >= count || params[i].type == MySqlResult::kNull)
+					payload[bitmap + i / 8] |= (char)(1 << (i % 8));
+			}
+
+			// types follow on every execute, so one statement takes any lua value
+			MySqlPacket::put_uint(payload, 1, 1);
+			for (std::size_t i = 0; i < statement.params; i++)
+			{
+				uint8_t type = kTypeNull;
+				if (i < count)
+				{
+					switch (params[i].type)
+					{
+					case MySqlResult::kInteger: type = kTypeLongLong; break;
+					case MySqlResult::kNumber: type = kTypeDouble; break;
+					case MySqlResult::kString: type = kTypeVarString; break;
+					default: break;
+					}
+				}
+				MySqlPacket::put_uint(payload, type, 1);
+				MySqlPacket::put_uint(payload, 0, 1);
+			}
+
+			for (std::size_t i = 0; i < count; i++)
+			{
+				const MySqlParam& param = params[i];
+				switch (param.type)
+				{
+				case MySqlResult::kInteger:
+					MySqlPacket::put_uint(payload, (uint64_t)param.integer, 8);
+					break;
+
+				case MySqlResult::kNumber:
+				{
+					uint64_t bits;
+					std::memcpy(&bits, &param.number, sizeof(bits));
+					MySqlPacket::put_uint(payload, bits, 8);
+					break;
+				}
+
+				case MySqlResult::kString:
+					MySqlPacket::put_lenenc(payload, param.string.size());
+					payload.append(param.string);
+					break;
+
+				default:
+					break;
+				}
+			}
+		}
+
+		void parse_error(const char *data, std::size_t size, MySqlResult& result)
+		{
+			MySqlPacket::Reader reader(data, size);
+			reader.uint(1);
+			int code = (int)reader.uint(2);
+
+			std::string state("HY000");
+			if (reader.peek() == '#')
+			{
+				reader.uint(1);
+				state.assign(reader.bytes(5), 5);
+			}
+
+			result.fail(code, reader.rest(), state.c_str());
+		}
+
+		void finish()
+		{
+			Request request = std::move(in_flight_.front());
+			in_flight_.pop_front();
+			client_.in_flight_--;
+
+			MySqlResultPtr result;
+			result.swap(result_);
+			phase_ = kHeader;
+
+			client_.complete(request, result);
+
+			if (state_ == kReady)
+				client_.dispatch();
+		}
+
+		void write_packet(uint8_t seq, const std::string& payload)
+		{
+			std::size_t offset = 0;
+
+			for (;;)
+			{
+				std::size_t size = std::min(payload.size() - offset, kMaxPacket);
+
+				MySqlPacket::put_uint(outbox_, size, 3);
+				MySqlPacket::put_uint(outbox_, seq++, 1);
+				outbox_.append(payload, offset, size);
+				offset += size;
+
+				if (size < kMaxPacket)
+					break;
+			}
+
+			do_write();
+		}
+
+		void do_write()
+		{
+			if (write_pending_ || outbox_.empty())
+				return;
+
+			write_pending_ = true;
+			writing_.swap(outbox_);
+
+			auto self = shared_from_this();
+			asio::async_write(socket_, asio::buffer(writing_),
+				[this, self](const asio::error_code& ec, std::size_t)
+			{
+				write_pending_ = false;
+				writing_.clear();
+
+				if (state_ == kClosed || state_ == kDisconnected)
+					return;
+
+				if (ec)
+				{
+					disconnect(kErrorServerLost, "lost connection to mysql server: " + ec.message());
+					return;
+				}
+
+				do_write();
+			});
+		}
+
+		void arm_deadline(Clock::time_point deadline)
+		{
+			deadline_ = deadline;
+
+			if (deadline == Clock::time_point::max())
+				return;
+
+			timer_armed_ = true;
+			timer_.expires_at(deadline);
+
+			auto self = shared_from_this();
+			timer_.async_wait([this, self](const asio::error_code& ec)
+			{
+				// a cancelled wait was replaced by a newer one
+				if (ec == asio::error::operation_aborted)
+					return;
+
+				timer_armed_ = false;
+
+				if (state_ != kClosed)
+					on_timer();
+			});
+		}
+
+		// the wait may have been overtaken by a newer deadline, so every
+		// branch checks the clock rather than trusting the wakeup
+		void on_timer()
+		{
+			Clock::time_point now = Clock::now();
+
+			switch (state_)
+			{
+			case kDisconnected:
+				if (now >= deadline_)
+					start();
+				else
+					arm_deadline(deadline_);
+				break;
+
+			case kConnecting:
+			case kHandshake:
+			case kAuth:
+				if (now >= deadline_)
+					disconnect(kErrorConnection, "connect " + client_.options_.host + ": timed out");
+				else
+					arm_deadline(deadline_);
+				break;
+
+			case kReady:
+				if (in_flight_.empty())
+					break;
+
+				if (now >= in_flight_.front().deadline)
+				{
+					Request request = std::move(in_flight_.front());
+					in_flight_.pop_front();
+					client_.in_flight_--;
+					client_.timeouts_++;
+
+					client_.fail(request, kErrorTimeout, "mysql query timed out");
+
+					disconnect(kErrorServerLost, "mysql connection reset after a query timed out");
+				}
+				else
+				{
+					arm_deadline(in_flight_.front().deadline);
+				}
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		// fail what was sent, statements that may have run are never retried
+		void disconnect(int code, const std::string& message)
+		{
+			if (state_ == kReady)
+				client_.ready_--;
+
+			state_ = kDisconnected;
+
+			asio::error_code ec;
+			socket_.close(ec);
+
+			in_size_ = 0;
+			large_.clear();
+			outbox_.clear();
+			result_.reset();
+			phase_ = kHeader;
+
+			// prepared statements die with the session
+			statements_.clear();
+			statement_order_.clear();
+
+			std::deque<Request> requests;
+			requests.swap(in_flight_);
+			client_.in_flight_ -= requests.size();
+
+			for (auto& request : requests)
+				client_.fail(request, code, message);
+
+			int delay = client_.options_.reconnect_delay << std::min(attempts_, 5);
+			attempts_++;
+
+			arm_deadline(Clock::now() + std::chrono::milliseconds(delay));
+
+			// whatever waits may still fit on the other connections
+			client_.dispatch();
+		}
+
+		MySqlClient& client_;
+
+		asio::ip::tcp::socket socket_;
+
+		asio::steady_timer timer_;
+
+		bool timer_armed_;
+
+		State state_;
+
+		// connect timeout, retry time or the oldest statement's timeout
+		Clock::time_point deadline_;
+
+		int attempts_;
+
+		std::vector<char> in_;
+
+		std::size_t in_size_;
+
+		std::string large_;
+
+		uint8_t seq_;
+
+		std::string outbox_;
+
+		std::string writing_;
+
+		bool write_pending_;
+
+		uint32_t capabilities_;
+
+		std::string scramble_;
+
+		std::string plugin_;
+
+		std::deque<Request> in_flight_;
+
+		Phase phase_;
+
+		std::size_t columns_;
+
+		// true once the first result set of a reply is complete
+		bool captured_;
+
+		MySqlResultPtr result_;
+
+		typedef std::unordered_map<std::string, Statement> StatementMap;
+
+		StatementMap statements_;
+
+		// insertion order, the front is closed when the cache is full
+		std::deque<std::string> statement_order_;
+
+		Statement preparing_;
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+
+	MySqlClient::MySqlClient(asio::io_service& io_service, Resolver& resolver,
+		const Options& options)
+		: io_service_(io_service)
+		, resolver_(resolver)
+		, options_(options)
+		, connections_()
+		, queue_()
+		, queue_timer_(io_service)
+		, queue_timer_armed_(false)
+		, closed_(false)
+		, ready_(0)
+		, queued_(0)
+		, in_flight_(0)
+		, completed_(0)
+		, failed_(0)
+		, timeouts_(0)
+	{
+		if (options_.connections < 1)
+			options_.connections = 1;
+
+		if (options_.pipeline < 1)
+			options_.pipeline = 1;
+	}
+
+	MySqlClient::~MySqlClient()
+	{
+		for (auto& connection : connections_)
+			connection->close();
+	}
+
+	void MySqlClient::start()
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self]()
+		{
+			if (closed_ || !connections_.empty())
+				return;
+
+			for (int i = 0; i < options_.connections; i++)
+			{
+				connections_.push_back(std::make_shared<Connection>(*this));
+				connections_.back()->start();
+			}
+		});
+	}
+
+	void MySqlClient::query(std::string sql, Handler handler)
+	{
+		Request request;
+		request.sql = std::move(sql);
+		request.handler = std::move(handler);
+
+		submit(request);
+	}
+
+	void MySqlClient::execute(std::string sql, MySqlParams params, Handler handler)
+	{
+		Request request;
+		request.sql = std::move(sql);
+		request.prepared = true;
+		request.params = std::move(params);
+		request.handler = std::move(handler);
+
+		submit(request);
+	}
+
+	void MySqlClient::stream(std::string sql, std::size_t batch_rows, Handler handler)
+	{
+		Request request;
+		request.sql = std::move(sql);
+		request.batch_rows = batch_rows > 0 ? batch_rows : 1;
+		request.handler = std::move(handler);
+
+		submit(request);
+	}
+
+	void MySqlClient::submit(Request& request)
+	{
+		request.deadline = options_.timeout > 0
+			? Clock::now() + std::chrono::milliseconds(options_.timeout)
+			: Clock::time_point::max();
+
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self, request]() mutable
+		{
+			do_query(request);
+		});
+	}
+
+	void MySqlClient::close()
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self]()
+		{
+			closed_ = true;
+
+			for (auto& connection : connections_)
+				connection->close();
+			connections_.clear();
+
+			queue_.clear();
+			queued_ = 0;
+			in_flight_ = 0;
+			ready_ = 0;
+
+			asio::error_code ec;
+			queue_timer_.cancel(ec);
+		});
+	}
+
+	MySqlClient::Stats MySqlClient::stats() const
+	{
+		Stats stats;
+		stats.connections = (std::size_t)options_.connections;
+		stats.ready = ready_;
+		stats.queued = queued_;
+		stats.in_flight = in_flight_;
+		stats.completed = completed_;
+		stats.failed = failed_;
+		stats.timeouts = timeouts_;
+		return stats;
+	}
+
+	void MySqlClient::do_query(Request& request)
+	{
+		if (closed_)
+			return;
+
+		if (queue_.size() >= (std::size_t)options_.queue_limit)
+		{
+			fail(request, kErrorQueueFull, "mysql queue full");
+			return;
+		}
+
+		queue_.push_back(std::move(request));
+		queued_++;
+
+		dispatch();
+
+		if (!queue_.empty() && !queue_timer_armed_)
+			arm_queue_timer();
+	}
+
+	void MySqlClient::dispatch()
+	{
+		while (!queue_.empty() && !closed_)
+		{
+			Connection *target = nullptr;
+
+			for (auto& connection : connections_)
+			{
+				if (!connection->ready()
+					|| connection->in_flight() >= (std::size_t)options_.pipeline)
+					continue;
+
+				if (target == nullptr || connection->in_flight() < target->in_flight())
+					target = connection.get();
+			}
+
+			if (target == nullptr)
+				break;
+
+			Request request = std::move(queue_.front());
+			queue_.pop_front();
+			queued_--;
+
+			target->send(request);
+		}
+	}
+
+	void MySqlClient::arm_queue_timer()
+	{
+		Clock::time_point deadline = queue_.front().deadline;
+		if (deadline == Clock::time_point::max())
+			return;
+
+		queue_timer_armed_ = true;
+		queue_timer_.expires_at(deadline);
+
+		auto self = shared_from_this();
+		queue_timer_.async_wait([this, self](const asio::error_code& ec)
+		{
+			if (ec == asio::error::operation_aborted)
+				return;
+
+			queue_timer_armed_ = false;
+
+			if (!closed_)
+				on_queue_timer();
+		});
+	}
+
+	void MySqlClient::on_queue_timer()
+	{
+		Clock::time_point now = Clock::now();
+
+		while (!queue_.empty() && queue_.front().deadline <= now)
+		{
+			Request request = std::move(queue_.front());
+			queue_.pop_front();
+			queued_--;
+			timeouts_++;
+
+			fail(request, kErrorTimeout, "mysql query timed out waiting for a connection");
+		}
+
+		if (!queue_.empty())
+			arm_queue_timer();
+	}
+
+	void MySqlClient::complete(Request& request, const MySqlResultPtr& result)
+	{
+		if (result->ok())
+			completed_++;
+		else
+			failed_++;
+
+		if (request.handler)
+			request.handler(result);
+	}
+
+	void MySqlClient::fail(Request& request, int code, const std::string& message)
+	{
+		MySqlResultPtr result = std::make_shared<MySqlResult>();
+		result->fail(code, message);
+
+		complete(request, result);
+	}
+}
@@ -0,0 +1,170 @@
+#ifndef TENGINE_MYSQL_CLIENT_HPP
+#define TENGINE_MYSQL_CLIENT_HPP
+
+#include "asio.hpp"
+#include "asio/steady_timer.hpp"
+
+#include "allocator.hpp"
+#include "mysql_result.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Resolver;
+
+	// mysql client speaking the wire protocol on an io_service, no thread
+	// is ever parked on a connection. queries are pipelined: each
+	// connection has up to `pipeline` statements written ahead of their
+	// replies, and the rest wait in a bounded queue for the least loaded
+	// connection. a statement that outlives its timeout takes its
+	// connection down with it, since the reply can no longer be matched.
+	// prepared statements are keyed by their sql and prepared lazily on
+	// each connection the first time they run there; results come back in
+	// the binary protocol with integers and floats already decoded.
+	// auth: mysql_native_password and caching_sha2_password, the latter's
+	// full exchange through the server's rsa key. no tls.
+	class MySqlClient :
+		public Allocator, public std::enable_shared_from_this<MySqlClient>
+	{
+	public:
+		struct Options
+		{
+			std::string host;
+			uint16_t port = 3306;
+			std::string user;
+			std::string password;
+			std::string db;
+			int connections = 2;
+			// statements in flight per connection
+			int pipeline = 16;
+			// statements waiting for a connection, beyond this they fail
+			int queue_limit = 10000;
+			// milliseconds from query() to reply, 0 waits forever
+			int timeout = 10000;
+			int connect_timeout = 10000;
+			// first retry after a lost connection, doubles up to 32x
+			int reconnect_delay = 1000;
+			// prepared statements kept per connection, oldest closed first
+			int statement_cache = 256;
+		};
+
+		// called on the io_service thread, result->ok() tells success
+		typedef std::function<void(const MySqlResultPtr& result)> Handler;
+
+		struct Stats
+		{
+			std::size_t connections;
+			std::size_t ready;
+			std::size_t queued;
+			std::size_t in_flight;
+			uint64_t completed;
+			uint64_t failed;
+			uint64_t timeouts;
+		};
+
+		MySqlClient(asio::io_service& io_service, Resolver& resolver,
+			const Options& options);
+
+		MySqlClient(const MySqlClient&) = delete;
+
+		MySqlClient& operator=(const MySqlClient&) = delete;
+
+		~MySqlClient();
+
+		// the calls below may be made from any thread
+
+		void start();
+
+		void query(std::string sql, Handler handler);
+
+		// run sql as a prepared statement with params bound to its markers
+		void execute(std::string sql, MySqlParams params, Handler handler);
+
+		// rows come back in batches of up to batch_rows as they arrive, each
+		// with more set but the last, which also carries any error. batches
+		// are not throttled, the consumer keeps up or they queue in memory
+		void stream(std::string sql, std::size_t batch_rows, Handler handler);
+
+		// disconnect, statements not yet answered are dropped unanswered
+		void close();
+
+		Stats stats() const;
+
+	private:
+		class Connection;
+
+		friend class Connection;
+
+		typedef std::shared_ptr<Connection> ConnectionPtr;
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct Request
+		{
+			std::string sql;
+			bool prepared = false;
+			MySqlParams params;
+			Handler handler;
+			Clock::time_point deadline;
+			// command the connection wrote for it, to read the reply
+			uint8_t command = 0;
+			// re-prepared once after the server dropped the statement
+			bool retried = false;
+			// rows per streamed batch, 0 delivers the result whole
+			std::size_t batch_rows = 0;
+		};
+
+		void submit(Request& request);
+
+		void do_query(Request& request);
+
+		void dispatch();
+
+		void arm_queue_timer();
+
+		void on_queue_timer();
+
+		void complete(Request& request, const MySqlResultPtr& result);
+
+		void fail(Request& request, int code, const std::string& message);
+
+		asio::io_service& io_service_;
+
+		Resolver& resolver_;
+
+		Options options_;
+
+		std::vector<ConnectionPtr> connections_;
+
+		std::deque<Request> queue_;
+
+		asio::steady_timer queue_timer_;
+
+		bool queue_timer_armed_;
+
+		bool closed_;
+
+		std::atomic<std::size_t> ready_;
+
+		std::atomic<std::size_t> queued_;
+
+		std::atomic<std::size_t> in_flight_;
+
+		std::atomic<uint64_t> completed_;
+
+		std::atomic<uint64_t> failed_;
+
+		std::atomic<uint64_t> timeouts_;
+	};
+}
+
+#endif
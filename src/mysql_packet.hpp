@@ -0,0 +1,140 @@
+#ifndef TENGINE_MYSQL_PACKET_HPP
+#define TENGINE_MYSQL_PACKET_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	// the little endian integers and length encoded values of the mysql
+	// client/server protocol, as MySqlClient reads and writes them
+	class MySqlPacket
+	{
+	public:
+		// reads one packet payload. running past the end leaves ok() false
+		// and every later read empty, so a row is decoded first and checked
+		// once
+		class Reader
+		{
+		public:
+			Reader(const char *data, std::size_t size)
+				: p_((const uint8_t*)data)
+				, end_((const uint8_t*)data + size)
+				, ok_(true)
+			{}
+
+			bool ok() const { return ok_; }
+
+			std::size_t left() const { return end_ - p_; }
+
+			uint8_t peek() const { return p_ < end_ ? *p_ : 0; }
+
+			uint64_t uint(std::size_t bytes)
+			{
+				if (left() < bytes)
+				{
+					ok_ = false;
+					p_ = end_;
+					return 0;
+				}
+
+				uint64_t value = 0;
+				for (std::size_t i = 0; i < bytes; i++)
+					value |= (uint64_t)p_[i] << (8 * i);
+				p_ += bytes;
+				return value;
+			}
+
+			uint64_t lenenc()
+			{
+				uint8_t first = (uint8_t)uint(1);
+				switch (first)
+				{
+				case 0xfc: return uint(2);
+				case 0xfd: return uint(3);
+				case 0xfe: return uint(8);
+				default: return first;
+				}
+			}
+
+			const char* bytes(std::size_t size)
+			{
+				if (left() < size)
+				{
+					ok_ = false;
+					p_ = end_;
+					return "";
+				}
+
+				const char *data = (const char*)p_;
+				p_ += size;
+				return data;
+			}
+
+			std::string lenenc_string()
+			{
+				std::size_t size = (std::size_t)lenenc();
+
+				// ok_ only once bytes() has checked the size
+				const char *data = bytes(size);
+				return std::string(data, ok_ ? size : 0);
+			}
+
+			std::string null_string()
+			{
+				const uint8_t *nul = std::find(p_, end_, 0);
+				std::string value((const char*)p_, nul - p_);
+				p_ = nul < end_ ? nul + 1 : end_;
+				return value;
+			}
+
+			std::string rest()
+			{
+				std::string value((const char*)p_, end_ - p_);
+				p_ = end_;
+				return value;
+			}
+
+			void skip(std::size_t size) { bytes(size); }
+
+		private:
+			const uint8_t *p_;
+
+			const uint8_t *end_;
+
+			bool ok_;
+		};
+
+		static void put_uint(std::string& out, uint64_t value, std::size_t bytes)
+		{
+			for (std::size_t i = 0; i < bytes; i++)
+				out.push_back((char)((value >> (8 * i)) & 0xff));
+		}
+
+		static void put_lenenc(std::string& out, uint64_t value)
+		{
+			if (value < 0xfb)
+				put_uint(out, value, 1);
+			else if (value < 0x10000)
+			{
+				out.push_back((char)0xfc);
+				put_uint(out, value, 2);
+			}
+			else if (value < 0x1000000)
+			{
+				out.push_back((char)0xfd);
+				put_uint(out, value, 3);
+			}
+			else
+			{
+				out.push_back((char)0xfe);
+				put_uint(out, value, 8);
+			}
+		}
+	};
+}
+
+#endif // ! TENGINE_MYSQL_PACKET_HPP
@@ -0,0 +1,210 @@
+#ifndef TENGINE_MYSQL_RESULT_HPP
+#define TENGINE_MYSQL_RESULT_HPP
+
+#include "allocator.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	// outcome of one statement, independent of the driver that produced it.
+	// cells are kept in one buffer so a large result is a handful of
+	// allocations, not one per value.
+	class MySqlResult : public Allocator
+	{
+	public:
+		struct Field
+		{
+			std::string name;
+			// enum_field_types, same codes on the wire and in mysql.h
+			uint8_t type;
+			uint16_t flags;
+			uint8_t decimals;
+		};
+
+		MySqlResult()
+			: affected_rows(0)
+			, insert_id(0)
+			, status(0)
+			, warnings(0)
+			, error_code(0)
+			, error()
+			, sqlstate("00000")
+			, more(false)
+			, fields_()
+			, data_()
+			, cells_()
+		{
+
+		}
+
+		bool ok() const { return error_code == 0 && error.empty(); }
+
+		void fail(int code, const std::string& message, const char *state = "HY000")
+		{
+			error_code = code;
+			error = message;
+			sqlstate = state;
+		}
+
+		// a statement without a result set, affected_rows and insert_id apply
+		bool empty() const { return fields_.empty(); }
+
+		const std::vector<Field>& fields() const { return fields_; }
+
+		std::size_t field_count() const { return fields_.size(); }
+
+		std::size_t row_count() const
+		{
+			return fields_.empty() ? 0 : cells_.size() / fields_.size();
+		}
+
+		// text results only hold strings and NULLs, binary results from
+		// prepared statements carry integers and floats as such
+		enum Type
+		{
+			kNull,
+			kString,
+			kInteger,
+			kNumber,
+		};
+
+		Type type(std::size_t row, std::size_t column) const
+		{
+			return cell(row, column).type;
+		}
+
+		// nullptr unless the cell is a string, which is nul terminated
+		const char* value(std::size_t row, std::size_t column, std::size_t& size) const
+		{
+			const Cell& c = cell(row, column);
+			if (c.type != kString)
+			{
+				size = 0;
+				return nullptr;
+			}
+
+			size = c.size;
+			return data_.data() + c.offset;
+		}
+
+		int64_t integer(std::size_t row, std::size_t column) const
+		{
+			return cell(row, column).integer;
+		}
+
+		double number(std::size_t row, std::size_t column) const
+		{
+			return cell(row, column).number;
+		}
+
+		void add_field(const Field& field) { fields_.push_back(field); }
+
+		void add_value(const char *data, std::size_t size)
+		{
+			Cell c = { kString, data_.size(), size, {} };
+			cells_.push_back(c);
+			data_.append(data, size);
+			data_.push_back('\0');
+		}
+
+		void add_integer(int64_t value)
+		{
+			Cell c = { kInteger, 0, 0, {} };
+			c.integer = value;
+			cells_.push_back(c);
+		}
+
+		void add_number(double value)
+		{
+			Cell c = { kNumber, 0, 0, {} };
+			c.number = value;
+			cells_.push_back(c);
+		}
+
+		void add_null()
+		{
+			Cell c = { kNull, 0, 0, {} };
+			cells_.push_back(c);
+		}
+
+		void reserve(std::size_t bytes) { data_.reserve(bytes); }
+
+		// roughly what the result holds on the heap
+		std::size_t bytes() const
+		{
+			std::size_t size = sizeof(*this) + data_.capacity() + cells_.capacity() * sizeof(Cell);
+			for (auto& field : fields_)
+				size += sizeof(field) + field.name.capacity();
+			return size;
+		}
+
+		// an empty result with the same columns, for the next streamed batch
+		std::shared_ptr<MySqlResult> next() const
+		{
+			std::shared_ptr<MySqlResult> batch = std::make_shared<MySqlResult>();
+			batch->fields_ = fields_;
+			return batch;
+		}
+
+		uint64_t affected_rows;
+
+		uint64_t insert_id;
+
+		uint16_t status;
+
+		uint16_t warnings;
+
+		int error_code;
+
+		std::string error;
+
+		std::string sqlstate;
+
+		// a streamed batch with more rows to follow, the last one clears it
+		bool more;
+
+	private:
+		struct Cell
+		{
+			Type type;
+			std::size_t offset;
+			std::size_t size;
+			union
+			{
+				int64_t integer;
+				double number;
+			};
+		};
+
+		const Cell& cell(std::size_t row, std::size_t column) const
+		{
+			return cells_[row * fields_.size() + column];
+		}
+
+		std::vector<Field> fields_;
+
+		std::string data_;
+
+		std::vector<Cell> cells_;
+	};
+
+	typedef std::shared_ptr<MySqlResult> MySqlResultPtr;
+
+	// one bound argument of a prepared statement
+	struct MySqlParam
+	{
+		MySqlResult::Type type;
+		int64_t integer;
+		double number;
+		std::string string;
+	};
+
+	typedef std::vector<MySqlParam> MySqlParams;
+}
+
+#endif
@@ -0,0 +1,757 @@
+#include "mysql_writer.hpp"
+
+#include "context.hpp"
+
+#include "errmsg.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include <experimental/filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace tengine
+{
+	namespace
+	{
+#ifdef _WIN32
+		namespace fs = std::tr2::sys;
+#else
+		namespace fs = std::experimental::filesystem;
+#endif
+
+		// server errors worth retrying as they are, anything else below
+		// CR_MIN_ERROR is blamed on the rows of the failing statement
+		constexpr unsigned int kErrorLockWaitTimeout = 1205;
+		constexpr unsigned int kErrorDeadlock = 1213;
+
+		std::string identifier(const std::string& name)
+		{
+			std::string quoted("`");
+			for (char c : name)
+			{
+				if (c == '`')
+					quoted.push_back('`');
+				quoted.push_back(c);
+			}
+			quoted.push_back('`');
+			return quoted;
+		}
+
+		// same escaping as mysql_real_escape_string for utf8, which is what
+		// the connection is set to
+		std::string literal(const MySqlParam& param)
+		{
+			switch (param.type)
+			{
+			case MySqlResult::kInteger:
+				return std::to_string(param.integer);
+
+			case MySqlResult::kNumber:
+			{
+				if (!std::isfinite(param.number))
+					return "NULL";
+
+				char buffer[32];
+				snprintf(buffer, sizeof(buffer), "%.17g", param.number);
+				return buffer;
+			}
+
+			case MySqlResult::kString:
+			{
+				std::string quoted("'");
+				quoted.reserve(param.string.size() + 2);
+				for (char c : param.string)
+				{
+					switch (c)
+					{
+					case '\0': quoted += "\\0"; break;
+					case '\n': quoted += "\\n"; break;
+					case '\r': quoted += "\\r"; break;
+					case '\\': quoted += "\\\\"; break;
+					case '\'': quoted += "\\'"; break;
+					case '"': quoted += "\\\""; break;
+					case '\032': quoted += "\\Z"; break;
+					default: quoted.push_back(c); break;
+					}
+				}
+				quoted.push_back('\'');
+				return quoted;
+			}
+
+			default:
+				return "NULL";
+			}
+		}
+
+		// journal records: u32 size, u32 column count, u32 key count, then
+		// the table and each name and literal as u32 size and bytes
+		void put_string(std::string& out, const std::string& s)
+		{
+			uint32_t size = (uint32_t)s.size();
+			out.append((const char*)&size, sizeof(size));
+			out.append(s);
+		}
+
+		bool get_string(const char *&p, const char *end, std::string& s)
+		{
+			uint32_t size;
+			if ((std::size_t)(end - p) < sizeof(size))
+				return false;
+			std::memcpy(&size, p, sizeof(size));
+			p += sizeof(size);
+
+			if ((std::size_t)(end - p) < size)
+				return false;
+			s.assign(p, size);
+			p += size;
+			return true;
+		}
+
+		bool is_connection_error(unsigned int code)
+		{
+			return code >= CR_MIN_ERROR || code == kErrorLockWaitTimeout || code == kErrorDeadlock;
+		}
+	}
+
+	void MySqlWriter::load(Context& context, const char *conf, Options& options)
+	{
+		char key[256];
+
+		snprintf(key, sizeof(key), "%s.host", conf);
+		options.host = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.port", conf);
+		options.port = (uint16_t)context.config(key, 3306);
+
+		snprintf(key, sizeof(key), "%s.user", conf);
+		options.user = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.password", conf);
+		options.password = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.db", conf);
+		options.db = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.write_behind.interval", conf);
+		options.interval = std::max(10, context.config(key, options.interval));
+
+		snprintf(key, sizeof(key), "%s.write_behind.rows", conf);
+		options.rows = std::max(1, context.config(key, options.rows));
+
+		snprintf(key, sizeof(key), "%s.write_behind.statement_bytes", conf);
+		options.statement_bytes = std::max(4096, context.config(key, options.statement_bytes));
+
+		snprintf(key, sizeof(key), "%s.write_behind.journal", conf);
+		options.journal = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.write_behind.sync", conf);
+		options.sync = context.config(key, 0) > 0;
+	}
+
+	MySqlWriter::MySqlWriter(asio::io_service& io_service, BlockingPool& pool,
+		const Options& options)
+		: timer_(io_service)
+		, options_(options)
+		, queue_(pool.queue("mysql_writer", 1))
+		, mutex_()
+		, pending_()
+		, flushing_(false)
+		, failing_(false)
+		, journal_(nullptr)
+		, journal_path_()
+		, journal_seq_(0)
+		, sealed_()
+		, mysql_(nullptr)
+		, on_commit_()
+		, written_(0)
+		, flushes_(0)
+		, failures_(0)
+		, dropped_(0)
+	{
+
+	}
+
+	MySqlWriter::~MySqlWriter()
+	{
+		asio::error_code ec;
+		timer_.cancel(ec);
+
+		queue_->close();
+
+		do_flush();
+
+		if (journal_ != nullptr)
+		{
+			fclose(journal_);
+			journal_ = nullptr;
+
+			// nothing in it has been left unwritten
+			if (pending_.empty())
+				std::remove(journal_path_.c_str());
+		}
+
+		if (mysql_ != nullptr)
+		{
+			mysql_close(mysql_);
+			mysql_ = nullptr;
+		}
+	}
+
+	int MySqlWriter::start()
+	{
+		if (!options_.journal.empty())
+		{
+			fs::path prefix(options_.journal);
+			fs::path dir = prefix.parent_path();
+			if (dir.empty())
+				dir = ".";
+
+			std::string base = prefix.filename().string() + ".";
+
+			std::map<uint64_t, std::string> found;
+
+			std::error_code ec;
+			for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+			{
+				std::string name = it->path().filename().string();
+				if (name.size() <= base.size() || name.compare(0, base.size(), base) != 0)
+					continue;
+
+				std::string seq = name.substr(base.size());
+				if (seq.find_first_not_of("0123456789") != std::string::npos)
+					continue;
+
+				found[std::strtoull(seq.c_str(), nullptr, 10)] = it->path().string();
+			}
+
+			// replayed in write order, they stay on disk until flushed
+			for (auto& file : found)
+			{
+				replay(file.second);
+				sealed_.push_back(file.second);
+				journal_seq_ = file.first + 1;
+			}
+
+			if (!found.empty())
+				fprintf(stderr, "mysql write-behind replayed %zu rows from %zu journal files\n",
+					pending_.size(), found.size());
+
+			if (!open_journal())
+				return 1;
+		}
+
+		arm_timer();
+
+		if (!pending_.empty())
+			flush();
+
+		return 0;
+	}
+
+	bool MySqlWriter::put(const std::string& table, const Columns& keys,
+		const Columns& values, std::string& error)
+	{
+		if (table.empty() || keys.empty() || values.empty())
+		{
+			error = "write needs a table, key columns and value columns";
+			return false;
+		}
+
+		Row row;
+		row.table = table;
+
+		// sorted so {a=1, b=2} and {b=2, a=1} name the same row
+		Columns sorted(keys);
+		std::sort(sorted.begin(), sorted.end(),
+			[](const Columns::value_type& a, const Columns::value_type& b)
+		{
+			return a.first < b.first;
+		});
+
+		for (auto& key : sorted)
+		{
+			row.names.push_back(key.first);
+			row.values.push_back(literal(key.second));
+		}
+		row.keys = row.names.size();
+
+		for (auto& value : values)
+		{
+			if (std::find(row.names.begin(), row.names.begin() + row.keys, value.first)
+				!= row.names.begin() + row.keys)
+				continue;
+
+			row.names.push_back(value.first);
+			row.values.push_back(literal(value.second));
+		}
+
+		if (row.names.size() == row.keys)
+		{
+			error = "write needs at least one column besides the key";
+			return false;
+		}
+
+		bool full;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			// the journal may have failed to reopen after a flush; a write
+			// it can't cover is refused rather than lost on a crash
+			if (!options_.journal.empty() && journal_ == nullptr && !open_journal())
+			{
+				error = "write-behind journal can't be opened";
+				return false;
+			}
+
+			if (journal_ != nullptr)
+				append_journal(row);
+
+			add(row);
+
+			full = !flushing_ && !failing_ && pending_.size() >= (std::size_t)options_.rows;
+		}
+
+		if (full)
+			flush();
+
+		return true;
+	}
+
+	void MySqlWriter::flush()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (flushing_)
+				return;
+
+			flushing_ = true;
+		}
+
+		queue_->post(
+			[this]
+		{
+			do_flush();
+		});
+	}
+
+	MySqlWriter::Stats MySqlWriter::stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Stats stats;
+		stats.pending = pending_.size();
+		stats.written = written_;
+		stats.flushes = flushes_;
+		stats.failures = failures_;
+		stats.dropped = dropped_;
+		return stats;
+	}
+
+	std::string MySqlWriter::row_key(const Row& row)
+	{
+		std::string key(row.table);
+		key.push_back('\0');
+
+		for (std::size_t i = 0; i < row.keys; i++)
+		{
+			key.append(row.names[i]);
+			key.push_back('\0');
+			key.append(row.values[i]);
+			key.push_back('\0');
+		}
+
+		return key;
+	}
+
+	void MySqlWriter::merge(Row& into, const Row& row)
+	{
+		for (std::size_t i = row.keys; i < row.names.size(); i++)
+		{
+			auto begin = into.names.begin() + into.keys;
+			auto iter = std::find(begin, into.names.end(), row.names[i]);
+
+			if (iter != into.names.end())
+			{
+				into.values[iter - into.names.begin()] = row.values[i];
+			}
+			else
+			{
+				into.names.push_back(row.names[i]);
+				into.values.push_back(row.values[i]);
+			}
+		}
+	}
+
+	void MySqlWriter::add(const Row& row)
+	{
+		std::string key = row_key(row);
+
+		auto iter = pending_.find(key);
+		if (iter == pending_.end())
+			pending_.emplace(std::move(key), row);
+		else
+			merge(iter->second, row);
+	}
+
+	void MySqlWriter::replay(const std::string& path)
+	{
+		FILE *file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+			return;
+
+		std::string data;
+		char buffer[65536];
+		std::size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			data.append(buffer, n);
+
+		fclose(file);
+
+		const char *p = data.data();
+		const char *end = p + data.size();
+
+		// a record cut short by a crash ends the file
+		while (true)
+		{
+			uint32_t size;
+			if ((std::size_t)(end - p) < sizeof(size))
+				break;
+			std::memcpy(&size, p, sizeof(size));
+
+			if ((std::size_t)(end - p) < sizeof(size) + size)
+				break;
+
+			const char *record = p + sizeof(size);
+			const char *record_end = record + size;
+			p = record_end;
+
+			uint32_t counts[2];
+			if (size < sizeof(counts))
+				continue;
+			std::memcpy(counts, record, sizeof(counts));
+			record += sizeof(counts);
+
+			Row row;
+			row.keys = counts[1];
+			row.names.resize(counts[0]);
+			row.values.resize(counts[0]);
+
+			bool ok = row.keys > 0 && row.keys < counts[0]
+				&& get_string(record, record_end, row.table);
+			for (std::size_t i = 0; ok && i < counts[0]; i++)
+			{
+				ok = get_string(record, record_end, row.names[i])
+					&& get_string(record, record_end, row.values[i]);
+			}
+
+			if (ok)
+				add(row);
+		}
+	}
+
+	bool MySqlWriter::open_journal()
+	{
+		journal_path_ = options_.journal + "." + std::to_string(journal_seq_++);
+
+		journal_ = fopen(journal_path_.c_str(), "ab");
+		if (journal_ == nullptr)
+		{
+			fprintf(stderr, "mysql write-behind can't open journal %s: %s\n",
+				journal_path_.c_str(), strerror(errno));
+			return false;
+		}
+
+		return true;
+	}
+
+	void MySqlWriter::append_journal(const Row& row)
+	{
+		std::string record(sizeof(uint32_t), '\0');
+
+		uint32_t counts[2] = { (uint32_t)row.names.size(), (uint32_t)row.keys };
+		record.append((const char*)counts, sizeof(counts));
+
+		put_string(record, row.table);
+		for (std::size_t i = 0; i < row.names.size(); i++)
+		{
+			put_string(record, row.names[i]);
+			put_string(record, row.values[i]);
+		}
+
+		uint32_t size = (uint32_t)(record.size() - sizeof(uint32_t));
+		std::memcpy(&record[0], &size, sizeof(size));
+
+		fwrite(record.data(), 1, record.size(), journal_);
+		fflush(journal_);
+
+		if (options_.sync)
+		{
+#ifdef _WIN32
+			_commit(_fileno(journal_));
+#else
+			fsync(fileno(journal_));
+#endif
+		}
+	}
+
+	bool MySqlWriter::connect()
+	{
+		if (mysql_ != nullptr)
+			return true;
+
+		mysql_ = mysql_init(NULL);
+		if (mysql_ == nullptr)
+			return false;
+
+		char timeout = 10;
+		mysql_options(mysql_, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+		mysql_options(mysql_, MYSQL_SET_CHARSET_NAME, "utf8");
+
+		if (mysql_real_connect(mysql_, options_.host.c_str(), options_.user.c_str(),
+			options_.password.c_str(), options_.db.c_str(), options_.port, NULL, 0) == NULL)
+		{
+			fprintf(stderr, "mysql write-behind can't connect: %s\n", mysql_error(mysql_));
+			mysql_close(mysql_);
+			mysql_ = nullptr;
+			return false;
+		}
+
+		return true;
+	}
+
+	void MySqlWriter::arm_timer()
+	{
+		timer_.expires_from_now(std::chrono::milliseconds(options_.interval));
+		timer_.async_wait(
+			[this](const asio::error_code& ec)
+		{
+			if (ec == asio::error::operation_aborted)
+				return;
+
+			flush();
+			arm_timer();
+		});
+	}
+
+	bool MySqlWriter::do_flush()
+	{
+		Rows rows;
+		std::vector<std::string> sealed;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			rows.swap(pending_);
+
+			// what is written from here on goes to a new file, the sealed
+			// ones are removed once their rows are committed
+			if (journal_ != nullptr && !rows.empty())
+			{
+				fclose(journal_);
+				sealed_.push_back(journal_path_);
+
+				// on failure put() tries again
+				open_journal();
+			}
+
+			sealed = sealed_;
+		}
+
+		uint64_t dropped = 0;
+		bool ok = rows.empty() || write(rows, dropped);
+
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		flushing_ = false;
+		dropped_ += dropped;
+
+		if (ok)
+		{
+			failing_ = false;
+			written_ += rows.size();
+			if (!rows.empty())
+				flushes_++;
+
+			for (auto& path : sealed)
+			{
+				std::remove(path.c_str());
+				sealed_.erase(std::find(sealed_.begin(), sealed_.end(), path));
+			}
+
+			lock.unlock();
+
+			if (on_commit_ && !rows.empty())
+			{
+				std::vector<std::string> tables;
+				for (auto& entry : rows)
+				{
+					if (std::find(tables.begin(), tables.end(), entry.second.table) == tables.end())
+						tables.push_back(entry.second.table);
+				}
+
+				on_commit_(tables);
+			}
+
+			return true;
+		}
+
+		failing_ = true;
+		failures_++;
+
+		// writes made during the flush are newer and win
+		for (auto& entry : rows)
+		{
+			auto iter = pending_.find(entry.first);
+			if (iter != pending_.end())
+			{
+				merge(entry.second, iter->second);
+				iter->second = std::move(entry.second);
+			}
+			else
+			{
+				pending_.emplace(entry.first, std::move(entry.second));
+			}
+		}
+
+		return false;
+	}
+
+	bool MySqlWriter::write(Rows& rows, uint64_t& dropped)
+	{
+		struct Statement
+		{
+			std::string sql;
+			std::vector<std::string> keys;
+		};
+
+		while (!rows.empty())
+		{
+			if (!connect())
+				return false;
+
+			// one INSERT per table and column list, cut at statement_bytes
+			std::map<std::string, std::vector<const Rows::value_type*>> groups;
+			for (auto& entry : rows)
+			{
+				std::string signature(entry.second.table);
+				for (auto& name : entry.second.names)
+				{
+					signature.push_back('\0');
+					signature.append(name);
+				}
+				groups[signature].push_back(&entry);
+			}
+
+			std::vector<Statement> statements;
+
+			for (auto& group : groups)
+			{
+				const Row& first = group.second.front()->second;
+
+				std::string head = "INSERT INTO " + identifier(first.table) + " (";
+				std::string tail = " ON DUPLICATE KEY UPDATE ";
+
+				for (std::size_t i = 0; i < first.names.size(); i++)
+				{
+					head += (i > 0 ? "," : "") + identifier(first.names[i]);
+
+					if (i >= first.keys)
+					{
+						std::string column = identifier(first.names[i]);
+						tail += (i > first.keys ? "," : "") + column + "=VALUES(" + column + ")";
+					}
+				}
+				head += ") VALUES ";
+
+				Statement statement;
+				for (auto entry : group.second)
+				{
+					const Row& row = entry->second;
+
+					std::string values("(");
+					for (std::size_t i = 0; i < row.values.size(); i++)
+						values += (i > 0 ? "," : "") + row.values[i];
+					values += ")";
+
+					if (!statement.keys.empty() &&
+						statement.sql.size() + values.size() + tail.size() > (std::size_t)options_.statement_bytes)
+					{
+						statement.sql += tail;
+						statements.push_back(std::move(statement));
+						statement = Statement();
+					}
+
+					statement.sql += statement.keys.empty() ? head : ",";
+					statement.sql += values;
+					statement.keys.push_back(entry->first);
+				}
+
+				statement.sql += tail;
+				statements.push_back(std::move(statement));
+			}
+
+			const char begin[] = "START TRANSACTION";
+			if (mysql_real_query(mysql_, begin, sizeof(begin) - 1) != 0)
+			{
+				fprintf(stderr, "mysql write-behind: %s\n", mysql_error(mysql_));
+				mysql_close(mysql_);
+				mysql_ = nullptr;
+				return false;
+			}
+
+			const Statement *failed = nullptr;
+			for (auto& statement : statements)
+			{
+				if (mysql_real_query(mysql_, statement.sql.data(), (unsigned long)statement.sql.size()) != 0)
+				{
+					failed = &statement;
+					break;
+				}
+			}
+
+			const char commit[] = "COMMIT";
+			if (failed == nullptr && mysql_real_query(mysql_, commit, sizeof(commit) - 1) == 0)
+				return true;
+
+			unsigned int code = mysql_errno(mysql_);
+			std::string error = mysql_error(mysql_);
+
+			const char rollback[] = "ROLLBACK";
+			mysql_real_query(mysql_, rollback, sizeof(rollback) - 1);
+
+			if (failed == nullptr || is_connection_error(code))
+			{
+				fprintf(stderr, "mysql write-behind will retry: %s\n", error.c_str());
+				if (code >= CR_MIN_ERROR)
+				{
+					mysql_close(mysql_);
+					mysql_ = nullptr;
+				}
+				return false;
+			}
+
+			// the server refused these rows (unknown column, bad value...),
+			// retrying them would hold back every other write for good
+			fprintf(stderr, "mysql write-behind dropped %zu rows: %s\n",
+				failed->keys.size(), error.c_str());
+
+			dropped += failed->keys.size();
+			for (auto& key : failed->keys)
+				rows.erase(key);
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,170 @@
+#ifndef TENGINE_MYSQL_WRITER_HPP
+#define TENGINE_MYSQL_WRITER_HPP
+
+#include "asio.hpp"
+#include "asio/steady_timer.hpp"
+
+#include "allocator.hpp"
+#include "blocking_pool.hpp"
+#include "mysql_result.hpp"
+
+#include "mysql.h"
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <stdint.h>
+
+namespace tengine
+{
+	class Context;
+
+	// write-behind for small row updates shared by every service using one
+	// mysql section. writes are keyed by table and primary key, a later
+	// write to the same row overrides the columns it names, and every
+	// `interval` ms (or once `rows` rows are pending) the lot goes out as
+	// multi-row INSERT ... ON DUPLICATE KEY UPDATE in one transaction on
+	// its own connection. with a journal configured each write is appended
+	// there before put() returns, and replayed on the next start if it
+	// never reached the database.
+	class MySqlWriter : public Allocator
+	{
+	public:
+		struct Options
+		{
+			std::string host;
+			uint16_t port = 3306;
+			std::string user;
+			std::string password;
+			std::string db;
+			// milliseconds between flushes
+			int interval = 1000;
+			// pending rows that trigger a flush before the interval
+			int rows = 1000;
+			// one INSERT is cut at this size, below max_allowed_packet
+			int statement_bytes = 1 << 20;
+			// path prefix of the journal files, empty disables it
+			std::string journal;
+			// fsync the journal on every write, not just on flush
+			bool sync = false;
+		};
+
+		// column name and value, a kNull value writes NULL
+		typedef std::vector<std::pair<std::string, MySqlParam>> Columns;
+
+		struct Stats
+		{
+			std::size_t pending;
+			uint64_t written;
+			uint64_t flushes;
+			uint64_t failures;
+			uint64_t dropped;
+		};
+
+		// the [section].write_behind table on top of the section's login
+		static void load(Context& context, const char *conf, Options& options);
+
+		MySqlWriter(asio::io_service& io_service, BlockingPool& pool, const Options& options);
+
+		MySqlWriter(const MySqlWriter&) = delete;
+
+		MySqlWriter& operator=(const MySqlWriter&) = delete;
+
+		// flushes what is pending, rows it cannot write stay in the journal
+		~MySqlWriter();
+
+		// replays the journal and starts the flush timer
+		int start();
+
+		// may be called from any thread; false with the reason in error,
+		// also while a configured journal can't be opened
+		bool put(const std::string& table, const Columns& keys,
+			const Columns& values, std::string& error);
+
+		void flush();
+
+		Stats stats();
+
+		// called on the pool thread with the tables of each committed flush
+		typedef std::function<void(const std::vector<std::string>& tables)> CommitHook;
+
+		// set before start()
+		void on_commit(CommitHook hook) { on_commit_ = std::move(hook); }
+
+	private:
+		struct Row
+		{
+			std::string table;
+			// key columns first, then values; literals already escaped
+			std::vector<std::string> names;
+			std::vector<std::string> values;
+			std::size_t keys;
+		};
+
+		typedef std::unordered_map<std::string, Row> Rows;
+
+		static std::string row_key(const Row& row);
+
+		static void merge(Row& into, const Row& row);
+
+		void add(const Row& row);
+
+		void replay(const std::string& path);
+
+		bool open_journal();
+
+		void append_journal(const Row& row);
+
+		bool connect();
+
+		void arm_timer();
+
+		// on the pool queue; false when the rows went back to pending
+		bool do_flush();
+
+		bool write(Rows& rows, uint64_t& dropped);
+
+		asio::steady_timer timer_;
+
+		Options options_;
+
+		BlockingPool::QueuePtr queue_;
+
+		std::mutex mutex_;
+
+		Rows pending_;
+
+		bool flushing_;
+
+		// a failed flush waits for the timer instead of the row threshold
+		bool failing_;
+
+		FILE *journal_;
+
+		std::string journal_path_;
+
+		uint64_t journal_seq_;
+
+		// journal files whose rows are pending but not yet committed
+		std::vector<std::string> sealed_;
+
+		MYSQL *mysql_;
+
+		CommitHook on_commit_;
+
+		uint64_t written_;
+
+		uint64_t flushes_;
+
+		uint64_t failures_;
+
+		uint64_t dropped_;
+	};
+}
+
+#endif
@@ -1,7 +1,8 @@
 #include "network.hpp"
 
 #include "context.hpp"
-#include "executor.hpp"
+#include "blocking_pool.hpp"
+#include "affinity.hpp"
 #include "sandbox.hpp"
 #include "dispatch.hpp"
 
@@ -9,14 +10,14 @@ namespace tengine
 {
 	HttpClient::HttpClient(Context& context)
 		: Service(context)
-		, executor_(new Executor())
+		, queue_(context.blocking_pool().queue("http", context.config("pool.http", 4)))
 	{
 
 	}
 
 	HttpClient::~HttpClient()
 	{
-		delete executor_;
+		queue_->close();
 	}
 
 	int HttpClient::init(const char* name)
@@ -25,8 +26,6 @@ namespace tengine
 
 		context_.register_name(this, "Network");
 
-		executor_->run();
-
 		return 0;
 	}
 
@@ -63,7 +62,7 @@ namespace tengine
 		asio::post(executor(),
 			[=]
 		{
-			asio::post(executor_->executor(),
+			queue_->post(
 				[=]
 			{
 				auto r = this->do_request(request_type, request_url,
@@ -110,7 +109,7 @@ namespace tengine
 	{
 		port_ = port;
 
-		server_ = new SimpleWeb::HttpServer(port_, 2);
+		server_ = new SimpleWeb::HttpServer(port_, 1);
 
 		if (server_ == nullptr)
 			return 1;
@@ -190,6 +189,8 @@ namespace tengine
 
 		worker_ = new std::thread([this]
 		{
+			ThreadRoles::enter("web");
+
 			this->server_->start();
 		});
 
@@ -256,7 +257,7 @@ namespace tengine
 
 	int WebServer::start(const std::string& path)
 	{
-		server_ = new SimpleWeb::WebSocketServer(port_, 2);
+		server_ = new SimpleWeb::WebSocketServer(port_, 1);
 
 		if (server_ == nullptr)
 			return 1;
@@ -297,6 +298,8 @@ namespace tengine
 
 		worker_ = new std::thread([this]
 		{
+			ThreadRoles::enter("web");
+
 			this->server_->start();
 		});
 
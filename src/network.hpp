@@ -4,6 +4,7 @@
 #include "service.hpp"
 #include "service_proxy.hpp"
 #include "spin_lock.hpp"
+#include "blocking_pool.hpp"
 
 #include "http_client.hpp"
 #include "http_server.hpp"
@@ -15,8 +16,6 @@
 
 namespace tengine
 {
-	class Executor;
-
 	class HttpClient : public Service
 	{
 	public:
@@ -40,7 +39,8 @@ namespace tengine
 			const std::string& url, const std::string& path,
 			const std::string& content);
 
-		Executor *executor_;
+		// pool.http bounds concurrent outgoing requests
+		BlockingPool::QueuePtr queue_;
 	};
 
 
@@ -4,7 +4,8 @@
 #include "asio.hpp"
 
 #include "service.hpp"
-#include "process_info.hpp"
+#include "node_router.hpp"
+#include "membership.hpp"
 
 #include <stdint.h>
 #include <thread>
@@ -13,52 +14,63 @@
 
 namespace tengine
 {
-	class Announcer;
-
-	class Discoverer;
-
 	class Node : public Service
 	{
 	public:
+		// a service on another node is addressed by a handle: the node id in
+		// the bits above kNodeShift, its id there below. local ids are
+		// handles with node 0. 11 bits of node keep a handle a positive
+		// int, 20 bits of service id are a million services on a node
+		enum
+		{
+			kNodeShift = 20,
+			kMaxNode = (1 << 11) - 1,
+			kMaxService = (1 << kNodeShift) - 1,
+		};
+
+		static int handle(int node, int service) { return (node << kNodeShift) | service; }
+
+		static int node_of(int handle) { return (handle >> kNodeShift) & kMaxNode; }
+
+		static int service_of(int handle) { return handle & kMaxService; }
+
 		Node(Context& context);
 
 		virtual ~Node();
 
 		virtual int init(const char* name);
 
-		int announce(const std::string& name, int id);
+		// names a service others find this node by, in members()
+		int announce(const std::string& name);
 
-		template<class Handler>
-		int discovery(const std::string& name, Handler handler)
-		{
-			return 0;
-		}
+		// this node's id, from node.node
+		int id_in_cluster() const { return router_ ? router_->node() : 0; }
 
-		static std::string name()
+		// true when the handle names a service on another node
+		bool remote(int handle) const
 		{
-			std::ostringstream os;
-			os << asio::ip::host_name() << ":" << ProcessInfo::current().id();
-			return os.str();
+			int node = node_of(handle);
+			return node != 0 && node != id_in_cluster();
 		}
 
-	private:
-		std::string node_name_;
-
-		asio::io_service io_service_;
-
-		asio::io_service::work work_;
+		// a request or response to a service on another node, by handle or
+		// by the name it registered there; from is the local sender. the
+		// data is copied. false when that node can't be reached
+		bool send(NodeRouter::FrameType type, int from, int node, int to, const std::string& name,
+			int session, const char *data, std::size_t size);
 
-		std::thread thread_;
+		std::vector<NodeRouter::Stats> links();
 
-		Discoverer *discover_;
+		// every node gossip knows of, this one included; empty when node.enable
+		// is off
+		std::vector<Membership::Member> members();
 
-		typedef std::map<int, Discoverer*> DiscovererMap;
-
-		DiscovererMap discovers_;
-
-		typedef std::map<int, Announcer*> AnnouncerMap;
+	private:
+		// links to the other nodes, on the network thread
+		std::shared_ptr<NodeRouter> router_;
 
-		AnnouncerMap anncouncers_;
+		// finds the other nodes and tells the router where they are
+		std::shared_ptr<Membership> membership_;
 
 	};
 }
@@ -0,0 +1,945 @@
+#include "node_router.hpp"
+
+#include "context.hpp"
+#include "dispatch.hpp"
+#include "node.hpp"
+#include "resolver.hpp"
+#include "sandbox.hpp"
+#include "spin_lock.hpp"
+
+#include "openssl/crypto.h"
+#include "openssl/hmac.h"
+#include "openssl/rand.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+namespace tengine
+{
+	namespace
+	{
+		// [uint32 size][uint8 type][uint8 name size][uint16 0][int32 from]
+		// [int32 to][int32 session][name][payload], size counting what
+		// follows it, big endian so nodes of any architecture interoperate
+		const std::size_t kFrameHeader = 20;
+
+		const std::size_t kReadChunk = 64 * 1024;
+
+		// the hello payload, a fresh challenge for the peer
+		const std::size_t kNonce = 16;
+
+		// the auth payload, hmac-sha256
+		const std::size_t kProof = 32;
+
+		void put32(char *p, uint32_t value)
+		{
+			p[0] = (char)(value >> 24);
+			p[1] = (char)(value >> 16);
+			p[2] = (char)(value >> 8);
+			p[3] = (char)value;
+		}
+
+		uint32_t get32(const char *p)
+		{
+			const uint8_t *u = (const uint8_t*)p;
+			return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+		}
+
+		// what node `from` answers to the nonce of node `to`; the order of
+		// the ids keeps a proof from being reflected back to its sender
+		void prove(const std::string& key, const char *nonce, int from, int to, char *proof)
+		{
+			char message[kNonce + 8];
+			std::memcpy(message, nonce, kNonce);
+			put32(message + kNonce, (uint32_t)from);
+			put32(message + kNonce + 4, (uint32_t)to);
+
+			unsigned int size = kProof;
+			HMAC(EVP_sha256(), key.data(), (int)key.size(), (const unsigned char*)message,
+				sizeof(message), (unsigned char*)proof, &size);
+		}
+	}
+
+	// one connection to a peer. writes from any thread collect in the
+	// outbox and leave as a single write per flush: whatever services queue
+	// while a write is in flight goes out together in the next one.
+	// both sides open with a hello carrying a nonce and answer the other's
+	// with an hmac of it under the cluster key; messages only flow, either
+	// way, once the peer has proved it holds the key
+	class NodeLink : public Allocator, public std::enable_shared_from_this<NodeLink>
+	{
+	public:
+		NodeLink(const std::shared_ptr<NodeRouter>& router, int node, bool inbound)
+			: router_(router)
+			, socket_(router->io_service_)
+			, timer_(router->io_service_)
+			, node_(node)
+			, inbound_(inbound)
+			, address_()
+			, in_(kReadChunk)
+			, have_(0)
+			, nonce_()
+			, peer_node_(0)
+			, peer_nonce_()
+			, hello_(false)
+			, authed_(false)
+			, outbox_lock_()
+			, control_()
+			, outbox_()
+			, queued_(0)
+			, writing_()
+			, in_flight_(0)
+			, flushing_(false)
+			, connected_(false)
+			, ready_(false)
+			, closed_(false)
+			, sent_(0)
+			, received_(0)
+			, batches_(0)
+			, bytes_(0)
+			, dropped_(0)
+		{
+			if (RAND_bytes((unsigned char*)nonce_, sizeof(nonce_)) != 1)
+			{
+				std::random_device random;
+				for (std::size_t i = 0; i < kNonce; i++)
+					nonce_[i] = (char)random();
+			}
+		}
+
+		asio::ip::tcp::socket& socket() { return socket_; }
+
+		int node() const { return node_; }
+
+		bool inbound() const { return inbound_; }
+
+		// outbound, "host:port"
+		void connect(const std::string& address)
+		{
+			{
+				SpinHolder holder(outbox_lock_);
+				address_ = address;
+			}
+
+			std::size_t colon = address.rfind(':');
+			if (colon == std::string::npos)
+			{
+				auto self(shared_from_this());
+				asio::post(router_->io_service_, [this, self]() { fail("no port in address"); });
+				return;
+			}
+
+			std::string host = address.substr(0, colon);
+			unsigned short port = (unsigned short)atoi(address.c_str() + colon + 1);
+
+			auto self(shared_from_this());
+			router_->context_.resolver().async_resolve(host,
+				[this, self, port](const asio::error_code& ec, const Resolver::Addresses& addresses)
+			{
+				if (closed_)
+					return;
+
+				if (ec || addresses.empty())
+				{
+					fail(ec ? ec.message() : "no address");
+					return;
+				}
+
+				timer_.expires_from_now(std::chrono::milliseconds(router_->options_.connect_timeout));
+				timer_.async_wait([this, self](const asio::error_code& ec)
+				{
+					if (!ec)
+						fail("connect timed out");
+				});
+
+				socket_.async_connect(asio::ip::tcp::endpoint(addresses.front(), port),
+					[this, self](const asio::error_code& ec)
+				{
+					timer_.cancel();
+
+					if (ec)
+						fail(ec.message());
+					else
+						start();
+				});
+			});
+		}
+
+		// on the network thread, once the socket is connected
+		void start()
+		{
+			if (closed_)
+				return;
+
+			asio::error_code ec;
+			socket_.set_option(asio::ip::tcp::no_delay(true), ec);
+
+			if (inbound_)
+			{
+				auto endpoint = socket_.remote_endpoint(ec);
+				if (!ec)
+				{
+					std::string address = endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+
+					SpinHolder holder(outbox_lock_);
+					address_ = address;
+				}
+			}
+
+			// the handshake has as long as the connect had
+			auto self(shared_from_this());
+			timer_.expires_from_now(std::chrono::milliseconds(router_->options_.connect_timeout));
+			timer_.async_wait([this, self](const asio::error_code& ec)
+			{
+				if (!ec && !authed_)
+					fail("handshake timed out");
+			});
+
+			{
+				SpinHolder holder(outbox_lock_);
+				connected_ = true;
+			}
+
+			control(NodeRouter::kFrameHello, router_->node(), nonce_, kNonce);
+
+			do_read();
+		}
+
+		// false when dropped: the link is gone or too far behind
+		bool write(NodeRouter::FrameType type, int from, int to, const std::string& name,
+			int session, const char *data, std::size_t size)
+		{
+			bool flush;
+			{
+				SpinHolder holder(outbox_lock_);
+				if (closed_ || outbox_.size() + size > (std::size_t)router_->options_.queue_bytes)
+				{
+					dropped_++;
+					return false;
+				}
+
+				append(outbox_, type, from, to, name, session, data, size);
+				queued_++;
+				sent_++;
+
+				flush = ready_ && !flushing_;
+				flushing_ = flushing_ || flush;
+			}
+
+			if (flush)
+			{
+				auto self(shared_from_this());
+				asio::post(router_->io_service_, [this, self]() { do_flush(); });
+			}
+
+			return true;
+		}
+
+		void close()
+		{
+			auto self(shared_from_this());
+			asio::post(router_->io_service_, [this, self]() { fail(std::string()); });
+		}
+
+		NodeRouter::Stats stats()
+		{
+			NodeRouter::Stats stats;
+			stats.node = node_;
+			{
+				// stats come from any thread, the address is set on the network one
+				SpinHolder holder(outbox_lock_);
+				stats.address = address_;
+				stats.connected = connected_ && !closed_;
+			}
+			stats.inbound = inbound_;
+			stats.sent = sent_;
+			stats.received = received_;
+			stats.batches = batches_;
+			stats.bytes = bytes_;
+			stats.dropped = dropped_;
+			return stats;
+		}
+
+	private:
+		friend class NodeRouter;
+
+		// under outbox_lock_
+		static void append(std::vector<char>& out, NodeRouter::FrameType type, int from, int to,
+			const std::string& name, int session, const char *data, std::size_t size)
+		{
+			std::size_t name_size = std::min(name.size(), (std::size_t)255);
+			std::size_t offset = out.size();
+
+			out.resize(offset + kFrameHeader + name_size + size);
+			char *p = out.data() + offset;
+
+			put32(p, (uint32_t)(kFrameHeader - 4 + name_size + size));
+			p[4] = (char)type;
+			p[5] = (char)name_size;
+			p[6] = 0;
+			p[7] = 0;
+			put32(p + 8, (uint32_t)from);
+			put32(p + 12, (uint32_t)to);
+			put32(p + 16, (uint32_t)session);
+
+			if (name_size > 0)
+				std::memcpy(p + kFrameHeader, name.data(), name_size);
+			if (size > 0)
+				std::memcpy(p + kFrameHeader + name_size, data, size);
+		}
+
+		// on the network thread, handshake frames go ahead of the outbox
+		void control(NodeRouter::FrameType type, int from, const char *data, std::size_t size)
+		{
+			bool flush;
+			{
+				SpinHolder holder(outbox_lock_);
+				append(control_, type, from, 0, std::string(), 0, data, size);
+				flush = !flushing_;
+				flushing_ = true;
+			}
+
+			if (flush)
+				do_flush();
+		}
+
+		void do_flush()
+		{
+			if (closed_)
+				return;
+
+			{
+				SpinHolder holder(outbox_lock_);
+				writing_.swap(control_);
+
+				if (ready_ && writing_.empty())
+				{
+					writing_.swap(outbox_);
+					in_flight_ = queued_;
+					queued_ = 0;
+				}
+			}
+
+			auto self(shared_from_this());
+			asio::async_write(socket_, asio::buffer(writing_),
+				[this, self](const asio::error_code& ec, std::size_t bytes)
+			{
+				if (ec)
+				{
+					fail(ec.message());
+					return;
+				}
+
+				batches_++;
+				bytes_ += bytes;
+				writing_.clear();
+
+				bool more;
+				{
+					SpinHolder holder(outbox_lock_);
+					in_flight_ = 0;
+					more = !control_.empty() || (ready_ && !outbox_.empty());
+					flushing_ = more;
+				}
+
+				if (more)
+					do_flush();
+			});
+		}
+
+		void do_read()
+		{
+			if (in_.size() - have_ < kReadChunk / 4)
+				in_.resize(std::max(in_.size() * 2, have_ + kReadChunk));
+
+			auto self(shared_from_this());
+			socket_.async_read_some(asio::buffer(in_.data() + have_, in_.size() - have_),
+				[this, self](const asio::error_code& ec, std::size_t bytes)
+			{
+				if (ec)
+				{
+					fail(ec.message());
+					return;
+				}
+
+				have_ += bytes;
+
+				if (parse())
+					do_read();
+			});
+		}
+
+		bool parse()
+		{
+			std::size_t offset = 0;
+
+			while (have_ - offset >= 4)
+			{
+				const char *p = in_.data() + offset;
+
+				uint32_t size = get32(p);
+				if (size < kFrameHeader - 4
+					|| size > (uint32_t)router_->options_.max_frame + kFrameHeader + 255)
+				{
+					fail("bad frame");
+					return false;
+				}
+
+				if (have_ - offset < 4 + (std::size_t)size)
+					break;
+
+				NodeRouter::FrameType type = (NodeRouter::FrameType)(uint8_t)p[4];
+				std::size_t name_size = (uint8_t)p[5];
+				int from = (int)get32(p + 8);
+				int to = (int)get32(p + 12);
+				int session = (int)get32(p + 16);
+
+				if (name_size > size - (kFrameHeader - 4))
+				{
+					fail("bad frame");
+					return false;
+				}
+
+				const char *name = p + kFrameHeader;
+				const char *data = name + name_size;
+				std::size_t data_size = size - (kFrameHeader - 4) - name_size;
+
+				if (!hello_)
+				{
+					if (type != NodeRouter::kFrameHello || data_size != kNonce)
+					{
+						fail("no hello");
+						return false;
+					}
+
+					hello_ = true;
+					peer_node_ = from;
+					std::memcpy(peer_nonce_, data, kNonce);
+
+					char proof[kProof];
+					prove(router_->options_.key, peer_nonce_, router_->node(), peer_node_, proof);
+					control(NodeRouter::kFrameAuth, router_->node(), proof, kProof);
+				}
+				else if (!authed_)
+				{
+					char proof[kProof];
+					prove(router_->options_.key, nonce_, peer_node_, router_->node(), proof);
+
+					if (type != NodeRouter::kFrameAuth || data_size != kProof
+						|| CRYPTO_memcmp(proof, data, kProof) != 0)
+					{
+						fprintf(stderr, "node %d: link from %s failed authentication as node %d\n",
+							router_->node(), address_.c_str(), peer_node_);
+						fail("authentication failed");
+						return false;
+					}
+
+					authed_ = true;
+
+					asio::error_code ec;
+					timer_.cancel(ec);
+
+					if (!router_->on_hello(shared_from_this(), peer_node_))
+					{
+						fail(std::string());
+						return false;
+					}
+
+					// what services queued meanwhile may go now
+					bool flush;
+					{
+						SpinHolder holder(outbox_lock_);
+						ready_ = true;
+						flush = !flushing_ && !outbox_.empty();
+						flushing_ = flushing_ || flush;
+					}
+
+					if (flush)
+						do_flush();
+				}
+				else
+				{
+					received_++;
+					router_->on_frame(shared_from_this(), type, from, to,
+						name, name_size, session, data, data_size);
+				}
+
+				offset += 4 + size;
+			}
+
+			// keep the partial frame at the front, large ones grow the buffer
+			if (offset > 0)
+			{
+				std::memmove(in_.data(), in_.data() + offset, have_ - offset);
+				have_ -= offset;
+			}
+
+			if (have_ >= 4 && 4 + (std::size_t)get32(in_.data()) > in_.size())
+				in_.resize(4 + (std::size_t)get32(in_.data()));
+
+			return true;
+		}
+
+		// an empty error is a close on our side
+		void fail(const std::string& error)
+		{
+			uint64_t lost;
+			{
+				SpinHolder holder(outbox_lock_);
+				if (closed_)
+					return;
+				closed_ = true;
+				control_.clear();
+				outbox_.clear();
+
+				// accepted by send, but they never left or may not have arrived
+				lost = queued_ + in_flight_;
+				queued_ = 0;
+				in_flight_ = 0;
+			}
+
+			dropped_ += lost;
+
+			asio::error_code ec;
+			timer_.cancel(ec);
+			socket_.close(ec);
+
+			router_->on_closed(shared_from_this(), error, lost);
+		}
+
+		std::shared_ptr<NodeRouter> router_;
+
+		asio::ip::tcp::socket socket_;
+
+		asio::steady_timer timer_;
+
+		// 0 on an accepted link until its hello
+		std::atomic<int> node_;
+
+		bool inbound_;
+
+		// set and logged on the network thread, read by stats() under
+		// outbox_lock_
+		std::string address_;
+
+		std::vector<char> in_;
+
+		std::size_t have_;
+
+		// ours, for the peer to prove itself against
+		char nonce_[kNonce];
+
+		// from its hello
+		int peer_node_;
+
+		char peer_nonce_[kNonce];
+
+		bool hello_;
+
+		// the peer proved it has the key
+		bool authed_;
+
+		SpinLock outbox_lock_;
+
+		// hello and auth, which must not wait for the handshake
+		std::vector<char> control_;
+
+		std::vector<char> outbox_;
+
+		// messages in the outbox
+		uint64_t queued_;
+
+		// the batch being written
+		std::vector<char> writing_;
+
+		// messages in it
+		uint64_t in_flight_;
+
+		bool flushing_;
+
+		bool connected_;
+
+		// messages flow once the peer has authenticated
+		bool ready_;
+
+		bool closed_;
+
+		std::atomic<uint64_t> sent_;
+
+		std::atomic<uint64_t> received_;
+
+		std::atomic<uint64_t> batches_;
+
+		std::atomic<uint64_t> bytes_;
+
+		std::atomic<uint64_t> dropped_;
+	};
+
+	void NodeRouter::load(Context& context, const char *conf, Options& options)
+	{
+		char key[256];
+
+		snprintf(key, sizeof(key), "%s.node", conf);
+		options.node = context.config(key, options.node);
+
+		snprintf(key, sizeof(key), "%s.port", conf);
+		options.port = context.config(key, options.port);
+
+		snprintf(key, sizeof(key), "%s.address", conf);
+		options.address = context.config(key, options.address.c_str());
+
+		snprintf(key, sizeof(key), "%s.key", conf);
+		options.key = context.config(key, options.key.c_str());
+
+		snprintf(key, sizeof(key), "%s.connect_timeout", conf);
+		options.connect_timeout = std::max(1, context.config(key, options.connect_timeout));
+
+		snprintf(key, sizeof(key), "%s.reconnect_delay", conf);
+		options.reconnect_delay = std::max(0, context.config(key, options.reconnect_delay));
+
+		snprintf(key, sizeof(key), "%s.queue_bytes", conf);
+		options.queue_bytes = std::max(1, context.config(key, options.queue_bytes));
+
+		snprintf(key, sizeof(key), "%s.max_frame", conf);
+		options.max_frame = std::max(1, context.config(key, options.max_frame));
+
+		// "2=10.0.0.2:30000, 3=10.0.0.3:30000"
+		snprintf(key, sizeof(key), "%s.peers", conf);
+		std::string list = context.config(key, "");
+
+		std::size_t begin = 0;
+		while (begin < list.size())
+		{
+			std::size_t end = list.find(',', begin);
+			if (end == std::string::npos)
+				end = list.size();
+
+			std::string item = list.substr(begin, end - begin);
+			item.erase(0, item.find_first_not_of(" \t"));
+			item.erase(item.find_last_not_of(" \t") + 1);
+
+			std::size_t equals = item.find('=');
+			int node = equals == std::string::npos ? 0 : atoi(item.c_str());
+			if (node >= 1 && node <= Node::kMaxNode && node != options.node)
+				options.peers[node] = item.substr(equals + 1);
+			else if (!item.empty())
+				fprintf(stderr, "%s: bad peer \"%s\", expected id=host:port\n", key, item.c_str());
+
+			begin = end + 1;
+		}
+	}
+
+	NodeRouter::NodeRouter(Context& context, asio::io_service& io_service, const Options& options)
+		: context_(context)
+		, io_service_(io_service)
+		, options_(options)
+		, acceptor_(io_service)
+		, mutex_()
+		, peers_()
+		, links_()
+		, closed_(false)
+	{
+		for (auto& peer : options_.peers)
+			peers_[peer.first].address = peer.second;
+	}
+
+	NodeRouter::~NodeRouter()
+	{
+
+	}
+
+	int NodeRouter::start()
+	{
+		if (options_.port <= 0)
+			return 0;
+
+		asio::error_code ec;
+		asio::ip::tcp::endpoint endpoint(asio::ip::address::from_string(options_.address, ec),
+			(unsigned short)options_.port);
+
+		if (!ec)
+			acceptor_.open(endpoint.protocol(), ec);
+		if (!ec)
+			acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true), ec);
+		if (!ec)
+			acceptor_.bind(endpoint, ec);
+		if (!ec)
+			acceptor_.listen(asio::socket_base::max_connections, ec);
+
+		if (ec)
+		{
+			fprintf(stderr, "node %d: can't listen on %s:%d: %s\n", options_.node,
+				options_.address.c_str(), options_.port, ec.message().c_str());
+
+			acceptor_.close(ec);
+			return -1;
+		}
+
+		if (options_.key.empty() && !endpoint.address().is_loopback())
+		{
+			fprintf(stderr, "node %d: listening on %s:%d without node.key, anyone who can "
+				"reach the port can act as a node\n", options_.node, options_.address.c_str(), options_.port);
+		}
+
+		auto self(shared_from_this());
+		asio::post(io_service_, [this, self]() { do_accept(); });
+
+		return 0;
+	}
+
+	void NodeRouter::close()
+	{
+		std::vector<NodeLinkPtr> links;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (closed_)
+				return;
+			closed_ = true;
+
+			for (auto& peer : peers_)
+			{
+				if (peer.second.link)
+					links.push_back(peer.second.link);
+			}
+			links.insert(links.end(), links_.begin(), links_.end());
+		}
+
+		for (auto& link : links)
+			link->close();
+
+		auto self(shared_from_this());
+		asio::post(io_service_, [this, self]()
+		{
+			asio::error_code ec;
+			acceptor_.close(ec);
+		});
+	}
+
+	bool NodeRouter::send(int node, FrameType type, int from, int to, const std::string& name,
+		int session, const char *data, std::size_t size)
+	{
+		NodeLinkPtr link;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (closed_)
+				return false;
+
+			auto iter = peers_.find(node);
+			if (iter == peers_.end())
+				return false;
+
+			Peer& peer = iter->second;
+			if (!peer.link)
+			{
+				if (peer.address.empty() || std::chrono::steady_clock::now() < peer.retry)
+					return false;
+
+				peer.link = connect(node, peer);
+			}
+
+			link = peer.link;
+		}
+
+		return link->write(type, from, to, name, session, data, size);
+	}
+
+	void NodeRouter::update(int node, const std::string& address)
+	{
+		NodeLinkPtr link;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (closed_ || node == options_.node)
+				return;
+
+			Peer& peer = peers_[node];
+			if (peer.address == address)
+				return;
+
+			peer.address = address;
+			peer.retry = std::chrono::steady_clock::time_point();
+
+			// a link the peer opened stays while it is alive
+			if (peer.link && (address.empty() || !peer.link->inbound()))
+				link = peer.link;
+		}
+
+		if (link)
+			link->close();
+	}
+
+	std::vector<NodeRouter::Stats> NodeRouter::stats()
+	{
+		std::vector<NodeLinkPtr> links;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (auto& peer : peers_)
+			{
+				if (peer.second.link)
+					links.push_back(peer.second.link);
+			}
+			links.insert(links.end(), links_.begin(), links_.end());
+		}
+
+		std::vector<Stats> stats;
+		for (auto& link : links)
+			stats.push_back(link->stats());
+
+		// messages lost with links that are gone
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto& peer : peers_)
+		{
+			if (peer.second.dropped == 0)
+				continue;
+
+			auto iter = std::find_if(stats.begin(), stats.end(),
+				[&peer](const Stats& stats) { return stats.node == peer.first; });
+
+			if (iter != stats.end())
+				iter->dropped += peer.second.dropped;
+			else
+				stats.push_back(Stats{ peer.first, peer.second.address, false, false, 0, 0, 0, 0, peer.second.dropped });
+		}
+
+		return stats;
+	}
+
+	void NodeRouter::do_accept()
+	{
+		auto link = std::make_shared<NodeLink>(shared_from_this(), 0, true);
+
+		acceptor_.async_accept(link->socket(),
+			[this, link](const asio::error_code& ec)
+		{
+			if (ec == asio::error::operation_aborted || !acceptor_.is_open())
+				return;
+
+			if (!ec)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (closed_)
+						return;
+					links_.push_back(link);
+				}
+
+				link->start();
+			}
+
+			do_accept();
+		});
+	}
+
+	// under mutex_
+	NodeLinkPtr NodeRouter::connect(int node, Peer& peer)
+	{
+		auto link = std::make_shared<NodeLink>(shared_from_this(), node, false);
+		link->connect(peer.address);
+		return link;
+	}
+
+	bool NodeRouter::on_hello(const NodeLinkPtr& link, int node)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (node < 1 || node > Node::kMaxNode || node == options_.node)
+		{
+			fprintf(stderr, "node %d: link from %s says it is node %d, closed\n",
+				options_.node, link->address_.c_str(), node);
+			return false;
+		}
+
+		if (!link->inbound())
+		{
+			if (node != link->node())
+			{
+				fprintf(stderr, "node %d: peer %s is node %d, not %d\n",
+					options_.node, link->address_.c_str(), node, link->node());
+				return false;
+			}
+			return true;
+		}
+
+		link->node_ = node;
+
+		// both sides dialled at once: the first link wins the slot, the
+		// other still delivers what its side sends
+		Peer& peer = peers_[node];
+		if (!peer.link)
+		{
+			links_.erase(std::remove(links_.begin(), links_.end(), link), links_.end());
+			peer.link = link;
+		}
+
+		return true;
+	}
+
+	void NodeRouter::on_frame(const NodeLinkPtr& link, FrameType type, int from, int to,
+		const char *name, std::size_t name_size, int session, const char *data, std::size_t size)
+	{
+		Service *service = name_size > 0
+			? context_.query(std::string(name, name_size).c_str())
+			: context_.query(to);
+		if (service == nullptr)
+			return;
+
+		// the receiver frees it, as for a local send
+		char *copy = (char*)ccmalloc(size);
+		if (size > 0)
+			std::memcpy(copy, data, size);
+
+		int src = Node::handle(link->node(), from);
+
+		if (type == kFrameRequest)
+			dispatch<MessageType::kMessageServiceRequest, SandBox>(src, service, session, (const char*)copy, size);
+		else
+			dispatch<MessageType::kMessageServiceResponse, SandBox>(src, service, session, (const char*)copy, size);
+	}
+
+	void NodeRouter::on_closed(const NodeLinkPtr& link, const std::string& error, uint64_t dropped)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		links_.erase(std::remove(links_.begin(), links_.end(), link), links_.end());
+
+		if (!error.empty() && !closed_ && link->node() > 0)
+		{
+			fprintf(stderr, "node %d: link to node %d (%s) lost: %s\n", options_.node,
+				link->node(), link->address_.c_str(), error.c_str());
+		}
+
+		if (dropped > 0)
+		{
+			fprintf(stderr, "node %d: %llu messages to node %d dropped with its link\n",
+				options_.node, (unsigned long long)dropped, link->node());
+		}
+
+		auto iter = peers_.find(link->node());
+		if (iter == peers_.end())
+			return;
+
+		// the link's own counter goes with it
+		iter->second.dropped += dropped;
+
+		if (iter->second.link != link)
+			return;
+
+		Peer& peer = iter->second;
+		peer.link.reset();
+		peer.retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(options_.reconnect_delay);
+
+		// a link that lost the race for the slot takes it over
+		for (auto other = links_.begin(); other != links_.end(); ++other)
+		{
+			if ((*other)->node() == link->node())
+			{
+				peer.link = *other;
+				links_.erase(other);
+				break;
+			}
+		}
+	}
+}
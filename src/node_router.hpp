@@ -0,0 +1,159 @@
+#ifndef TENGINE_NODE_ROUTER_HPP
+#define TENGINE_NODE_ROUTER_HPP
+
+#include "asio.hpp"
+
+#include "allocator.hpp"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Context;
+
+	class NodeLink;
+
+	typedef std::shared_ptr<NodeLink> NodeLinkPtr;
+
+	// service messages between nodes. every pair of nodes shares a tcp link,
+	// made on the first message and kept; messages to any service on the
+	// peer are multiplexed on it. a link accepted from a peer carries our
+	// messages to it as well, so replies find their way back to callers we
+	// have no address for. a link carries nothing until both ends have
+	// proved they hold the cluster key
+	class NodeRouter : public Allocator, public std::enable_shared_from_this<NodeRouter>
+	{
+	public:
+		enum FrameType : uint8_t
+		{
+			// first frame either way, from is the sender's node id and the
+			// payload a nonce
+			kFrameHello,
+			kFrameRequest,
+			kFrameResponse,
+			// the answer to the other side's nonce, hmac-sha256 under key
+			kFrameAuth,
+		};
+
+		struct Options
+		{
+			// this node, 1 to Node::kMaxNode
+			int node = 1;
+			// listens for peers when set
+			int port = 0;
+			// loopback unless other hosts should reach us
+			std::string address = "127.0.0.1";
+			// shared by every node of the cluster, authenticates the links
+			std::string key;
+			// node id to "host:port"
+			std::map<int, std::string> peers;
+			int connect_timeout = 5000;
+			// milliseconds before a failed peer is dialled again, messages
+			// to it are dropped meanwhile
+			int reconnect_delay = 1000;
+			// bytes queued on a link that is not writing fast enough, more
+			// is dropped
+			int queue_bytes = 64 << 20;
+			// the largest frame a peer may send, more closes the link
+			int max_frame = 16 << 20;
+		};
+
+		struct Stats
+		{
+			int node;
+			std::string address;
+			bool connected;
+			bool inbound;
+			uint64_t sent;
+			uint64_t received;
+			// writes, each carrying every message queued since the last
+			uint64_t batches;
+			uint64_t bytes;
+			// refused by a full queue, or accepted and lost with a link
+			uint64_t dropped;
+		};
+
+		static void load(Context& context, const char *conf, Options& options);
+
+		NodeRouter(Context& context, asio::io_service& io_service, const Options& options);
+
+		NodeRouter(const NodeRouter&) = delete;
+
+		NodeRouter& operator=(const NodeRouter&) = delete;
+
+		~NodeRouter();
+
+		int node() const { return options_.node; }
+
+		// listens when a port is set; 0 on success
+		int start();
+
+		void close();
+
+		// from any thread; name is empty when to is set. false when the
+		// node is unknown or its link is down
+		bool send(int node, FrameType type, int from, int to, const std::string& name,
+			int session, const char *data, std::size_t size);
+
+		// from any thread; where a node listens, from membership. an empty
+		// address forgets it and closes its link, a new one redials
+		void update(int node, const std::string& address);
+
+		std::vector<Stats> stats();
+
+	private:
+		friend class NodeLink;
+
+		struct Peer
+		{
+			std::string address;
+			NodeLinkPtr link;
+			// a failed link is not dialled again before this
+			std::chrono::steady_clock::time_point retry;
+			// lost with links to it that are gone
+			uint64_t dropped = 0;
+		};
+
+		void do_accept();
+
+		NodeLinkPtr connect(int node, Peer& peer);
+
+		// on the network thread, from the links, once the peer proved
+		// itself; false closes the link
+		bool on_hello(const NodeLinkPtr& link, int node);
+
+		void on_frame(const NodeLinkPtr& link, FrameType type, int from, int to,
+			const char *name, std::size_t name_size, int session, const char *data, std::size_t size);
+
+		// dropped counts messages accepted by send that died with the link
+		void on_closed(const NodeLinkPtr& link, const std::string& error, uint64_t dropped);
+
+		Context& context_;
+
+		asio::io_service& io_service_;
+
+		Options options_;
+
+		asio::ip::tcp::acceptor acceptor_;
+
+		std::mutex mutex_;
+
+		std::unordered_map<int, Peer> peers_;
+
+		// accepted links whose hello has not arrived, and any link that
+		// lost the race for its peer's slot; they still deliver
+		std::vector<NodeLinkPtr> links_;
+
+		bool closed_;
+	};
+}
+
+#endif // ! TENGINE_NODE_ROUTER_HPP
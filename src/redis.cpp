@@ -1,37 +1,198 @@
 #include "redis.hpp"
 
 #include "context.hpp"
+#include "blocking_pool.hpp"
 #include "executor.hpp"
 #include "service.hpp"
 #include "message.hpp"
 
 #include "asio/ts/executor.hpp"
 
+#include <algorithm>
+#include <cstdio>
+
 namespace tengine
 {
 	constexpr int Redis::REDIS_KEY;
 
+	namespace
+	{
+		// a transaction comes back as MULTI's +OK, a +QUEUED or an error
+		// per command, then EXEC's array. the commands get the array's
+		// elements; when EXEC failed, their queuing error or EXEC's
+		std::vector<redisReply*> unpack_exec(redisReply **replies, std::size_t count)
+		{
+			std::size_t size = count - 2;
+			redisReply *exec = replies[count - 1];
+
+			std::vector<redisReply*> unpacked;
+			unpacked.reserve(size);
+
+			if (exec->type == REDIS_REPLY_ARRAY && exec->elements == size)
+			{
+				for (std::size_t i = 0; i < size; i++)
+				{
+					unpacked.push_back(exec->element[i]);
+					exec->element[i] = nullptr;
+				}
+
+				return unpacked;
+			}
+
+			std::string reason;
+			if (replies[0]->type == REDIS_REPLY_ERROR)
+				reason.assign(replies[0]->str, replies[0]->len);
+			else if (exec->type == REDIS_REPLY_ERROR)
+				reason.assign(exec->str, exec->len);
+			else
+				reason = "ERR transaction aborted, a watched key changed";
+
+			for (std::size_t i = 0; i < size; i++)
+			{
+				redisReply *queued = replies[i + 1];
+				if (queued->type == REDIS_REPLY_ERROR)
+				{
+					unpacked.push_back(queued);
+					replies[i + 1] = nullptr;
+				}
+				else
+				{
+					unpacked.push_back(RedisClient::error_reply(reason));
+				}
+			}
+
+			return unpacked;
+		}
+
+		// the miss one caller sends for every caller that joined it; if the
+		// reply never comes back to it they are woken with an error rather
+		// than left waiting on the command for good
+		class CacheFill
+		{
+		public:
+			CacheFill(RedisCache *cache, std::string command, std::string key, int ttl)
+				: cache_(cache)
+				, command_(std::move(command))
+				, key_(std::move(key))
+				, ttl_(ttl)
+			{
+
+			}
+
+			CacheFill(const CacheFill&) = delete;
+
+			CacheFill& operator=(const CacheFill&) = delete;
+
+			~CacheFill()
+			{
+				if (cache_ != nullptr)
+					complete(RedisClient::error_reply("ERR reply dropped"));
+			}
+
+			// takes the reply
+			RedisCache::ReplyPtr complete(redisReply *reply)
+			{
+				RedisCache::ReplyPtr shared = RedisCache::share(reply);
+
+				RedisCache *cache = cache_;
+				cache_ = nullptr;
+				cache->complete(command_, key_, ttl_, shared);
+
+				return shared;
+			}
+
+		private:
+			RedisCache *cache_;
+
+			std::string command_;
+
+			std::string key_;
+
+			int ttl_;
+		};
+	}
+
+	RedisPipeline::RedisPipeline(bool transaction)
+		: transaction_(transaction)
+		, commands_()
+	{
+
+	}
+
+	RedisPipeline::~RedisPipeline()
+	{
+		for (auto& command : commands_)
+			RedisCommand::release(command);
+	}
+
+	void RedisPipeline::add(std::string command)
+	{
+		commands_.push_back(std::move(command));
+	}
+
+	std::vector<std::string> RedisPipeline::take()
+	{
+		std::vector<std::string> commands;
+
+		if (!transaction_)
+		{
+			commands.swap(commands_);
+			return commands;
+		}
+
+		commands.reserve(commands_.size() + 2);
+
+		commands.push_back(RedisCommand::acquire());
+		RedisCommand::begin(commands.back(), 1);
+		RedisCommand::arg(commands.back(), "MULTI", 5);
+
+		for (auto& command : commands_)
+			commands.push_back(std::move(command));
+		commands_.clear();
+
+		commands.push_back(RedisCommand::acquire());
+		RedisCommand::begin(commands.back(), 1);
+		RedisCommand::arg(commands.back(), "EXEC", 4);
+
+		return commands;
+	}
+
 	Redis::Redis(Service* s)
 		: ServiceProxy(s)
-		, executor_(new Executor())
+		, client_()
+		, cluster_()
+		, subscriber_()
+		, cache_(nullptr)
+		, subscriptions_(std::make_shared<Subscriptions>())
+		, queue_()
 		, redis_mutex_()
 		, redis_used_()
 		, redis_free_()
 		, redis_cond_()
-		, pipeline_()
-		, pipeline_index_(0)
 	{
 
 	}
 
 	Redis::~Redis()
 	{
-		if (this->executor_ != nullptr)
+		if (subscriber_)
 		{
-			delete executor_;
-			executor_ = nullptr;
+			for (auto& subscription : *subscriptions_)
+				subscriber_->unsubscribe(subscription.first);
 		}
 
+		subscriptions_.reset();
+
+		if (client_)
+			client_->close();
+
+		if (cluster_)
+			cluster_->close();
+
+		// queries still running hold a connection, wait for them
+		if (queue_)
+			queue_->close();
+
 		for (auto redis : redis_free_)
 		{
 			redisFree(redis);
@@ -49,7 +210,38 @@ namespace tengine
 
 	int Redis::start(const char *conf)
 	{
+		conf_ = conf;
+
+		RedisCache *cache = host_->context().redis_cache(conf);
+		if (cache->enabled())
+			cache_ = cache;
+
 		char key[256];
+		snprintf(key, sizeof(key), "%s.cluster", conf);
+
+		std::string cluster = host_->context().config(key, "");
+		if (!cluster.empty())
+		{
+#if !defined(_WIN32)
+			return start_cluster(conf);
+#else
+			fprintf(stderr, "redis %s: cluster mode needs the async engine, which needs posix descriptors\n", conf);
+			return 1;
+#endif
+		}
+
+		snprintf(key, sizeof(key), "%s.engine", conf);
+
+		std::string engine = host_->context().config(key, "blocking");
+		if (engine == "async")
+		{
+#if !defined(_WIN32)
+			return start_async(conf);
+#else
+			fprintf(stderr, "redis %s: the async engine needs posix descriptors, using the blocking one\n", conf);
+#endif
+		}
+
 		snprintf(key, sizeof(key), "%s.host", conf);
 
 		std::string host = host_->context().config(key, "localhost");
@@ -88,7 +280,58 @@ namespace tengine
 
 		int thread_num = host_->context().config(key, 1);
 
-		this->executor_->run(thread_num);
+		// never more running than connections, so get() does not park a
+		// pool thread waiting for a free one
+		std::size_t limit = (std::size_t)std::max(1, std::min(thread_num, pool));
+		queue_ = host_->context().blocking_pool().queue("redis", limit);
+
+		return 0;
+	}
+
+	int Redis::start_async(const char *conf)
+	{
+		Context& context = host_->context();
+
+		RedisClient::Options options;
+		RedisClient::load(context, conf, options);
+		if (options.host.empty())
+			return 1;
+
+		client_ = std::make_shared<RedisClient>(
+			context.net_executor().io_service(), context.resolver(), options);
+		client_->start();
+
+		return 0;
+	}
+
+	int Redis::start_cluster(const char *conf)
+	{
+		Context& context = host_->context();
+
+		RedisCluster::Options options;
+		RedisClient::load(context, conf, options.node);
+
+		// a cluster has one database
+		options.node.db = 0;
+
+		char key[256];
+		snprintf(key, sizeof(key), "%s.cluster", conf);
+		options.seeds = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.max_redirects", conf);
+		options.max_redirects = context.config(key, options.max_redirects);
+
+		snprintf(key, sizeof(key), "%s.refresh_interval", conf);
+		options.refresh_interval = context.config(key, options.refresh_interval);
+
+		cluster_ = std::make_shared<RedisCluster>(
+			context.net_executor().io_service(), context.resolver(), options);
+		if (!cluster_->start())
+		{
+			fprintf(stderr, "redis %s: no cluster seed in \"%s\"\n", conf, options.seeds.c_str());
+			cluster_.reset();
+			return 1;
+		}
 
 		return 0;
 	}
@@ -117,169 +360,242 @@ namespace tengine
 		redis_cond_.notify_one();
 	}
 
-	void Redis::call(const char *c, std::size_t size, Handler handler)
+	void Redis::call(std::string command, Handler handler)
 	{
-		std::string command = { c, size };
-		asio::post(executor_->executor(),
-			[=]
+		std::string key;
+		int ttl = 0;
+		if (cache_ != nullptr && cache_->cacheable(command, key, ttl))
 		{
-			redisContext *redis = get();
-
-			redisReply *reply = (redisReply*)redisCommand(redis, command.c_str());
-
-			asio::post(host_->executor(),
-				[=]
+			// the handler only reads the reply, which other callers share
+			cached(std::move(command), std::move(key), ttl,
+				[handler](Redis *redis, const ReplyPtr& reply)
 			{
-				handler(redis, reply);
-
-				freeReplyObject(reply);
-
-				this->put(redis);
+				handler(redis, const_cast<redisReply*>(reply.get()));
 			});
+			return;
+		}
+
+		std::vector<std::string> commands;
+		commands.push_back(std::move(command));
 
+		commit(std::move(commands),
+			[handler](Redis *redis, redisReply **replies, std::size_t)
+		{
+			handler(redis, replies[0]);
 		});
 	}
 
-	void Redis::call(const char** argv, std::size_t* argvlen, std::size_t nargs, Handler handler)
+	void Redis::call_shared(std::string command, SharedHandler handler)
 	{
-		std::array<std::string, kRedisCommandMaxArgs> args;
-		for (std::size_t i = 0; i < nargs; i++)
+		std::string key;
+		int ttl = 0;
+		if (cache_ != nullptr && cache_->cacheable(command, key, ttl))
 		{
-			args[i] = { argv[i], argvlen[i] };
+			cached(std::move(command), std::move(key), ttl, std::move(handler));
+			return;
 		}
 
-		asio::post(executor_->executor(),
-			[=]
+		std::vector<std::string> commands;
+		commands.push_back(std::move(command));
+
+		commit(std::move(commands),
+			[handler](Redis *redis, redisReply **replies, std::size_t)
 		{
-			redisContext *redis = get();
+			ReplyPtr reply = RedisCache::share(replies[0]);
+			replies[0] = nullptr;
+
+			handler(redis, reply);
+		});
+	}
 
-			const char* argv[Redis::kRedisCommandMaxArgs];
-			std::size_t argvlen[Redis::kRedisCommandMaxArgs];
+	void Redis::cached(std::string command, std::string key, int ttl, SharedHandler handler)
+	{
+		Service::ServiceExecutor executor = host_->executor();
 
-			for (std::size_t i = 0; i < nargs; i++)
+		ReplyPtr reply;
+		RedisCache::Lookup lookup = cache_->lookup(command, key, reply,
+			[this, executor, handler](const RedisCache::ReplyPtr& reply)
+		{
+			asio::post(executor, [this, handler, reply]()
 			{
-				argv[i] = args[i].c_str();
-				argvlen[i] = args[i].size();
-			}
+				handler(this, reply);
+			});
+		});
 
-			redisReply *reply = (redisReply*)redisCommandArgv(redis, nargs, argv, argvlen);
+		if (lookup == RedisCache::kHit)
+		{
+			RedisCommand::release(command);
 
-			asio::post(host_->executor(),
-				[=]
+			asio::post(executor, [this, handler, reply]()
 			{
-				handler(redis, reply);
+				handler(this, reply);
+			});
+			return;
+		}
 
-				freeReplyObject(reply);
+		if (lookup == RedisCache::kJoined)
+		{
+			RedisCommand::release(command);
+			return;
+		}
 
-				this->put(redis);
-			});
+		// the pooled buffer goes out with the command, the cache keeps a copy
+		auto fill = std::make_shared<CacheFill>(cache_, std::string(command), std::move(key), ttl);
+
+		std::vector<std::string> commands;
+		commands.push_back(std::move(command));
+
+		commit(std::move(commands),
+			[fill, handler](Redis *redis, redisReply **replies, std::size_t)
+		{
+			ReplyPtr reply = fill->complete(replies[0]);
+			replies[0] = nullptr;
 
+			handler(redis, reply);
 		});
 	}
 
-	void Redis::pipeline(const RedisCommandQueue& queue, std::size_t nargs, Handler handler)
+	void Redis::call(const char *c, std::size_t size, Handler handler)
 	{
-		asio::post(executor_->executor(),
-			[=]
-		{
-			redisContext *redis = get();
-
-			/*
-			for (std::size_t i = 0; i < nargs; i++)
-			{
-				const char* argv[Redis::kRedisCommandMaxArgs];
-				std::size_t argvlen[Redis::kRedisCommandMaxArgs];
+		std::string command = RedisCommand::acquire();
+		RedisCommand::line(command, c, size);
 
-				for (int j = 0; j < nargs; j++)
-				{
-					argv[j] = queue[i].c_str();
-					argvlen[j] = queue[i].size();
-				}
+		call(std::move(command), std::move(handler));
+	}
 
-				redisAppendCommandArgv(redis, )
-			}
+	void Redis::commit(RedisPipeline& pipeline, PipelineHander handler)
+	{
+		if (!pipeline.transaction())
+		{
+			commit(pipeline.take(), std::move(handler));
+			return;
+		}
 
-			
+		commit(pipeline.take(),
+			[handler](Redis *redis, redisReply **replies, std::size_t count)
+		{
+			std::vector<redisReply*> unpacked = unpack_exec(replies, count);
 
-			redisReply *reply = (redisReply*)redisCommandArgv(redis, nargs, argv, argvlen);
-			
-			asio::post(host_->executor(),
-				[=]
-			{
-				handler(redis, reply);
+			handler(redis, unpacked.data(), unpacked.size());
 
+			for (auto reply : unpacked)
 				freeReplyObject(reply);
-
-				this->put(redis);
-			});
-			*/
 		});
 	}
 
+	void Redis::commit(std::vector<std::string> commands, PipelineHander handler)
+	{
+		if (client_ || cluster_)
+		{
+			RedisClient::Handler done = [this, handler](redisReply **replies, std::size_t count)
+			{
+				std::vector<redisReply*> owned(replies, replies + count);
 
-    void Redis::transaction()
-    {
-		pipeline_index_ = 0;
-    }
+				asio::post(host_->executor(),
+					[this, handler, owned]() mutable
+				{
+					handler(this, owned.data(), owned.size());
 
-    void Redis::pipeline(const char** argv, std::size_t* argvlen, std::size_t nargs)
-    {
-		RedisCommandType& args = pipeline_[pipeline_index_];
+					for (auto reply : owned)
+						freeReplyObject(reply);
+				});
+			};
 
-		for (std::size_t i = 0; i < nargs; i++)
-		{
-			args[i] = { argv[i], argvlen[i] };
+			if (cluster_)
+				cluster_->send(std::move(commands), std::move(done));
+			else
+				client_->send(std::move(commands), std::move(done));
+			return;
 		}
 
-		pipeline_args_[pipeline_index_] = nargs;
-		pipeline_index_++;
-    }
+		auto shared = std::make_shared<std::vector<std::string>>(std::move(commands));
 
-    void Redis::commit(PipelineHander handler)
-    {
-        asio::post(executor_->executor(),
-        [=]
-        {
-            redisContext *redis = get();
+		queue_->post(
+			[this, handler, shared]
+		{
+			std::vector<std::string>& commands = *shared;
 
-			for (std::size_t i = 0; i < pipeline_index_; i++)
+			redisContext *redis = get();
+
+			for (auto& command : commands)
 			{
-				std::size_t nargs = pipeline_args_[i];
-				const char* argv[Redis::kRedisCommandMaxArgs];
-				std::size_t argvlen[Redis::kRedisCommandMaxArgs];
+				if (!command.empty())
+					redisAppendFormattedCommand(redis, command.data(), command.size());
+			}
 
-				for (std::size_t j = 0; j < nargs; j++)
-				{
-					argv[j] = pipeline_[i][j].c_str();
-					argvlen[j] = pipeline_[i][j].size();
-				}
+			std::vector<redisReply*> replies;
+			for (auto& command : commands)
+			{
+				void *reply = nullptr;
 
-				redisAppendCommandArgv(redis, nargs, argv, argvlen);
+				if (command.empty())
+					replies.push_back(RedisClient::error_reply("ERR empty command"));
+				else if (redis->err == 0 && redisGetReply(redis, &reply) == REDIS_OK && reply != nullptr)
+					replies.push_back((redisReply*)reply);
+				else
+					replies.push_back(RedisClient::error_reply(std::string("ERR ") + redis->errstr));
+
+				RedisCommand::release(command);
 			}
 
-			std::array<redisReply*, kRedisPipelineMaxSize> rets;
+			// a context that failed once is unusable, open it again for the
+			// next caller; if that fails too the next call reports it
+			if (redis->err)
+				redisReconnect(redis);
+
+			this->put(redis);
 
-			for (std::size_t i = 0; i < pipeline_index_; ++i)
+			asio::post(host_->executor(),
+				[this, handler, replies]() mutable
 			{
-				redisGetReply(redis, reinterpret_cast<void**>(&(rets[i])));
-			}
+				handler(this, replies.data(), replies.size());
 
-            asio::post(host_->executor(),
-				[=]
-				{
-					handler(redis, const_cast<redisReply**>(rets.data()), pipeline_index_);
-									
-					for (std::size_t i = 0; i < pipeline_index_; ++i)
-					{
-						freeReplyObject(rets[i]);
-					}
-
-					this->put(redis);
-				});
+				for (auto reply : replies)
+					freeReplyObject(reply);
+			});
+		});
+	}
 
-        });
+	uint64_t Redis::subscribe(std::vector<std::string> names, bool pattern, MessageHandler handler)
+	{
+		if (!subscriber_)
+		{
+			subscriber_ = host_->context().redis_subscriber(conf_.c_str());
+			if (!subscriber_)
+				return 0;
+		}
 
-    }
+		std::weak_ptr<Subscriptions> subscriptions = subscriptions_;
+		Service::ServiceExecutor executor = host_->executor();
 
+		// runs on the net thread, this handle may be gone by then
+		uint64_t id = subscriber_->subscribe(std::move(names), pattern,
+			[this, subscriptions, executor](uint64_t id, const RedisSubscriber::MessagePtr& message)
+		{
+			asio::post(executor, [this, subscriptions, id, message]()
+			{
+				auto live = subscriptions.lock();
+				if (!live)
+					return;
+
+				auto iter = live->find(id);
+				if (iter == live->end())
+					return;
+
+				// the handler may unsubscribe itself
+				MessageHandler handler = iter->second;
+				handler(this, id, *message);
+			});
+		});
 
+		(*subscriptions_)[id] = std::move(handler);
+
+		return id;
+	}
+
+	void Redis::unsubscribe(uint64_t id)
+	{
+		if (subscriptions_->erase(id) != 0)
+			subscriber_->unsubscribe(id);
+	}
 }
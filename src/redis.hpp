@@ -4,12 +4,21 @@
 #include "asio.hpp"
 
 #include "service_proxy.hpp"
+#include "blocking_pool.hpp"
+#include "redis_client.hpp"
+#include "redis_cluster.hpp"
+#include "redis_command.hpp"
+#include "redis_cache.hpp"
+#include "redis_subscriber.hpp"
 
 #include "hiredis/hiredis.h"
 
 #include <string>
 #include <set>
+#include <unordered_map>
 #include <list>
+#include <memory>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 
@@ -17,22 +26,42 @@ namespace tengine
 {
 	class Service;
 
-	class Executor;
+	// commands one caller batches up and hands to Redis::commit, any number
+	// of them. owned by whoever builds it, so batches don't share state.
+	// with transaction set they run between MULTI and EXEC, and commit
+	// reports what EXEC returned for each one
+	class RedisPipeline : public Allocator
+	{
+	public:
+		explicit RedisPipeline(bool transaction = false);
+
+		RedisPipeline(const RedisPipeline&) = delete;
+
+		RedisPipeline& operator=(const RedisPipeline&) = delete;
+
+		~RedisPipeline();
+
+		bool transaction() const { return transaction_; }
+
+		std::size_t size() const { return commands_.size(); }
+
+		// one command in the wire format, see RedisCommand
+		void add(std::string command);
+
+		// the commands to send, MULTI and EXEC included; leaves it empty
+		std::vector<std::string> take();
+
+	private:
+		bool transaction_;
+
+		std::vector<std::string> commands_;
+	};
 
 	class Redis : public ServiceProxy
 	{
 	public:
 		static constexpr int REDIS_KEY = 0;
 
-		enum
-		{
-			kRedisCommandMaxArgs= 256,
-            kRedisPipelineMaxSize = 64,
-		};
-
-        typedef std::array<std::string, kRedisCommandMaxArgs> RedisCommandType;
-		typedef std::array<RedisCommandType, kRedisPipelineMaxSize> RedisCommandQueue;
-
 		Redis(Service *s);
 
 		~Redis();
@@ -43,22 +72,83 @@ namespace tengine
 
 		void put(redisContext* redis);
 
-		typedef std::function<void(redisContext*, redisReply*)> Handler;
-		typedef std::function<void(redisContext*, redisReply**, std::size_t)> PipelineHander;
+		// called on the owning service's strand, the reply is freed once it
+		// returns. never null: a lost connection or a timeout shows up as an
+		// error reply
+		typedef std::function<void(Redis*, redisReply*)> Handler;
+		// a handler keeps a reply by taking it out of its slot, the others
+		// are freed once it returns
+		typedef std::function<void(Redis*, redisReply**, std::size_t)> PipelineHander;
+
+		// a reply the handler may keep for as long as it likes; read only,
+		// the near cache may hand the same one to other callers
+		typedef RedisCache::ReplyPtr ReplyPtr;
+		typedef std::function<void(Redis*, const ReplyPtr&)> SharedHandler;
+
+		// one command in the wire format, see RedisCommand. reads of keys
+		// under the section's cache prefixes may be answered from the near
+		// cache, still on the strand and never before call returns
+		void call(std::string command, Handler handler);
 
+		void call_shared(std::string command, SharedHandler handler);
+
+		// a command line split on spaces, e.g. "GET key"
 		void call(const char *c, std::size_t size, Handler handler);
-		void call(const char** argv, std::size_t* argvlen, std::size_t nargs, Handler handler);
 
-		void pipeline(const RedisCommandQueue& queue, std::size_t nargs, Handler handler);
+		// commands sent back to back on one connection, one reply each
+		void commit(std::vector<std::string> commands, PipelineHander handler);
+
+		// one reply per command added, for a transaction those from EXEC;
+		// an aborted one gives every command an error. the pipeline is
+		// left empty for reuse
+		void commit(RedisPipeline& pipeline, PipelineHander handler);
+
+		bool async() const { return client_ != nullptr || cluster_ != nullptr; }
+
+		// null unless [section].cache is enabled
+		RedisCache *cache() { return cache_; }
 
-		// ֻcortioneܱ֤̰߳ȫ
-        void transaction();
-        void pipeline(const char** argv, std::size_t* argvlen, std::size_t nargs);
-		void commit(PipelineHander handler);
+		// called on the owning service's strand for every message until
+		// unsubscribe, whichever engine the section uses
+		typedef std::function<void(Redis*, uint64_t, const RedisSubscriber::Message&)> MessageHandler;
+
+		// channels, or glob patterns such as "__keyspace@0__:user:*" when
+		// pattern is set, on the section's shared pub/sub connection; the
+		// id ends it, 0 when pub/sub is not available
+		uint64_t subscribe(std::vector<std::string> names, bool pattern, MessageHandler handler);
+
+		void unsubscribe(uint64_t id);
 
 	private:
+		int start_async(const char *conf);
+
+		int start_cluster(const char *conf);
+
+		void cached(std::string command, std::string key, int ttl, SharedHandler handler);
 
-		Executor *executor_;
+		typedef std::unordered_map<uint64_t, MessageHandler> Subscriptions;
+
+		std::string conf_;
+
+		// set when the section says engine = "async": commands from every
+		// handle are pipelined on the network thread, the blocking pool and
+		// its connections are not used
+		std::shared_ptr<RedisClient> client_;
+
+		// set when the section lists cluster seeds, always async
+		std::shared_ptr<RedisCluster> cluster_;
+
+		std::shared_ptr<RedisSubscriber> subscriber_;
+
+		// shared by every handle on the section, owned by the context
+		RedisCache *cache_;
+
+		// touched on the strand only; messages already posted when an id
+		// leaves, or when this handle goes away, find nothing and drop
+		std::shared_ptr<Subscriptions> subscriptions_;
+
+		// thread_num bounds how many calls run at once on the shared pool
+		BlockingPool::QueuePtr queue_;
 
 		std::mutex redis_mutex_;
 
@@ -67,10 +157,6 @@ namespace tengine
 		std::list<redisContext*> redis_free_;
 
 		std::condition_variable redis_cond_;
-
-        std::array<RedisCommandType, kRedisPipelineMaxSize> pipeline_;
-		std::size_t pipeline_index_;
-		std::size_t pipeline_args_[kRedisPipelineMaxSize];
 	};
 }
 
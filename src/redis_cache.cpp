@@ -0,0 +1,323 @@
+#include "redis_cache.hpp"
+
+#include "context.hpp"
+#include "redis_command.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace tengine
+{
+	namespace
+	{
+		bool is(const char *name, std::size_t size, const char *word)
+		{
+			if (strlen(word) != size)
+				return false;
+
+			for (std::size_t i = 0; i < size; i++)
+			{
+				if (std::tolower((unsigned char)name[i]) != word[i])
+					return false;
+			}
+			return true;
+		}
+
+		// reads of one key, argument 1, that change nothing; their replies
+		// only change when the key is written
+		bool is_cached_read(const char *name, std::size_t size)
+		{
+			static const char *const kCommands[] = {
+				"get", "getrange", "strlen", "getbit", "bitcount", "type", "exists",
+				"hget", "hmget", "hgetall", "hkeys", "hvals", "hlen", "hexists", "hstrlen",
+				"lrange", "llen", "lindex",
+				"smembers", "scard", "sismember",
+				"zrange", "zrevrange", "zrangebyscore", "zrevrangebyscore",
+				"zscore", "zcard", "zcount", "zrank", "zrevrank",
+			};
+
+			for (const char *command : kCommands)
+			{
+				if (is(name, size, command))
+					return true;
+			}
+			return false;
+		}
+
+		std::size_t reply_bytes(const redisReply *reply)
+		{
+			std::size_t bytes = sizeof(redisReply) + (std::size_t)reply->len;
+
+			for (std::size_t i = 0; i < reply->elements; i++)
+				bytes += sizeof(redisReply*) + reply_bytes(reply->element[i]);
+
+			return bytes;
+		}
+	}
+
+	void RedisCache::load(Context& context, const char *conf, Options& options)
+	{
+		char key[256];
+
+		snprintf(key, sizeof(key), "%s.cache.capacity", conf);
+		options.capacity = std::max(0, context.config(key, options.capacity));
+
+		snprintf(key, sizeof(key), "%s.cache.max_bytes", conf);
+		options.max_bytes = std::max(0, context.config(key, options.max_bytes));
+
+		snprintf(key, sizeof(key), "%s.cache.ttl", conf);
+		options.ttl = std::max(1, context.config(key, options.ttl));
+
+		snprintf(key, sizeof(key), "%s.cache.prefixes", conf);
+		std::string list = context.config(key, "");
+
+		std::size_t begin = 0;
+		while (begin < list.size())
+		{
+			std::size_t end = list.find(',', begin);
+			if (end == std::string::npos)
+				end = list.size();
+
+			std::string item = list.substr(begin, end - begin);
+			item.erase(0, item.find_first_not_of(" \t"));
+			item.erase(item.find_last_not_of(" \t") + 1);
+
+			if (!item.empty())
+			{
+				Prefix prefix;
+				prefix.ttl = 0;
+
+				std::size_t equals = item.rfind('=');
+				if (equals != std::string::npos)
+				{
+					prefix.ttl = std::max(0, atoi(item.c_str() + equals + 1));
+					item.erase(equals);
+				}
+
+				prefix.prefix = item;
+				options.prefixes.push_back(prefix);
+			}
+
+			begin = end + 1;
+		}
+	}
+
+	RedisCache::ReplyPtr RedisCache::share(redisReply *reply)
+	{
+		return ReplyPtr(reply, [](const redisReply *reply)
+		{
+			freeReplyObject((void*)reply);
+		});
+	}
+
+	RedisCache::RedisCache(const Options& options)
+		: options_(options)
+		, mutex_()
+		, entries_()
+		, index_()
+		, keyed_()
+		, pending_()
+		, bytes_(0)
+		, hits_(0)
+		, misses_(0)
+		, joined_(0)
+		, stores_(0)
+		, evictions_(0)
+		, invalidations_(0)
+		, flushes_(0)
+	{
+
+	}
+
+	bool RedisCache::cacheable(const std::string& command, std::string& key, int& ttl) const
+	{
+		RedisCommand::Arg args[2];
+		std::size_t nargs = RedisCommand::parse(command, args, 2);
+		if (nargs < 2 || !is_cached_read(args[0].data, args[0].size))
+			return false;
+
+		// EXISTS counts several keys
+		if (nargs > 2 && is(args[0].data, args[0].size, "exists"))
+			return false;
+
+		for (auto& prefix : options_.prefixes)
+		{
+			if (args[1].size >= prefix.prefix.size()
+				&& memcmp(args[1].data, prefix.prefix.data(), prefix.prefix.size()) == 0)
+			{
+				key.assign(args[1].data, args[1].size);
+				ttl = prefix.ttl > 0 ? prefix.ttl : options_.ttl;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	RedisCache::Lookup RedisCache::lookup(const std::string& command, const std::string& key,
+		ReplyPtr& reply, Waiter waiter)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto iter = index_.find(command);
+		if (iter != index_.end())
+		{
+			if (Clock::now() < iter->second->expires)
+			{
+				entries_.splice(entries_.begin(), entries_, iter->second);
+				reply = iter->second->reply;
+				hits_++;
+				return kHit;
+			}
+
+			erase(iter->second);
+		}
+
+		auto pending = pending_.find(command);
+		if (pending != pending_.end())
+		{
+			pending->second.waiters.push_back(std::move(waiter));
+			joined_++;
+			return kJoined;
+		}
+
+		Pending& entry = pending_[command];
+		entry.key = key;
+		entry.stale = false;
+
+		misses_++;
+		return kMiss;
+	}
+
+	void RedisCache::complete(const std::string& command, const std::string& key,
+		int ttl, const ReplyPtr& reply)
+	{
+		std::vector<Waiter> waiters;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto pending = pending_.find(command);
+			if (pending == pending_.end())
+				return;
+
+			waiters.swap(pending->second.waiters);
+
+			bool fresh = !pending->second.stale;
+			pending_.erase(pending);
+
+			std::size_t bytes = reply_bytes(reply.get()) + command.size() + key.size();
+
+			if (fresh && reply->type != REDIS_REPLY_ERROR && bytes <= (std::size_t)options_.max_bytes)
+			{
+				auto iter = index_.find(command);
+				if (iter != index_.end())
+					erase(iter->second);
+
+				Entry entry;
+				entry.command = command;
+				entry.key = key;
+				entry.reply = reply;
+				entry.bytes = bytes;
+				entry.expires = Clock::now() + std::chrono::milliseconds(ttl > 0 ? ttl : options_.ttl);
+
+				entries_.push_front(std::move(entry));
+				index_[command] = entries_.begin();
+				keyed_[key].insert(command);
+
+				bytes_ += bytes;
+				stores_++;
+
+				while (!entries_.empty() && (entries_.size() > (std::size_t)options_.capacity
+					|| bytes_ > (std::size_t)options_.max_bytes))
+				{
+					erase(std::prev(entries_.end()));
+					evictions_++;
+				}
+			}
+		}
+
+		for (auto& waiter : waiters)
+			waiter(reply);
+	}
+
+	void RedisCache::invalidate(const std::vector<std::string>& keys)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto& key : keys)
+		{
+			for (auto& pending : pending_)
+			{
+				if (pending.second.key == key)
+					pending.second.stale = true;
+			}
+
+			auto keyed = keyed_.find(key);
+			if (keyed == keyed_.end())
+				continue;
+
+			// erase() edits the set we would be walking
+			std::vector<std::string> commands(keyed->second.begin(), keyed->second.end());
+			for (auto& command : commands)
+			{
+				auto iter = index_.find(command);
+				if (iter != index_.end())
+				{
+					erase(iter->second);
+					invalidations_++;
+				}
+			}
+		}
+	}
+
+	void RedisCache::clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		entries_.clear();
+		index_.clear();
+		keyed_.clear();
+		bytes_ = 0;
+		flushes_++;
+
+		// whatever is in flight now may predate the reason for clearing
+		for (auto& pending : pending_)
+			pending.second.stale = true;
+	}
+
+	RedisCache::Stats RedisCache::stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Stats stats;
+		stats.entries = entries_.size();
+		stats.bytes = bytes_;
+		stats.hits = hits_;
+		stats.misses = misses_;
+		stats.joined = joined_;
+		stats.stores = stores_;
+		stats.evictions = evictions_;
+		stats.invalidations = invalidations_;
+		stats.flushes = flushes_;
+		return stats;
+	}
+
+	void RedisCache::erase(Entries::iterator iter)
+	{
+		auto keyed = keyed_.find(iter->key);
+		if (keyed != keyed_.end())
+		{
+			keyed->second.erase(iter->command);
+			if (keyed->second.empty())
+				keyed_.erase(keyed);
+		}
+
+		bytes_ -= iter->bytes;
+		index_.erase(iter->command);
+		entries_.erase(iter);
+	}
+}
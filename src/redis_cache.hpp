@@ -0,0 +1,176 @@
+#ifndef TENGINE_REDIS_CACHE_HPP
+#define TENGINE_REDIS_CACHE_HPP
+
+#include "allocator.hpp"
+
+#include "hiredis/hiredis.h"
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Context;
+
+	// near cache of read replies for one redis section, shared by every
+	// sandbox. only single key reads of keys under the configured prefixes
+	// are kept, keyed by the encoded command and tagged with the key. the
+	// section's subscriber hears about writes to those prefixes, through
+	// CLIENT TRACKING or keyspace events, and drops every reply of the key;
+	// a read in flight across that is not stored. when the subscriber
+	// loses its connection writes may have gone unseen and everything is
+	// dropped. concurrent misses on one command share a single request.
+	class RedisCache : public Allocator
+	{
+	public:
+		struct Prefix
+		{
+			std::string prefix;
+			// milliseconds, 0 for the section's
+			int ttl;
+		};
+
+		struct Options
+		{
+			// entries kept, 0 disables the cache
+			int capacity = 0;
+			// bytes of replies kept, least recently used go first
+			int max_bytes = 64 << 20;
+			// milliseconds an entry lives unless its prefix says otherwise,
+			// bounds how long a lost invalidation can serve stale data
+			int ttl = 5000;
+			// "guild:=30000, rank:" keys cached, with their own ttl
+			std::vector<Prefix> prefixes;
+		};
+
+		struct Stats
+		{
+			std::size_t entries;
+			std::size_t bytes;
+			uint64_t hits;
+			uint64_t misses;
+			// misses that joined a request already in flight
+			uint64_t joined;
+			uint64_t stores;
+			uint64_t evictions;
+			uint64_t invalidations;
+			// everything dropped after the invalidations may have been lost
+			uint64_t flushes;
+		};
+
+		// replies are shared by every caller that reads them, and freed
+		// with the last
+		typedef std::shared_ptr<const redisReply> ReplyPtr;
+
+		typedef std::function<void(const ReplyPtr& reply)> Waiter;
+
+		enum Lookup
+		{
+			kHit,
+			// the caller sends the command and hands the reply to complete()
+			kMiss,
+			// another caller sends it, the waiter gets its reply
+			kJoined,
+		};
+
+		static void load(Context& context, const char *conf, Options& options);
+
+		// takes the reply, freed with the last copy
+		static ReplyPtr share(redisReply *reply);
+
+		explicit RedisCache(const Options& options);
+
+		RedisCache(const RedisCache&) = delete;
+
+		RedisCache& operator=(const RedisCache&) = delete;
+
+		bool enabled() const { return options_.capacity > 0 && !options_.prefixes.empty(); }
+
+		const std::vector<Prefix>& prefixes() const { return options_.prefixes; }
+
+		// the key a command in the wire format reads and how long its reply
+		// may be kept; false for writes, several keys and other prefixes
+		bool cacheable(const std::string& command, std::string& key, int& ttl) const;
+
+		// the calls below may be made from any thread
+
+		Lookup lookup(const std::string& command, const std::string& key,
+			ReplyPtr& reply, Waiter waiter);
+
+		// stores the reply for ttl ms and wakes the callers that joined;
+		// errors are handed on but not stored
+		void complete(const std::string& command, const std::string& key,
+			int ttl, const ReplyPtr& reply);
+
+		void invalidate(const std::vector<std::string>& keys);
+
+		void clear();
+
+		Stats stats();
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Entry
+		{
+			std::string command;
+			std::string key;
+			ReplyPtr reply;
+			std::size_t bytes;
+			Clock::time_point expires;
+		};
+
+		typedef std::list<Entry> Entries;
+
+		struct Pending
+		{
+			std::string key;
+			std::vector<Waiter> waiters;
+			// its key was written while the command was in flight
+			bool stale;
+		};
+
+		void erase(Entries::iterator iter);
+
+		Options options_;
+
+		std::mutex mutex_;
+
+		// most recently used first
+		Entries entries_;
+
+		std::unordered_map<std::string, Entries::iterator> index_;
+
+		// key to the commands whose replies read it
+		std::unordered_map<std::string, std::unordered_set<std::string>> keyed_;
+
+		std::unordered_map<std::string, Pending> pending_;
+
+		std::size_t bytes_;
+
+		uint64_t hits_;
+
+		uint64_t misses_;
+
+		uint64_t joined_;
+
+		uint64_t stores_;
+
+		uint64_t evictions_;
+
+		uint64_t invalidations_;
+
+		uint64_t flushes_;
+	};
+}
+
+#endif
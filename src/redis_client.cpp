@@ -0,0 +1,727 @@
+#include "redis_client.hpp"
+
+#include "context.hpp"
+#include "resolver.hpp"
+#include "redis_command.hpp"
+#include "redis_socket.hpp"
+
+#include "asio/ts/executor.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// see RedisSocket
+#if !defined(_WIN32)
+
+namespace tengine
+{
+	namespace
+	{
+		// hiredis frees the reply once the callback returns, so the contents
+		// move to a reply of our own and the original is left empty
+		redisReply* take_reply(redisReply *reply)
+		{
+			redisReply *owned = (redisReply*)malloc(sizeof(redisReply));
+			*owned = *reply;
+
+			reply->type = REDIS_REPLY_NIL;
+			reply->str = nullptr;
+			reply->len = 0;
+			reply->element = nullptr;
+			reply->elements = 0;
+
+			return owned;
+		}
+
+		// the first argument of a command in the wire format, lower cased
+		std::string command_name(const std::string& command)
+		{
+			RedisCommand::Arg arg;
+			if (RedisCommand::parse(command, &arg, 1) == 0)
+				return std::string();
+
+			std::string name(arg.data, arg.size);
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			return name;
+		}
+
+		// replies to these don't come one per command, they would shift
+		// every reply after them on the shared connection
+		bool is_subscription(const std::string& command)
+		{
+			std::string name = command_name(command);
+
+			return name == "subscribe" || name == "psubscribe"
+				|| name == "unsubscribe" || name == "punsubscribe"
+				|| name == "monitor";
+		}
+	}
+
+	redisReply* RedisClient::error_reply(const std::string& message)
+	{
+		redisReply *reply = (redisReply*)calloc(1, sizeof(redisReply));
+		reply->type = REDIS_REPLY_ERROR;
+		reply->len = (int)message.size();
+		reply->str = (char*)malloc(message.size() + 1);
+		memcpy(reply->str, message.c_str(), message.size() + 1);
+		return reply;
+	}
+
+	// one connection of the client on a RedisSocket, reconnecting with a
+	// backoff after it is lost
+	class RedisClient::Connection :
+		public Allocator, public std::enable_shared_from_this<Connection>
+	{
+	public:
+		Connection(RedisClient& client)
+			: client_(client)
+			, socket_(std::make_shared<RedisSocket>(client.io_service_))
+			, timer_(client.io_service_)
+			, timer_armed_(false)
+			, state_(kDisconnected)
+			, deadline_(Clock::time_point::max())
+			, attempts_(0)
+			, setup_(0)
+			, in_flight_()
+			, replies_()
+			, pending_(0)
+		{
+
+		}
+
+		~Connection()
+		{
+			close();
+		}
+
+		bool ready() const { return state_ == kReady; }
+
+		// commands, not requests: a pipeline counts for all of its own
+		std::size_t in_flight() const { return pending_; }
+
+		void start()
+		{
+			if (state_ != kDisconnected)
+				return;
+
+			state_ = kConnecting;
+			arm_deadline(Clock::now() + std::chrono::milliseconds(client_.options_.connect_timeout));
+
+			auto self = shared_from_this();
+			client_.resolver_.async_resolve(client_.options_.host,
+				[this, self](const asio::error_code& ec, const Resolver::Addresses& addresses)
+			{
+				if (state_ != kConnecting)
+					return;
+
+				if (ec || addresses.empty())
+				{
+					disconnect("ERR resolve " + client_.options_.host + ": "
+						+ (ec ? ec.message() : std::string("no address")));
+					return;
+				}
+
+				do_connect(addresses.front());
+			});
+		}
+
+		void close()
+		{
+			state_ = kClosed;
+
+			asio::error_code ec;
+			timer_.cancel(ec);
+
+			socket_->close();
+
+			for (auto reply : replies_)
+				freeReplyObject(reply);
+			replies_.clear();
+
+			in_flight_.clear();
+			pending_ = 0;
+		}
+
+		void send(Request& request)
+		{
+			for (std::size_t i = 0; i < request.count; i++)
+			{
+				const std::string& command = request.command(i);
+				redisAsyncFormattedCommand(socket_->context(), &Connection::on_reply, this,
+					command.data(), command.size());
+			}
+
+			for (auto& command : request.commands)
+				RedisCommand::release(command);
+			request.commands.clear();
+
+			pending_ += request.count;
+			client_.in_flight_ += request.count;
+
+			bool first = in_flight_.empty();
+			in_flight_.push_back(std::move(request));
+
+			if (first)
+				arm_deadline(in_flight_.front().deadline);
+		}
+
+	private:
+		enum State
+		{
+			kDisconnected,
+			kConnecting,
+			kSetup,
+			kReady,
+			kClosed,
+		};
+
+		void do_connect(const asio::ip::address& address)
+		{
+			// the socket belongs to this connection and never outlives it
+			std::string error;
+			bool ok = socket_->connect(address, client_.options_.port,
+				[this](const std::string& error)
+			{
+				if (error.empty())
+					on_connected();
+				else
+					disconnect("ERR connect " + client_.options_.host + ": " + error);
+			},
+				[this](const std::string& error)
+			{
+				disconnect(error.empty()
+					? std::string("ERR redis connection closed")
+					: "ERR redis connection lost: " + error);
+			}, error);
+
+			if (!ok)
+				disconnect("ERR connect " + client_.options_.host + ": " + error);
+		}
+
+		void on_connected()
+		{
+			const Options& options = client_.options_;
+			redisAsyncContext *context = socket_->context();
+
+			state_ = kSetup;
+			setup_ = 0;
+
+			if (!options.password.empty())
+			{
+				const char *argv[] = { "AUTH", options.password.c_str() };
+				std::size_t argvlen[] = { 4, options.password.size() };
+				redisAsyncCommandArgv(context, &Connection::on_setup_reply, this, 2, argv, argvlen);
+				setup_++;
+			}
+
+			if (options.db != 0)
+			{
+				redisAsyncCommand(context, &Connection::on_setup_reply, this, "SELECT %d", options.db);
+				setup_++;
+			}
+
+			if (setup_ == 0)
+				on_ready();
+		}
+
+		void on_ready()
+		{
+			state_ = kReady;
+			attempts_ = 0;
+			client_.ready_++;
+
+			arm_deadline(Clock::time_point::max());
+
+			client_.dispatch();
+		}
+
+		void on_command_reply(redisReply *reply)
+		{
+			if (in_flight_.empty())
+				return;
+
+			pending_--;
+			client_.in_flight_--;
+
+			Request& request = in_flight_.front();
+			replies_.push_back(take_reply(reply));
+
+			if (replies_.size() < request.count)
+				return;
+
+			Request done = std::move(request);
+			in_flight_.pop_front();
+
+			std::vector<redisReply*> replies;
+			replies.swap(replies_);
+
+			client_.complete(done, replies);
+
+			if (state_ != kReady)
+				return;
+
+			arm_deadline(in_flight_.empty()
+				? Clock::time_point::max() : in_flight_.front().deadline);
+
+			client_.dispatch();
+		}
+
+		// the reply is null when the context goes away, disconnect() fails
+		// what was waiting so there is nothing left to do then
+		static void on_reply(redisAsyncContext *context, void *r, void *privdata)
+		{
+			if (context->data == nullptr || r == nullptr)
+				return;
+
+			((Connection*)privdata)->on_command_reply((redisReply*)r);
+		}
+
+		// AUTH and SELECT sent before the connection is ready
+		static void on_setup_reply(redisAsyncContext *context, void *r, void *privdata)
+		{
+			if (context->data == nullptr || r == nullptr)
+				return;
+
+			Connection *self = (Connection*)privdata;
+			redisReply *reply = (redisReply*)r;
+
+			if (reply->type == REDIS_REPLY_ERROR)
+			{
+				self->disconnect("ERR redis setup: " + std::string(reply->str, reply->len));
+				return;
+			}
+
+			if (--self->setup_ == 0)
+				self->on_ready();
+		}
+
+		void arm_deadline(Clock::time_point deadline)
+		{
+			deadline_ = deadline;
+
+			if (deadline == Clock::time_point::max())
+				return;
+
+			timer_armed_ = true;
+			timer_.expires_at(deadline);
+
+			auto self = shared_from_this();
+			timer_.async_wait([this, self](const asio::error_code& ec)
+			{
+				// a cancelled wait was replaced by a newer one
+				if (ec == asio::error::operation_aborted)
+					return;
+
+				timer_armed_ = false;
+
+				if (state_ != kClosed)
+					on_timer();
+			});
+		}
+
+		// the wait may have been overtaken by a newer deadline, so every
+		// branch checks the clock rather than trusting the wakeup
+		void on_timer()
+		{
+			Clock::time_point now = Clock::now();
+
+			switch (state_)
+			{
+			case kDisconnected:
+				if (now >= deadline_)
+					start();
+				else
+					arm_deadline(deadline_);
+				break;
+
+			case kConnecting:
+			case kSetup:
+				if (now >= deadline_)
+					disconnect("ERR connect " + client_.options_.host + ": timed out");
+				else
+					arm_deadline(deadline_);
+				break;
+
+			case kReady:
+				if (in_flight_.empty())
+					break;
+
+				if (now >= in_flight_.front().deadline)
+				{
+					Request request = std::move(in_flight_.front());
+					in_flight_.pop_front();
+					client_.timeouts_++;
+
+					client_.fail(request, "ERR redis command timed out");
+
+					disconnect("ERR redis connection reset after a command timed out");
+				}
+				else
+				{
+					arm_deadline(in_flight_.front().deadline);
+				}
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		// fail what was sent, commands that may have run are never retried
+		void disconnect(const std::string& message)
+		{
+			if (state_ == kClosed)
+				return;
+
+			if (state_ == kReady)
+				client_.ready_--;
+
+			state_ = kDisconnected;
+
+			socket_->close();
+
+			for (auto reply : replies_)
+				freeReplyObject(reply);
+			replies_.clear();
+
+			client_.in_flight_ -= pending_;
+			pending_ = 0;
+
+			std::deque<Request> requests;
+			requests.swap(in_flight_);
+
+			for (auto& request : requests)
+				client_.fail(request, message);
+
+			int delay = client_.options_.reconnect_delay << std::min(attempts_, 5);
+			attempts_++;
+
+			arm_deadline(Clock::now() + std::chrono::milliseconds(delay));
+
+			// whatever waits may still fit on the other connections
+			client_.dispatch();
+		}
+
+		RedisClient& client_;
+
+		std::shared_ptr<RedisSocket> socket_;
+
+		asio::steady_timer timer_;
+
+		bool timer_armed_;
+
+		State state_;
+
+		// connect timeout, retry time or the oldest command's timeout
+		Clock::time_point deadline_;
+
+		int attempts_;
+
+		// AUTH and SELECT replies still expected
+		int setup_;
+
+		std::deque<Request> in_flight_;
+
+		// replies of the front request so far
+		std::vector<redisReply*> replies_;
+
+		// commands sent and not answered
+		std::size_t pending_;
+	};
+
+	void RedisClient::load(Context& context, const char *conf, Options& options)
+	{
+		char key[256];
+		snprintf(key, sizeof(key), "%s.host", conf);
+		options.host = context.config(key, "localhost");
+
+		snprintf(key, sizeof(key), "%s.port", conf);
+		options.port = (uint16_t)context.config(key, 6379);
+
+		snprintf(key, sizeof(key), "%s.password", conf);
+		options.password = context.config(key, "");
+
+		snprintf(key, sizeof(key), "%s.db", conf);
+		options.db = context.config(key, 0);
+
+		snprintf(key, sizeof(key), "%s.pool", conf);
+		options.connections = context.config(key, options.connections);
+
+		snprintf(key, sizeof(key), "%s.pipeline", conf);
+		options.pipeline = context.config(key, options.pipeline);
+
+		snprintf(key, sizeof(key), "%s.queue_limit", conf);
+		options.queue_limit = context.config(key, options.queue_limit);
+
+		snprintf(key, sizeof(key), "%s.command_timeout", conf);
+		options.timeout = context.config(key, options.timeout);
+
+		snprintf(key, sizeof(key), "%s.timeout", conf);
+		options.connect_timeout = context.config(key, options.connect_timeout);
+
+		snprintf(key, sizeof(key), "%s.reconnect_delay", conf);
+		options.reconnect_delay = context.config(key, options.reconnect_delay);
+	}
+
+	RedisClient::RedisClient(asio::io_service& io_service, Resolver& resolver,
+		const Options& options)
+		: io_service_(io_service)
+		, resolver_(resolver)
+		, options_(options)
+		, connections_()
+		, queue_()
+		, queue_timer_(io_service)
+		, queue_timer_armed_(false)
+		, closed_(false)
+		, ready_(0)
+		, queued_(0)
+		, in_flight_(0)
+		, completed_(0)
+		, failed_(0)
+		, timeouts_(0)
+	{
+		if (options_.connections < 1)
+			options_.connections = 1;
+
+		if (options_.pipeline < 1)
+			options_.pipeline = 1;
+	}
+
+	RedisClient::~RedisClient()
+	{
+		for (auto& connection : connections_)
+			connection->close();
+	}
+
+	void RedisClient::start()
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self]()
+		{
+			if (closed_ || !connections_.empty())
+				return;
+
+			for (int i = 0; i < options_.connections; i++)
+			{
+				connections_.push_back(std::make_shared<Connection>(*this));
+				connections_.back()->start();
+			}
+		});
+	}
+
+	void RedisClient::send(std::vector<std::string> commands, Handler handler)
+	{
+		Request request;
+		request.commands = std::move(commands);
+		request.count = request.commands.size();
+		request.handler = std::move(handler);
+
+		submit(request);
+	}
+
+	void RedisClient::send(Commands commands, std::vector<std::size_t> which, Handler handler)
+	{
+		Request request;
+		request.shared = std::move(commands);
+		request.which = std::move(which);
+		request.count = request.which.size();
+		request.handler = std::move(handler);
+
+		submit(request);
+	}
+
+	void RedisClient::submit(Request& request)
+	{
+		request.deadline = options_.timeout > 0
+			? Clock::now() + std::chrono::milliseconds(options_.timeout)
+			: Clock::time_point::max();
+
+		auto self = shared_from_this();
+		// moved, not copied: the buffers are what hiredis will send
+		asio::post(io_service_, [this, self, request = std::move(request)]() mutable
+		{
+			do_send(request);
+		});
+	}
+
+	void RedisClient::close()
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self]()
+		{
+			closed_ = true;
+
+			for (auto& connection : connections_)
+				connection->close();
+			connections_.clear();
+
+			queue_.clear();
+			queued_ = 0;
+			in_flight_ = 0;
+			ready_ = 0;
+
+			asio::error_code ec;
+			queue_timer_.cancel(ec);
+		});
+	}
+
+	RedisClient::Stats RedisClient::stats() const
+	{
+		Stats stats;
+		stats.connections = (std::size_t)options_.connections;
+		stats.ready = ready_;
+		stats.queued = queued_;
+		stats.in_flight = in_flight_;
+		stats.completed = completed_;
+		stats.failed = failed_;
+		stats.timeouts = timeouts_;
+		return stats;
+	}
+
+	void RedisClient::do_send(Request& request)
+	{
+		if (closed_)
+			return;
+
+		if (request.count == 0)
+		{
+			std::vector<redisReply*> replies;
+			complete(request, replies);
+			return;
+		}
+
+		for (std::size_t i = 0; i < request.count; i++)
+		{
+			if (is_subscription(request.command(i)))
+			{
+				fail(request, "ERR " + command_name(request.command(i)) + " is not supported on a shared connection");
+				return;
+			}
+		}
+
+		if (queue_.size() >= (std::size_t)options_.queue_limit)
+		{
+			fail(request, "ERR redis queue full");
+			return;
+		}
+
+		queue_.push_back(std::move(request));
+		queued_++;
+
+		dispatch();
+
+		if (!queue_.empty() && !queue_timer_armed_)
+			arm_queue_timer();
+	}
+
+	void RedisClient::dispatch()
+	{
+		while (!queue_.empty() && !closed_)
+		{
+			Connection *target = nullptr;
+
+			// a pipeline longer than the window still goes out, alone, on an
+			// idle connection
+			std::size_t size = std::min(queue_.front().count,
+				(std::size_t)options_.pipeline);
+
+			for (auto& connection : connections_)
+			{
+				if (!connection->ready()
+					|| connection->in_flight() + size > (std::size_t)options_.pipeline)
+					continue;
+
+				if (target == nullptr || connection->in_flight() < target->in_flight())
+					target = connection.get();
+			}
+
+			if (target == nullptr)
+				break;
+
+			Request request = std::move(queue_.front());
+			queue_.pop_front();
+			queued_--;
+
+			target->send(request);
+		}
+	}
+
+	void RedisClient::arm_queue_timer()
+	{
+		Clock::time_point deadline = queue_.front().deadline;
+		if (deadline == Clock::time_point::max())
+			return;
+
+		queue_timer_armed_ = true;
+		queue_timer_.expires_at(deadline);
+
+		auto self = shared_from_this();
+		queue_timer_.async_wait([this, self](const asio::error_code& ec)
+		{
+			if (ec == asio::error::operation_aborted)
+				return;
+
+			queue_timer_armed_ = false;
+
+			if (!closed_)
+				on_queue_timer();
+		});
+	}
+
+	void RedisClient::on_queue_timer()
+	{
+		Clock::time_point now = Clock::now();
+
+		while (!queue_.empty() && queue_.front().deadline <= now)
+		{
+			Request request = std::move(queue_.front());
+			queue_.pop_front();
+			queued_--;
+			timeouts_++;
+
+			fail(request, "ERR redis command timed out waiting for a connection");
+		}
+
+		if (!queue_.empty())
+			arm_queue_timer();
+	}
+
+	void RedisClient::complete(Request& request, std::vector<redisReply*>& replies)
+	{
+		bool ok = true;
+		for (auto reply : replies)
+		{
+			if (reply->type == REDIS_REPLY_ERROR)
+				ok = false;
+		}
+
+		if (ok)
+			completed_++;
+		else
+			failed_++;
+
+		if (request.handler)
+			request.handler(replies.data(), replies.size());
+		else
+		{
+			for (auto reply : replies)
+				freeReplyObject(reply);
+		}
+	}
+
+	void RedisClient::fail(Request& request, const std::string& message)
+	{
+		std::vector<redisReply*> replies;
+		for (std::size_t i = 0; i < request.count; i++)
+			replies.push_back(error_reply(message));
+
+		for (auto& command : request.commands)
+			RedisCommand::release(command);
+
+		complete(request, replies);
+	}
+}
+
+#endif
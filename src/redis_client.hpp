@@ -0,0 +1,179 @@
+#ifndef TENGINE_REDIS_CLIENT_HPP
+#define TENGINE_REDIS_CLIENT_HPP
+
+#include "asio.hpp"
+#include "asio/steady_timer.hpp"
+
+#include "allocator.hpp"
+
+#include "hiredis/hiredis.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Context;
+	class Resolver;
+
+	// redis client on an io_service through hiredis' async api, driven by
+	// an asio adapter instead of one of the event libraries hiredis ships
+	// adapters for. no thread is parked on a connection: commands from
+	// every caller are written back to back on a few connections, up to
+	// `pipeline` unanswered on each, and replies are matched in order.
+	// the rest wait in a bounded queue for the least loaded connection. a
+	// command that outlives its timeout takes its connection down with it.
+	class RedisClient :
+		public Allocator, public std::enable_shared_from_this<RedisClient>
+	{
+	public:
+		struct Options
+		{
+			std::string host = "localhost";
+			uint16_t port = 6379;
+			// AUTH and SELECT after connecting, when set
+			std::string password;
+			int db = 0;
+			int connections = 2;
+			// commands in flight per connection
+			int pipeline = 1024;
+			// commands waiting for a connection, beyond this they fail
+			int queue_limit = 100000;
+			// milliseconds from send() to the last reply, 0 waits forever
+			int timeout = 10000;
+			int connect_timeout = 10000;
+			// first retry after a lost connection, doubles up to 32x
+			int reconnect_delay = 1000;
+		};
+
+		// called on the io_service thread with one reply per command, in
+		// order. the handler owns them and frees them with freeReplyObject;
+		// a command the server never answered gets an error reply
+		typedef std::function<void(redisReply **replies, std::size_t count)> Handler;
+
+		struct Stats
+		{
+			std::size_t connections;
+			std::size_t ready;
+			std::size_t queued;
+			std::size_t in_flight;
+			uint64_t completed;
+			uint64_t failed;
+			uint64_t timeouts;
+		};
+
+		// host, port, password, db, pool, pipeline, queue_limit,
+		// command_timeout, timeout and reconnect_delay of a redis section
+		static void load(Context& context, const char *conf, Options& options);
+
+		// an error reply the caller owns, like the ones failures produce
+		static redisReply *error_reply(const std::string& message);
+
+		RedisClient(asio::io_service& io_service, Resolver& resolver,
+			const Options& options);
+
+		RedisClient(const RedisClient&) = delete;
+
+		RedisClient& operator=(const RedisClient&) = delete;
+
+		~RedisClient();
+
+		// the calls below may be made from any thread
+
+		void start();
+
+		// commands already in the wire format, see RedisCommand; they go out
+		// back to back on one connection and their buffers are released
+		// once hiredis has copied them
+		void send(std::vector<std::string> commands, Handler handler);
+
+		// commands the caller keeps, e.g. to send one again to another
+		// node: only those at `which` go out, in that order, and their
+		// buffers are left alone
+		typedef std::shared_ptr<std::vector<std::string>> Commands;
+
+		void send(Commands commands, std::vector<std::size_t> which, Handler handler);
+
+		// disconnect, commands not yet answered are dropped unanswered
+		void close();
+
+		Stats stats() const;
+
+	private:
+		class Connection;
+
+		friend class Connection;
+
+		typedef std::shared_ptr<Connection> ConnectionPtr;
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct Request
+		{
+			std::vector<std::string> commands;
+			// or these, borrowed
+			Commands shared;
+			std::vector<std::size_t> which;
+			// how many, owned buffers are gone once sent
+			std::size_t count;
+			Handler handler;
+			Clock::time_point deadline;
+
+			const std::string& command(std::size_t i) const
+			{
+				return shared ? (*shared)[which[i]] : commands[i];
+			}
+		};
+
+		void submit(Request& request);
+
+		void do_send(Request& request);
+
+		void dispatch();
+
+		void arm_queue_timer();
+
+		void on_queue_timer();
+
+		void complete(Request& request, std::vector<redisReply*>& replies);
+
+		void fail(Request& request, const std::string& message);
+
+		asio::io_service& io_service_;
+
+		Resolver& resolver_;
+
+		Options options_;
+
+		std::vector<ConnectionPtr> connections_;
+
+		std::deque<Request> queue_;
+
+		asio::steady_timer queue_timer_;
+
+		bool queue_timer_armed_;
+
+		bool closed_;
+
+		std::atomic<std::size_t> ready_;
+
+		std::atomic<std::size_t> queued_;
+
+		std::atomic<std::size_t> in_flight_;
+
+		std::atomic<uint64_t> completed_;
+
+		std::atomic<uint64_t> failed_;
+
+		std::atomic<uint64_t> timeouts_;
+	};
+}
+
+#endif
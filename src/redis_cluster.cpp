@@ -0,0 +1,691 @@
+#include "redis_cluster.hpp"
+
+#include "redis_command.hpp"
+
+#include "asio/ts/executor.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+
+// RedisClient's adapter waits on the socket through posix descriptors
+#if !defined(_WIN32)
+
+namespace tengine
+{
+	constexpr std::size_t RedisCluster::kSlots;
+
+	namespace
+	{
+		// crc16 xmodem, what the cluster spec hashes keys with
+		struct Crc16Table
+		{
+			uint16_t entries[256];
+
+			Crc16Table()
+			{
+				for (int i = 0; i < 256; i++)
+				{
+					uint16_t crc = (uint16_t)(i << 8);
+					for (int bit = 0; bit < 8; bit++)
+						crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+					entries[i] = crc;
+				}
+			}
+		};
+
+		uint16_t crc16(const char *data, std::size_t size)
+		{
+			static const Crc16Table table;
+
+			uint16_t crc = 0;
+			for (std::size_t i = 0; i < size; i++)
+				crc = (uint16_t)((crc << 8) ^ table.entries[((crc >> 8) ^ (uint8_t)data[i]) & 0xff]);
+			return crc;
+		}
+
+		bool equals(const RedisCommand::Arg& arg, const char *name)
+		{
+			std::size_t size = strlen(name);
+			if (arg.size != size)
+				return false;
+
+			for (std::size_t i = 0; i < size; i++)
+			{
+				if (tolower((unsigned char)arg.data[i]) != name[i])
+					return false;
+			}
+
+			return true;
+		}
+
+		bool is_error(redisReply *reply, const char *prefix)
+		{
+			std::size_t size = strlen(prefix);
+			return reply->type == REDIS_REPLY_ERROR
+				&& (std::size_t)reply->len > size
+				&& memcmp(reply->str, prefix, size) == 0;
+		}
+
+		// "host:port" at the end of a MOVED or ASK error
+		bool parse_target(redisReply *reply, uint16_t& slot, std::string& host, uint16_t& port)
+		{
+			std::string message(reply->str, reply->len);
+
+			std::size_t first = message.find(' ');
+			std::size_t second = message.find(' ', first + 1);
+			std::size_t colon = message.rfind(':');
+			if (first == std::string::npos || second == std::string::npos
+				|| colon == std::string::npos || colon < second)
+				return false;
+
+			slot = (uint16_t)(strtoul(message.c_str() + first + 1, nullptr, 10) % RedisCluster::kSlots);
+			host = message.substr(second + 1, colon - second - 1);
+			port = (uint16_t)strtoul(message.c_str() + colon + 1, nullptr, 10);
+			return !host.empty() && port != 0;
+		}
+
+		std::string node_key(const std::string& host, uint16_t port)
+		{
+			return host + ":" + std::to_string(port);
+		}
+
+		std::string encode(std::initializer_list<const char*> args)
+		{
+			std::string command = RedisCommand::acquire();
+			RedisCommand::begin(command, args.size());
+			for (auto arg : args)
+				RedisCommand::arg(command, arg, strlen(arg));
+			return command;
+		}
+
+		enum
+		{
+			// enough for every command below but XREAD's streams
+			kRouteArgs = 8,
+		};
+
+		// the argument whose slot picks the node, 0 when the command has
+		// no key and any node will do
+		std::size_t key_index(const std::string& command)
+		{
+			RedisCommand::Arg args[kRouteArgs];
+			std::size_t nargs = RedisCommand::parse(command, args, kRouteArgs);
+			if (nargs < 2)
+				return 0;
+
+			const RedisCommand::Arg& name = args[0];
+
+			static const char *keyless[] = {
+				"ping", "echo", "info", "time", "dbsize", "flushall", "flushdb",
+				"randomkey", "scan", "keys", "config", "client", "cluster",
+				"script", "auth", "select", "multi", "exec", "discard", "unwatch",
+				"readonly", "readwrite", "wait", "lastsave", "save", "bgsave",
+				"bgrewriteaof", "slowlog", "command", "publish", "pubsub",
+				"function",
+			};
+
+			for (auto keyless_name : keyless)
+			{
+				if (equals(name, keyless_name))
+					return 0;
+			}
+
+			if (equals(name, "eval") || equals(name, "evalsha")
+				|| equals(name, "eval_ro") || equals(name, "evalsha_ro")
+				|| equals(name, "fcall") || equals(name, "fcall_ro"))
+			{
+				if (nargs < 4 || strtol(args[2].data, nullptr, 10) <= 0)
+					return 0;
+				return 3;
+			}
+
+			if (equals(name, "object") || equals(name, "memory") || equals(name, "bitop")
+				|| equals(name, "xgroup") || equals(name, "xinfo"))
+				return nargs > 2 ? 2 : 0;
+
+			if (equals(name, "xread") || equals(name, "xreadgroup"))
+			{
+				std::vector<RedisCommand::Arg> all(nargs);
+				RedisCommand::parse(command, all.data(), nargs);
+
+				for (std::size_t i = 1; i + 1 < nargs; i++)
+				{
+					if (equals(all[i], "streams"))
+						return i + 1;
+				}
+				return 0;
+			}
+
+			return 1;
+		}
+	}
+
+	struct RedisCluster::Batch
+	{
+		RedisClient::Commands commands;
+
+		Handler handler;
+
+		std::vector<redisReply*> replies;
+
+		// per command, a transaction counts them on the first
+		std::vector<int> redirects;
+
+		std::size_t pending;
+
+		bool transaction;
+	};
+
+	uint16_t RedisCluster::slot(const char *key, std::size_t size)
+	{
+		const char *open = (const char*)memchr(key, '{', size);
+		if (open != nullptr)
+		{
+			const char *begin = open + 1;
+			const char *close = (const char*)memchr(begin, '}', key + size - begin);
+
+			// "{}" hashes the whole key
+			if (close != nullptr && close > begin)
+				return (uint16_t)(crc16(begin, close - begin) % kSlots);
+		}
+
+		return (uint16_t)(crc16(key, size) % kSlots);
+	}
+
+	RedisCluster::RedisCluster(asio::io_service& io_service, Resolver& resolver,
+		const Options& options)
+		: io_service_(io_service)
+		, resolver_(resolver)
+		, options_(options)
+		, nodes_()
+		, seeds_()
+		, slots_(kSlots, nullptr)
+		, retired_()
+		, timer_(io_service)
+		, refreshing_(false)
+		, stale_(false)
+		, rotation_(0)
+		, closed_(false)
+	{
+		if (options_.max_redirects < 0)
+			options_.max_redirects = 0;
+	}
+
+	RedisCluster::~RedisCluster()
+	{
+		for (auto& node : nodes_)
+			node.second->close();
+
+		for (auto& retired : retired_)
+			retired.second->close();
+	}
+
+	bool RedisCluster::start()
+	{
+		std::vector<std::pair<std::string, uint16_t>> seeds;
+
+		const std::string& list = options_.seeds;
+		std::size_t begin = 0;
+		while (begin < list.size())
+		{
+			std::size_t end = list.find(',', begin);
+			if (end == std::string::npos)
+				end = list.size();
+
+			std::string item = list.substr(begin, end - begin);
+			item.erase(0, item.find_first_not_of(" \t"));
+			item.erase(item.find_last_not_of(" \t") + 1);
+
+			if (!item.empty())
+			{
+				std::size_t colon = item.rfind(':');
+				if (colon == std::string::npos)
+					seeds.push_back(std::make_pair(item, (uint16_t)6379));
+				else
+					seeds.push_back(std::make_pair(item.substr(0, colon),
+						(uint16_t)atoi(item.c_str() + colon + 1)));
+			}
+
+			begin = end + 1;
+		}
+
+		if (seeds.empty())
+			return false;
+
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self, seeds]()
+		{
+			if (closed_ || !seeds_.empty())
+				return;
+
+			for (auto& seed : seeds)
+			{
+				node(seed.first, seed.second);
+				seeds_.push_back(node_key(seed.first, seed.second));
+			}
+
+			refresh();
+		});
+
+		return true;
+	}
+
+	void RedisCluster::send(std::vector<std::string> commands, Handler handler)
+	{
+		BatchPtr batch = std::make_shared<Batch>();
+		batch->commands = std::make_shared<std::vector<std::string>>(std::move(commands));
+		batch->handler = std::move(handler);
+
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self, batch]()
+		{
+			do_send(batch);
+		});
+	}
+
+	void RedisCluster::close()
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self]()
+		{
+			closed_ = true;
+
+			asio::error_code ec;
+			timer_.cancel(ec);
+
+			for (auto& node : nodes_)
+				node.second->close();
+			nodes_.clear();
+
+			for (auto& retired : retired_)
+				retired.second->close();
+			retired_.clear();
+
+			std::fill(slots_.begin(), slots_.end(), nullptr);
+		});
+	}
+
+	void RedisCluster::do_send(const BatchPtr& batch)
+	{
+		if (closed_)
+			return;
+
+		const std::vector<std::string>& commands = *batch->commands;
+		std::size_t count = commands.size();
+
+		batch->replies.assign(count, nullptr);
+		batch->redirects.assign(count, 0);
+		batch->pending = count;
+
+		if (count == 0)
+		{
+			finish(batch);
+			return;
+		}
+
+		RedisCommand::Arg first;
+		batch->transaction = count >= 2
+			&& RedisCommand::parse(commands.front(), &first, 1) == 1
+			&& equals(first, "multi");
+
+		if (batch->transaction)
+		{
+			RedisClient *target = nullptr;
+			for (std::size_t i = 1; i + 1 < count && target == nullptr; i++)
+			{
+				if (key_index(commands[i]) != 0)
+					target = route(commands[i]);
+			}
+
+			send_transaction(batch, target ? target : any());
+			return;
+		}
+
+		std::vector<std::pair<RedisClient*, std::vector<std::size_t>>> groups;
+		for (std::size_t i = 0; i < count; i++)
+		{
+			RedisClient *target = route(commands[i]);
+
+			auto group = std::find_if(groups.begin(), groups.end(),
+				[target](const std::pair<RedisClient*, std::vector<std::size_t>>& g)
+			{
+				return g.first == target;
+			});
+
+			if (group == groups.end())
+			{
+				groups.push_back(std::make_pair(target, std::vector<std::size_t>()));
+				group = groups.end() - 1;
+			}
+
+			group->second.push_back(i);
+		}
+
+		for (auto& group : groups)
+			send_to(batch, group.first, std::move(group.second));
+	}
+
+	void RedisCluster::send_transaction(const BatchPtr& batch, RedisClient *target)
+	{
+		std::vector<std::size_t> which(batch->commands->size());
+		for (std::size_t i = 0; i < which.size(); i++)
+			which[i] = i;
+
+		auto self = shared_from_this();
+		target->send(batch->commands, std::move(which),
+			[this, self, batch](redisReply **replies, std::size_t count)
+		{
+			// a queued command refused with MOVED sends the whole
+			// transaction after its slot
+			for (std::size_t i = 0; i < count && !closed_; i++)
+			{
+				uint16_t slot;
+				std::string host;
+				uint16_t port;
+
+				if (!is_error(replies[i], "MOVED ")
+					|| batch->redirects[0] >= options_.max_redirects
+					|| !parse_target(replies[i], slot, host, port))
+					continue;
+
+				batch->redirects[0]++;
+
+				RedisClient *moved = node(host, port);
+				slots_[slot] = moved;
+				refresh();
+
+				for (std::size_t j = 0; j < count; j++)
+					freeReplyObject(replies[j]);
+
+				send_transaction(batch, moved);
+				return;
+			}
+
+			for (std::size_t i = 0; i < count; i++)
+				batch->replies[i] = replies[i];
+			batch->pending = 0;
+
+			finish(batch);
+		});
+	}
+
+	void RedisCluster::send_to(const BatchPtr& batch, RedisClient *target, std::vector<std::size_t> which)
+	{
+		auto self = shared_from_this();
+		target->send(batch->commands, which,
+			[this, self, batch, which](redisReply **replies, std::size_t count)
+		{
+			for (std::size_t k = 0; k < count; k++)
+			{
+				std::size_t index = which[k];
+
+				if (redirect(batch, index, replies[k]))
+				{
+					freeReplyObject(replies[k]);
+					continue;
+				}
+
+				batch->replies[index] = replies[k];
+				batch->pending--;
+			}
+
+			if (batch->pending == 0)
+				finish(batch);
+		});
+	}
+
+	bool RedisCluster::redirect(const BatchPtr& batch, std::size_t index, redisReply *reply)
+	{
+		if (closed_)
+			return false;
+
+		bool moved = is_error(reply, "MOVED ");
+		bool ask = !moved && is_error(reply, "ASK ");
+		if (!moved && !ask)
+			return false;
+
+		uint16_t slot;
+		std::string host;
+		uint16_t port;
+		if (batch->redirects[index] >= options_.max_redirects
+			|| !parse_target(reply, slot, host, port))
+			return false;
+
+		batch->redirects[index]++;
+
+		RedisClient *target = node(host, port);
+
+		if (moved)
+		{
+			slots_[slot] = target;
+			refresh();
+
+			send_to(batch, target, std::vector<std::size_t>(1, index));
+			return true;
+		}
+
+		// the slot is migrating: just this command goes to the importing
+		// node, after ASKING on the same connection
+		std::vector<std::string> commands;
+		commands.push_back(encode({ "ASKING" }));
+		commands.push_back((*batch->commands)[index]);
+
+		auto self = shared_from_this();
+		target->send(std::move(commands),
+			[this, self, batch, index](redisReply **replies, std::size_t /*count*/)
+		{
+			// one reply per command is guaranteed: ASKING, then ours
+			freeReplyObject(replies[0]);
+
+			if (redirect(batch, index, replies[1]))
+			{
+				freeReplyObject(replies[1]);
+				return;
+			}
+
+			batch->replies[index] = replies[1];
+			batch->pending--;
+
+			if (batch->pending == 0)
+				finish(batch);
+		});
+
+		return true;
+	}
+
+	void RedisCluster::finish(const BatchPtr& batch)
+	{
+		for (auto& command : *batch->commands)
+			RedisCommand::release(command);
+
+		if (batch->handler)
+			batch->handler(batch->replies.data(), batch->replies.size());
+		else
+		{
+			for (auto reply : batch->replies)
+				freeReplyObject(reply);
+		}
+	}
+
+	RedisClient* RedisCluster::route(const std::string& command)
+	{
+		std::size_t index = key_index(command);
+		if (index == 0)
+			return any();
+
+		std::vector<RedisCommand::Arg> args(index + 1);
+		if (RedisCommand::parse(command, args.data(), index + 1) <= index)
+			return any();
+
+		RedisClient *owner = slots_[slot(args[index].data, args[index].size)];
+		return owner ? owner : any();
+	}
+
+	RedisClient* RedisCluster::node(const std::string& host, uint16_t port)
+	{
+		std::string key = node_key(host, port);
+
+		auto it = nodes_.find(key);
+		if (it != nodes_.end())
+			return it->second.get();
+
+		RedisClient::Options options = options_.node;
+		options.host = host;
+		options.port = port;
+
+		Node client = std::make_shared<RedisClient>(io_service_, resolver_, options);
+		client->start();
+
+		nodes_[key] = client;
+		return client.get();
+	}
+
+	// keyless commands take turns over the seeds, which are never retired
+	RedisClient* RedisCluster::any()
+	{
+		const std::string& key = seeds_[rotation_++ % seeds_.size()];
+		return nodes_[key].get();
+	}
+
+	void RedisCluster::refresh()
+	{
+		if (closed_)
+			return;
+
+		if (refreshing_)
+		{
+			stale_ = true;
+			return;
+		}
+
+		refreshing_ = true;
+		stale_ = false;
+
+		// the seeds in turn, then whatever the last map named
+		std::vector<std::string> candidates = seeds_;
+		for (auto& node : nodes_)
+		{
+			if (std::find(seeds_.begin(), seeds_.end(), node.first) == seeds_.end())
+				candidates.push_back(node.first);
+		}
+
+		const std::string& key = candidates[rotation_++ % candidates.size()];
+		RedisClient *target = nodes_[key].get();
+		std::string host = key.substr(0, key.rfind(':'));
+
+		std::vector<std::string> commands;
+		commands.push_back(encode({ "CLUSTER", "SLOTS" }));
+
+		auto self = shared_from_this();
+		target->send(std::move(commands),
+			[this, self, host](redisReply **replies, std::size_t /*count*/)
+		{
+			// always exactly one, an error reply when the node never answered
+			refreshing_ = false;
+
+			bool ok = replies[0]->type == REDIS_REPLY_ARRAY;
+			if (ok && !closed_)
+				apply(replies[0], host);
+			else if (!ok)
+				fprintf(stderr, "redis cluster: CLUSTER SLOTS on %s failed: %.*s\n", host.c_str(),
+					replies[0]->type == REDIS_REPLY_ERROR ? replies[0]->len : 0,
+					replies[0]->type == REDIS_REPLY_ERROR ? replies[0]->str : "");
+
+			freeReplyObject(replies[0]);
+
+			if (closed_)
+				return;
+
+			// another node soon after a failure, the next refresh on time
+			if (stale_ || !ok)
+				arm_timer(stale_ ? 100 : 1000);
+			else if (options_.refresh_interval > 0)
+				arm_timer(options_.refresh_interval);
+		});
+	}
+
+	void RedisCluster::apply(redisReply *reply, const std::string& host)
+	{
+		std::vector<RedisClient*> slots(kSlots, nullptr);
+		std::unordered_set<std::string> masters;
+
+		for (std::size_t i = 0; i < reply->elements; i++)
+		{
+			redisReply *range = reply->element[i];
+			if (range->type != REDIS_REPLY_ARRAY || range->elements < 3
+				|| range->element[0]->type != REDIS_REPLY_INTEGER
+				|| range->element[1]->type != REDIS_REPLY_INTEGER)
+				continue;
+
+			redisReply *master = range->element[2];
+			if (master->type != REDIS_REPLY_ARRAY || master->elements < 2
+				|| master->element[0]->type != REDIS_REPLY_STRING
+				|| master->element[1]->type != REDIS_REPLY_INTEGER)
+				continue;
+
+			// an empty address is the node that answered
+			std::string address(master->element[0]->str, master->element[0]->len);
+			if (address.empty())
+				address = host;
+
+			uint16_t port = (uint16_t)master->element[1]->integer;
+			RedisClient *owner = node(address, port);
+			masters.insert(node_key(address, port));
+
+			long long first = std::max(0LL, range->element[0]->integer);
+			long long last = std::min((long long)kSlots - 1, range->element[1]->integer);
+			for (long long slot = first; slot <= last; slot++)
+				slots[(std::size_t)slot] = owner;
+		}
+
+		slots_.swap(slots);
+
+		Clock::time_point now = Clock::now();
+
+		for (auto it = nodes_.begin(); it != nodes_.end();)
+		{
+			bool seed = std::find(seeds_.begin(), seeds_.end(), it->first) != seeds_.end();
+			if (seed || masters.count(it->first) != 0)
+			{
+				++it;
+				continue;
+			}
+
+			retired_.push_back(std::make_pair(now, it->second));
+			it = nodes_.erase(it);
+		}
+
+		// commands routed before the map changed finish on the old node
+		for (auto it = retired_.begin(); it != retired_.end();)
+		{
+			RedisClient::Stats stats = it->second->stats();
+			if (now - it->first < std::chrono::seconds(10) || stats.in_flight + stats.queued > 0)
+			{
+				++it;
+				continue;
+			}
+
+			it->second->close();
+			it = retired_.erase(it);
+		}
+	}
+
+	void RedisCluster::arm_timer(int delay)
+	{
+		timer_.expires_from_now(std::chrono::milliseconds(delay));
+
+		auto self = shared_from_this();
+		timer_.async_wait([this, self](const asio::error_code& ec)
+		{
+			if (ec == asio::error::operation_aborted || closed_)
+				return;
+
+			refresh();
+		});
+	}
+}
+
+#endif
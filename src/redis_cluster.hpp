@@ -0,0 +1,137 @@
+#ifndef TENGINE_REDIS_CLUSTER_HPP
+#define TENGINE_REDIS_CLUSTER_HPP
+
+#include "asio.hpp"
+#include "asio/steady_timer.hpp"
+
+#include "allocator.hpp"
+#include "redis_client.hpp"
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+namespace tengine
+{
+	class Resolver;
+
+	// redis cluster on top of one RedisClient per master. commands go to
+	// the master of their key's hash slot, a batch is split per node and
+	// the parts run in parallel, replies come back in the batch's order.
+	// MOVED updates the slot and sends the command again, ASK sends it
+	// once to the importing node behind ASKING; both refresh the slot map
+	// with CLUSTER SLOTS, as does a timer. a batch opening with MULTI is a
+	// transaction and goes whole to the node of its first key.
+	class RedisCluster :
+		public Allocator, public std::enable_shared_from_this<RedisCluster>
+	{
+	public:
+		static constexpr std::size_t kSlots = 16384;
+
+		struct Options
+		{
+			// "host:port, ..." to learn the topology from
+			std::string seeds;
+			// host and port are ignored, the rest is used for every node
+			RedisClient::Options node;
+			// redirects followed per command before its error is returned
+			int max_redirects = 5;
+			// milliseconds between slot map refreshes, 0 only on redirects
+			int refresh_interval = 60000;
+		};
+
+		typedef RedisClient::Handler Handler;
+
+		// crc16 of the key, or of its {hash tag} when it has one
+		static uint16_t slot(const char *key, std::size_t size);
+
+		RedisCluster(asio::io_service& io_service, Resolver& resolver,
+			const Options& options);
+
+		RedisCluster(const RedisCluster&) = delete;
+
+		RedisCluster& operator=(const RedisCluster&) = delete;
+
+		~RedisCluster();
+
+		// the calls below may be made from any thread
+
+		// false when no seed could be parsed
+		bool start();
+
+		// see RedisClient::send
+		void send(std::vector<std::string> commands, Handler handler);
+
+		void close();
+
+	private:
+		typedef std::shared_ptr<RedisClient> Node;
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct Batch;
+
+		typedef std::shared_ptr<Batch> BatchPtr;
+
+		void do_send(const BatchPtr& batch);
+
+		void send_transaction(const BatchPtr& batch, RedisClient *node);
+
+		void send_to(const BatchPtr& batch, RedisClient *node, std::vector<std::size_t> which);
+
+		// true when the reply sent the command elsewhere
+		bool redirect(const BatchPtr& batch, std::size_t index, redisReply *reply);
+
+		void finish(const BatchPtr& batch);
+
+		// the node owning the command's slot, any node for keyless ones
+		RedisClient* route(const std::string& command);
+
+		RedisClient* node(const std::string& host, uint16_t port);
+
+		RedisClient* any();
+
+		void refresh();
+
+		void apply(redisReply *reply, const std::string& host);
+
+		void arm_timer(int delay);
+
+		asio::io_service& io_service_;
+
+		Resolver& resolver_;
+
+		Options options_;
+
+		// "host:port" to its client, seeds included
+		std::unordered_map<std::string, Node> nodes_;
+
+		std::vector<std::string> seeds_;
+
+		// the master of each slot, owned by nodes_; null until the first
+		// refresh or MOVED
+		std::vector<RedisClient*> slots_;
+
+		// dropped from the topology, closed once they had time to drain
+		std::list<std::pair<Clock::time_point, Node>> retired_;
+
+		asio::steady_timer timer_;
+
+		bool refreshing_;
+
+		// a redirect asked for a refresh while one was running
+		bool stale_;
+
+		// which seed or node the next refresh asks
+		std::size_t rotation_;
+
+		bool closed_;
+	};
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include "redis_command.hpp"
+
+#include "spin_lock.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace tengine
+{
+	namespace
+	{
+		enum
+		{
+			// buffers kept for reuse
+			kPoolSize = 256,
+			// a buffer grown past this by one large value is not kept
+			kMaxPooledCapacity = 64 * 1024,
+		};
+
+		struct Pool
+		{
+			SpinLock lock;
+
+			std::vector<std::string> buffers;
+		};
+
+		Pool& pool()
+		{
+			static Pool instance;
+			return instance;
+		}
+
+		void append_header(std::string& buffer, char type, std::size_t value)
+		{
+			char digits[24];
+			char *end = digits + sizeof(digits);
+			char *p = end;
+
+			do
+			{
+				*--p = (char)('0' + value % 10);
+				value /= 10;
+			} while (value != 0);
+
+			buffer.push_back(type);
+			buffer.append(p, end - p);
+			buffer.append("\r\n", 2);
+		}
+	}
+
+	std::string RedisCommand::acquire()
+	{
+		Pool& p = pool();
+
+		SpinHolder holder(p.lock);
+		if (p.buffers.empty())
+			return std::string();
+
+		std::string buffer = std::move(p.buffers.back());
+		p.buffers.pop_back();
+		return buffer;
+	}
+
+	void RedisCommand::release(std::string& buffer)
+	{
+		if (buffer.capacity() > kMaxPooledCapacity)
+		{
+			std::string().swap(buffer);
+			return;
+		}
+
+		buffer.clear();
+
+		Pool& p = pool();
+
+		SpinHolder holder(p.lock);
+		if (p.buffers.size() < kPoolSize)
+			p.buffers.push_back(std::move(buffer));
+	}
+
+	void RedisCommand::begin(std::string& buffer, std::size_t nargs)
+	{
+		append_header(buffer, '*', nargs);
+	}
+
+	void RedisCommand::arg(std::string& buffer, const char *data, std::size_t size)
+	{
+		append_header(buffer, '$', size);
+		buffer.append(data, size);
+		buffer.append("\r\n", 2);
+	}
+
+	bool RedisCommand::line(std::string& buffer, const char *data, std::size_t size)
+	{
+		std::size_t nargs = 0;
+		for (std::size_t i = 0; i < size; i++)
+		{
+			if (data[i] != ' ' && (i == 0 || data[i - 1] == ' '))
+				nargs++;
+		}
+
+		if (nargs == 0)
+			return false;
+
+		begin(buffer, nargs);
+
+		std::size_t start = 0;
+		for (std::size_t i = 0; i <= size; i++)
+		{
+			if (i < size && data[i] != ' ')
+				continue;
+
+			if (i > start)
+				arg(buffer, data + start, i - start);
+
+			start = i + 1;
+		}
+
+		return true;
+	}
+
+	std::size_t RedisCommand::parse(const std::string& command, Arg *args, std::size_t max)
+	{
+		const char *p = command.data();
+		const char *end = p + command.size();
+
+		if (p == end || *p != '*')
+			return 0;
+
+		std::size_t nargs = (std::size_t)strtoul(p + 1, nullptr, 10);
+		p = (const char*)memchr(p, '\n', end - p);
+
+		for (std::size_t i = 0; i < nargs && i < max; i++)
+		{
+			if (p == nullptr || ++p >= end || *p != '$')
+				return i;
+
+			std::size_t size = (std::size_t)strtoul(p + 1, nullptr, 10);
+			p = (const char*)memchr(p, '\n', end - p);
+			if (p == nullptr || (std::size_t)(end - p - 1) < size + 2)
+				return i;
+
+			args[i].data = p + 1;
+			args[i].size = size;
+
+			p += 1 + size + 1;
+		}
+
+		return nargs;
+	}
+}
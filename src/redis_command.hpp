@@ -0,0 +1,43 @@
+#ifndef TENGINE_REDIS_COMMAND_HPP
+#define TENGINE_REDIS_COMMAND_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace tengine
+{
+	// writes commands in the RESP wire format straight into a buffer, so
+	// each argument is copied once, from the caller into the bytes hiredis
+	// sends. buffers come from a process-wide free list and go back to it
+	// once hiredis has taken their bytes, keeping their capacity.
+	class RedisCommand
+	{
+	public:
+		struct Arg
+		{
+			const char *data;
+			std::size_t size;
+		};
+
+		// an empty buffer, with the capacity of one released earlier
+		static std::string acquire();
+
+		// may be called from any thread
+		static void release(std::string& buffer);
+
+		// "*nargs\r\n", followed by exactly nargs calls to arg()
+		static void begin(std::string& buffer, std::size_t nargs);
+
+		static void arg(std::string& buffer, const char *data, std::size_t size);
+
+		// a command line split on spaces like redisCommand does, without
+		// reading it as a format; false when it holds no argument
+		static bool line(std::string& buffer, const char *data, std::size_t size);
+
+		// points args at the first max arguments of an encoded command,
+		// returns how many there are in all
+		static std::size_t parse(const std::string& command, Arg *args, std::size_t max);
+	};
+}
+
+#endif
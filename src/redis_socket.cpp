@@ -0,0 +1,227 @@
+#include "redis_socket.hpp"
+
+#if !defined(_WIN32)
+
+namespace tengine
+{
+	RedisSocket::RedisSocket(asio::io_service& io_service)
+		: descriptor_(io_service)
+		, context_(nullptr)
+		, on_connect_()
+		, on_disconnect_()
+		, generation_(0)
+		, want_read_(false)
+		, want_write_(false)
+		, reading_(false)
+		, writing_(false)
+	{
+
+	}
+
+	RedisSocket::~RedisSocket()
+	{
+		close();
+	}
+
+	bool RedisSocket::connect(const asio::ip::address& address, uint16_t port,
+		ConnectHandler on_connect, DisconnectHandler on_disconnect, std::string& error)
+	{
+		close();
+
+		redisAsyncContext *context = redisAsyncConnect(address.to_string().c_str(), port);
+		if (context == nullptr)
+		{
+			error = "out of memory";
+			return false;
+		}
+
+		if (context->err)
+		{
+			error = context->errstr;
+			redisAsyncFree(context);
+			return false;
+		}
+
+		asio::error_code ec;
+		descriptor_.assign(context->c.fd, ec);
+		if (ec)
+		{
+			redisAsyncFree(context);
+			error = ec.message();
+			return false;
+		}
+
+		context_ = context;
+		on_connect_ = std::move(on_connect);
+		on_disconnect_ = std::move(on_disconnect);
+		generation_++;
+
+		context->data = this;
+		context->ev.data = this;
+		context->ev.addRead = &RedisSocket::add_read;
+		context->ev.delRead = &RedisSocket::del_read;
+		context->ev.addWrite = &RedisSocket::add_write;
+		context->ev.delWrite = &RedisSocket::del_write;
+		context->ev.cleanup = &RedisSocket::cleanup;
+
+		redisAsyncSetDisconnectCallback(context, &RedisSocket::on_disconnect);
+		// waits for the socket to become writable, which is when the non
+		// blocking connect finished one way or the other
+		redisAsyncSetConnectCallback(context, &RedisSocket::on_connect);
+
+		return true;
+	}
+
+	void RedisSocket::close()
+	{
+		if (context_ == nullptr)
+			return;
+
+		redisAsyncContext *context = context_;
+		release();
+
+		// the callbacks of commands still pending find no socket
+		context->data = nullptr;
+		context_ = nullptr;
+		redisAsyncFree(context);
+	}
+
+	void RedisSocket::on_connect(const redisAsyncContext *context, int status)
+	{
+		RedisSocket *self = (RedisSocket*)context->data;
+		if (self == nullptr)
+			return;
+
+		ConnectHandler handler = self->on_connect_;
+
+		if (status != REDIS_OK)
+		{
+			// hiredis frees the context when this returns
+			std::string error = context->errstr;
+			self->detach();
+			handler(error);
+			return;
+		}
+
+		handler(std::string());
+	}
+
+	void RedisSocket::on_disconnect(const redisAsyncContext *context, int status)
+	{
+		RedisSocket *self = (RedisSocket*)context->data;
+		if (self == nullptr)
+			return;
+
+		std::string error = status == REDIS_OK ? std::string() : std::string(context->errstr);
+
+		DisconnectHandler handler = self->on_disconnect_;
+		self->detach();
+		handler(error);
+	}
+
+	void RedisSocket::add_read(void *data)
+	{
+		RedisSocket *self = (RedisSocket*)data;
+		self->want_read_ = true;
+		self->wait_read();
+	}
+
+	void RedisSocket::del_read(void *data)
+	{
+		((RedisSocket*)data)->want_read_ = false;
+	}
+
+	void RedisSocket::add_write(void *data)
+	{
+		RedisSocket *self = (RedisSocket*)data;
+		self->want_write_ = true;
+		self->wait_write();
+	}
+
+	void RedisSocket::del_write(void *data)
+	{
+		((RedisSocket*)data)->want_write_ = false;
+	}
+
+	void RedisSocket::cleanup(void *data)
+	{
+		((RedisSocket*)data)->release();
+	}
+
+	// an empty wait queue makes asio re-arm the socket with epoll_ctl,
+	// which reports readiness that arrived before the wait was queued
+	void RedisSocket::wait_read()
+	{
+		if (reading_)
+			return;
+
+		reading_ = true;
+
+		auto self = shared_from_this();
+		uint64_t generation = generation_;
+		descriptor_.async_wait(asio::posix::stream_descriptor::wait_read,
+			[this, self, generation](const asio::error_code& ec)
+		{
+			if (generation != generation_)
+				return;
+
+			reading_ = false;
+
+			if (ec || context_ == nullptr || !want_read_)
+				return;
+
+			redisAsyncHandleRead(context_);
+		});
+	}
+
+	void RedisSocket::wait_write()
+	{
+		if (writing_)
+			return;
+
+		writing_ = true;
+
+		auto self = shared_from_this();
+		uint64_t generation = generation_;
+		descriptor_.async_wait(asio::posix::stream_descriptor::wait_write,
+			[this, self, generation](const asio::error_code& ec)
+		{
+			if (generation != generation_)
+				return;
+
+			writing_ = false;
+
+			if (ec || context_ == nullptr || !want_write_)
+				return;
+
+			redisAsyncHandleWrite(context_);
+		});
+	}
+
+	void RedisSocket::release()
+	{
+		if (!descriptor_.is_open())
+			return;
+
+		asio::error_code ec;
+		descriptor_.cancel(ec);
+		descriptor_.release();
+
+		// waits still queued are stale whatever they report
+		generation_++;
+		reading_ = false;
+		writing_ = false;
+		want_read_ = false;
+		want_write_ = false;
+	}
+
+	void RedisSocket::detach()
+	{
+		release();
+
+		context_->data = nullptr;
+		context_ = nullptr;
+	}
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef TENGINE_REDIS_SOCKET_HPP
+#define TENGINE_REDIS_SOCKET_HPP
+
+#include "asio.hpp"
+
+#include "allocator.hpp"
+
+#include "hiredis/async.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <stdint.h>
+
+// the adapter waits on the socket through posix descriptors
+#if !defined(_WIN32)
+
+namespace tengine
+{
+	// one redisAsyncContext on an io_service. hiredis asks for read and
+	// write readiness through the ev hooks, which become async_waits on
+	// the socket; the descriptor is released before hiredis closes it.
+	// context->data is ours, commands pass their owner as privdata.
+	class RedisSocket :
+		public Allocator, public std::enable_shared_from_this<RedisSocket>
+	{
+	public:
+		// an empty error once connected, else hiredis' reason
+		typedef std::function<void(const std::string& error)> ConnectHandler;
+
+		// an empty error when the server closed the connection
+		typedef std::function<void(const std::string& error)> DisconnectHandler;
+
+		explicit RedisSocket(asio::io_service& io_service);
+
+		RedisSocket(const RedisSocket&) = delete;
+
+		RedisSocket& operator=(const RedisSocket&) = delete;
+
+		~RedisSocket();
+
+		// a non blocking connect, on_connect runs once it finished. false
+		// with the reason in error when it failed right away. the handlers
+		// run inside hiredis callbacks on the io_service thread
+		bool connect(const asio::ip::address& address, uint16_t port,
+			ConnectHandler on_connect, DisconnectHandler on_disconnect, std::string& error);
+
+		// null while not connected
+		redisAsyncContext* context() const { return context_; }
+
+		// frees the context, commands still pending get a null reply and
+		// neither handler runs. connect() may be called again afterwards
+		void close();
+
+	private:
+		static void on_connect(const redisAsyncContext *context, int status);
+
+		static void on_disconnect(const redisAsyncContext *context, int status);
+
+		static void add_read(void *data);
+
+		static void del_read(void *data);
+
+		static void add_write(void *data);
+
+		static void del_write(void *data);
+
+		static void cleanup(void *data);
+
+		void wait_read();
+
+		void wait_write();
+
+		// the fd belongs to hiredis, which closes it
+		void release();
+
+		// hiredis is freeing the context itself
+		void detach();
+
+		asio::posix::stream_descriptor descriptor_;
+
+		redisAsyncContext *context_;
+
+		ConnectHandler on_connect_;
+
+		DisconnectHandler on_disconnect_;
+
+		// bumped whenever the descriptor is released, so waits queued on
+		// an earlier socket are ignored
+		uint64_t generation_;
+
+		bool want_read_;
+
+		bool want_write_;
+
+		bool reading_;
+
+		bool writing_;
+	};
+}
+
+#endif
+
+#endif
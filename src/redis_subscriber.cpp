@@ -0,0 +1,629 @@
+#include "redis_subscriber.hpp"
+
+#include "context.hpp"
+#include "resolver.hpp"
+#include "redis_socket.hpp"
+
+#include "asio/ts/executor.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// see RedisSocket
+#if !defined(_WIN32)
+
+namespace tengine
+{
+	namespace
+	{
+		bool is_string(const redisReply *reply)
+		{
+			return reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_STATUS;
+		}
+
+		std::string to_string(const redisReply *reply)
+		{
+			return is_string(reply) ? std::string(reply->str, reply->len) : std::string();
+		}
+
+		// where CLIENT TRACKING ... REDIRECT sends invalidations to a RESP2
+		// connection
+		const char kInvalidateChannel[] = "__redis__:invalidate";
+	}
+
+	void RedisSubscriber::load(Context& context, const char *conf, Options& options)
+	{
+		RedisClient::load(context, conf, options.server);
+
+		char key[256];
+		snprintf(key, sizeof(key), "%s.cluster", conf);
+
+		std::string seeds = context.config(key, "");
+		if (!seeds.empty())
+		{
+			std::string seed = seeds.substr(0, seeds.find(','));
+			seed.erase(0, seed.find_first_not_of(" \t"));
+			seed.erase(seed.find_last_not_of(" \t") + 1);
+
+			std::size_t colon = seed.rfind(':');
+			options.server.host = seed.substr(0, colon);
+			options.server.port = colon == std::string::npos
+				? (uint16_t)6379 : (uint16_t)atoi(seed.c_str() + colon + 1);
+		}
+
+		snprintf(key, sizeof(key), "%s.notify_keyspace_events", conf);
+		options.notify_keyspace_events = context.config(key, "");
+	}
+
+	RedisSubscriber::RedisSubscriber(asio::io_service& io_service, Resolver& resolver,
+		const Options& options)
+		: io_service_(io_service)
+		, resolver_(resolver)
+		, options_(options)
+		, socket_(std::make_shared<RedisSocket>(io_service))
+		, timer_(io_service)
+		, state_(kDisconnected)
+		, attempts_(0)
+		, setup_(0)
+		, next_id_(0)
+		, subscriptions_()
+		, channels_()
+		, patterns_()
+		, leaving_channels_()
+		, leaving_patterns_()
+		, tracked_()
+		, invalidator_()
+		, tracking_(false)
+	{
+
+	}
+
+	RedisSubscriber::~RedisSubscriber()
+	{
+		socket_->close();
+	}
+
+	uint64_t RedisSubscriber::subscribe(std::vector<std::string> names, bool pattern, Handler handler)
+	{
+		uint64_t id = ++next_id_;
+
+		Subscription subscription;
+		subscription.names = std::move(names);
+		subscription.pattern = pattern;
+		subscription.handler = std::move(handler);
+
+		auto self = shared_from_this();
+		asio::post(io_service_,
+			[this, self, id, subscription = std::move(subscription)]() mutable
+		{
+			do_subscribe(id, subscription);
+		});
+
+		return id;
+	}
+
+	void RedisSubscriber::unsubscribe(uint64_t id)
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self, id]()
+		{
+			do_unsubscribe(id);
+		});
+	}
+
+	void RedisSubscriber::track(std::vector<std::string> prefixes, Invalidator invalidator)
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_,
+			[this, self, prefixes = std::move(prefixes), invalidator = std::move(invalidator)]() mutable
+		{
+			if (state_ == kClosed || prefixes.empty())
+				return;
+
+			tracked_ = std::move(prefixes);
+			invalidator_ = std::move(invalidator);
+
+			// CLIENT commands can't go out on a subscribed connection, set
+			// up a new one
+			if (state_ != kDisconnected)
+				socket_->close();
+
+			start();
+		});
+	}
+
+	void RedisSubscriber::close()
+	{
+		auto self = shared_from_this();
+		asio::post(io_service_, [this, self]()
+		{
+			state_ = kClosed;
+
+			asio::error_code ec;
+			timer_.cancel(ec);
+
+			socket_->close();
+
+			subscriptions_.clear();
+			channels_.clear();
+			patterns_.clear();
+			leaving_channels_.clear();
+			leaving_patterns_.clear();
+		});
+	}
+
+	void RedisSubscriber::do_subscribe(uint64_t id, Subscription& subscription)
+	{
+		if (state_ == kClosed)
+			return;
+
+		Index& index = subscription.pattern ? patterns_ : channels_;
+		auto& leaving = subscription.pattern ? leaving_patterns_ : leaving_channels_;
+
+		std::vector<std::string> added;
+		for (auto& name : subscription.names)
+		{
+			std::vector<uint64_t>& ids = index[name];
+			if (std::find(ids.begin(), ids.end(), id) != ids.end())
+				continue;
+
+			ids.push_back(id);
+
+			// one still leaving is subscribed again when it has left
+			if (ids.size() == 1 && leaving.count(name) == 0 && !internal(name, subscription.pattern))
+				added.push_back(name);
+		}
+
+		bool pattern = subscription.pattern;
+		subscriptions_[id] = std::move(subscription);
+
+		if (state_ == kReady)
+			send(pattern ? "PSUBSCRIBE" : "SUBSCRIBE", added);
+		else if (state_ == kDisconnected && attempts_ == 0)
+			start();
+	}
+
+	void RedisSubscriber::do_unsubscribe(uint64_t id)
+	{
+		auto iter = subscriptions_.find(id);
+		if (iter == subscriptions_.end())
+			return;
+
+		bool pattern = iter->second.pattern;
+		Index& index = pattern ? patterns_ : channels_;
+		auto& leaving = pattern ? leaving_patterns_ : leaving_channels_;
+
+		std::vector<std::string> removed;
+		for (auto& name : iter->second.names)
+		{
+			auto found = index.find(name);
+			if (found == index.end())
+				continue;
+
+			std::vector<uint64_t>& ids = found->second;
+			ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+			if (!ids.empty())
+				continue;
+
+			index.erase(found);
+
+			if (leaving.count(name) == 0 && !internal(name, pattern))
+				removed.push_back(name);
+		}
+
+		subscriptions_.erase(iter);
+
+		if (state_ != kReady)
+			return;
+
+		send(pattern ? "PUNSUBSCRIBE" : "UNSUBSCRIBE", removed);
+
+		leaving.insert(removed.begin(), removed.end());
+	}
+
+	void RedisSubscriber::start()
+	{
+		state_ = kConnecting;
+		arm_timer(options_.server.connect_timeout);
+
+		auto self = shared_from_this();
+		resolver_.async_resolve(options_.server.host,
+			[this, self](const asio::error_code& ec, const Resolver::Addresses& addresses)
+		{
+			if (state_ != kConnecting)
+				return;
+
+			if (ec || addresses.empty())
+			{
+				disconnect("resolve " + options_.server.host + ": "
+					+ (ec ? ec.message() : std::string("no address")));
+				return;
+			}
+
+			do_connect(addresses.front());
+		});
+	}
+
+	void RedisSubscriber::do_connect(const asio::ip::address& address)
+	{
+		// the socket belongs to this subscriber and never outlives it
+		std::string error;
+		bool ok = socket_->connect(address, options_.server.port,
+			[this](const std::string& error)
+		{
+			if (error.empty())
+				on_connected();
+			else
+				disconnect("connect " + options_.server.host + ": " + error);
+		},
+			[this](const std::string& error)
+		{
+			disconnect(error.empty() ? std::string("connection closed") : "connection lost: " + error);
+		}, error);
+
+		if (!ok)
+			disconnect("connect " + options_.server.host + ": " + error);
+	}
+
+	void RedisSubscriber::on_connected()
+	{
+		redisAsyncContext *context = socket_->context();
+
+		// nothing is written to a quiet subscriber, so only keepalives
+		// notice a peer that went away without closing
+		redisEnableKeepAlive(&context->c);
+
+		state_ = kSetup;
+		setup_ = 0;
+
+		if (!options_.server.password.empty())
+		{
+			const char *argv[] = { "AUTH", options_.server.password.c_str() };
+			std::size_t argvlen[] = { 4, options_.server.password.size() };
+			redisAsyncCommandArgv(context, &RedisSubscriber::on_auth_reply, this, 2, argv, argvlen);
+			setup_++;
+		}
+
+		if (!options_.notify_keyspace_events.empty())
+		{
+			const std::string& events = options_.notify_keyspace_events;
+			const char *argv[] = { "CONFIG", "SET", "notify-keyspace-events", events.c_str() };
+			std::size_t argvlen[] = { 6, 3, 22, events.size() };
+			redisAsyncCommandArgv(context, &RedisSubscriber::on_config_reply, this, 4, argv, argvlen);
+			setup_++;
+		}
+
+		tracking_ = false;
+		if (!tracked_.empty())
+		{
+			redisAsyncCommand(context, &RedisSubscriber::on_client_id, this, "CLIENT ID");
+			setup_++;
+		}
+
+		if (setup_ == 0)
+			on_ready();
+	}
+
+	void RedisSubscriber::on_ready()
+	{
+		state_ = kReady;
+		attempts_ = 0;
+
+		asio::error_code ec;
+		timer_.cancel(ec);
+
+		// the server forgot everything with the old connection
+		leaving_channels_.clear();
+		leaving_patterns_.clear();
+
+		std::vector<std::string> names;
+		for (auto& channel : channels_)
+			names.push_back(channel.first);
+		send("SUBSCRIBE", names);
+
+		names.clear();
+		for (auto& pattern : patterns_)
+			names.push_back(pattern.first);
+		send("PSUBSCRIBE", names);
+
+		if (tracked_.empty())
+			return;
+
+		if (tracking_)
+			send("SUBSCRIBE", std::vector<std::string>(1, kInvalidateChannel));
+		else
+			send("PSUBSCRIBE", keyspace_patterns());
+
+		// what was read before the channel above is in place may be stale
+		invalidator_(std::vector<std::string>());
+	}
+
+	void RedisSubscriber::send(const char *command, const std::vector<std::string>& names)
+	{
+		if (names.empty())
+			return;
+
+		std::vector<const char*> argv;
+		std::vector<std::size_t> argvlen;
+		argv.reserve(names.size() + 1);
+		argvlen.reserve(names.size() + 1);
+
+		argv.push_back(command);
+		argvlen.push_back(strlen(command));
+
+		for (auto& name : names)
+		{
+			argv.push_back(name.data());
+			argvlen.push_back(name.size());
+		}
+
+		redisAsyncCommandArgv(socket_->context(), &RedisSubscriber::on_reply, this,
+			(int)argv.size(), argv.data(), argvlen.data());
+	}
+
+	// ["message", channel, payload], ["pmessage", pattern, channel,
+	// payload], or the confirmation of a (p)(un)subscribe per name
+	void RedisSubscriber::on_message(redisReply *reply)
+	{
+		if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 3)
+			return;
+
+		for (std::size_t i = 0; i < reply->elements; i++)
+		{
+			if (i != 2 && !is_string(reply->element[i]))
+				return;
+		}
+
+		std::string type = to_string(reply->element[0]);
+
+		if (type == "message" && tracking_ && to_string(reply->element[1]) == kInvalidateChannel)
+		{
+			// an array of keys, nil after FLUSHALL or FLUSHDB
+			std::vector<std::string> keys;
+
+			const redisReply *payload = reply->element[2];
+			for (std::size_t i = 0; i < payload->elements; i++)
+				keys.push_back(to_string(payload->element[i]));
+
+			invalidator_(keys);
+		}
+		else if (type == "pmessage" && !tracking_ && !tracked_.empty() && reply->elements >= 4
+			&& internal(to_string(reply->element[1]), true))
+		{
+			// __keyspace@<db>__:<key>
+			std::string channel = to_string(reply->element[2]);
+			std::size_t colon = channel.find("__:");
+			if (colon != std::string::npos)
+				invalidator_(std::vector<std::string>(1, channel.substr(colon + 3)));
+		}
+
+		if (type == "message")
+		{
+			auto message = std::make_shared<Message>();
+			message->channel = to_string(reply->element[1]);
+			message->payload = to_string(reply->element[2]);
+
+			deliver(channels_, message->channel, message);
+		}
+		else if (type == "pmessage" && reply->elements >= 4)
+		{
+			auto message = std::make_shared<Message>();
+			message->pattern = to_string(reply->element[1]);
+			message->channel = to_string(reply->element[2]);
+			message->payload = to_string(reply->element[3]);
+
+			deliver(patterns_, message->pattern, message);
+		}
+		else if (type == "unsubscribe" || type == "punsubscribe")
+		{
+			bool pattern = type[0] == 'p';
+			Index& index = pattern ? patterns_ : channels_;
+			auto& leaving = pattern ? leaving_patterns_ : leaving_channels_;
+
+			std::string name = to_string(reply->element[1]);
+			leaving.erase(name);
+
+			// wanted again while it was leaving
+			if (index.count(name) != 0)
+				send(pattern ? "PSUBSCRIBE" : "SUBSCRIBE", std::vector<std::string>(1, name));
+		}
+	}
+
+	void RedisSubscriber::deliver(const Index& index, const std::string& name, const MessagePtr& message)
+	{
+		auto found = index.find(name);
+		if (found == index.end())
+			return;
+
+		for (auto id : found->second)
+		{
+			auto iter = subscriptions_.find(id);
+			if (iter != subscriptions_.end())
+				iter->second.handler(id, message);
+		}
+	}
+
+	void RedisSubscriber::disconnect(const std::string& message)
+	{
+		if (state_ == kClosed)
+			return;
+
+		fprintf(stderr, "redis subscriber %s:%d: %s\n",
+			options_.server.host.c_str(), (int)options_.server.port, message.c_str());
+
+		state_ = kDisconnected;
+
+		socket_->close();
+
+		// writes go unseen until the connection is back
+		if (!tracked_.empty())
+			invalidator_(std::vector<std::string>());
+
+		int delay = options_.server.reconnect_delay << std::min(attempts_, 5);
+		attempts_++;
+
+		arm_timer(delay);
+	}
+
+	void RedisSubscriber::arm_timer(int delay)
+	{
+		timer_.expires_after(std::chrono::milliseconds(delay));
+
+		auto self = shared_from_this();
+		timer_.async_wait([this, self](const asio::error_code& ec)
+		{
+			// a cancelled wait was replaced by a newer one
+			if (ec == asio::error::operation_aborted)
+				return;
+
+			if (state_ == kDisconnected)
+				start();
+			else if (state_ == kConnecting || state_ == kSetup)
+				disconnect("connect " + options_.server.host + ": timed out");
+		});
+	}
+
+	std::vector<std::string> RedisSubscriber::keyspace_patterns() const
+	{
+		std::vector<std::string> patterns;
+
+		for (auto& prefix : tracked_)
+		{
+			std::string pattern = "__keyspace@" + std::to_string(options_.server.db) + "__:";
+
+			for (char c : prefix)
+			{
+				if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')
+					pattern.push_back('\\');
+				pattern.push_back(c);
+			}
+
+			pattern.push_back('*');
+			patterns.push_back(pattern);
+		}
+
+		return patterns;
+	}
+
+	bool RedisSubscriber::internal(const std::string& name, bool pattern) const
+	{
+		if (tracked_.empty())
+			return false;
+
+		if (!pattern)
+			return name == kInvalidateChannel;
+
+		std::vector<std::string> patterns = keyspace_patterns();
+		return std::find(patterns.begin(), patterns.end(), name) != patterns.end();
+	}
+
+	// the reply is null when the context goes away
+	void RedisSubscriber::on_reply(redisAsyncContext *context, void *r, void *privdata)
+	{
+		if (context->data == nullptr || r == nullptr)
+			return;
+
+		((RedisSubscriber*)privdata)->on_message((redisReply*)r);
+	}
+
+	void RedisSubscriber::on_auth_reply(redisAsyncContext *context, void *r, void *privdata)
+	{
+		if (context->data == nullptr || r == nullptr)
+			return;
+
+		RedisSubscriber *self = (RedisSubscriber*)privdata;
+		redisReply *reply = (redisReply*)r;
+
+		if (reply->type == REDIS_REPLY_ERROR)
+		{
+			self->disconnect("setup: " + std::string(reply->str, reply->len));
+			return;
+		}
+
+		if (--self->setup_ == 0)
+			self->on_ready();
+	}
+
+	// only costs the keyspace events, managed servers often refuse CONFIG
+	void RedisSubscriber::on_config_reply(redisAsyncContext *context, void *r, void *privdata)
+	{
+		if (context->data == nullptr || r == nullptr)
+			return;
+
+		RedisSubscriber *self = (RedisSubscriber*)privdata;
+		redisReply *reply = (redisReply*)r;
+
+		if (reply->type == REDIS_REPLY_ERROR)
+		{
+			fprintf(stderr, "redis subscriber %s:%d: notify-keyspace-events not set: %.*s\n",
+				self->options_.server.host.c_str(), (int)self->options_.server.port,
+				reply->len, reply->str);
+		}
+
+		if (--self->setup_ == 0)
+			self->on_ready();
+	}
+
+	void RedisSubscriber::on_client_id(redisAsyncContext *context, void *r, void *privdata)
+	{
+		if (context->data == nullptr || r == nullptr)
+			return;
+
+		RedisSubscriber *self = (RedisSubscriber*)privdata;
+		redisReply *reply = (redisReply*)r;
+
+		if (reply->type != REDIS_REPLY_INTEGER)
+		{
+			fprintf(stderr, "redis subscriber %s:%d: no CLIENT ID, invalidating from keyspace events\n",
+				self->options_.server.host.c_str(), (int)self->options_.server.port);
+
+			if (--self->setup_ == 0)
+				self->on_ready();
+			return;
+		}
+
+		std::string id = std::to_string(reply->integer);
+
+		std::vector<const char*> argv = { "CLIENT", "TRACKING", "on", "REDIRECT", id.c_str(), "BCAST" };
+		for (auto& prefix : self->tracked_)
+		{
+			argv.push_back("PREFIX");
+			argv.push_back(prefix.c_str());
+		}
+
+		std::vector<std::size_t> argvlen;
+		for (std::size_t i = 0; i < argv.size(); i++)
+			argvlen.push_back(strlen(argv[i]));
+
+		// the setup step goes on with this reply
+		redisAsyncCommandArgv(context, &RedisSubscriber::on_tracking_reply, self,
+			(int)argv.size(), argv.data(), argvlen.data());
+	}
+
+	void RedisSubscriber::on_tracking_reply(redisAsyncContext *context, void *r, void *privdata)
+	{
+		if (context->data == nullptr || r == nullptr)
+			return;
+
+		RedisSubscriber *self = (RedisSubscriber*)privdata;
+		redisReply *reply = (redisReply*)r;
+
+		if (reply->type == REDIS_REPLY_ERROR)
+		{
+			fprintf(stderr, "redis subscriber %s:%d: CLIENT TRACKING refused, invalidating from keyspace events: %.*s\n",
+				self->options_.server.host.c_str(), (int)self->options_.server.port,
+				reply->len, reply->str);
+		}
+		else
+		{
+			self->tracking_ = true;
+		}
+
+		if (--self->setup_ == 0)
+			self->on_ready();
+	}
+}
+
+#endif
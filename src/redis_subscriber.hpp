@@ -0,0 +1,197 @@
+#ifndef TENGINE_REDIS_SUBSCRIBER_HPP
+#define TENGINE_REDIS_SUBSCRIBER_HPP
+
+#include "asio.hpp"
+#include "asio/steady_timer.hpp"
+
+#include "allocator.hpp"
+#include "redis_client.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+
+struct redisAsyncContext;
+
+namespace tengine
+{
+	class Context;
+	class Resolver;
+	class RedisSocket;
+
+	// the pub/sub side of a redis section: one connection in subscribe
+	// mode, shared by every service of the process. a channel or pattern
+	// is subscribed on the server with its first local subscription and
+	// dropped with its last, each message goes to every local one. a lost
+	// connection comes back with everything subscribed again; what was
+	// published meanwhile is lost, as it is for any redis subscriber
+	class RedisSubscriber :
+		public Allocator, public std::enable_shared_from_this<RedisSubscriber>
+	{
+	public:
+		struct Options
+		{
+			// db, pool, pipeline and the command timeout are not used
+			RedisClient::Options server;
+			// CONFIG SET notify-keyspace-events before subscribing, when set
+			std::string notify_keyspace_events;
+		};
+
+		struct Message
+		{
+			std::string channel;
+			std::string payload;
+			// what the channel matched, empty for a channel subscription
+			std::string pattern;
+		};
+
+		// one per message, shared by every subscription it goes to
+		typedef std::shared_ptr<const Message> MessagePtr;
+
+		// called on the io_service thread with the id subscribe returned
+		typedef std::function<void(uint64_t id, const MessagePtr& message)> Handler;
+
+		// keys written on the server, called on the io_service thread; none
+		// when any key may have been, after a lost connection or a flush
+		typedef std::function<void(const std::vector<std::string>& keys)> Invalidator;
+
+		// the RedisClient keys plus notify_keyspace_events; a cluster
+		// section subscribes on its first seed, the cluster forwards every
+		// PUBLISH to all of its nodes
+		static void load(Context& context, const char *conf, Options& options);
+
+		RedisSubscriber(asio::io_service& io_service, Resolver& resolver,
+			const Options& options);
+
+		RedisSubscriber(const RedisSubscriber&) = delete;
+
+		RedisSubscriber& operator=(const RedisSubscriber&) = delete;
+
+		~RedisSubscriber();
+
+		// the calls below may be made from any thread
+
+		// channels, or glob patterns when pattern is set; the id ends the
+		// subscription. connects on the first one
+		uint64_t subscribe(std::vector<std::string> names, bool pattern, Handler handler);
+
+		void unsubscribe(uint64_t id);
+
+		// writes to keys under the prefixes: CLIENT TRACKING in broadcast
+		// mode redirected to this connection, or on servers without it the
+		// keyspace events of the section's db, which notify_keyspace_events
+		// must enable (e.g. "KA"). connects like subscribe; one set per
+		// subscriber
+		void track(std::vector<std::string> prefixes, Invalidator invalidator);
+
+		void close();
+
+	private:
+		enum State
+		{
+			kDisconnected,
+			kConnecting,
+			kSetup,
+			kReady,
+			kClosed,
+		};
+
+		struct Subscription
+		{
+			std::vector<std::string> names;
+			bool pattern;
+			Handler handler;
+		};
+
+		// channel or pattern to the subscriptions listening on it
+		typedef std::unordered_map<std::string, std::vector<uint64_t>> Index;
+
+		void do_subscribe(uint64_t id, Subscription& subscription);
+
+		void do_unsubscribe(uint64_t id);
+
+		void start();
+
+		void do_connect(const asio::ip::address& address);
+
+		void on_connected();
+
+		void on_ready();
+
+		// SUBSCRIBE, PSUBSCRIBE or their opposites with the names as
+		// arguments, nothing when there are none
+		void send(const char *command, const std::vector<std::string>& names);
+
+		void on_message(redisReply *reply);
+
+		// keyspace channels of the tracked prefixes
+		std::vector<std::string> keyspace_patterns() const;
+
+		// channels and patterns of our own, a local unsubscribe leaves them
+		bool internal(const std::string& name, bool pattern) const;
+
+		void deliver(const Index& index, const std::string& name, const MessagePtr& message);
+
+		void disconnect(const std::string& message);
+
+		void arm_timer(int delay);
+
+		static void on_reply(redisAsyncContext *context, void *r, void *privdata);
+
+		static void on_auth_reply(redisAsyncContext *context, void *r, void *privdata);
+
+		static void on_config_reply(redisAsyncContext *context, void *r, void *privdata);
+
+		static void on_client_id(redisAsyncContext *context, void *r, void *privdata);
+
+		static void on_tracking_reply(redisAsyncContext *context, void *r, void *privdata);
+
+		asio::io_service& io_service_;
+
+		Resolver& resolver_;
+
+		Options options_;
+
+		std::shared_ptr<RedisSocket> socket_;
+
+		// connect timeout or the next retry
+		asio::steady_timer timer_;
+
+		State state_;
+
+		int attempts_;
+
+		// replies of the setup commands still expected
+		int setup_;
+
+		std::atomic<uint64_t> next_id_;
+
+		std::unordered_map<uint64_t, Subscription> subscriptions_;
+
+		Index channels_;
+
+		Index patterns_;
+
+		// unsubscribed on the server, not yet confirmed: hiredis drops a
+		// name's callback on the confirmation, so subscribing it again
+		// waits for that
+		std::unordered_set<std::string> leaving_channels_;
+
+		std::unordered_set<std::string> leaving_patterns_;
+
+		std::vector<std::string> tracked_;
+
+		Invalidator invalidator_;
+
+		// the server accepted CLIENT TRACKING on this connection
+		bool tracking_;
+	};
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include "resolver.hpp"
+
+#include "asio/ts/executor.hpp"
+
+#include <algorithm>
+
+namespace tengine
+{
+	Resolver::Resolver(asio::io_service& io_service, int ttl, int negative_ttl)
+		: io_service_(io_service)
+		, resolver_(io_service)
+		, ttl_(ttl)
+		, negative_ttl_(negative_ttl)
+		, mutex_()
+		, entries_()
+	{
+
+	}
+
+	Resolver::~Resolver()
+	{
+		resolver_.cancel();
+	}
+
+	void Resolver::async_resolve(const std::string& host, Handler handler)
+	{
+		asio::error_code ec;
+		asio::ip::address address = asio::ip::address::from_string(host, ec);
+		if (!ec)
+		{
+			Addresses addresses(1, address);
+			asio::post(io_service_,
+				[handler, addresses]()
+			{
+				handler(asio::error_code(), addresses);
+			});
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			Entry& entry = entries_[host];
+
+			if (entry.pending)
+			{
+				entry.waiting.push_back(handler);
+				return;
+			}
+
+			if (entry.expires > Clock::now())
+			{
+				asio::error_code error = entry.error;
+				Addresses addresses = entry.addresses;
+				asio::post(io_service_,
+					[handler, error, addresses]()
+				{
+					handler(error, addresses);
+				});
+				return;
+			}
+
+			entry.pending = true;
+			entry.waiting.push_back(handler);
+		}
+
+		asio::post(io_service_,
+			[this, host]()
+		{
+			do_resolve(host);
+		});
+	}
+
+	bool Resolver::lookup(const std::string& host, Addresses& addresses)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		EntryMap::iterator iter = entries_.find(host);
+		if (iter == entries_.end() || iter->second.error)
+			return false;
+
+		if (iter->second.expires <= Clock::now())
+			return false;
+
+		addresses = iter->second.addresses;
+		return !addresses.empty();
+	}
+
+	void Resolver::clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (EntryMap::iterator iter = entries_.begin(); iter != entries_.end();)
+		{
+			if (!iter->second.pending)
+				iter = entries_.erase(iter);
+			else
+				++iter;
+		}
+	}
+
+	void Resolver::do_resolve(const std::string& host)
+	{
+		asio::ip::tcp::resolver::query query(host, "");
+
+		resolver_.async_resolve(query,
+			[this, host](const asio::error_code& ec,
+				asio::ip::tcp::resolver::iterator iter)
+		{
+			Addresses addresses;
+
+			if (!ec)
+			{
+				asio::ip::tcp::resolver::iterator end;
+				for (; iter != end; ++iter)
+				{
+					asio::ip::address address = iter->endpoint().address();
+					if (std::find(addresses.begin(), addresses.end(), address) == addresses.end())
+						addresses.push_back(address);
+				}
+			}
+
+			complete(host, ec, addresses);
+		});
+	}
+
+	void Resolver::complete(const std::string& host, const asio::error_code& ec,
+		const Addresses& addresses)
+	{
+		asio::error_code error = ec;
+		if (!error && addresses.empty())
+			error = asio::error::host_not_found;
+
+		std::vector<Handler> waiting;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			Entry& entry = entries_[host];
+			entry.pending = false;
+			entry.error = error;
+			entry.addresses = addresses;
+			entry.expires = Clock::now() + (error ? negative_ttl_ : ttl_);
+			waiting.swap(entry.waiting);
+		}
+
+		for (auto& handler : waiting)
+		{
+			handler(error, addresses);
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef TENGINE_RESOLVER_HPP
+#define TENGINE_RESOLVER_HPP
+
+#include "asio.hpp"
+
+#include "allocator.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tengine
+{
+	// process-wide dns cache, lookups never block the calling thread.
+	// getaddrinfo does not report record ttls, so entries live for the
+	// configured ttl (dns.ttl) and failures for dns.negative_ttl.
+	class Resolver : public Allocator
+	{
+	public:
+		typedef std::vector<asio::ip::address> Addresses;
+
+		typedef std::function<void(const asio::error_code&, const Addresses&)> Handler;
+
+		Resolver(asio::io_service& io_service, int ttl, int negative_ttl);
+
+		Resolver(const Resolver&) = delete;
+
+		Resolver& operator=(const Resolver&) = delete;
+
+		~Resolver();
+
+		// handler is always invoked on io_service
+		void async_resolve(const std::string& host, Handler handler);
+
+		bool lookup(const std::string& host, Addresses& addresses);
+
+		void clear();
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Entry
+		{
+			Addresses addresses;
+			asio::error_code error;
+			Clock::time_point expires;
+			bool pending = false;
+			std::vector<Handler> waiting;
+		};
+
+		void do_resolve(const std::string& host);
+
+		void complete(const std::string& host, const asio::error_code& ec,
+			const Addresses& addresses);
+
+		asio::io_service& io_service_;
+
+		asio::ip::tcp::resolver resolver_;
+
+		std::chrono::seconds ttl_;
+
+		std::chrono::seconds negative_ttl_;
+
+		std::mutex mutex_;
+
+		typedef std::unordered_map<std::string, Entry> EntryMap;
+
+		EntryMap entries_;
+	};
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include "sandbox_logger.cpp"
 #include "sandbox_server.cpp"
 #include "sandbox_udp.cpp"
+#include "sandbox_kcp.cpp"
 #include "sandbox_channel.cpp"
 #include "sandbox_network.cpp"
 #include "sandbox_mysql.cpp"
@@ -37,6 +38,8 @@ int luaopen_tengine(lua_State *L)
 		{ "query", query },
 		{ "register_name", register_name },
 		{ "send", send },
+		{ "remote", remote },
+		{ "node", node_id },
 		{ "dispatch", dispatch },
 		{ "timer", timer },
 		{ "log", log },
@@ -47,15 +50,21 @@ int luaopen_tengine(lua_State *L)
 
 		{ "systeminfo", system_info },
 		{ "processinfo", process_info },
+		{ "netinfo", net_info },
+		{ "poolinfo", pool_info },
+		{ "nodeinfo", node_info },
+		{ "members", members },
 
 		{ "http", http },
 		{ "web", web },
 		{ "webserver", webserver },
 		{ "server", server },
 		{ "udp_server", udp_server },
+		{ "kcp_server", kcp_server },
 		{ "channel", channel },
 		{ "udp_channel", udp_channel },
 		{ "udp_sender", udp_sender },
+		{ "shm_channel", shm_channel },
 		{ "mysql", mysql },
 		{ "announce", announcer },
 		{ "files", files },
@@ -101,6 +110,7 @@ namespace tengine
 		, logger_(nullptr)
 		, channels()
 		, udp_channels()
+		, shm_channels()
 	{
 
 	}
@@ -111,6 +121,8 @@ namespace tengine
 
 		udp_channels.clear();
 
+		shm_channels.clear();
+
 		if (l_)
 		{
 			lua_close(l_);
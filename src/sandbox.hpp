@@ -62,8 +62,7 @@ namespace tengine
 
 		void server_closed(void* sender, int session, const char* error);
 
-		void server_udp_read(void *sender, const std::string& address,
-			uint16_t port, const char* data, std::size_t size);
+		void server_udp_read(void *sender, const DatagramBatchPtr& batch);
 
 		void channel_connected(void *sender);
 
@@ -71,11 +70,17 @@ namespace tengine
 
 		void channel_closed(void *sender, const char* error);
 
-		void udp_channel_read(void *sender, const std::string& address,
-			uint16_t port, const char* data, std::size_t size);
+		void udp_channel_read(void *sender, const DatagramBatchPtr& batch);
 
-		void udp_sender_read(void *sender, const std::string& address,
-			uint16_t port, const char* data, std::size_t size);
+		void udp_channel_error(void *sender, const char* error);
+
+		void udp_sender_read(void *sender, const DatagramBatchPtr& batch);
+
+		void shm_channel_connected(void *sender);
+
+		void shm_channel_read(void *sender, const char* data, std::size_t size);
+
+		void shm_channel_closed(void *sender, const char* error);
 
 		void dispatch(int type, int src, int session, const char* data, std::size_t size);
 
@@ -87,6 +92,13 @@ namespace tengine
 
 		void webserver_error(void* sender, int session, const std::string& error);
 
+		void kcp_server_accept(void* sender, int session);
+
+		void kcp_server_read(
+			void* sender, int session, const char* data, std::size_t size);
+
+		void kcp_server_closed(void* sender, int session, const char* error);
+
 		lua_State* l_;
 
 		std::string args_;
@@ -107,6 +119,10 @@ namespace tengine
 		typedef std::map<void*, UdpSenderPtr> UdpSenderPtrMap;
 
 		UdpSenderPtrMap udp_senders;
+
+		typedef std::map<void*, ShmChannelPtr> ShmChannelPtrMap;
+
+		ShmChannelPtrMap shm_channels;
 	};
 
 	// timer
@@ -164,26 +180,52 @@ namespace tengine
 	// udp
 	template<>
 	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageUdpServerRead>, int src,
-		void* sender, std::string address, uint16_t port, const char* data,
-		std::size_t size)
+		void* sender, DatagramBatchPtr batch)
 	{
-		server_udp_read(sender, address, port, data, size);
+		server_udp_read(sender, batch);
 	}
 
 	template<>
 	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageUdpChannelRead>, int src,
-		void* sender, std::string address, uint16_t port, const char* data,
-		std::size_t size)
+		void* sender, DatagramBatchPtr batch)
 	{
-		udp_channel_read(sender, address, port, data, size);
+		udp_channel_read(sender, batch);
+	}
+
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageUdpChannelError>, int src,
+		void* sender, const char* error)
+	{
+		udp_channel_error(sender, error);
 	}
 
 	template<>
 	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageUdpSenderRead>, int src,
-		void* sender, std::string address, uint16_t port, const char* data,
-		std::size_t size)
+		void* sender, DatagramBatchPtr batch)
 	{
-		udp_sender_read(sender, address, port, data, size);
+		udp_sender_read(sender, batch);
+	}
+
+	// shm
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageShmChannelConnected>, int src,
+		void* sender)
+	{
+		shm_channel_connected(sender);
+	}
+
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageShmChannelRead>, int src,
+		void* sender, const char* data, std::size_t size)
+	{
+		shm_channel_read(sender, data, size);
+	}
+
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageShmChannelClosed>, int src,
+		void* sender, const char* error)
+	{
+		shm_channel_closed(sender, error);
 	}
 
 	// rpc
@@ -230,6 +272,28 @@ namespace tengine
 		webserver_error(sender, session, error);
 	}
 
+	// kcp
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageKcpServerAccept>, int src,
+		void* sender, int session)
+	{
+		kcp_server_accept(sender, session);
+	}
+
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageKcpServerRead>, int src,
+		void* sender, int session, const char* data, std::size_t size)
+	{
+		kcp_server_read(sender, session, data, size);
+	}
+
+	template<>
+	inline void SandBox::handler(MessageTypeTrait<MessageType::kMessageKcpServerClosed>, int src,
+		void* sender, int session, const char* error)
+	{
+		kcp_server_closed(sender, session, error);
+	}
+
 }
 
 #endif
@@ -119,7 +119,8 @@ static int channel(lua_State *L)
 	if (address == NULL)
 		return luaL_error(L, "channel need address");
 
-	const char* port = luaL_checkstring(L, 2);
+	// unix-domain addresses carry no port
+	const char* port = luaL_optstring(L, 2, "");
 
 	// callback
 	luaL_checktype(L, 3, LUA_TTABLE);
@@ -137,10 +138,27 @@ static int channel(lua_State *L)
 	int closed_handler = luaL_ref(L, LUA_REGISTRYINDEX);
 	//lua_pop(L, 1);
 
+	// optional, defaults come from the channel section of the config
+	lua_getfield(L, 3, "timeout");
+	int timeout = (int)luaL_optinteger(L, -1, -1);
+	lua_getfield(L, 3, "reconnect");
+	int reconnect = (int)luaL_optinteger(L, -1, -1);
+	lua_getfield(L, 3, "reconnect_delay");
+	int reconnect_delay = (int)luaL_optinteger(L, -1, -1);
+	lua_getfield(L, 3, "reconnect_max_delay");
+	int reconnect_max_delay = (int)luaL_optinteger(L, -1, -1);
+	lua_pop(L, 4);
+
 	ChannelPtr channel(new Channel(self));
 	if (channel == NULL)
 		return luaL_error(L, "create channel failed");
 
+	if (timeout >= 0)
+		channel->connect_timeout(timeout);
+
+	// each one given replaces its config value on its own
+	channel->reconnect(reconnect, reconnect_delay, reconnect_max_delay);
+
 	channel->connect(address, port);
 
 	struct channel *c = (struct channel*)lua_newuserdata(L, sizeof(*c));
@@ -262,6 +280,7 @@ struct udp_channel
 	SandBox* self;
 	UdpChannel *imp;
 	int on_read_ref;
+	int on_error_ref;
 };
 
 static int udp_channel_send_to(lua_State *L)
@@ -338,6 +357,7 @@ static int udp_channel_release(lua_State *L)
 	if (c)
 	{
 		luaL_unref(L, LUA_REGISTRYINDEX, c->on_read_ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, c->on_error_ref);
 	}
 
 	lua_rawgetp(L, LUA_REGISTRYINDEX, &UdpChannel::UDPCHANNEL_KEY);
@@ -370,10 +390,14 @@ static int udp_channel(lua_State *L)
 	luaL_checktype(L, 3, LUA_TTABLE);
 	//lua_settop(L, 3);
 
-	lua_getfield(L, 1, "on_read");
+	lua_getfield(L, 3, "on_read");
 	int read_handler = luaL_ref(L, LUA_REGISTRYINDEX);
 	//lua_pop(L, 1);
 
+	// optional, called with the error each time the peer fails to resolve
+	lua_getfield(L, 3, "on_error");
+	int error_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
 	UdpChannelPtr channel(new UdpChannel(self, address, port));
 	if (!channel)
 		return luaL_error(L, "create udp_channel failed");
@@ -382,6 +406,7 @@ static int udp_channel(lua_State *L)
 	c->self = self;
 	c->imp = channel.get();
 	c->on_read_ref = read_handler;
+	c->on_error_ref = error_handler;
 
 	if (luaL_newmetatable(L, "udp_channel")) {
 		luaL_Reg l[] = {
@@ -418,6 +443,8 @@ static int udp_channel(lua_State *L)
 	lua_pop(L, 1);
 
 	self->udp_channels[c] = channel;
+
+	channel->start();
 	return 1;
 }
 
@@ -585,7 +612,7 @@ static int udp_sender(lua_State *L)
 }
 
 
-void SandBox::udp_channel_read(void* sender, const std::string& address, uint16_t port, const char* data, std::size_t size)
+void SandBox::udp_channel_read(void* sender, const DatagramBatchPtr& batch)
 {
 	lua_State *L = l_;
 
@@ -596,15 +623,51 @@ void SandBox::udp_channel_read(void* sender, const std::string& address, uint16_
 	struct udp_channel* c = (struct udp_channel*)lua_touserdata(L, -1);
 	if (c != NULL)
 	{
-		lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_read_ref);
-		lua_pushlstring(L, data, size);
-		//lua_pushlstring(L, read_message->address()->c_str(), read_message->address()->size());
-		//lua_pushinteger(L, read_message->port());
-		call(3, true);
+		for (std::size_t i = 0; i < batch->size(); i++)
+		{
+			const asio::ip::udp::endpoint& endpoint = batch->endpoint(i);
+			const std::string& address = endpoint.address().to_string();
+
+			lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_read_ref);
+			lua_pushlstring(L, batch->data(i), batch->length(i));
+			lua_pushlstring(L, address.c_str(), address.size());
+			lua_pushinteger(L, endpoint.port());
+			call(3, true);
+		}
 	}
+
+	lua_pop(L, 2);
 }
 
-void SandBox::udp_sender_read(void* sender, const std::string& address, uint16_t port, const char* data, std::size_t size)
+void SandBox::udp_channel_error(void* sender, const char* error)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &UdpChannel::UDPCHANNEL_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct udp_channel* c = (struct udp_channel*)lua_touserdata(L, -1);
+	if (c != NULL)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_error_ref);
+		if (lua_isfunction(L, -1))
+		{
+			lua_pushstring(L, error);
+			call(1, true);
+		}
+		else
+		{
+			lua_pop(L, 1);
+		}
+	}
+
+	lua_pop(L, 2);
+
+	ccfree((void*)error);
+}
+
+void SandBox::udp_sender_read(void* sender, const DatagramBatchPtr& batch)
 {
 	lua_State *L = l_;
 
@@ -615,10 +678,244 @@ void SandBox::udp_sender_read(void* sender, const std::string& address, uint16_t
 	struct udp_sender* c = (struct udp_sender*)lua_touserdata(L, -1);
 	if (c != NULL)
 	{
-		lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_read_ref);
-		lua_pushlstring(L, data, size);
-		lua_pushlstring(L, address.c_str(), address.size());
-		lua_pushinteger(L, port);
-		call(3, true);
+		for (std::size_t i = 0; i < batch->size(); i++)
+		{
+			const asio::ip::udp::endpoint& endpoint = batch->endpoint(i);
+			const std::string& address = endpoint.address().to_string();
+
+			lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_read_ref);
+			lua_pushlstring(L, batch->data(i), batch->length(i));
+			lua_pushlstring(L, address.c_str(), address.size());
+			lua_pushinteger(L, endpoint.port());
+			call(3, true);
+		}
 	}
-}
\ No newline at end of file
+
+	lua_pop(L, 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct shm_channel
+{
+	SandBox* self;
+	ShmChannel *imp;
+	int on_connected_ref;
+	int on_read_ref;
+	int on_closed_ref;
+};
+
+static int shm_channel_send(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct shm_channel *c = (struct shm_channel *)lua_touserdata(L, 1);
+	if (!c || !c->imp)
+		return luaL_error(L, "please new shm_channel first ...");
+
+	if (!c->imp->is_open())
+		return luaL_error(L, "channel is not open");
+
+	size_t len;
+
+	const char * data = luaL_checklstring(L, 2, &len);
+
+	if (!c->imp->write(data, len))
+		return luaL_error(L, "message too large for shm channel: %d", (int)len);
+
+	return 0;
+}
+
+static int shm_channel_close(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct shm_channel *c = (struct shm_channel *)lua_touserdata(L, 1);
+	if (!c || !c->imp)
+		return luaL_error(L, "please new shm_channel first ...");
+
+	c->imp->close();
+
+	return 0;
+}
+
+static int shm_channel_release(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct shm_channel *c = (struct shm_channel *)lua_touserdata(L, 1);
+	if (!c)
+		return 0;
+
+	luaL_unref(L, LUA_REGISTRYINDEX, c->on_closed_ref);
+	luaL_unref(L, LUA_REGISTRYINDEX, c->on_connected_ref);
+	luaL_unref(L, LUA_REGISTRYINDEX, c->on_read_ref);
+
+	if (c->imp)
+	{
+		lua_rawgetp(L, LUA_REGISTRYINDEX, &ShmChannel::SHMCHANNEL_KEY);
+		lua_pushlightuserdata(L, c->imp);
+		lua_pushnil(L);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+
+		// unlike sockets the reader thread and mapping must not outlive us
+		c->imp->close();
+		c->imp = NULL;
+		c->self->shm_channels.erase(c);
+	}
+
+	return 0;
+}
+
+static int shm_channel(lua_State *L)
+{
+	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
+
+	SandBox *self = (SandBox*)lua_touserdata(L, lua_upvalueindex(2));
+
+	const char *name = luaL_checkstring(L, 1);
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	lua_getfield(L, 2, "on_connected");
+	int connected_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_getfield(L, 2, "on_read");
+	int read_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_getfield(L, 2, "on_closed");
+	int closed_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	// optional, defaults come from the shm and channel sections of the config
+	lua_getfield(L, 2, "size");
+	int size = (int)luaL_optinteger(L, -1, 0);
+	lua_getfield(L, 2, "timeout");
+	int timeout = (int)luaL_optinteger(L, -1, -1);
+	lua_pop(L, 2);
+
+	ShmChannelPtr channel(new ShmChannel(self));
+	if (channel == NULL)
+		return luaL_error(L, "create shm_channel failed");
+
+	if (timeout >= 0)
+		channel->connect_timeout(timeout);
+
+	struct shm_channel *c = (struct shm_channel*)lua_newuserdata(L, sizeof(*c));
+	c->self = self;
+	c->imp = channel.get();
+	c->on_connected_ref = connected_handler;
+	c->on_read_ref = read_handler;
+	c->on_closed_ref = closed_handler;
+
+	if (luaL_newmetatable(L, "shm_channel")) {
+		luaL_Reg l[] = {
+			{ "send", shm_channel_send },
+			{ "close", shm_channel_close },
+			{ "__gc", shm_channel_release },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, shm_channel_release);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &ShmChannel::SHMCHANNEL_KEY) == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_createtable(L, 0, 2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &ShmChannel::SHMCHANNEL_KEY);
+		lua_pushstring(L, "kv");
+		lua_setfield(L, -2, "__mode");
+		lua_pushvalue(L, -1);
+		lua_setmetatable(L, -2);
+	}
+
+	lua_pushlightuserdata(L, c->imp);
+	lua_pushvalue(L, -3);
+	lua_settable(L, -3);
+
+	lua_pop(L, 1);
+
+	self->shm_channels[c] = channel;
+
+	// events are dispatched to this sandbox, so connect once we are registered
+	channel->connect(name, size);
+
+	return 1;
+}
+
+void SandBox::shm_channel_connected(void* sender)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &ShmChannel::SHMCHANNEL_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct shm_channel* c = (struct shm_channel*)lua_touserdata(L, -1);
+	if (c != NULL)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_connected_ref);
+		call(0, true);
+	}
+
+	lua_pop(L, 2);
+}
+
+void SandBox::shm_channel_read(void* sender, const char* data, std::size_t size)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &ShmChannel::SHMCHANNEL_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct shm_channel* c = (struct shm_channel*)lua_touserdata(L, -1);
+	if (c != NULL)
+	{
+		// a batch of back-to-back [uint32 length][payload] records
+		std::size_t pos = 0;
+		while (pos + 4 <= size)
+		{
+			uint32_t length;
+			memcpy(&length, data + pos, 4);
+			pos += 4;
+
+			lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_read_ref);
+			lua_pushlstring(L, data + pos, length);
+			lua_pushinteger(L, length);
+			call(2, true);
+
+			pos += length;
+		}
+	}
+
+	lua_pop(L, 2);
+
+	ccfree((void*)data);
+}
+
+void SandBox::shm_channel_closed(void* sender, const char* error)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &ShmChannel::SHMCHANNEL_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct shm_channel* c = (struct shm_channel*)lua_touserdata(L, -1);
+	if (c != NULL)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, c->on_closed_ref);
+		lua_pushstring(L, error);
+		call(1, true);
+	}
+
+	lua_pop(L, 2);
+
+	ccfree((void*)error);
+}
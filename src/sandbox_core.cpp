@@ -3,8 +3,11 @@
 #include "context.hpp"
 #include "network.hpp"
 #include "node.hpp"
+#include "process_info.hpp"
 #include "system_info.hpp"
 #include "dispatch.hpp"
+#include "executor.hpp"
+#include "blocking_pool.hpp"
 
 #include <experimental/filesystem>
 #ifdef _WIN32
@@ -74,6 +77,8 @@ static int register_name(lua_State *L)
 	return 0;
 }
 
+// to a service id or registered name here, or on another node to a handle
+// from remote() or to "name@node"
 static int send(lua_State *L)
 {
 	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
@@ -82,6 +87,13 @@ static int send(lua_State *L)
 
 	Service *dest = NULL;
 
+	Node *node = context->node();
+
+	// set when the destination is on another node
+	int remote_node = 0;
+	int remote_id = 0;
+	std::string remote_name;
+
 	int type = lua_type(L, 1);
 
 	switch (lua_type(L, 1))
@@ -90,7 +102,15 @@ static int send(lua_State *L)
 	{
 		int service_id = (int)luaL_checknumber(L, 1);
 
-		dest = context->query(service_id);
+		if (node != nullptr && node->remote(service_id))
+		{
+			remote_node = Node::node_of(service_id);
+			remote_id = service_id;
+		}
+		else
+		{
+			dest = context->query(Node::service_of(service_id));
+		}
 	}
 	break;
 	case LUA_TSTRING:
@@ -99,7 +119,28 @@ static int send(lua_State *L)
 		if (service_name == NULL)
 			return luaL_error(L, "no dest service");
 
-		dest = context->query(service_name);
+		const char *at = strrchr(service_name, '@');
+		if (at == NULL)
+		{
+			dest = context->query(service_name);
+			break;
+		}
+
+		std::string name(service_name, at - service_name);
+
+		int id = atoi(at + 1);
+		if (id < 1 || id > Node::kMaxNode)
+			return luaL_error(L, "bad node in %s", service_name);
+
+		if (node != nullptr && node->remote(Node::handle(id, 0)))
+		{
+			remote_node = id;
+			remote_name = name;
+		}
+		else
+		{
+			dest = context->query(name.c_str());
+		}
 	}
 	break;
 	case LUA_TLIGHTUSERDATA:
@@ -111,7 +152,7 @@ static int send(lua_State *L)
 		luaL_error(L, "send param error");
 	}
 
-	if (!dest)
+	if (!dest && remote_node == 0)
 		luaL_error(L, "dest is null");
 
 	int session = (int)luaL_checknumber(L, 2);
@@ -126,6 +167,13 @@ static int send(lua_State *L)
 	{
 		const char* tmp = lua_tolstring(L, 3, &len);
 
+		// the link copies it into its outbox
+		if (remote_node != 0)
+		{
+			data = (void*)tmp;
+			break;
+		}
+
 		data = ccmalloc(len);
 		memcpy(data, tmp, len);
 	}
@@ -140,6 +188,8 @@ static int send(lua_State *L)
 		luaL_error(L, "send param error");
 	}
 
+	bool response = false;
+
 	switch (session)
 	{
 	case 0:
@@ -147,18 +197,110 @@ static int send(lua_State *L)
 		session = self->session();
 	case -1:
 		// send
-		dispatch<MessageType::kMessageServiceRequest, SandBox>(self, dest, session, (const char*)data, len);
 		break;
 	default:
 		// return
+		response = true;
+	}
+
+	if (remote_node != 0)
+	{
+		bool sent = node->send(response ? NodeRouter::kFrameResponse : NodeRouter::kFrameRequest,
+			self->id(), remote_node, remote_id, remote_name, session, (const char*)data, len);
+
+		if (lua_type(L, 3) == LUA_TLIGHTUSERDATA)
+			ccfree(data);
+
+		if (!sent)
+			return luaL_error(L, "node %d unreachable", remote_node);
+	}
+	else if (response)
+	{
 		dispatch<MessageType::kMessageServiceResponse, SandBox>(self, dest, session, (const char*)data, len);
 	}
+	else
+	{
+		dispatch<MessageType::kMessageServiceRequest, SandBox>(self, dest, session, (const char*)data, len);
+	}
 
 	lua_pushinteger(L, session);
 
 	return 1;
 }
 
+// remote(node, id), the handle send() takes for a service on another node
+static int remote(lua_State *L)
+{
+	lua_Integer node = luaL_checkinteger(L, 1);
+	lua_Integer id = luaL_checkinteger(L, 2);
+
+	luaL_argcheck(L, node >= 1 && node <= Node::kMaxNode, 1, "node out of range");
+	luaL_argcheck(L, id >= 1 && id <= Node::kMaxService, 2, "service id out of range");
+
+	lua_pushinteger(L, Node::handle((int)node, (int)id));
+	return 1;
+}
+
+static int node_id(lua_State *L)
+{
+	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
+
+	Node *node = context->node();
+	lua_pushinteger(L, node ? node->id_in_cluster() : 0);
+	return 1;
+}
+
+static int node_info(lua_State* L)
+{
+	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
+
+	Node *node = context->node();
+	if (node == nullptr)
+		return luaL_error(L, "no node service");
+
+	std::vector<NodeRouter::Stats> links = node->links();
+
+	lua_createtable(L, (int)links.size(), 0);
+
+	for (std::size_t i = 0; i < links.size(); i++)
+	{
+		const NodeRouter::Stats& stats = links[i];
+
+		lua_newtable(L);
+
+		lua_pushinteger(L, stats.node);
+		lua_setfield(L, -2, "node");
+
+		lua_pushstring(L, stats.address.c_str());
+		lua_setfield(L, -2, "address");
+
+		lua_pushboolean(L, stats.connected);
+		lua_setfield(L, -2, "connected");
+
+		lua_pushboolean(L, stats.inbound);
+		lua_setfield(L, -2, "inbound");
+
+		lua_pushinteger(L, (lua_Integer)stats.sent);
+		lua_setfield(L, -2, "sent");
+
+		lua_pushinteger(L, (lua_Integer)stats.received);
+		lua_setfield(L, -2, "received");
+
+		lua_pushinteger(L, (lua_Integer)stats.batches);
+		lua_setfield(L, -2, "batches");
+
+		lua_pushinteger(L, (lua_Integer)stats.bytes);
+		lua_setfield(L, -2, "bytes");
+
+		lua_pushinteger(L, (lua_Integer)stats.dropped);
+		lua_setfield(L, -2, "dropped");
+
+		lua_rawseti(L, -2, (lua_Integer)(i + 1));
+	}
+
+	return 1;
+}
+
 static int dispatch(lua_State *L)
 {
 	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
@@ -236,24 +378,134 @@ static int process_info(lua_State* L)
 	return 1;
 }
 
-static int announcer(lua_State* L)
+static int net_info(lua_State* L)
 {
 	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
 
-	SandBox *self = (SandBox*)lua_touserdata(L, lua_upvalueindex(2));
+	Executor::Stats stats = context->net_executor().stats();
+
+	lua_newtable(L);
+	lua_pushinteger(L, context->net_executor().busy_poll());
+	lua_setfield(L, -2, "busy_poll");
+
+	lua_pushinteger(L, (lua_Integer)(stats.spin_time / 1000));
+	lua_setfield(L, -2, "spin_us");
+
+	lua_pushinteger(L, (lua_Integer)(stats.idle_time / 1000));
+	lua_setfield(L, -2, "idle_us");
+
+	lua_pushinteger(L, (lua_Integer)stats.spin_handlers);
+	lua_setfield(L, -2, "spin_handlers");
+
+	lua_pushinteger(L, (lua_Integer)stats.idle_waits);
+	lua_setfield(L, -2, "idle_waits");
+
+	return 1;
+}
+
+static int pool_info(lua_State* L)
+{
+	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
+
+	BlockingPool &pool = context->blocking_pool();
+
+	lua_newtable(L);
+	lua_pushinteger(L, (lua_Integer)pool.size());
+	lua_setfield(L, -2, "threads");
+
+	for (const BlockingPool::Stats& stats : pool.stats())
+	{
+		lua_newtable(L);
 
-	Node *node = (Node*)context->query("Node");
+		lua_pushinteger(L, (lua_Integer)stats.queues);
+		lua_setfield(L, -2, "queues");
+
+		lua_pushinteger(L, (lua_Integer)stats.queued);
+		lua_setfield(L, -2, "queued");
+
+		lua_pushinteger(L, (lua_Integer)stats.running);
+		lua_setfield(L, -2, "running");
+
+		lua_pushinteger(L, (lua_Integer)stats.limit);
+		lua_setfield(L, -2, "limit");
+
+		lua_pushinteger(L, (lua_Integer)stats.completed);
+		lua_setfield(L, -2, "completed");
+
+		lua_setfield(L, -2, stats.name.c_str());
+	}
+
+	return 1;
+}
+
+// announce(name), gossiped with this node so the others find it in members()
+static int announcer(lua_State* L)
+{
+	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
+
+	Node *node = context->node();
 	if (node == nullptr)
 		return luaL_error(L, "no node service");
 
-	const char* name = lua_tostring(L, 1);
-	int id = (int)luaL_checknumber(L, 2);
+	const char* name = luaL_checkstring(L, 1);
+	luaL_argcheck(L, strchr(name, ',') == NULL, 1, "name can't have ','");
 
-	node->announce(std::string(name), id);
+	if (node->announce(std::string(name)) != 0)
+		return luaL_error(L, "node.enable is off");
 
 	return 0;
 }
 
+static int members(lua_State* L)
+{
+	Context *context = (Context*)lua_touserdata(L, lua_upvalueindex(1));
+
+	Node *node = context->node();
+	if (node == nullptr)
+		return luaL_error(L, "no node service");
+
+	std::vector<Membership::Member> members = node->members();
+
+	lua_createtable(L, (int)members.size(), 0);
+
+	for (std::size_t i = 0; i < members.size(); i++)
+	{
+		const Membership::Member& member = members[i];
+
+		lua_newtable(L);
+
+		lua_pushinteger(L, member.node);
+		lua_setfield(L, -2, "node");
+
+		lua_pushstring(L, member.host.c_str());
+		lua_setfield(L, -2, "host");
+
+		lua_pushinteger(L, member.router_port);
+		lua_setfield(L, -2, "port");
+
+		lua_pushinteger(L, member.port);
+		lua_setfield(L, -2, "gossip_port");
+
+		lua_pushstring(L, Membership::state_name(member.state));
+		lua_setfield(L, -2, "state");
+
+		lua_pushinteger(L, (lua_Integer)member.incarnation);
+		lua_setfield(L, -2, "incarnation");
+
+		lua_createtable(L, (int)member.services.size(), 0);
+		for (std::size_t j = 0; j < member.services.size(); j++)
+		{
+			lua_pushstring(L, member.services[j].c_str());
+			lua_rawseti(L, -2, (lua_Integer)(j + 1));
+		}
+		lua_setfield(L, -2, "services");
+
+		lua_rawseti(L, -2, (lua_Integer)(i + 1));
+	}
+
+	return 1;
+}
+
 static int files(lua_State* L)
 {
 	const char* path = luaL_checkstring(L, 1);
@@ -0,0 +1,258 @@
+#include "sandbox.hpp"
+
+#include "context.hpp"
+#include "server.hpp"
+
+using namespace tengine;
+
+struct kcp_server
+{
+	KcpServer *imp;
+	int on_accept_ref;
+	int on_read_ref;
+	int on_closed_ref;
+};
+
+static int kcp_server_send(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct kcp_server *s = (struct kcp_server *)lua_touserdata(L, 1);
+	if (!s || !s->imp)
+		return luaL_error(L, "please new kcp_server first ...");
+
+	int session = (int)luaL_checkinteger(L, 2);
+
+	size_t len;
+
+	const char * data = luaL_checklstring(L, 3, &len);
+
+	s->imp->send(session, data, len);
+
+	lua_pushinteger(L, len);
+
+	return 1;
+}
+
+static int kcp_server_close(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct kcp_server *s = (struct kcp_server *)lua_touserdata(L, 1);
+	if (!s || !s->imp)
+		return luaL_error(L, "please new kcp_server first ...");
+
+	int session = (int)luaL_checkinteger(L, 2);
+
+	s->imp->close_session(session);
+
+	return 0;
+}
+
+static int kcp_server_local_address(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct kcp_server *s = (struct kcp_server *)lua_touserdata(L, 1);
+	if (!s || !s->imp)
+		return luaL_error(L, "please new kcp_server first ...");
+
+	std::string address = s->imp->local_address();
+
+	lua_pushstring(L, address.c_str());
+
+	return 1;
+}
+
+static int kcp_server_remote_address(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct kcp_server *s = (struct kcp_server *)lua_touserdata(L, 1);
+	if (!s || !s->imp)
+		return luaL_error(L, "please new kcp_server first ...");
+
+	int session = (int)luaL_checkinteger(L, 2);
+
+	std::string address = s->imp->address(session);
+
+	lua_pushstring(L, address.c_str());
+
+	return 1;
+}
+
+static int kcp_server_release(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct kcp_server *s = (struct kcp_server *)lua_touserdata(L, 1);
+
+	if (s)
+	{
+		luaL_unref(L, LUA_REGISTRYINDEX, s->on_accept_ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, s->on_read_ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, s->on_closed_ref);
+
+		if (s->imp)
+		{
+			delete s->imp;
+			s->imp = nullptr;
+		}
+	}
+
+	return 0;
+}
+
+static int kcp_server_option(lua_State *L, int index, const char *name)
+{
+	lua_getfield(L, index, name);
+	int value = (int)luaL_optinteger(L, -1, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+static int kcp_server(lua_State *L)
+{
+	SandBox *self = (SandBox*)lua_touserdata(L, lua_upvalueindex(2));
+
+	int port = (int)luaL_checknumber(L, 1);
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	lua_getfield(L, 2, "on_accept");
+	int accept_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_getfield(L, 2, "on_read");
+	int read_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_getfield(L, 2, "on_closed");
+	int closed_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	KcpServer *server = new KcpServer(self, port);
+	if (server == NULL)
+		return luaL_error(L, "create kcp_server failed");
+
+	// unset fields fall back to the kcp section of the config
+	server->nodelay(
+		kcp_server_option(L, 2, "nodelay"),
+		kcp_server_option(L, 2, "interval"),
+		kcp_server_option(L, 2, "resend"),
+		kcp_server_option(L, 2, "nc"));
+
+	server->window(
+		kcp_server_option(L, 2, "sndwnd"),
+		kcp_server_option(L, 2, "rcvwnd"));
+
+	server->mtu(kcp_server_option(L, 2, "mtu"));
+
+	server->timeout(kcp_server_option(L, 2, "timeout"));
+
+	server->start();
+
+	struct kcp_server *s = (struct kcp_server*)lua_newuserdata(L, sizeof(*s));
+	s->imp = server;
+	s->on_accept_ref = accept_handler;
+	s->on_read_ref = read_handler;
+	s->on_closed_ref = closed_handler;
+
+	if (luaL_newmetatable(L, "kcp_server")) {
+		luaL_Reg l[] = {
+			{ "send", kcp_server_send },
+			{ "close", kcp_server_close },
+			{ "localaddress", kcp_server_local_address },
+			{ "remoteaddress", kcp_server_remote_address },
+			{ "__gc", kcp_server_release },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, kcp_server_release);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &KcpServer::KCPSERVER_KEY) == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_createtable(L, 0, 2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &KcpServer::KCPSERVER_KEY);
+		lua_pushstring(L, "kv");
+		lua_setfield(L, -2, "__mode");
+		lua_pushvalue(L, -1);
+		lua_setmetatable(L, -2);
+	}
+
+	lua_pushlightuserdata(L, s->imp);
+	lua_pushvalue(L, -3);
+
+	lua_settable(L, -3);
+
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+void SandBox::kcp_server_accept(void* sender, int session)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &KcpServer::KCPSERVER_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct kcp_server* s = (struct kcp_server*)lua_touserdata(L, -1);
+	if (s != NULL)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, s->on_accept_ref);
+		lua_pushinteger(L, session);
+		call(1, true);
+	}
+
+	lua_pop(L, 2);
+}
+
+void SandBox::kcp_server_read(void* sender, int session, const char* data, std::size_t size)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &KcpServer::KCPSERVER_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct kcp_server* s = (struct kcp_server*)lua_touserdata(L, -1);
+	if (s != NULL)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, s->on_read_ref);
+		lua_pushinteger(L, session);
+		lua_pushlstring(L, data, size);
+		lua_pushinteger(L, size);
+		call(3, true);
+	}
+
+	lua_pop(L, 2);
+
+	ccfree((void*)data);
+}
+
+void SandBox::kcp_server_closed(void* sender, int session, const char* error)
+{
+	lua_State *L = l_;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &KcpServer::KCPSERVER_KEY);
+
+	lua_rawgetp(L, -1, sender);
+
+	struct kcp_server* s = (struct kcp_server*)lua_touserdata(L, -1);
+	if (s != NULL)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, s->on_closed_ref);
+		lua_pushinteger(L, session);
+		lua_pushstring(L, error);
+		call(2, true);
+	}
+
+	lua_pop(L, 2);
+
+	ccfree((void*)error);
+}
@@ -266,6 +266,279 @@ struct mysql
 	SandBox *self;
 };
 
+// false for NULL, nothing is pushed then
+static bool push_mysql_value(lua_State *L, const MySqlResult& result,
+	std::size_t row, std::size_t column)
+{
+	const MySqlResult::Field& field = result.fields()[column];
+	std::size_t size;
+	const char *s;
+
+	switch (result.type(row, column))
+	{
+	case MySqlResult::kInteger:
+		lua_pushinteger(L, result.integer(row, column));
+		return true;
+
+	case MySqlResult::kNumber:
+		lua_pushnumber(L, result.number(row, column));
+		return true;
+
+	case MySqlResult::kString:
+		s = result.value(row, column, size);
+		// text protocol numbers arrive as digits, integers stay integers
+		if (!IS_NUM(field.type))
+			lua_pushlstring(L, s, size);
+		else if (field.type == MYSQL_TYPE_FLOAT || field.type == MYSQL_TYPE_DOUBLE
+			|| field.type == MYSQL_TYPE_DECIMAL || field.type == MYSQL_TYPE_NEWDECIMAL)
+			lua_pushnumber(L, strtod(s, nullptr));
+		else
+			lua_pushinteger(L, (lua_Integer)strtoll(s, nullptr, 10));
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// one row as a table of name -> value, NULL columns are left out
+static void push_mysql_row(lua_State *L, const MySqlResult& result, std::size_t row)
+{
+	const std::vector<MySqlResult::Field>& fields = result.fields();
+	std::size_t num_fields = fields.size();
+
+	lua_createtable(L, 0, (int)num_fields);
+
+	for (std::size_t i = 0; i < num_fields; i++)
+	{
+		if (push_mysql_value(L, result, row, i))
+			lua_setfield(L, -2, fields[i].name.c_str());
+	}
+}
+
+static void push_mysql_result(lua_State *L, const MySqlResult& result)
+{
+	if (result.empty())
+	{
+		lua_newtable(L);
+		lua_pushinteger(L, result.affected_rows);
+		lua_setfield(L, -2, "affected_rows");
+
+		lua_pushinteger(L, result.insert_id);
+		lua_setfield(L, -2, "insert_id");
+
+		lua_pushstring(L, result.sqlstate.c_str());
+		lua_setfield(L, -2, "server_status");
+
+		lua_pushinteger(L, result.warnings);
+		lua_setfield(L, -2, "warning_count");
+		return;
+	}
+
+	std::size_t num_rows = result.row_count();
+
+	lua_createtable(L, (int)num_rows, 0);
+
+	for (std::size_t row = 0; row < num_rows; row++)
+	{
+		push_mysql_row(L, result, row);
+		lua_seti(L, -2, (lua_Integer)(row + 1));
+	}
+}
+
+// a result set left in its c++ buffer, values become lua values only when
+// read: res[i] is row i as a table, res:value(i, col) and res:column(col)
+// skip the row tables altogether
+struct mysql_result
+{
+	MySqlResultPtr result;
+};
+
+static const MySqlResult& check_mysql_result(lua_State *L, int index)
+{
+	struct mysql_result *res = (struct mysql_result*)luaL_checkudata(L, index, "mysql_result");
+	return *res->result;
+}
+
+// columns are given by 1-based position or by name
+static std::size_t check_mysql_column(lua_State *L, const MySqlResult& result, int index)
+{
+	const std::vector<MySqlResult::Field>& fields = result.fields();
+
+	if (lua_type(L, index) == LUA_TSTRING)
+	{
+		const char *name = lua_tostring(L, index);
+		for (std::size_t i = 0; i < fields.size(); i++)
+		{
+			if (fields[i].name == name)
+				return i;
+		}
+		luaL_argerror(L, index, "no such column");
+	}
+
+	lua_Integer column = luaL_checkinteger(L, index);
+	luaL_argcheck(L, column >= 1 && column <= (lua_Integer)fields.size(), index, "column out of range");
+
+	return (std::size_t)(column - 1);
+}
+
+static int _mysql_result_value(lua_State *L)
+{
+	const MySqlResult& result = check_mysql_result(L, 1);
+
+	lua_Integer row = luaL_checkinteger(L, 2);
+	std::size_t column = check_mysql_column(L, result, 3);
+
+	if (row < 1 || row > (lua_Integer)result.row_count()
+		|| !push_mysql_value(L, result, (std::size_t)(row - 1), column))
+		lua_pushnil(L);
+
+	return 1;
+}
+
+static int _mysql_result_column(lua_State *L)
+{
+	const MySqlResult& result = check_mysql_result(L, 1);
+
+	std::size_t column = check_mysql_column(L, result, 2);
+	std::size_t num_rows = result.row_count();
+
+	lua_createtable(L, (int)num_rows, 0);
+
+	for (std::size_t row = 0; row < num_rows; row++)
+	{
+		if (push_mysql_value(L, result, row, column))
+			lua_seti(L, -2, (lua_Integer)(row + 1));
+	}
+
+	return 1;
+}
+
+static int _mysql_result_fields(lua_State *L)
+{
+	const MySqlResult& result = check_mysql_result(L, 1);
+
+	const std::vector<MySqlResult::Field>& fields = result.fields();
+
+	lua_createtable(L, (int)fields.size(), 0);
+
+	for (std::size_t i = 0; i < fields.size(); i++)
+	{
+		lua_pushstring(L, fields[i].name.c_str());
+		lua_seti(L, -2, (lua_Integer)(i + 1));
+	}
+
+	return 1;
+}
+
+static int _mysql_result_len(lua_State *L)
+{
+	const MySqlResult& result = check_mysql_result(L, 1);
+
+	lua_pushinteger(L, (lua_Integer)result.row_count());
+	return 1;
+}
+
+static int _mysql_result_index(lua_State *L)
+{
+	const MySqlResult& result = check_mysql_result(L, 1);
+
+	if (lua_isinteger(L, 2))
+	{
+		lua_Integer row = lua_tointeger(L, 2);
+		if (row < 1 || row > (lua_Integer)result.row_count())
+			lua_pushnil(L);
+		else
+			push_mysql_row(L, result, (std::size_t)(row - 1));
+		return 1;
+	}
+
+	lua_pushvalue(L, 2);
+	lua_rawget(L, lua_upvalueindex(1));
+	return 1;
+}
+
+static int _mysql_result_release(lua_State *L)
+{
+	struct mysql_result *res = (struct mysql_result*)lua_touserdata(L, 1);
+
+	if (res)
+		res->result.~MySqlResultPtr();
+
+	return 0;
+}
+
+static void push_mysql_lazy(lua_State *L, const MySqlResultPtr& result)
+{
+	struct mysql_result *res = (struct mysql_result*)lua_newuserdata(L, sizeof(*res));
+	new (&res->result) MySqlResultPtr(result);
+
+	if (luaL_newmetatable(L, "mysql_result")) {
+		luaL_Reg l[] = {
+			{ "value", _mysql_result_value },
+			{ "column", _mysql_result_column },
+			{ "fields", _mysql_result_fields },
+			{ "count", _mysql_result_len },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_pushcclosure(L, _mysql_result_index, 1);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, _mysql_result_len);
+		lua_setfield(L, -2, "__len");
+		lua_pushcfunction(L, _mysql_result_release);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+}
+
+enum MySqlReply
+{
+	kReplyTables,
+	kReplyLazy,
+	// callback(err, batch, more) per batch, batches are always lazy
+	kReplyStream,
+};
+
+// callback(err, result) on the sandbox once the statement is answered
+static MySql::Handler mysql_reply(struct mysql *my, int callback, MySqlReply mode = kReplyTables)
+{
+	return [=](MySql *self, const MySqlResultPtr& result)
+	{
+		lua_State* L = my->self->state();
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
+
+		if (!result->ok())
+		{
+			lua_pushstring(L, result->error.c_str());
+			lua_pushnil(L);
+		}
+		else
+		{
+			lua_pushnil(L);
+			if (mode == kReplyTables || result->empty())
+				push_mysql_result(L, *result);
+			else
+				push_mysql_lazy(L, result);
+		}
+
+		if (mode == kReplyStream)
+		{
+			lua_pushboolean(L, result->more);
+			my->self->call(3, true);
+		}
+		else
+		{
+			my->self->call(2, true);
+		}
+
+		if (!result->more)
+			luaL_unref(L, LUA_REGISTRYINDEX, callback);
+	};
+}
+
 static int _mysql_query(lua_State *L)
 {
 	luaL_checktype(L, 1, LUA_TUSERDATA);
@@ -284,102 +557,413 @@ static int _mysql_query(lua_State *L)
 	lua_pushvalue(L, 3);
 	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
+	// mysql:query(sql, callback, true) leaves the rows in a mysql_result
 	my->imp->query(data, len,
-		[=](MySql *self, MYSQL *mysql, const char* err)
+		mysql_reply(my, callback, lua_toboolean(L, 4) ? kReplyLazy : kReplyTables));
+
+	return 0;
+}
+
+// mysql:cached(sql, ttl, callback[, lazy]), ttl nil or 0 for the default
+static int _mysql_cached(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp)
 	{
-		lua_State* L = my->self->state();
+		return luaL_error(L, "please new mysql first ...");
+	}
 
-		lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
+	size_t len;
+
+	const char * data = luaL_checklstring(L, 2, &len);
+
+	int ttl = (int)luaL_optinteger(L, 3, 0);
+
+	luaL_checktype(L, 4, LUA_TFUNCTION);
+	lua_pushvalue(L, 4);
+	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	my->imp->cached(data, len, nullptr, ttl,
+		mysql_reply(my, callback, lua_toboolean(L, 5) ? kReplyLazy : kReplyTables));
+
+	return 0;
+}
+
+// mysql:invalidate(table, ...)
+static int _mysql_invalidate(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp)
+	{
+		return luaL_error(L, "please new mysql first ...");
+	}
+
+	std::vector<std::string> tables;
+	for (int i = 2; i <= lua_gettop(L); i++)
+		tables.push_back(luaL_checkstring(L, i));
+
+	my->imp->invalidate(tables);
+
+	return 0;
+}
+
+static int _mysql_cache_stats(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp || !my->imp->cache())
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	MySqlCache::Stats stats = my->imp->cache()->stats();
+
+	lua_createtable(L, 0, 8);
+
+	lua_pushinteger(L, (lua_Integer)stats.entries);
+	lua_setfield(L, -2, "entries");
+
+	lua_pushinteger(L, (lua_Integer)stats.bytes);
+	lua_setfield(L, -2, "bytes");
+
+	lua_pushinteger(L, (lua_Integer)stats.hits);
+	lua_setfield(L, -2, "hits");
+
+	lua_pushinteger(L, (lua_Integer)stats.misses);
+	lua_setfield(L, -2, "misses");
+
+	lua_pushinteger(L, (lua_Integer)stats.joined);
+	lua_setfield(L, -2, "joined");
+
+	lua_pushinteger(L, (lua_Integer)stats.stores);
+	lua_setfield(L, -2, "stores");
+
+	lua_pushinteger(L, (lua_Integer)stats.evictions);
+	lua_setfield(L, -2, "evictions");
+
+	lua_pushinteger(L, (lua_Integer)stats.invalidations);
+	lua_setfield(L, -2, "invalidations");
+
+	return 1;
+}
+
+static void push_histogram(lua_State *L, const Histogram& histogram)
+{
+	lua_createtable(L, 0, 6);
+
+	lua_pushinteger(L, (lua_Integer)histogram.count());
+	lua_setfield(L, -2, "count");
+
+	lua_pushinteger(L, (lua_Integer)histogram.sum());
+	lua_setfield(L, -2, "sum");
+
+	lua_pushinteger(L, (lua_Integer)histogram.max());
+	lua_setfield(L, -2, "max");
+
+	lua_pushinteger(L, (lua_Integer)histogram.percentile(0.5));
+	lua_setfield(L, -2, "p50");
+
+	lua_pushinteger(L, (lua_Integer)histogram.percentile(0.9));
+	lua_setfield(L, -2, "p90");
+
+	lua_pushinteger(L, (lua_Integer)histogram.percentile(0.99));
+	lua_setfield(L, -2, "p99");
+}
+
+static void push_pool_stats(lua_State *L, const MySql::PoolStats& stats)
+{
+	lua_createtable(L, 0, 12);
+
+	lua_pushstring(L, stats.host.c_str());
+	lua_setfield(L, -2, "host");
+
+	lua_pushinteger(L, (lua_Integer)stats.port);
+	lua_setfield(L, -2, "port");
+
+	lua_pushinteger(L, (lua_Integer)stats.connections);
+	lua_setfield(L, -2, "connections");
+
+	lua_pushinteger(L, (lua_Integer)stats.idle);
+	lua_setfield(L, -2, "idle");
+
+	lua_pushinteger(L, (lua_Integer)stats.in_flight);
+	lua_setfield(L, -2, "in_flight");
+
+	lua_pushinteger(L, (lua_Integer)stats.grown);
+	lua_setfield(L, -2, "grown");
+
+	lua_pushinteger(L, (lua_Integer)stats.shrunk);
+	lua_setfield(L, -2, "shrunk");
+
+	lua_pushinteger(L, (lua_Integer)stats.reconnects);
+	lua_setfield(L, -2, "reconnects");
+
+	lua_pushinteger(L, (lua_Integer)stats.ping_failures);
+	lua_setfield(L, -2, "ping_failures");
+
+	// microseconds
+	push_histogram(L, stats.wait);
+	lua_setfield(L, -2, "wait");
+
+	push_histogram(L, stats.busy);
+	lua_setfield(L, -2, "busy");
+
+	// microseconds
+	push_histogram(L, stats.latency);
+	lua_setfield(L, -2, "latency");
+}
+
+// the primary's pool, with the replicas' in .replicas
+static int _mysql_pool_stats(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp || my->imp->async())
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	std::vector<MySql::PoolStats> stats = my->imp->pool_stats();
+	if (stats.empty())
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	push_pool_stats(L, stats[0]);
+
+	lua_createtable(L, (int)stats.size() - 1, 0);
+	for (std::size_t i = 1; i < stats.size(); i++)
+	{
+		push_pool_stats(L, stats[i]);
+		lua_rawseti(L, -2, (int)i);
+	}
+	lua_setfield(L, -2, "replicas");
+
+	return 1;
+}
+
+static int _mysql_stream(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp)
+	{
+		return luaL_error(L, "please new mysql first ...");
+	}
+
+	size_t len;
+
+	const char * data = luaL_checklstring(L, 2, &len);
+
+	lua_Integer batch = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, batch > 0, 3, "batch size must be positive");
+
+	luaL_checktype(L, 4, LUA_TFUNCTION);
+	lua_pushvalue(L, 4);
+	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	my->imp->stream(data, len, (std::size_t)batch, mysql_reply(my, callback, kReplyStream));
+
+	return 0;
+}
+
+// nil is NULL and booleans are 0/1, other types don't bind
+static bool to_mysql_param(lua_State *L, int index, MySqlParam& param)
+{
+	switch (lua_type(L, index))
+	{
+	case LUA_TNIL:
+		param.type = MySqlResult::kNull;
+		return true;
 
-		int type = lua_type(L, -1);
+	case LUA_TBOOLEAN:
+		param.type = MySqlResult::kInteger;
+		param.integer = lua_toboolean(L, index);
+		return true;
 
-		if (err)
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index))
 		{
-			lua_pushstring(L, err);
-			lua_pushnil(L);
+			param.type = MySqlResult::kInteger;
+			param.integer = lua_tointeger(L, index);
 		}
 		else
 		{
-			lua_pushnil(L);
+			param.type = MySqlResult::kNumber;
+			param.number = lua_tonumber(L, index);
+		}
+		return true;
 
-			int field_count = mysql_field_count(mysql);
+	case LUA_TSTRING:
+	{
+		size_t len;
+		const char *s = lua_tolstring(L, index, &len);
+		param.type = MySqlResult::kString;
+		param.string.assign(s, len);
+		return true;
+	}
 
-			if (0 == field_count)
-			{
-				uint64_t affected_rows = mysql_affected_rows(mysql);
+	default:
+		return false;
+	}
+}
 
-				uint64_t insert_id = mysql_insert_id(mysql);
+// {column = value, ...}, names must be strings
+static void check_mysql_columns(lua_State *L, int index, MySqlWriter::Columns& columns)
+{
+	luaL_checktype(L, index, LUA_TTABLE);
 
-				lua_newtable(L);
-				lua_pushinteger(L, affected_rows);
-				lua_setfield(L, -2, "affected_rows");
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0)
+	{
+		if (lua_type(L, -2) != LUA_TSTRING)
+			luaL_argerror(L, index, "column names must be strings");
 
-				lua_pushinteger(L, insert_id);
-				lua_setfield(L, -2, "insert_id");
+		MySqlParam param;
+		if (!to_mysql_param(L, -1, param))
+			luaL_argerror(L, index, "column values must be boolean, number or string");
 
-				lua_pushfstring(L, mysql_sqlstate(mysql));
-				lua_setfield(L, -2, "server_status");
+		columns.emplace_back(lua_tostring(L, -2), std::move(param));
+		lua_pop(L, 1);
+	}
+}
 
-				lua_pushinteger(L, mysql_warning_count(mysql));
-				lua_setfield(L, -2, "warning_count");
-			}
-			else
-			{
-				MYSQL_RES *result = mysql_store_result(mysql);
+// mysql:write(table, {id = 1}, {gold = 10}) -> true or nil, err
+// the row is upserted by the section's write-behind queue later on
+static int _mysql_write(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
 
-				if (result)
-				{
-					int num_fields = mysql_num_fields(result);
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp)
+	{
+		return luaL_error(L, "please new mysql first ...");
+	}
 
-					MYSQL_FIELD ** fds = (MYSQL_FIELD **)ccmalloc(sizeof(MYSQL_FIELD *)* num_fields);
-					MYSQL_FIELD * fd;
-					for (int i = 0; fd = mysql_fetch_field(result); ++i)
-					{
-						fds[i] = fd;
-					}
+	size_t len;
+	const char *table = luaL_checklstring(L, 2, &len);
 
-					lua_newtable(L);
+	MySqlWriter::Columns keys;
+	check_mysql_columns(L, 3, keys);
 
-					MYSQL_ROW row;
-					int index = 0;
-					while ((row = mysql_fetch_row(result)))
-					{
-						unsigned long *lengths;
-						lengths = mysql_fetch_lengths(result);
-
-						lua_newtable(L);
-						for (int i = 0; i < num_fields; i++)
-						{
-							char* s = row[i];
-							if (IS_NUM(fds[i]->type))
-							{
-								lua_pushnumber(L, atol(s));
-							}
-							else
-							{
-								lua_pushlstring(L, s, lengths[i]);
-							}
-							//lua_seti(L, -2, (i + 1));
-							lua_setfield(L, -2, fds[i]->name);
-						}
-						index++;
-						lua_seti(L, -2, index);
-					}
+	MySqlWriter::Columns values;
+	check_mysql_columns(L, 4, values);
 
-					ccfree(fds);
-					mysql_free_result(result);
-				}
-			}
-		}
+	std::string error;
+	if (!my->imp->write(std::string(table, len), keys, values, error))
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, error.c_str());
+		return 2;
+	}
 
-		my->self->call(2, true);
+	lua_pushboolean(L, 1);
+	return 1;
+}
 
-		luaL_unref(L, LUA_REGISTRYINDEX, callback);
-	});
+// a prepared statement keeps its mysql alive through its user value and
+// carries its sql inline
+struct mysql_stmt
+{
+	struct mysql *my;
+	size_t size;
+	char sql[1];
+};
+
+// stmt:execute(p1, p2, ..., callback) or, read through the cache,
+// stmt:cached(ttl, p1, p2, ..., callback)
+static int mysql_stmt_run(lua_State *L, bool cached)
+{
+	struct mysql_stmt *stmt = (struct mysql_stmt*)luaL_checkudata(L, 1, "mysql_stmt");
+	if (!stmt->my->imp)
+	{
+		return luaL_error(L, "mysql already released ...");
+	}
+
+	int first = cached ? 3 : 2;
+	int ttl = cached ? (int)luaL_optinteger(L, 2, 0) : 0;
+
+	int top = lua_gettop(L);
+	luaL_checktype(L, top, LUA_TFUNCTION);
+
+	MySqlParams params(top > first ? top - first : 0);
+
+	for (int i = first; i < top; i++)
+	{
+		if (!to_mysql_param(L, i, params[i - first]))
+			return luaL_argerror(L, i, "nil, boolean, number or string expected");
+	}
+
+	lua_pushvalue(L, top);
+	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	if (cached)
+		stmt->my->imp->cached(stmt->sql, stmt->size, &params, ttl, mysql_reply(stmt->my, callback));
+	else
+		stmt->my->imp->execute(stmt->sql, stmt->size, std::move(params),
+			mysql_reply(stmt->my, callback));
 
 	return 0;
 }
 
+static int _mysql_stmt_execute(lua_State *L)
+{
+	return mysql_stmt_run(L, false);
+}
+
+static int _mysql_stmt_cached(lua_State *L)
+{
+	return mysql_stmt_run(L, true);
+}
+
+static int _mysql_prepare(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct mysql *my = (struct mysql*)lua_touserdata(L, 1);
+	if (!my || !my->imp)
+	{
+		return luaL_error(L, "please new mysql first ...");
+	}
+
+	size_t len;
+
+	const char * data = luaL_checklstring(L, 2, &len);
+
+	struct mysql_stmt *stmt = (struct mysql_stmt*)lua_newuserdata(L, sizeof(*stmt) + len);
+	stmt->my = my;
+	stmt->size = len;
+	memcpy(stmt->sql, data, len);
+	stmt->sql[len] = '\0';
+
+	if (luaL_newmetatable(L, "mysql_stmt")) {
+		luaL_Reg l[] = {
+			{ "execute", _mysql_stmt_execute },
+			{ "cached", _mysql_stmt_cached },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+	}
+
+	lua_setmetatable(L, -2);
+
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+
+	return 1;
+}
+
 static int _mysql_release(lua_State *L)
 {
 	luaL_checktype(L, 1, LUA_TUSERDATA);
@@ -420,6 +1004,13 @@ static int mysql(lua_State *L)
 	if (luaL_newmetatable(L, "mysql")) {
 		luaL_Reg l[] = {
 			{ "query", _mysql_query },
+			{ "prepare", _mysql_prepare },
+			{ "stream", _mysql_stream },
+			{ "write", _mysql_write },
+			{ "cached", _mysql_cached },
+			{ "invalidate", _mysql_invalidate },
+			{ "cache_stats", _mysql_cache_stats },
+			{ "pool_stats", _mysql_pool_stats },
 			{ "__gc", _mysql_release },
 			{ NULL, NULL },
 		};
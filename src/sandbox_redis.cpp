@@ -9,7 +9,12 @@ struct redis
 	SandBox *self;
 };
 
-static int push_reply(lua_State *L, redisReply *reply)
+struct redis_pipeline
+{
+	RedisPipeline *imp;
+};
+
+static int push_reply(lua_State *L, const redisReply *reply)
 {
 	switch (reply->type) {
 		case REDIS_REPLY_STRING:
@@ -41,30 +46,202 @@ static int push_reply(lua_State *L, redisReply *reply)
 	return 1;
 }
 
-static int load_args(lua_State *L, int idx,
-	const char** argv, std::size_t* argvlen)
+// every argument is checked before a buffer is taken: the errors longjmp
+// past C++ destructors
+static int check_args(lua_State *L, int idx, int top)
 {
-	int nargs = lua_gettop(L) - idx + 1;
+	int nargs = top - idx + 1;
 
 	if (nargs <= 0)
 		return luaL_error(L, "missing command name");
 
-	if (nargs > Redis::kRedisCommandMaxArgs)
-		return luaL_error(L, "too many arguments");
+	for (int i = idx; i <= top; i++)
+	{
+		int type = lua_type(L, i);
+		if (type != LUA_TSTRING && type != LUA_TNUMBER)
+			return luaL_argerror(L, i, "expected a string or number value");
+	}
+
+	return nargs;
+}
+
+static void encode_args(lua_State *L, int idx, int top, std::string& command)
+{
+	RedisCommand::begin(command, (std::size_t)(top - idx + 1));
 
-	for (int i = 0; i < nargs; i++)
+	for (int i = idx; i <= top; i++)
 	{
 		std::size_t len;
-		const char* str = lua_tolstring(L, idx + i, &len);
-		if (str == NULL)
-			return luaL_argerror(L, idx + i,
-				"expected a string or number value");
+		const char* str = lua_tolstring(L, i, &len);
+		RedisCommand::arg(command, str, len);
+	}
+}
+
+static void push_result(lua_State *L, redisReply *reply)
+{
+	if (reply->type == REDIS_REPLY_ERROR)
+		lua_pushboolean(L, 0);
+	else
+		lua_pushboolean(L, 1);
+
+	push_reply(L, reply);
+}
+
+// a reply left in hiredis' tree, values become lua values only when read:
+// reply[i], #reply, ipairs and pairs; nested arrays are replies too.
+// reply:totable() converts it all at once, reply:tomap() turns a field,
+// value list such as HGETALL's into a table keyed by field
+struct redis_reply
+{
+	Redis::ReplyPtr root;
+	const redisReply *reply;
+};
 
-		argv[i] = str;
-		argvlen[i] = len;
+static void push_lazy(lua_State *L, const Redis::ReplyPtr& root, const redisReply *reply);
+
+static struct redis_reply *check_redis_reply(lua_State *L, int index)
+{
+	return (struct redis_reply*)luaL_checkudata(L, index, "redis_reply");
+}
+
+static void push_element(lua_State *L, struct redis_reply *res, std::size_t i)
+{
+	const redisReply *element = res->reply->element[i];
+
+	if (element->type == REDIS_REPLY_ARRAY)
+		push_lazy(L, res->root, element);
+	else
+		push_reply(L, element);
+}
+
+static int _redis_reply_index(lua_State *L)
+{
+	struct redis_reply *res = check_redis_reply(L, 1);
+
+	if (lua_isinteger(L, 2))
+	{
+		lua_Integer i = lua_tointeger(L, 2);
+		if (i < 1 || i > (lua_Integer)res->reply->elements)
+			lua_pushnil(L);
+		else
+			push_element(L, res, (std::size_t)(i - 1));
+		return 1;
 	}
 
-	return nargs;
+	lua_pushvalue(L, 2);
+	lua_rawget(L, lua_upvalueindex(1));
+	return 1;
+}
+
+static int _redis_reply_len(lua_State *L)
+{
+	struct redis_reply *res = check_redis_reply(L, 1);
+
+	lua_pushinteger(L, (lua_Integer)res->reply->elements);
+	return 1;
+}
+
+static int _redis_reply_next(lua_State *L)
+{
+	struct redis_reply *res = check_redis_reply(L, 1);
+
+	lua_Integer i = lua_isnil(L, 2) ? 0 : luaL_checkinteger(L, 2);
+	if (i < 0 || i >= (lua_Integer)res->reply->elements)
+		return 0;
+
+	lua_pushinteger(L, i + 1);
+	push_element(L, res, (std::size_t)i);
+	return 2;
+}
+
+static int _redis_reply_pairs(lua_State *L)
+{
+	check_redis_reply(L, 1);
+
+	lua_pushcfunction(L, _redis_reply_next);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+static int _redis_reply_totable(lua_State *L)
+{
+	struct redis_reply *res = check_redis_reply(L, 1);
+
+	push_reply(L, res->reply);
+	return 1;
+}
+
+// nil fields are skipped, values are converted whole
+static int _redis_reply_tomap(lua_State *L)
+{
+	struct redis_reply *res = check_redis_reply(L, 1);
+
+	const redisReply *reply = res->reply;
+	if (reply->elements % 2 != 0)
+		return luaL_error(L, "%d elements are not field, value pairs", (int)reply->elements);
+
+	lua_createtable(L, 0, (int)(reply->elements / 2));
+
+	for (std::size_t i = 0; i < reply->elements; i += 2)
+	{
+		if (reply->element[i]->type == REDIS_REPLY_NIL)
+			continue;
+
+		push_reply(L, reply->element[i]);
+		push_reply(L, reply->element[i + 1]);
+		lua_rawset(L, -3);
+	}
+
+	return 1;
+}
+
+static int _redis_reply_release(lua_State *L)
+{
+	struct redis_reply *res = (struct redis_reply*)lua_touserdata(L, 1);
+
+	if (res)
+		res->root.~shared_ptr();
+
+	return 0;
+}
+
+static void push_lazy(lua_State *L, const Redis::ReplyPtr& root, const redisReply *reply)
+{
+	struct redis_reply *res = (struct redis_reply*)lua_newuserdata(L, sizeof(*res));
+	new (&res->root) Redis::ReplyPtr(root);
+	res->reply = reply;
+
+	if (luaL_newmetatable(L, "redis_reply")) {
+		luaL_Reg l[] = {
+			{ "totable", _redis_reply_totable },
+			{ "tomap", _redis_reply_tomap },
+			{ "count", _redis_reply_len },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_pushcclosure(L, _redis_reply_index, 1);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, _redis_reply_len);
+		lua_setfield(L, -2, "__len");
+		lua_pushcfunction(L, _redis_reply_pairs);
+		lua_setfield(L, -2, "__pairs");
+		lua_pushcfunction(L, _redis_reply_release);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+}
+
+// like push_result, an array stays a redis_reply
+static void push_shared_result(lua_State *L, const Redis::ReplyPtr& reply)
+{
+	lua_pushboolean(L, reply->type != REDIS_REPLY_ERROR);
+
+	if (reply->type == REDIS_REPLY_ARRAY)
+		push_lazy(L, reply, reply.get());
+	else
+		push_reply(L, reply.get());
 }
 
 static int redis_call(lua_State *L)
@@ -78,28 +255,21 @@ static int redis_call(lua_State *L)
 	}
 
 	luaL_checktype(L, 2, LUA_TFUNCTION);
-	lua_pushvalue(L, 2);
-	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
 	size_t len;
 	const char * data = luaL_checklstring(L, 3, &len);
 
+	lua_pushvalue(L, 2);
+	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
+
 	my->imp->call(data, len,
-		[=](redisContext *context, redisReply *reply)
+		[=](Redis *redis, redisReply *reply)
 	{
-		if (connect == nullptr || reply == nullptr)
-			return;
-
 		lua_State* L = my->self->state();
 
 		lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
 
-		if (reply->type == REDIS_REPLY_ERROR)
-			lua_pushboolean(L, 0);
-		else
-			lua_pushboolean(L, 1);
-
-		push_reply(L, reply);
+		push_result(L, reply);
 
 		my->self->call(2, true);
 
@@ -109,7 +279,7 @@ static int redis_call(lua_State *L)
 	return 0;
 }
 
-static int redis_callv(lua_State *L)
+static int callv(lua_State *L, bool lazy)
 {
 	luaL_checktype(L, 1, LUA_TUSERDATA);
 
@@ -120,30 +290,42 @@ static int redis_callv(lua_State *L)
 	}
 
 	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	int top = lua_gettop(L);
+	check_args(L, 3, top);
+
 	lua_pushvalue(L, 2);
 	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
-	const char* argv[Redis::kRedisCommandMaxArgs];
-	std::size_t argvlen[Redis::kRedisCommandMaxArgs];
-
-	int nargs = load_args(L, 3, argv, argvlen);
+	std::string command = RedisCommand::acquire();
+	encode_args(L, 3, top, command);
 
-	my->imp->call(argv, argvlen, nargs,
-		[=](redisContext *context, redisReply *reply)
+	if (lazy)
 	{
-		if (reply == nullptr || context == nullptr)
-			return;
+		my->imp->call_shared(std::move(command),
+			[=](Redis *redis, const Redis::ReplyPtr& reply)
+		{
+			lua_State* L = my->self->state();
+
+			lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
 
+			push_shared_result(L, reply);
+
+			my->self->call(2, true);
+
+			luaL_unref(L, LUA_REGISTRYINDEX, callback);
+		});
+		return 0;
+	}
+
+	my->imp->call(std::move(command),
+		[=](Redis *redis, redisReply *reply)
+	{
 		lua_State* L = my->self->state();
 
 		lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
 
-		if (reply->type == REDIS_REPLY_ERROR)
-			lua_pushboolean(L, 0);
-		else
-			lua_pushboolean(L, 1);
-
-		push_reply(L, reply);
+		push_result(L, reply);
 
 		my->self->call(2, true);
 
@@ -153,113 +335,380 @@ static int redis_callv(lua_State *L)
 	return 0;
 }
 
-static int redis_pipeline(lua_State *L)
+static int redis_callv(lua_State *L)
+{
+	return callv(L, false);
+}
+
+// redis:callv_lazy(callback, ...), an array reply comes back as a redis_reply
+static int redis_callv_lazy(lua_State *L)
+{
+	return callv(L, true);
+}
+
+// true, then {ok, value} per command
+static void push_replies(lua_State *L, redisReply **replys, std::size_t size, bool lazy)
+{
+	lua_pushboolean(L, 1);
+	lua_createtable(L, (int)size, 0);
+
+	for (std::size_t i = 0; i < size; i++)
+	{
+		lua_createtable(L, 2, 0);
+
+		if (lazy)
+		{
+			Redis::ReplyPtr reply = RedisCache::share(replys[i]);
+			replys[i] = nullptr;
+
+			push_shared_result(L, reply);
+		}
+		else
+		{
+			push_result(L, replys[i]);
+		}
+
+		lua_rawseti(L, -3, 2);
+		lua_rawseti(L, -2, 1);
+
+		lua_rawseti(L, -2, i+1);
+	}
+}
+
+// a pipeline from redis:pipeline(), or commands as an array of argument
+// arrays; one reply each, with lazy set arrays stay redis_reply
+static int redis_commit(lua_State *L)
 {
 	luaL_checktype(L, 1, LUA_TUSERDATA);
 
 	struct redis *my = (struct redis*)lua_touserdata(L, 1);
 	if (!my || !my->imp)
+        return luaL_error(L, "please new redis first ...");
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	struct redis_pipeline *pipeline = (struct redis_pipeline*)luaL_testudata(L, 3, "redis.pipeline");
+	if (pipeline == nullptr)
+		luaL_checktype(L, 3, LUA_TTABLE);
+	else if (pipeline->imp == nullptr)
+		return luaL_error(L, "pipeline already released");
+
+	bool lazy = lua_toboolean(L, 4) != 0;
+
+	std::size_t count = pipeline ? 0 : (std::size_t)lua_rawlen(L, 3);
+
+	for (std::size_t i = 1; i <= count; i++)
 	{
-		return luaL_error(L, "please new redis first ...");
+		if (lua_rawgeti(L, 3, (lua_Integer)i) != LUA_TTABLE)
+			return luaL_error(L, "command %d is not a table", (int)i);
+
+		int nargs = (int)lua_rawlen(L, -1);
+		luaL_checkstack(L, nargs, "too many arguments");
+
+		int base = lua_gettop(L);
+		for (int j = 1; j <= nargs; j++)
+			lua_rawgeti(L, base, j);
+
+		check_args(L, base + 1, base + nargs);
+
+		lua_settop(L, base - 1);
 	}
 
-	luaL_checktype(L, 2, LUA_TFUNCTION);
 	lua_pushvalue(L, 2);
 	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
-	lua_pushnil(L);
-	while(lua_next(L, 3) != 0) {
-		const char* argv[Redis::kRedisCommandMaxArgs];
-		std::size_t argvlen[Redis::kRedisCommandMaxArgs];
+	Redis::PipelineHander handler = [=](Redis *redis, redisReply **replys, std::size_t size)
+	{
+		lua_State* L = my->self->state();
 
-		int nargs = load_args(L, 3, argv, argvlen);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
 
-		my->imp->pipeline(argv, argvlen, nargs);
+		push_replies(L, replys, size, lazy);
 
-		lua_pop(L, 1);
+		my->self->call(2, true);
+
+		luaL_unref(L, LUA_REGISTRYINDEX, callback);
+	};
+
+	if (pipeline)
+	{
+		my->imp->commit(*pipeline->imp, std::move(handler));
+		return 0;
+	}
+
+	std::vector<std::string> commands;
+	commands.reserve(count);
+
+	for (std::size_t i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 3, (lua_Integer)i);
+
+		int nargs = (int)lua_rawlen(L, -1);
+
+		int base = lua_gettop(L);
+		for (int j = 1; j <= nargs; j++)
+			lua_rawgeti(L, base, j);
+
+		commands.push_back(RedisCommand::acquire());
+		encode_args(L, base + 1, base + nargs, commands.back());
+
+		lua_settop(L, base - 1);
 	}
 
+	my->imp->commit(std::move(commands), std::move(handler));
+
 	return 0;
 }
 
-static int redis_commit(lua_State *L)
+// the callback of subscription id of the handle, from its uservalue;
+// false once the handle was collected or the id unsubscribed
+static bool push_subscription(lua_State *L, Redis *redis, uint64_t id)
+{
+	int top = lua_gettop(L);
+
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &Redis::REDIS_KEY) != LUA_TTABLE
+		|| lua_rawgetp(L, -1, redis) != LUA_TUSERDATA
+		|| lua_getuservalue(L, -1) != LUA_TTABLE
+		|| lua_rawgeti(L, -1, (lua_Integer)id) != LUA_TFUNCTION)
+	{
+		lua_settop(L, top);
+		return false;
+	}
+
+	lua_replace(L, top + 1);
+	lua_settop(L, top + 1);
+
+	return true;
+}
+
+// redis:subscribe(callback, channel, ...) or redis:psubscribe(callback,
+// pattern, ...): callback(channel, message[, pattern]) runs for every
+// message until redis:unsubscribe(id). nil and why when it can't
+// subscribe
+static int subscribe(lua_State *L, bool pattern)
 {
 	luaL_checktype(L, 1, LUA_TUSERDATA);
 
 	struct redis *my = (struct redis*)lua_touserdata(L, 1);
 	if (!my || !my->imp)
-        return luaL_error(L, "please new redis first ...");
+		return luaL_error(L, "please new redis first ...");
 
 	luaL_checktype(L, 2, LUA_TFUNCTION);
-	lua_pushvalue(L, 2);
-	int callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
-	my->imp->transaction();
+	int top = lua_gettop(L);
+	if (top < 3)
+		return luaL_error(L, pattern ? "missing pattern" : "missing channel");
 
-	lua_pushnil(L);
-	while(lua_next(L, 3) != 0) {
-		const char* argv[Redis::kRedisCommandMaxArgs];
-		std::size_t argvlen[Redis::kRedisCommandMaxArgs];
+	check_args(L, 3, top);
 
-		std::size_t nargs = 0;
-		lua_pushnil(L);
-		while (lua_next(L, -2) != 0)
-		{
-			if (nargs >= Redis::kRedisCommandMaxArgs)
-				return luaL_error(L, "too many arguments");
+	if (lua_getuservalue(L, 1) != LUA_TTABLE)
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setuservalue(L, 1);
+	}
 
-			std::size_t len;
-			const char* str = lua_tolstring(L, -1, &len);
-			if (str == NULL)
-				return luaL_argerror(L, -1,
-					"expected a string or number value");
+	std::vector<std::string> names;
+	for (int i = 3; i <= top; i++)
+	{
+		std::size_t len;
+		const char *name = lua_tolstring(L, i, &len);
+		names.push_back(std::string(name, len));
+	}
 
-			argv[nargs] = str;
-			argvlen[nargs] = len;
-			nargs++;
+	SandBox *self = my->self;
+
+	uint64_t id = my->imp->subscribe(std::move(names), pattern,
+		[self](Redis *redis, uint64_t id, const RedisSubscriber::Message& message)
+	{
+		lua_State* L = self->state();
 
-			lua_pop(L, 1);
+		int top = lua_gettop(L);
+
+		if (!push_subscription(L, redis, id))
+			return;
+
+		lua_pushlstring(L, message.channel.data(), message.channel.size());
+		lua_pushlstring(L, message.payload.data(), message.payload.size());
+
+		if (message.pattern.empty())
+		{
+			self->call(2, true);
+		}
+		else
+		{
+			lua_pushlstring(L, message.pattern.data(), message.pattern.size());
+			self->call(3, true);
 		}
 
-		my->imp->pipeline(argv, argvlen, nargs);
+		lua_settop(L, top);
+	});
 
-		lua_pop(L, 1);
+	if (id == 0)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "redis pub/sub is not available");
+		return 2;
 	}
 
-	my->imp->commit(
-		[=](redisContext *context, redisReply **replys, std::size_t size)
-		{
-			lua_State* L = my->self->state();
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, (lua_Integer)id);
 
-			lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
-			lua_pushboolean(L, 1);
-			lua_newtable(L);
+	lua_pushinteger(L, (lua_Integer)id);
 
-			for (std::size_t i = 0; i < size; i++)
-			{
-				lua_newtable(L);
-				redisReply *reply = replys[i];
+	return 1;
+}
 
-				if (reply->type == REDIS_REPLY_ERROR)
-					lua_pushboolean(L, 0);
-				else
-					lua_pushboolean(L, 1);
-				lua_seti(L, -2, 1);
+static int redis_subscribe(lua_State *L)
+{
+	return subscribe(L, false);
+}
 
-				push_reply(L, reply);
-				lua_seti(L, -2, 2);
+static int redis_psubscribe(lua_State *L)
+{
+	return subscribe(L, true);
+}
 
-				lua_seti(L, -2, i+1);
-			}
-			
-			my->self->call(2, true);
+static int redis_unsubscribe(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
 
-			luaL_unref(L, LUA_REGISTRYINDEX, callback);
-		});
+	struct redis *my = (struct redis*)lua_touserdata(L, 1);
+	if (!my || !my->imp)
+		return luaL_error(L, "please new redis first ...");
+
+	lua_Integer id = luaL_checkinteger(L, 2);
+
+	my->imp->unsubscribe((uint64_t)id);
+
+	if (lua_getuservalue(L, 1) == LUA_TTABLE)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, -2, id);
+	}
+
+	return 0;
+}
+
+// nil when the section has no near cache
+static int redis_cache_stats(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	struct redis *my = (struct redis*)lua_touserdata(L, 1);
+	if (!my || !my->imp || !my->imp->cache())
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	RedisCache::Stats stats = my->imp->cache()->stats();
+
+	lua_createtable(L, 0, 10);
+
+	lua_pushinteger(L, (lua_Integer)stats.entries);
+	lua_setfield(L, -2, "entries");
+
+	lua_pushinteger(L, (lua_Integer)stats.bytes);
+	lua_setfield(L, -2, "bytes");
+
+	lua_pushinteger(L, (lua_Integer)stats.hits);
+	lua_setfield(L, -2, "hits");
+
+	lua_pushinteger(L, (lua_Integer)stats.misses);
+	lua_setfield(L, -2, "misses");
+
+	lua_pushinteger(L, (lua_Integer)stats.joined);
+	lua_setfield(L, -2, "joined");
+
+	lua_pushinteger(L, (lua_Integer)stats.stores);
+	lua_setfield(L, -2, "stores");
+
+	lua_pushinteger(L, (lua_Integer)stats.evictions);
+	lua_setfield(L, -2, "evictions");
+
+	lua_pushinteger(L, (lua_Integer)stats.invalidations);
+	lua_setfield(L, -2, "invalidations");
+
+	lua_pushinteger(L, (lua_Integer)stats.flushes);
+	lua_setfield(L, -2, "flushes");
+
+	// joined calls were answered without a request of their own
+	uint64_t lookups = stats.hits + stats.misses + stats.joined;
+	lua_pushnumber(L, lookups > 0 ? (lua_Number)(stats.hits + stats.joined) / lookups : 0);
+	lua_setfield(L, -2, "hit_rate");
+
+	return 1;
+}
+
+static int pipeline_queue(lua_State *L)
+{
+	struct redis_pipeline *pipeline = (struct redis_pipeline*)luaL_checkudata(L, 1, "redis.pipeline");
+	if (pipeline->imp == nullptr)
+		return luaL_error(L, "pipeline already released");
+
+	int top = lua_gettop(L);
+	check_args(L, 2, top);
+
+	std::string command = RedisCommand::acquire();
+	encode_args(L, 2, top, command);
+
+	pipeline->imp->add(std::move(command));
 
 	return 0;
 }
 
+static int pipeline_size(lua_State *L)
+{
+	struct redis_pipeline *pipeline = (struct redis_pipeline*)luaL_checkudata(L, 1, "redis.pipeline");
+
+	lua_pushinteger(L, pipeline->imp ? (lua_Integer)pipeline->imp->size() : 0);
+
+	return 1;
+}
+
+static int pipeline_release(lua_State *L)
+{
+	struct redis_pipeline *pipeline = (struct redis_pipeline*)luaL_checkudata(L, 1, "redis.pipeline");
+
+	if (pipeline->imp)
+	{
+		delete pipeline->imp;
+		pipeline->imp = nullptr;
+	}
+
+	return 0;
+}
+
+// redis:pipeline([transaction]), a batch for one caller to fill with
+// queue(...) and hand to commit
+static int redis_pipeline(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+
+	bool transaction = lua_toboolean(L, 2) != 0;
+
+	struct redis_pipeline *pipeline = (struct redis_pipeline*)lua_newuserdata(L, sizeof(*pipeline));
+	pipeline->imp = new RedisPipeline(transaction);
+
+	if (luaL_newmetatable(L, "redis.pipeline")) {
+		luaL_Reg l[] = {
+			{ "queue", pipeline_queue },
+			{ "size", pipeline_size },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, pipeline_release);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
 static int redis_release(lua_State *L)
 {
 	luaL_checktype(L, 1, LUA_TUSERDATA);
@@ -301,8 +750,13 @@ static int redis(lua_State *L)
 		luaL_Reg l[] = {
 			{ "call", redis_call },
 			{ "callv", redis_callv },
+			{ "callv_lazy", redis_callv_lazy },
 			{ "pipeline", redis_pipeline },
 			{ "commit", redis_commit },
+			{ "subscribe", redis_subscribe },
+			{ "psubscribe", redis_psubscribe },
+			{ "unsubscribe", redis_unsubscribe },
+			{ "cache_stats", redis_cache_stats },
 			{ "__gc", redis_release },
 			{ NULL, NULL },
 		};
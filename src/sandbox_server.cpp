@@ -126,7 +126,14 @@ static int server(lua_State *L)
 
 	SandBox *self = (SandBox*)lua_touserdata(L, lua_upvalueindex(2));
 
-	int port = (int)luaL_checknumber(L, 1);
+	// a port number, or "unix:/path" for a unix-domain socket
+	const char *address = "0.0.0.0";
+	int port = 0;
+
+	if (lua_type(L, 1) == LUA_TSTRING && strncmp(lua_tostring(L, 1), "unix:", 5) == 0)
+		address = lua_tostring(L, 1);
+	else
+		port = (int)luaL_checknumber(L, 1);
 
 	luaL_checktype(L, 2, LUA_TTABLE);
 	//lua_settop(L, 2);
@@ -143,7 +150,7 @@ static int server(lua_State *L)
 	int closed_handler = luaL_ref(L, LUA_REGISTRYINDEX);
 	//lua_pop(L, 1);
 
-	TcpServer *server = new TcpServer(self, port);
+	TcpServer *server = new TcpServer(self, address, port);
 	if (server == NULL)
 		return luaL_error(L, "create server failed");
 
@@ -168,7 +168,7 @@ static int udp_server(lua_State *L)
 	return 1;
 }
 
-void SandBox::server_udp_read(void* sender, const std::string& address, uint16_t port, const char* data, std::size_t size)
+void SandBox::server_udp_read(void* sender, const DatagramBatchPtr& batch)
 {
 	lua_State *L = l_;
 
@@ -179,12 +179,18 @@ void SandBox::server_udp_read(void* sender, const std::string& address, uint16_t
 	struct udp_server* s = (struct udp_server*)lua_touserdata(L, -1);
 	if (s != NULL)
 	{
-		lua_rawgeti(L, LUA_REGISTRYINDEX, s->on_read_ref);
-		lua_pushlstring(L, data, size);
-		lua_pushlstring(L, address.c_str(), address.size());
-		lua_pushinteger(L, port);
-		call(3, true);
+		for (std::size_t i = 0; i < batch->size(); i++)
+		{
+			const asio::ip::udp::endpoint& endpoint = batch->endpoint(i);
+			const std::string& address = endpoint.address().to_string();
+
+			lua_rawgeti(L, LUA_REGISTRYINDEX, s->on_read_ref);
+			lua_pushlstring(L, batch->data(i), batch->length(i));
+			lua_pushlstring(L, address.c_str(), address.size());
+			lua_pushinteger(L, endpoint.port());
+			call(3, true);
+		}
 	}
 
-	ccfree((void*)data);
-}
\ No newline at end of file
+	lua_pop(L, 2);
+}
@@ -8,42 +8,109 @@
 
 #include "asio/ts/executor.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <memory>
 #include <iostream>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+#include <sys/stat.h>
+#endif
 
 namespace tengine
 {
+	namespace
+	{
+		// a socket file left by a previous run makes bind fail. it only goes
+		// when nothing answers on it: a live server's socket, or some other
+		// file named by mistake, is left for bind to report
+		void remove_stale_socket(asio::io_service& io_service, const std::string& path)
+		{
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+			struct stat st;
+			if (::lstat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode))
+				return;
+
+			asio::local::stream_protocol::socket probe(io_service);
+			asio::error_code ec;
+			probe.connect(asio::local::stream_protocol::endpoint(path), ec);
+
+			if (ec == asio::error::connection_refused)
+				std::remove(path.c_str());
+#endif
+		}
+	}
+
 	class Session : public std::enable_shared_from_this<Session>
 	{
 	public:
-		Session(TcpServer& s, asio::ip::tcp::socket socket, uint32_t index)
+		Session(TcpServer& s, uint32_t index)
 			: owner_(s)
-			, socket_(std::move(socket))
 			, index_(index)
 		{
 		}
 
-		~Session()
+		virtual ~Session()
+		{
+		}
+
+		virtual void start() = 0;
+
+		// safe from any thread
+		virtual void close() = 0;
+
+		virtual void write(const char *data, size_t len) = 0;
+
+		virtual const std::string remote_address() = 0;
+
+		uint32_t index()
+		{
+			return index_;
+		}
+
+	protected:
+		TcpServer& owner_;
+		uint32_t index_;
+	};
+
+	class AsioSession : public Session
+	{
+	public:
+		AsioSession(TcpServer& s, StreamSocket socket, uint32_t index)
+			: Session(s, index)
+			, socket_(std::move(socket))
+		{
+		}
+
+		~AsioSession()
 		{
 			close();
 		}
 
-		void start()
+		void start() override
 		{
 			do_read_header();
 		}
 
-		void close()
+		void close() override
 		{
 			if (!socket_.is_open())
 				return;
 
 			asio::error_code ignored_ec;
-			socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+			socket_.shutdown(asio::socket_base::shutdown_both, ignored_ec);
 			socket_.close(ignored_ec);
 		}
 
-		void write(const char *data, size_t len)
+		void write(const char *data, size_t len) override
 		{
 			Message msg;
 			msg.body_length((uint16_t)len);
@@ -65,22 +132,14 @@ namespace tengine
 			*/
 		}
 
-		const std::string remote_address()
+		const std::string remote_address() override
 		{
-			try
-			{
-				asio::ip::tcp::endpoint ep = socket_.remote_endpoint();
-				return ep.address().to_string();
-			}
-			catch (asio::error_code& /*error*/)
-			{
+			asio::error_code ec;
+			StreamEndpoint ep = socket_.remote_endpoint(ec);
+			if (ec)
 				return "unknown";
-			}
-		}
 
-		uint32_t index()
-		{
-			return index_;
+			return endpoint_address(ep);
 		}
 
 	private:
@@ -165,13 +224,156 @@ namespace tengine
 			);
 		}
 
-		TcpServer& owner_;
-		asio::ip::tcp::socket socket_;
+		StreamSocket socket_;
 		Message read_msg_;
 		MessageDeque write_msgs_;
-		uint32_t index_;
 	};
 
+#if defined(__linux__)
+	// a session on the io_uring engine. one multishot recv feeds the frame
+	// reader on the network thread; writes from any thread collect in the
+	// outbox and leave as a single send per flush.
+	class UringSession : public Session
+	{
+	public:
+		UringSession(TcpServer& s, UringEngine& engine, int fd, uint32_t index)
+			: Session(s, index)
+			, engine_(engine)
+			, fd_(fd)
+			, socket_(engine.attach(fd))
+			, address_(peer_address(fd))
+			, reader_()
+			, failed_(false)
+			, closing_(false)
+			, outbox_lock_()
+			, outbox_()
+			, flushing_(false)
+		{
+		}
+
+		~UringSession()
+		{
+			if (fd_ >= 0)
+				::close(fd_);
+		}
+
+		void start() override
+		{
+			auto self(shared_from_this());
+
+			engine_.recv(socket_,
+				[this, self](const char *data, std::size_t size, const asio::error_code& ec)
+			{
+				if (size > 0)
+				{
+					if (failed_)
+						return;
+
+					bool ok = reader_.feed(data, size,
+						[this](const char *body, std::size_t length)
+					{
+						owner_.asyncNotifyRead(index_, body, length);
+					});
+
+					if (!ok)
+					{
+						failed_ = true;
+						::shutdown(fd_, SHUT_RDWR);
+					}
+					return;
+				}
+
+				// the recv is over: peer closed, error, or our own shutdown
+				engine_.close(socket_);
+				::close(fd_);
+				fd_ = -1;
+
+				std::string error = ec ? ec.message()
+					: asio::error_code(asio::error::eof).message();
+
+				owner_.asyncNotifyClosed(index_, error.c_str(), error.size());
+			});
+		}
+
+		void close() override
+		{
+			if (closing_.exchange(true))
+				return;
+
+			// the fd is only touched on the network thread; shutting it down
+			// ends the recv, which releases the session
+			auto self(shared_from_this());
+			engine_.io_service().post([this, self]()
+			{
+				if (fd_ >= 0)
+					::shutdown(fd_, SHUT_RDWR);
+			});
+		}
+
+		void write(const char *data, size_t len) override
+		{
+			uint16_t length = (uint16_t)std::min(len, (size_t)Message::max_body_length);
+
+			bool flush;
+			{
+				SpinHolder holder(outbox_lock_);
+				const char *header = (const char*)&length;
+				outbox_.insert(outbox_.end(), header, header + Message::header_length);
+				outbox_.insert(outbox_.end(), data, data + length);
+				flush = !flushing_;
+				flushing_ = true;
+			}
+
+			if (flush)
+			{
+				auto self(shared_from_this());
+				engine_.io_service().post([this, self]() { do_flush(); });
+			}
+		}
+
+		const std::string remote_address() override
+		{
+			return address_;
+		}
+
+	private:
+		static std::string peer_address(int fd)
+		{
+			StreamEndpoint ep;
+			socklen_t size = (socklen_t)ep.capacity();
+			if (::getpeername(fd, ep.data(), &size) != 0)
+				return "unknown";
+
+			ep.resize(size);
+			return endpoint_address(ep);
+		}
+
+		void do_flush()
+		{
+			std::vector<char> batch;
+			{
+				SpinHolder holder(outbox_lock_);
+				batch.swap(outbox_);
+				flushing_ = false;
+			}
+
+			if (fd_ >= 0)
+				engine_.send(socket_, batch.data(), batch.size());
+		}
+
+		UringEngine& engine_;
+		int fd_;
+		UringEngine::SocketPtr socket_;
+		std::string address_;
+		MessageReader reader_;
+		bool failed_;
+		std::atomic<bool> closing_;
+		SpinLock outbox_lock_;
+		std::vector<char> outbox_;
+		bool flushing_;
+	};
+#endif
+
 	constexpr int TcpServer::TCPSERVER_KEY;
 
 	TcpServer::TcpServer(Service* s, short port)
@@ -186,19 +388,38 @@ namespace tengine
 		, acceptor_(s->context().net_executor().io_service())
 		, socket_(s->context().net_executor().io_service())
 		, address_(address)
+		, path_()
 		, port_(std::to_string(port))
+		, uring_(s->context().uring())
+		, uring_acceptor_()
+		, uring_listener_()
 		, sessions_()
 		, ids_(0, kMaxSessionIndex)
 	{
 		sessions_.resize(kMaxSessionIndex);
 
-		asio::ip::tcp::resolver resolver(s->context().net_executor().io_service());
-		asio::ip::tcp::endpoint endpoint =
-			*resolver.resolve({ address_, port_ });
+		StreamEndpoint endpoint;
+
+		if (unix_address(address_, path_))
+		{
+			if (!unix_endpoint(path_, endpoint))
+				throw std::system_error(asio::error::address_family_not_supported);
+
+			remove_stale_socket(s->context().net_executor().io_service(), path_);
+		}
+		else
+		{
+			asio::ip::tcp::resolver resolver(s->context().net_executor().io_service());
+			endpoint = resolver.resolve({ address_, port_ })->endpoint();
+		}
+
 		acceptor_.open(endpoint.protocol());
 
-		acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-		acceptor_.set_option(asio::ip::tcp::no_delay(true));
+		if (path_.empty())
+		{
+			acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+			acceptor_.set_option(asio::ip::tcp::no_delay(true));
+		}
 
 		acceptor_.bind(endpoint);
 		acceptor_.listen();
@@ -206,10 +427,54 @@ namespace tengine
 		do_accept();
 	}
 
+	// owned by the uring accept handler, so the listening fd it accepts on
+	// is only closed once the accept has completed for the last time. server
+	// is cleared when the TcpServer goes away
+	struct TcpServer::UringListener
+	{
+		UringListener(TcpServer *server, int fd)
+			: lock()
+			, server(server)
+			, fd(fd)
+		{
+
+		}
+
+		~UringListener()
+		{
+#if defined(__linux__)
+			if (fd >= 0)
+				::close(fd);
+#endif
+		}
+
+		SpinLock lock;
+
+		TcpServer *server;
+
+		int fd;
+	};
+
 	TcpServer::~TcpServer()
 	{
+		if (uring_acceptor_)
+		{
+			{
+				SpinHolder holder(uring_listener_->lock);
+				uring_listener_->server = nullptr;
+			}
+
+			// the engine is only driven from the network thread
+			UringEngine *engine = uring_;
+			UringEngine::SocketPtr socket = uring_acceptor_;
+			engine->io_service().post([engine, socket]() { engine->close(socket); });
+		}
+
 		acceptor_.close();
 
+		if (!path_.empty())
+			std::remove(path_.c_str());
+
 		SpinHolder holder(session_lock_);
 
 		for (std::size_t i = 0; i < sessions_.size(); i++)
@@ -270,7 +535,11 @@ namespace tengine
 
 	std::string TcpServer::local_address()
 	{
-		asio::ip::tcp::endpoint ep = acceptor_.local_endpoint();
+		if (!path_.empty())
+			return address_;
+
+		asio::ip::tcp::endpoint ep;
+		tcp_endpoint(acceptor_.local_endpoint(), ep);
 
 		std::stringstream os;
 
@@ -336,15 +605,38 @@ namespace tengine
 
 		uint32_t index = ids_.get();
 
-		SessionPtr ptr(new Session(*this, std::move(socket_), index));
+		SessionPtr ptr(new AsioSession(*this, std::move(socket_), index));
 
 		sessions_[index] = ptr;
 
 		return ptr;
 	}
 
+	SessionPtr TcpServer::create_session(int fd)
+	{
+		SpinHolder holder(session_lock_);
+
+#if defined(__linux__)
+		uint32_t index = ids_.get();
+
+		SessionPtr ptr(new UringSession(*this, *uring_, fd, index));
+
+		sessions_[index] = ptr;
+
+		return ptr;
+#else
+		return SessionPtr();
+#endif
+	}
+
 	void TcpServer::do_accept()
 	{
+		if (uring_)
+		{
+			do_uring_accept();
+			return;
+		}
+
 		acceptor_.async_accept(socket_,
 			[this](std::error_code ec)
 			{
@@ -369,6 +661,58 @@ namespace tengine
 		);
 	}
 
+	void TcpServer::do_uring_accept()
+	{
+		// one multishot accept serves every connection; start() calls us again
+		if (uring_acceptor_)
+			return;
+
+		int listen_fd = -1;
+#if defined(__linux__)
+		// a descriptor of its own, which acceptor_ closing cannot hand to
+		// someone else while the accept is still armed on it
+		listen_fd = ::fcntl(acceptor_.native_handle(), F_DUPFD_CLOEXEC, 0);
+#endif
+		if (listen_fd < 0)
+			throw std::system_error(errno, std::system_category());
+
+		uring_listener_ = std::make_shared<UringListener>(this, listen_fd);
+		uring_acceptor_ = uring_->attach(listen_fd);
+
+		UringEngine *engine = uring_;
+		UringEngine::SocketPtr socket = uring_acceptor_;
+		std::shared_ptr<UringListener> listener = uring_listener_;
+
+		engine->io_service().post([engine, socket, listener]()
+		{
+			engine->accept(socket,
+				[listener](int fd, const asio::error_code& ec)
+			{
+				SpinHolder holder(listener->lock);
+
+				TcpServer *server = listener->server;
+
+				if (ec || !server)
+				{
+#if defined(__linux__)
+					if (fd >= 0)
+						::close(fd);
+#endif
+					return;
+				}
+
+				SessionPtr session = server->create_session(fd);
+
+				if (session)
+				{
+					session->start();
+
+					server->asyncNotifyAccept(session->index());
+				}
+			});
+		});
+	}
+
 	void TcpServer::asyncNotifyAccept(int session)
 	{
 		dispatch<MessageType::kMessageTcpServerAccept, SandBox>(
@@ -410,7 +754,11 @@ namespace tengine
         : ServiceProxy(s)
 		, socket_(s->context().net_executor().io_service())
 		, port_(port)
-		, messages_()
+		, receiver_(socket_,
+			s->context().config("udp.ring", 4),
+			s->context().config("udp.batch", 32),
+			s->context().config("udp.max_datagram", 2048))
+		, sender_(socket_)
 	{
 
 	}
@@ -428,7 +776,12 @@ namespace tengine
 		socket_.set_option(asio::ip::udp::socket::reuse_address(true));
 		socket_.bind(listen_endpoint);
 
-		do_receive();
+		receiver_.start(
+			[this](const DatagramBatchPtr& batch)
+		{
+			dispatch<MessageType::kMessageUdpServerRead, SandBox>(
+				host(), host(), (void*)this, batch);
+		});
 
 		return 0;
 	}
@@ -445,107 +798,504 @@ namespace tengine
 		return true;
 	}
 
-	void UdpServer::do_receive()
+	int UdpServer::send_to(const char* data, std::size_t size,
+		const std::string& address, uint16_t port)
+	{
+		asio::ip::udp::endpoint endpoint =
+			{ asio::ip::address::from_string(address), port };
+
+		return send_to({ data, size }, endpoint);
+	}
+
+	int UdpServer::send_to(
+		const std::string& data, asio::ip::udp::endpoint& endpoint)
+	{
+		return socket_.send_to(asio::buffer(data), endpoint);
+	}
+
+	int UdpServer::async_send_to(const char* data, std::size_t size,
+		const std::string& address, uint16_t port)
+	{
+		asio::error_code ec;
+		asio::ip::address ip = asio::ip::address::from_string(address, ec);
+		if (ec)
+			return -1;
+
+		sender_.async_send(data, size, { ip, port });
+
+		return 0;
+	}
+
+	int UdpServer::async_send_to(
+		const std::string& data, asio::ip::udp::endpoint& endpoint)
+	{
+		sender_.async_send(data.data(), data.size(), endpoint);
+
+		return 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	class KcpSession : public Allocator
+	{
+	public:
+		KcpSession(uint32_t conv, const asio::ip::udp::endpoint& endpoint,
+			Kcp::Output output)
+			: index(-1)
+			, endpoint(endpoint)
+			, address(endpoint.address().to_string())
+			, kcp(conv, output)
+			, last_recv(0)
+		{
+		}
+
+		int index;
+
+		asio::ip::udp::endpoint endpoint;
+
+		std::string address;
+
+		Kcp kcp;
+
+		uint32_t last_recv;
+	};
+
+	constexpr int KcpServer::KCPSERVER_KEY;
+
+	KcpServer::KcpServer(Service* s, short port)
+		: ServiceProxy(s)
+		, socket_(s->context().net_executor().io_service())
+		, port_(port)
+		, receiver_(socket_,
+			s->context().config("udp.ring", 4),
+			s->context().config("udp.batch", 32),
+			s->context().config("udp.max_datagram", 2048))
+		, sender_(socket_)
+		, timer_(s->context().net_executor().io_service())
+		, epoch_(std::chrono::steady_clock::now())
+		, nodelay_(s->context().config("kcp.nodelay", 1))
+		, interval_(s->context().config("kcp.interval", 10))
+		, resend_(s->context().config("kcp.resend", 2))
+		, nc_(s->context().config("kcp.nc", 0))
+		, sndwnd_(s->context().config("kcp.sndwnd", 128))
+		, rcvwnd_(s->context().config("kcp.rcvwnd", 128))
+		, mtu_(s->context().config("kcp.mtu", 1400))
+		, timeout_(s->context().config("kcp.timeout", 30000))
+		, max_sessions_(s->context().config("kcp.max_sessions", 10000))
+		, max_pending_(s->context().config("kcp.max_pending", 4096))
+		, handshake_timeout_(s->context().config("kcp.handshake_timeout", 10000))
+		, pending_()
+		, last_sweep_(0)
+		, random_(std::random_device()())
+		, sessions_()
+		, endpoints_()
+		, next_session_(0)
+	{
+
+	}
+
+	KcpServer::~KcpServer()
+	{
+		asio::error_code ignored_ec;
+		timer_.cancel(ignored_ec);
+		socket_.close(ignored_ec);
+
+		SpinHolder holder(session_lock_);
+		sessions_.clear();
+		endpoints_.clear();
+		pending_.clear();
+	}
+
+	void KcpServer::nodelay(int nodelay, int interval, int resend, int nc)
+	{
+		if (nodelay >= 0)
+			nodelay_ = nodelay;
+
+		if (interval > 0)
+			interval_ = interval;
+
+		if (resend >= 0)
+			resend_ = resend;
+
+		if (nc >= 0)
+			nc_ = nc;
+	}
+
+	void KcpServer::window(int sndwnd, int rcvwnd)
+	{
+		if (sndwnd > 0)
+			sndwnd_ = sndwnd;
+
+		if (rcvwnd > 0)
+			rcvwnd_ = rcvwnd;
+	}
+
+	void KcpServer::mtu(int mtu)
+	{
+		if (mtu > 0)
+			mtu_ = mtu;
+	}
+
+	void KcpServer::timeout(int milliseconds)
+	{
+		if (milliseconds > 0)
+			timeout_ = milliseconds;
+	}
+
+	int KcpServer::start()
 	{
-		socket_.async_receive(asio::null_buffers(),
-			[this](const asio::error_code& error, unsigned int)
+		asio::ip::udp::endpoint listen_endpoint(
+			asio::ip::address::from_string("0.0.0.0"), port_);
+		socket_.open(listen_endpoint.protocol());
+		socket_.set_option(asio::ip::udp::socket::reuse_address(true));
+		socket_.bind(listen_endpoint);
+
+		receiver_.start(
+			[this](const DatagramBatchPtr& batch)
+		{
+			on_receive(batch);
+		});
+
+		asio::post(socket_.get_io_service(),
+			[this]()
 		{
-			if (error)
+			do_update();
+		});
+
+		return 0;
+	}
+
+	void KcpServer::send(int session, const char *data, std::size_t size)
+	{
+		std::string message(data, size);
+
+		asio::post(socket_.get_io_service(),
+			[this, session, message]()
+		{
+			KcpSessionPtr ptr = this->session(session);
+			if (!ptr)
+				return;
+
+			// the stream would have a hole in it, so the session goes
+			if (ptr->kcp.send(message.data(), message.size()) < 0)
 			{
-				std::cerr << error.message() << std::endl;
+				remove_session(session, "message too large");
+				return;
 			}
-			else
+
+			// do not wait for the next tick to put new data on the wire
+			ptr->kcp.flush();
+		});
+	}
+
+	void KcpServer::close_session(int session)
+	{
+		asio::post(socket_.get_io_service(),
+			[this, session]()
+		{
+			remove_session(session, "closed");
+		});
+	}
+
+	std::string KcpServer::local_address()
+	{
+		asio::error_code ec;
+		asio::ip::udp::endpoint ep = socket_.local_endpoint(ec);
+		if (ec)
+			return "unknown";
+
+		std::stringstream os;
+
+		os << ep.address().to_string() << ":" << ep.port();
+
+		return os.str();
+	}
+
+	std::string KcpServer::address(int session)
+	{
+		KcpSessionPtr ptr = this->session(session);
+		if (ptr)
+			return ptr->address;
+
+		return "";
+	}
+
+	uint32_t KcpServer::clock()
+	{
+		return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - epoch_).count();
+	}
+
+	void KcpServer::do_update()
+	{
+		uint32_t current = clock();
+
+		std::vector<std::pair<int, const char*>> expired;
+
+		for (auto& pair : sessions_)
+		{
+			KcpSessionPtr& session = pair.second;
+
+			session->kcp.update(current);
+
+			if (session->kcp.dead())
+				expired.push_back(std::make_pair(pair.first, "dead link"));
+			else if ((int32_t)(current - session->last_recv) > timeout_)
+				expired.push_back(std::make_pair(pair.first, "timeout"));
+		}
+
+		for (auto& pair : expired)
+		{
+			remove_session(pair.first, pair.second);
+		}
+
+		if ((int32_t)(current - last_sweep_) >= handshake_timeout_)
+			sweep_pending(current);
+
+		timer_.expires_from_now(std::chrono::milliseconds(interval_));
+		timer_.async_wait(
+			[this](const asio::error_code& ec)
+		{
+			if (ec)
+				return;
+
+			do_update();
+		});
+	}
+
+	void KcpServer::on_receive(const DatagramBatchPtr& batch)
+	{
+		uint32_t current = clock();
+
+		std::string message;
+
+		for (std::size_t i = 0; i < batch->size(); i++)
+		{
+			const char *data = batch->data(i);
+			std::size_t size = batch->length(i);
+			const asio::ip::udp::endpoint& endpoint = batch->endpoint(i);
+
+			if (size == kHandshake && memcmp(data, "\0\0\0\0tkcp", kHandshake) == 0)
 			{
-				size_t bytes_available = socket_.available();
-
-				auto receive_buffer =
-					std::make_shared<std::vector<char>>(bytes_available);
-				auto sender_endpoint =
-					std::make_shared<asio::ip::udp::endpoint>();
-
-				socket_.async_receive_from(
-					asio::buffer(receive_buffer->data(),
-						receive_buffer->size()), *sender_endpoint,
-					[this, receive_buffer, sender_endpoint]
-				(const asio::error_code& error, std::size_t bytes_recvd)
-				{
-					if (error)
-					{
-						std::cerr << error.message() << std::endl;
-					}
-					else
-					{
-						const std::string& address = sender_endpoint->address().to_string();
-						uint16_t port = sender_endpoint->port();
+				on_handshake(endpoint, current);
+				continue;
+			}
 
-						dispatch<MessageType::kMessageUdpServerRead, SandBox>(host(), host(),
-							(void*)this, address, port, (const char*)receive_buffer->data(), bytes_recvd);
+			uint32_t conv = Kcp::conv(data, size);
+			if (conv == 0)
+				continue;
 
-						do_receive();
-					}
-				});
+			KcpSessionPtr ptr;
+
+			auto iter = endpoints_.find(endpoint);
+			if (iter != endpoints_.end())
+				ptr = session(iter->second);
+
+			if (ptr && ptr->kcp.conv() != conv)
+			{
+				// only a handshake from the endpoint itself replaces a session,
+				// the peer restarted
+				if (pending(endpoint, current) != conv)
+					continue;
+
+				remove_session(ptr->index, "conversation changed");
+				ptr.reset();
 			}
-		});
+
+			bool created = false;
+
+			if (!ptr)
+			{
+				// the conv was never handed to this endpoint
+				if (pending(endpoint, current) != conv)
+					continue;
+
+				ptr = create_session(conv, endpoint);
+				ptr->kcp.update(current);
+				created = true;
+			}
+
+			if (ptr->kcp.input(data, size) < 0)
+				continue;
+
+			if (created)
+			{
+				pending_.erase(endpoint);
+				add_session(ptr);
+			}
+
+			ptr->last_recv = current;
+
+			while (ptr->kcp.recv(message) >= 0)
+			{
+				asyncNotifyRead(ptr->index, message);
+			}
+		}
 	}
 
-	void UdpServer::do_write()
+	void KcpServer::on_handshake(const asio::ip::udp::endpoint& endpoint, uint32_t current)
 	{
-		/*
-		socket_.async_send_to(
-			asio::buffer(*messages_.begin()), endpoint,
-			[this](const asio::error_code& error, std::size_t bytes_transferred)
+		auto iter = pending_.find(endpoint);
+		if (iter == pending_.end())
 		{
-			messages_.pop_front();
-			if (!messages_.empty())
+			if ((int)pending_.size() >= max_pending_)
+				sweep_pending(current);
+
+			if ((int)pending_.size() >= max_pending_ || (int)sessions_.size() >= max_sessions_)
+				return;
+
+			uint32_t established = 0;
+
+			auto found = endpoints_.find(endpoint);
+			if (found != endpoints_.end())
 			{
-				do_write();
+				KcpSessionPtr ptr = session(found->second);
+				if (ptr)
+					established = ptr->kcp.conv();
 			}
+
+			uint32_t conv = 0;
+			while (conv == 0 || conv == established)
+			{
+				conv = (uint32_t)random_() ^ ((uint32_t)random_() << 16);
+			}
+
+			iter = pending_.insert(std::make_pair(endpoint, KcpPending{ conv, 0 })).first;
 		}
-		);
-		*/
+
+		// a resent handshake gets the same conv
+		iter->second.expires = current + handshake_timeout_;
+
+		char reply[kHandshakeReply] = { 0, 0, 0, 0, 't', 'k', 'c', 'p' };
+		uint32_t conv = iter->second.conv;
+		for (int i = 0; i < 4; i++)
+		{
+			reply[kHandshake + i] = (char)(conv >> (i * 8));
+		}
+
+		sender_.async_send(reply, sizeof(reply), endpoint);
 	}
 
-	int UdpServer::send_to(const char* data, std::size_t size,
-		const std::string& address, uint16_t port)
+	uint32_t KcpServer::pending(const asio::ip::udp::endpoint& endpoint, uint32_t current)
 	{
-		asio::ip::udp::endpoint endpoint =
-			{ asio::ip::address::from_string(address), port };
+		auto iter = pending_.find(endpoint);
+		if (iter == pending_.end())
+			return 0;
 
-		return send_to({ data, size }, endpoint);
+		if ((int32_t)(current - iter->second.expires) > 0)
+		{
+			pending_.erase(iter);
+			return 0;
+		}
+
+		return iter->second.conv;
 	}
 
-	int UdpServer::send_to(
-		const std::string& data, asio::ip::udp::endpoint& endpoint)
+	void KcpServer::sweep_pending(uint32_t current)
 	{
-		return socket_.send_to(asio::buffer(data), endpoint);
+		last_sweep_ = current;
+
+		for (auto iter = pending_.begin(); iter != pending_.end();)
+		{
+			if ((int32_t)(current - iter->second.expires) > 0)
+				iter = pending_.erase(iter);
+			else
+				++iter;
+		}
 	}
 
-	int UdpServer::async_send_to(const char* data, std::size_t size,
-		const std::string& address, uint16_t port)
+	KcpSessionPtr KcpServer::session(int session)
 	{
-		asio::ip::udp::endpoint endpoint =
-			{ asio::ip::address::from_string(address), port };
+		SpinHolder holder(session_lock_);
 
-		return async_send_to({data, size}, endpoint);
+		auto iter = sessions_.find(session);
+		if (iter == sessions_.end())
+			return KcpSessionPtr();
+
+		return iter->second;
 	}
 
-	int UdpServer::async_send_to(
-		const std::string& data, asio::ip::udp::endpoint& endpoint)
+	KcpSessionPtr KcpServer::create_session(uint32_t conv,
+		const asio::ip::udp::endpoint& endpoint)
 	{
-		messages_.push_back(data);
+		KcpSessionPtr session = std::make_shared<KcpSession>(conv, endpoint,
+			[this, endpoint](const char *data, std::size_t size)
+		{
+			sender_.async_send(data, size, endpoint);
+		});
 
-		socket_.async_send_to(
-			asio::buffer(*messages_.begin()), endpoint,
-			[this](const asio::error_code& error, std::size_t bytes_transferred)
+		session->kcp.nodelay(nodelay_, interval_, resend_, nc_);
+		session->kcp.window(sndwnd_, rcvwnd_);
+		session->kcp.mtu(mtu_);
+
+		return session;
+	}
+
+	void KcpServer::add_session(const KcpSessionPtr& session)
+	{
+		{
+			SpinHolder holder(session_lock_);
+
+			while (sessions_.find(next_session_) != sessions_.end())
 			{
-				messages_.pop_front();
-				if (!messages_.empty())
-				{
-					do_write();
-				}
+				next_session_ = next_session_ < 0x7fffffff ? next_session_ + 1 : 0;
 			}
-		);
 
-		return 0;
+			session->index = next_session_;
+			next_session_ = next_session_ < 0x7fffffff ? next_session_ + 1 : 0;
+
+			sessions_[session->index] = session;
+			endpoints_[session->endpoint] = session->index;
+		}
+
+		asyncNotifyAccept(session->index);
+	}
+
+	void KcpServer::remove_session(int session, const char *error)
+	{
+		{
+			SpinHolder holder(session_lock_);
+
+			auto iter = sessions_.find(session);
+			if (iter == sessions_.end())
+				return;
+
+			endpoints_.erase(iter->second->endpoint);
+			sessions_.erase(iter);
+		}
+
+		asyncNotifyClosed(session, error);
+	}
+
+	void KcpServer::asyncNotifyAccept(int session)
+	{
+		dispatch<MessageType::kMessageKcpServerAccept, SandBox>(
+			host(), host(), (void*)this, session);
+	}
+
+	void KcpServer::asyncNotifyRead(int session, const std::string& data)
+	{
+		const char *tmp = (char*)ccmalloc(data.size());
+
+		if (tmp)
+		{
+			memcpy((void*)tmp, data.data(), data.size());
+
+			dispatch<MessageType::kMessageKcpServerRead, SandBox>(
+				host(), host(), (void*)this, session, tmp, data.size());
+		}
+	}
+
+	void KcpServer::asyncNotifyClosed(int session, const char *error)
+	{
+		std::size_t size = strlen(error);
+
+		char *msg = (char*)ccmalloc(size + 1);
+		if (msg)
+		{
+			memcpy(msg, error, size);
+			msg[size] = '\0';
+			dispatch<MessageType::kMessageKcpServerClosed, SandBox>(
+				host(), host(), (void*)this, session, (const char*)msg);
+		}
 	}
 }
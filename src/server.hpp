@@ -5,12 +5,19 @@
 
 #include "service_proxy.hpp"
 #include "spin_lock.hpp"
+#include "datagram.hpp"
+#include "kcp.hpp"
+#include "stream.hpp"
+#include "uring.hpp"
 
 #include <memory>
 #include <string>
 #include <deque>
 #include <set>
 #include <list>
+#include <random>
+#include <map>
+#include <unordered_map>
 
 namespace tengine
 {
@@ -18,9 +25,11 @@ namespace tengine
 	class Session;
 	class Message;
 	class TcpServer;
+	class KcpSession;
 
 	typedef std::shared_ptr<Session> SessionPtr;
 	typedef std::shared_ptr<TcpServer> TcpServerPtr;
+	typedef std::shared_ptr<KcpSession> KcpSessionPtr;
 
 	typedef std::deque<Message> MessageDeque;
 
@@ -42,13 +51,15 @@ namespace tengine
 
 	class TcpServer : public ServiceProxy
 	{
-		friend class Session;
+		friend class AsioSession;
+		friend class UringSession;
 
 	public:
 		static constexpr int TCPSERVER_KEY = 0;
 
 		TcpServer(Service *s, short port);
 
+		// address "unix:/path" listens on a unix-domain socket, port is ignored
 		TcpServer(Service* s, const char * address, short port);
 
 		~TcpServer();
@@ -118,8 +129,12 @@ namespace tengine
 
 		SessionPtr create_session();
 
+		SessionPtr create_session(int fd);
+
 		void do_accept();
 
+		void do_uring_accept();
+
 		void asyncNotifyAccept(int session);
 
 		void asyncNotifyRead(int session, const char *data, std::size_t size);
@@ -128,14 +143,25 @@ namespace tengine
 
 		asio::strand<asio::executor> executor_;
 
-		asio::ip::tcp::acceptor acceptor_;
+		StreamAcceptor acceptor_;
 
-		asio::ip::tcp::socket socket_;
+		StreamSocket socket_;
 
 		std::string address_;
 
+		std::string path_;
+
 		std::string port_;
 
+		// null when sessions run on plain asio sockets
+		UringEngine *uring_;
+
+		UringEngine::SocketPtr uring_acceptor_;
+
+		struct UringListener;
+
+		std::shared_ptr<UringListener> uring_listener_;
+
 		SpinLock session_lock_;
 
 		typedef std::vector<SessionPtr> SessionPtrPool;
@@ -172,16 +198,137 @@ namespace tengine
 
 	private:
 
-		void do_receive();
+		asio::ip::udp::socket socket_;
+
+		short port_;
+
+		DatagramReceiver receiver_;
+
+		DatagramSender sender_;
+	};
+
+	// reliable ordered sessions over one udp socket, keyed by endpoint; all
+	// protocol state lives on the network thread. the server picks the
+	// conversation: a client first sends the 8 byte handshake
+	// [uint32 0]["tkcp"] and gets back [uint32 0]["tkcp"][uint32 conv],
+	// little endian like kcp itself, and the session is only opened by a
+	// valid kcp packet from that endpoint carrying that conv. a client that
+	// restarts handshakes again; packets with any other conv are dropped.
+	class KcpServer : public ServiceProxy
+	{
+	public:
+		static constexpr int KCPSERVER_KEY = 0;
+
+		enum { kHandshake = 8, kHandshakeReply = 12 };
+
+		KcpServer(Service *s, short port);
+
+		~KcpServer();
+
+		// must be called before start
+		void nodelay(int nodelay, int interval, int resend, int nc);
+
+		void window(int sndwnd, int rcvwnd);
+
+		void mtu(int mtu);
+
+		void timeout(int milliseconds);
+
+		int start();
+
+		void send(int session, const char *data, std::size_t size);
+
+		void close_session(int session);
+
+		std::string local_address();
+
+		std::string address(int session);
+
+	private:
+		uint32_t clock();
+
+		void do_update();
+
+		void on_receive(const DatagramBatchPtr& batch);
 
-		void do_write();
+		void on_handshake(const asio::ip::udp::endpoint& endpoint, uint32_t current);
+
+		// the conv handed to an endpoint, 0 when none is pending
+		uint32_t pending(const asio::ip::udp::endpoint& endpoint, uint32_t current);
+
+		void sweep_pending(uint32_t current);
+
+		KcpSessionPtr session(int session);
+
+		KcpSessionPtr create_session(uint32_t conv,
+			const asio::ip::udp::endpoint& endpoint);
+
+		void add_session(const KcpSessionPtr& session);
+
+		void remove_session(int session, const char *error);
+
+		void asyncNotifyAccept(int session);
+
+		void asyncNotifyRead(int session, const std::string& data);
+
+		void asyncNotifyClosed(int session, const char *error);
 
 		asio::ip::udp::socket socket_;
 
 		short port_;
 
-		std::deque<std::string> messages_;
+		DatagramReceiver receiver_;
+
+		DatagramSender sender_;
+
+		asio::steady_timer timer_;
+
+		std::chrono::steady_clock::time_point epoch_;
+
+		int nodelay_;
+
+		int interval_;
+
+		int resend_;
+
+		int nc_;
+
+		int sndwnd_;
+
+		int rcvwnd_;
+
+		int mtu_;
+
+		int timeout_;
+
+		int max_sessions_;
+
+		int max_pending_;
+
+		int handshake_timeout_;
+
+		struct KcpPending
+		{
+			uint32_t conv;
+			uint32_t expires;
+		};
+
+		// handshakes answered but not yet followed by a kcp packet
+		std::map<asio::ip::udp::endpoint, KcpPending> pending_;
+
+		uint32_t last_sweep_;
+
+		std::minstd_rand random_;
+
+		SpinLock session_lock_;
+
+		typedef std::unordered_map<int, KcpSessionPtr> KcpSessionMap;
+
+		KcpSessionMap sessions_;
+
+		std::map<asio::ip::udp::endpoint, int> endpoints_;
 
+		int next_session_;
 	};
 }
 
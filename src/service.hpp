@@ -46,6 +46,16 @@ namespace tengine
 		kMessageWebServerClose,
 		kMessageWebServerError,
 
+		kMessageKcpServerAccept,
+		kMessageKcpServerRead,
+		kMessageKcpServerClosed,
+
+		kMessageShmChannelConnected,
+		kMessageShmChannelRead,
+		kMessageShmChannelClosed,
+
+		kMessageUdpChannelError,
+
 		kMessageInternal,
 
 		kMessageCount,
@@ -0,0 +1,496 @@
+#include "shm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace tengine
+{
+	namespace
+	{
+		constexpr uint32_t kMagic = 0x544d5348; // "TSHM"
+		constexpr uint32_t kVersion = 2;
+		constexpr uint32_t kPadding = 0xffffffff;
+		constexpr std::size_t kMinCapacity = 64 * 1024;
+		constexpr std::size_t kDataOffset = 4096;
+		// an attached side refreshes its heartbeat at least this often
+		constexpr int kHeartbeat = 250;
+		// and is taken for dead when it has not for this long
+		constexpr uint64_t kStale = 3000;
+
+		inline uint64_t align8(uint64_t n)
+		{
+			return (n + 7) & ~(uint64_t)7;
+		}
+	}
+
+	struct ShmSegment::Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t capacity;
+		// pid of each side, 0 when detached; identity only, pids do not
+		// mean anything across pid namespaces
+		std::atomic<uint32_t> owners[2];
+		// CLOCK_MONOTONIC milliseconds each side last showed signs of life
+		std::atomic<uint64_t> heartbeats[2];
+	};
+
+	struct ShmSegment::Ring
+	{
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+		alignas(64) std::atomic<uint32_t> signal;
+		std::atomic<uint32_t> waiting;
+	};
+
+	ShmSegment::ShmSegment()
+		: path_()
+		, fd_(-1)
+		, base_(nullptr)
+		, length_(0)
+		, header_(nullptr)
+		, side_(-1)
+		, capacity_(0)
+		, in_(nullptr)
+		, in_data_(nullptr)
+		, out_(nullptr)
+		, out_data_(nullptr)
+	{
+
+	}
+
+	ShmSegment::~ShmSegment()
+	{
+		close();
+	}
+
+#if defined(__linux__)
+	namespace
+	{
+		// the monotonic clock is shared by every process on the host
+		uint64_t now()
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+		}
+
+		// not FUTEX_PRIVATE: the word is shared with another process
+		void futex_wait(std::atomic<uint32_t> *word, uint32_t value, int milliseconds)
+		{
+			struct timespec ts;
+			ts.tv_sec = milliseconds / 1000;
+			ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+			::syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, value, &ts, nullptr, 0);
+		}
+
+		void futex_wake(std::atomic<uint32_t> *word)
+		{
+			::syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+		}
+	}
+
+	bool ShmSegment::open(const std::string& name, std::size_t size, std::string& error)
+	{
+		if (name.empty() || name.find('/') != std::string::npos)
+		{
+			error = "invalid shared memory name";
+			return false;
+		}
+
+		uint64_t capacity = kMinCapacity;
+		while (capacity < size)
+			capacity <<= 1;
+
+		path_ = "/tengine." + name;
+
+		// the last peer unlinks the name on close; if that raced with our
+		// shm_open we hold a dead object, so open the name again
+		for (int retry = 0; retry < 3; retry++)
+		{
+			fd_ = ::shm_open(path_.c_str(), O_CREAT | O_RDWR, 0600);
+			if (fd_ < 0)
+			{
+				error = std::strerror(errno);
+				return false;
+			}
+
+			::flock(fd_, LOCK_EX);
+
+			struct stat st;
+			if (::fstat(fd_, &st) == 0 && st.st_nlink > 0)
+			{
+				if (st.st_size > 0)
+				{
+					// an existing segment keeps the capacity it was created with
+					Header existing;
+					if (::pread(fd_, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing)
+						&& existing.magic == kMagic && existing.version == kVersion)
+						capacity = existing.capacity;
+				}
+
+				break;
+			}
+
+			::flock(fd_, LOCK_UN);
+			::close(fd_);
+			fd_ = -1;
+		}
+
+		if (fd_ < 0)
+		{
+			error = "shared memory segment is being removed";
+			return false;
+		}
+
+		length_ = kDataOffset + 2 * capacity;
+
+		void *base = MAP_FAILED;
+		if (::ftruncate(fd_, length_) == 0)
+			base = ::mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+
+		if (base == MAP_FAILED)
+		{
+			error = std::strerror(errno);
+			::flock(fd_, LOCK_UN);
+			::close(fd_);
+			fd_ = -1;
+			return false;
+		}
+
+		static_assert(sizeof(Header) <= 128 && 128 + 2 * sizeof(Ring) <= kDataOffset,
+			"shm control block layout");
+
+		base_ = (char*)base;
+		header_ = (Header*)base_;
+		capacity_ = capacity;
+
+		Ring *rings = (Ring*)(base_ + 128);
+
+		if (header_->magic != kMagic || header_->version != kVersion)
+		{
+			std::memset(base_, 0, kDataOffset);
+			header_->version = kVersion;
+			header_->capacity = capacity_;
+			header_->magic = kMagic;
+		}
+
+		uint32_t pid = (uint32_t)::getpid();
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (!alive(i))
+			{
+				side_ = i;
+				break;
+			}
+		}
+
+		if (side_ < 0)
+		{
+			::flock(fd_, LOCK_UN);
+			error = "shared memory channel already has two peers";
+			close();
+			return false;
+		}
+
+		int peer = 1 - side_;
+
+		// nobody is listening on the other side, drop whatever a dead peer left
+		if (!alive(peer))
+		{
+			header_->owners[peer].store(0);
+
+			for (int i = 0; i < 2; i++)
+			{
+				rings[i].head.store(0);
+				rings[i].tail.store(0);
+			}
+		}
+
+		header_->heartbeats[side_].store(now());
+		header_->owners[side_].store(pid);
+
+		out_ = &rings[side_];
+		out_data_ = base_ + kDataOffset + side_ * capacity_;
+		in_ = &rings[peer];
+		in_data_ = base_ + kDataOffset + peer * capacity_;
+
+		::flock(fd_, LOCK_UN);
+
+		// let a waiting peer see us
+		signal(out_);
+
+		return true;
+	}
+
+	void ShmSegment::close()
+	{
+		if (!header_)
+		{
+			if (fd_ >= 0)
+			{
+				::close(fd_);
+				fd_ = -1;
+			}
+			return;
+		}
+
+		::flock(fd_, LOCK_EX);
+
+		if (side_ >= 0)
+		{
+			header_->owners[side_].store(0);
+
+			if (!alive(1 - side_))
+				::shm_unlink(path_.c_str());
+
+			// the peer's reader notices we are gone
+			signal(out_);
+		}
+
+		::flock(fd_, LOCK_UN);
+
+		::munmap(base_, length_);
+		::close(fd_);
+
+		fd_ = -1;
+		base_ = nullptr;
+		header_ = nullptr;
+		side_ = -1;
+		in_ = out_ = nullptr;
+		in_data_ = out_data_ = nullptr;
+	}
+
+	bool ShmSegment::peer_attached() const
+	{
+		if (!header_)
+			return false;
+
+		return alive(1 - side_);
+	}
+
+	bool ShmSegment::alive(int side) const
+	{
+		if (header_->owners[side].load() == 0)
+			return false;
+
+		// a process that died without closing stops beating
+		return now() - header_->heartbeats[side].load() < kStale;
+	}
+
+	void ShmSegment::heartbeat()
+	{
+		uint64_t current = now();
+		if (current - header_->heartbeats[side_].load(std::memory_order_relaxed) >= (uint64_t)kHeartbeat)
+			header_->heartbeats[side_].store(current, std::memory_order_relaxed);
+	}
+
+	std::size_t ShmSegment::max_message() const
+	{
+		return (std::size_t)(capacity_ / 4);
+	}
+
+	bool ShmSegment::push(const char *data, std::size_t size)
+	{
+		if (!header_ || size + 4 > max_message())
+			return false;
+
+		uint64_t record = align8(4 + size);
+		uint64_t head = out_->head.load(std::memory_order_relaxed);
+		uint64_t tail = out_->tail.load(std::memory_order_acquire);
+
+		uint64_t offset = head & (capacity_ - 1);
+		uint64_t contiguous = capacity_ - offset;
+		uint64_t need = record > contiguous ? contiguous + record : record;
+
+		if (head + need - tail > capacity_)
+			return false;
+
+		// a record never wraps, skip to the start of the ring instead
+		if (record > contiguous)
+		{
+			std::memcpy(out_data_ + offset, &kPadding, 4);
+			head += contiguous;
+			offset = 0;
+		}
+
+		uint32_t length = (uint32_t)size;
+		std::memcpy(out_data_ + offset, &length, 4);
+		std::memcpy(out_data_ + offset + 4, data, size);
+
+		out_->head.store(head + record);
+
+		if (out_->waiting.load())
+			signal(out_);
+
+		return true;
+	}
+
+	bool ShmSegment::pop(char *&data, std::size_t& size)
+	{
+		if (!header_)
+			return false;
+
+		heartbeat();
+
+		uint64_t head = in_->head.load(std::memory_order_acquire);
+		uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+
+		if (head == tail)
+			return false;
+
+		// the peer is not trusted: a head beyond the ring is corruption too
+		if (head - tail > capacity_ || ((head | tail) & 7) != 0)
+		{
+			std::fprintf(stderr, "shm %s: bad ring head %llu tail %llu, dropping it\n",
+				path_.c_str(), (unsigned long long)head, (unsigned long long)tail);
+			in_->tail.store(head, std::memory_order_release);
+			return false;
+		}
+
+		char *buffer = (char*)ccmalloc((std::size_t)(head - tail));
+		if (!buffer)
+			return false;
+
+		std::size_t pos = 0;
+
+		while (tail != head)
+		{
+			uint64_t offset = tail & (capacity_ - 1);
+			uint64_t contiguous = capacity_ - offset;
+			uint64_t available = head - tail;
+
+			uint32_t length;
+			std::memcpy(&length, in_data_ + offset, 4);
+
+			if (length == kPadding && contiguous <= available)
+			{
+				tail += contiguous;
+				continue;
+			}
+
+			// a record never wraps and never outgrows what push lets through
+			uint64_t record = align8(4 + (uint64_t)length);
+			if (4 + (uint64_t)length > max_message() || record > contiguous || record > available)
+			{
+				std::fprintf(stderr, "shm %s: bad record length %u, dropping %llu bytes\n",
+					path_.c_str(), length, (unsigned long long)available);
+				tail = head;
+				break;
+			}
+
+			std::memcpy(buffer + pos, in_data_ + offset, 4 + length);
+			pos += 4 + length;
+			tail += record;
+		}
+
+		in_->tail.store(tail, std::memory_order_release);
+
+		if (pos == 0)
+		{
+			ccfree(buffer);
+			return false;
+		}
+
+		data = buffer;
+		size = pos;
+
+		return true;
+	}
+
+	void ShmSegment::wait(int milliseconds)
+	{
+		if (!header_)
+			return;
+
+		heartbeat();
+
+		uint32_t value = in_->signal.load();
+
+		in_->waiting.store(1);
+
+		// wake up in time to keep our heartbeat fresh
+		if (in_->head.load() == in_->tail.load(std::memory_order_relaxed))
+			futex_wait(&in_->signal, value, std::min(milliseconds, kHeartbeat));
+
+		in_->waiting.store(0);
+	}
+
+	void ShmSegment::wake()
+	{
+		if (header_)
+			signal(in_);
+	}
+
+	void ShmSegment::signal(Ring *ring)
+	{
+		ring->signal.fetch_add(1);
+		futex_wake(&ring->signal);
+	}
+#else
+	bool ShmSegment::open(const std::string& name, std::size_t size, std::string& error)
+	{
+		error = "shared memory channel is not supported on this platform";
+		return false;
+	}
+
+	void ShmSegment::close()
+	{
+	}
+
+	bool ShmSegment::peer_attached() const
+	{
+		return false;
+	}
+
+	std::size_t ShmSegment::max_message() const
+	{
+		return 0;
+	}
+
+	bool ShmSegment::push(const char *data, std::size_t size)
+	{
+		return false;
+	}
+
+	bool ShmSegment::pop(char *&data, std::size_t& size)
+	{
+		return false;
+	}
+
+	void ShmSegment::wait(int milliseconds)
+	{
+	}
+
+	void ShmSegment::wake()
+	{
+	}
+
+	void ShmSegment::signal(Ring *ring)
+	{
+	}
+
+	bool ShmSegment::alive(int side) const
+	{
+		return false;
+	}
+
+	void ShmSegment::heartbeat()
+	{
+	}
+#endif
+}
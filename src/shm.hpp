@@ -0,0 +1,91 @@
+#ifndef TENGINE_SHM_HPP
+#define TENGINE_SHM_HPP
+
+#include "allocator.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace tengine
+{
+	// a named shared memory segment holding two single-producer/single-consumer
+	// byte rings, one per direction. the first process to open a name takes
+	// side 0 and the second side 1; a blocked reader is woken with a futex
+	// on the ring, so an idle channel costs no cpu and a busy one no syscalls.
+	// records are [uint32 length][payload], padded to 8 bytes. a side is
+	// attached while its reader keeps a heartbeat in the segment fresh, which
+	// also holds across pid namespaces.
+	class ShmSegment : public Allocator
+	{
+	public:
+		ShmSegment();
+
+		ShmSegment(const ShmSegment&) = delete;
+
+		ShmSegment& operator=(const ShmSegment&) = delete;
+
+		~ShmSegment();
+
+		// size is the capacity of each direction, rounded up to a power of two
+		bool open(const std::string& name, std::size_t size, std::string& error);
+
+		void close();
+
+		bool is_open() const { return header_ != nullptr; }
+
+		bool peer_attached() const;
+
+		std::size_t max_message() const;
+
+		// producer side, false if the outbound ring is full
+		bool push(const char *data, std::size_t size);
+
+		// consumer side, takes every complete record at once into a ccmalloc
+		// buffer of back-to-back [uint32 length][payload] records; a record
+		// with a bad length drops the rest of the ring
+		bool pop(char *&data, std::size_t& size);
+
+		// block until inbound data or a wakeup, at most milliseconds
+		void wait(int milliseconds);
+
+		// wake our own reader
+		void wake();
+
+	private:
+		struct Header;
+
+		struct Ring;
+
+		void signal(Ring *ring);
+
+		bool alive(int side) const;
+
+		// pop and wait keep our side's heartbeat fresh
+		void heartbeat();
+
+		std::string path_;
+
+		int fd_;
+
+		char *base_;
+
+		std::size_t length_;
+
+		Header *header_;
+
+		int side_;
+
+		uint64_t capacity_;
+
+		Ring *in_;
+
+		char *in_data_;
+
+		Ring *out_;
+
+		char *out_data_;
+	};
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TENGINE_STREAM_HPP
+#define TENGINE_STREAM_HPP
+
+#include "asio.hpp"
+
+#include <cstring>
+#include <string>
+
+namespace tengine
+{
+	// one socket type for tcp and unix-domain streams, so channels and
+	// servers pick the transport from the address alone.
+	typedef asio::generic::stream_protocol::socket StreamSocket;
+
+	typedef asio::basic_socket_acceptor<asio::generic::stream_protocol> StreamAcceptor;
+
+	typedef asio::generic::stream_protocol::endpoint StreamEndpoint;
+
+	// "unix:/run/tengine/logic.sock" names a unix-domain socket
+	inline bool unix_address(const std::string& address, std::string& path)
+	{
+		if (address.compare(0, 5, "unix:") != 0)
+			return false;
+
+		path = address.substr(5);
+		return true;
+	}
+
+	inline bool unix_endpoint(const std::string& path, StreamEndpoint& endpoint)
+	{
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		endpoint = asio::local::stream_protocol::endpoint(path);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	inline bool tcp_endpoint(const StreamEndpoint& endpoint, asio::ip::tcp::endpoint& ep)
+	{
+		int family = endpoint.protocol().family();
+		if (family != AF_INET && family != AF_INET6)
+			return false;
+
+		std::memcpy(ep.data(), endpoint.data(), endpoint.size());
+		ep.resize(endpoint.size());
+		return true;
+	}
+
+	inline std::string endpoint_address(const StreamEndpoint& endpoint)
+	{
+		asio::ip::tcp::endpoint ep;
+		if (!tcp_endpoint(endpoint, ep))
+			return "unix";
+
+		return ep.address().to_string();
+	}
+}
+
+#endif
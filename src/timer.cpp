@@ -3,6 +3,7 @@
 #include "context.hpp"
 
 #include "dispatch.hpp"
+#include "executor.hpp"
 
 #include <chrono>
 #include <thread>
@@ -12,29 +13,9 @@ using namespace std::chrono;
 
 namespace tengine
 {
-	namespace
-	{
-		struct TimerFunction
-		{
-			asio::io_service& io_service_;
-
-			TimerFunction(asio::io_service& io_service)
-				: io_service_(io_service)
-			{}
-
-			void operator()()
-			{
-				asio::error_code ec;
-				io_service_.run(ec);
-			}
-		};
-	}
-
 	Timer::Timer(Context& context)
 		: Service(context)
-		, io_service_()
-		, work_(io_service_)
-		, thread_(TimerFunction(io_service_))
+		, io_service_(context.service_executor().io_service())
 		, timer_events_()
 	{
 
@@ -42,8 +23,12 @@ namespace tengine
 
 	Timer::~Timer()
 	{
-		io_service_.stop();
-		thread_.join();
+		// the service loop is parked by now, pending waits never complete
+		for (TimerEvent *event : timer_events_)
+		{
+			delete event->timer;
+			ccfree(event);
+		}
 	}
 
 	int Timer::init(const char* name)
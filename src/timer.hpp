@@ -7,7 +7,6 @@
 #include "service.hpp"
 
 #include <set>
-#include <thread>
 
 #include <stdint.h>
 
@@ -65,11 +64,8 @@ namespace tengine
 
 		void on_timer(TimerEvent* event, const asio::error_code& ec);
 
-		asio::io_service io_service_;
-
-		asio::io_service::work work_;
-
-		std::thread thread_;
+		// the context service loop, shared with node and watchdog
+		asio::io_service& io_service_;
 
 		TimerEventHolder timer_events_;
 	};
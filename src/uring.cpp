@@ -0,0 +1,890 @@
+#include "uring.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// multishot recv and provided buffer rings need linux 6.0 headers
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define TENGINE_HAS_URING
+#endif
+#endif
+
+namespace tengine
+{
+	struct UringEngine::Operation
+	{
+		enum Type { kAccept, kRecv, kSend, kCancel };
+
+		Type type;
+
+		SocketPtr socket;
+	};
+
+	class UringEngine::Socket
+	{
+	public:
+		Socket(int fd)
+			: fd(fd)
+			, closed(false)
+			, accept_op(nullptr)
+			, recv_op(nullptr)
+			, send_op(nullptr)
+			, sent(0)
+		{
+
+		}
+
+		int fd;
+
+		bool closed;
+
+		Operation *accept_op;
+
+		Operation *recv_op;
+
+		Operation *send_op;
+
+		AcceptHandler accept_handler;
+
+		RecvHandler recv_handler;
+
+		// sends queue up in pending while one batch is in flight
+		std::vector<char> pending;
+
+		std::vector<char> sending;
+
+		std::size_t sent;
+	};
+
+#if defined(TENGINE_HAS_URING)
+	namespace
+	{
+		constexpr unsigned short kBufferGroup = 0;
+
+		int uring_setup(unsigned entries, struct io_uring_params *p)
+		{
+			return (int)::syscall(__NR_io_uring_setup, entries, p);
+		}
+
+		int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+		{
+			return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+		}
+
+		int uring_register(int fd, unsigned opcode, void *arg, unsigned args)
+		{
+			return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, args);
+		}
+
+		unsigned round_pow2(unsigned n)
+		{
+			unsigned v = 1;
+			while (v < n)
+				v <<= 1;
+			return v;
+		}
+
+		void* map(int fd, std::size_t size, off_t offset)
+		{
+			void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, offset);
+			return p == MAP_FAILED ? nullptr : p;
+		}
+	}
+
+	struct UringEngine::Ring
+	{
+		Ring(asio::io_service& io_service)
+			: fd(-1)
+			, event(io_service)
+			, event_value(0)
+			, sq_ring(nullptr)
+			, sq_ring_size(0)
+			, sq_head(nullptr)
+			, sq_tail(nullptr)
+			, sq_flags(nullptr)
+			, sq_mask(0)
+			, sq_entries(0)
+			, sq_array(nullptr)
+			, sqes(nullptr)
+			, sqes_size(0)
+			, sq_local_tail(0)
+			, pending(0)
+			, cq_ring(nullptr)
+			, cq_ring_size(0)
+			, cq_head(nullptr)
+			, cq_tail(nullptr)
+			, cq_mask(0)
+			, cqes(nullptr)
+			, buf_ring(nullptr)
+			, buf_ring_size(0)
+			, buffers(nullptr)
+			, buffers_size(0)
+			, buffer_count(0)
+			, buffer_size(0)
+			, buf_tail(0)
+		{
+
+		}
+
+		~Ring()
+		{
+			asio::error_code ec;
+			event.close(ec);
+
+			// closing the ring cancels whatever is still in the kernel
+			if (fd >= 0)
+				::close(fd);
+
+			if (buffers)
+				::munmap(buffers, buffers_size);
+			if (buf_ring)
+				::munmap(buf_ring, buf_ring_size);
+			if (sqes)
+				::munmap(sqes, sqes_size);
+			if (cq_ring)
+				::munmap(cq_ring, cq_ring_size);
+			if (sq_ring)
+				::munmap(sq_ring, sq_ring_size);
+
+			for (Operation *op : operations)
+				delete op;
+		}
+
+		bool init(unsigned entries, unsigned count, unsigned size, std::string& error)
+		{
+			struct io_uring_params p;
+			std::memset(&p, 0, sizeof(p));
+
+			// multishot recv can produce many completions per submission
+			p.flags = IORING_SETUP_CQSIZE;
+			p.cq_entries = entries * 4;
+
+			fd = uring_setup(entries, &p);
+			if (fd < 0)
+				return fail("io_uring_setup", error);
+
+			if (!(p.features & IORING_FEAT_NODROP))
+			{
+				error = "io_uring may drop completions on this kernel";
+				return false;
+			}
+
+			sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+			sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+			sq_ring = map(fd, sq_ring_size, IORING_OFF_SQ_RING);
+			cq_ring = map(fd, cq_ring_size, IORING_OFF_CQ_RING);
+			sqes = (struct io_uring_sqe*)map(fd, sqes_size, IORING_OFF_SQES);
+			if (!sq_ring || !cq_ring || !sqes)
+				return fail("mmap", error);
+
+			char *sq = (char*)sq_ring;
+			sq_head = (unsigned*)(sq + p.sq_off.head);
+			sq_tail = (unsigned*)(sq + p.sq_off.tail);
+			sq_flags = (unsigned*)(sq + p.sq_off.flags);
+			sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+			sq_entries = p.sq_entries;
+			sq_array = (unsigned*)(sq + p.sq_off.array);
+			sq_local_tail = *sq_tail;
+
+			char *cq = (char*)cq_ring;
+			cq_head = (unsigned*)(cq + p.cq_off.head);
+			cq_tail = (unsigned*)(cq + p.cq_off.tail);
+			cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+			cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+			if (!probe(error))
+				return false;
+
+			// buffer ring, handed to the kernel for recv to pick from
+			buffer_count = round_pow2(count);
+			if (buffer_count > 32768)
+				buffer_count = 32768;
+			buffer_size = size;
+
+			buf_ring_size = buffer_count * sizeof(struct io_uring_buf);
+			buf_ring = (struct io_uring_buf_ring*)::mmap(nullptr, buf_ring_size,
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (buf_ring == MAP_FAILED)
+			{
+				buf_ring = nullptr;
+				return fail("mmap", error);
+			}
+
+			buffers_size = (std::size_t)buffer_count * buffer_size;
+			buffers = (char*)::mmap(nullptr, buffers_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (buffers == MAP_FAILED)
+			{
+				buffers = nullptr;
+				return fail("mmap", error);
+			}
+
+			struct io_uring_buf_reg reg;
+			std::memset(&reg, 0, sizeof(reg));
+			reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+			reg.ring_entries = buffer_count;
+			reg.bgid = kBufferGroup;
+
+			if (uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+				return fail("provided buffer ring", error);
+
+			for (unsigned i = 0; i < buffer_count; i++)
+				recycle((unsigned short)i);
+
+			int efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (efd < 0)
+				return fail("eventfd", error);
+
+			event.assign(efd);
+
+			if (uring_register(fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+				return fail("eventfd registration", error);
+
+			return true;
+		}
+
+		bool probe(std::string& error)
+		{
+			const unsigned n = 256;
+			std::vector<char> storage(sizeof(struct io_uring_probe) + n * sizeof(struct io_uring_probe_op));
+			struct io_uring_probe *p = (struct io_uring_probe*)storage.data();
+
+			if (uring_register(fd, IORING_REGISTER_PROBE, p, n) < 0)
+				return fail("io_uring probe", error);
+
+			const int required[] = {
+				IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL
+			};
+
+			for (int op : required)
+			{
+				if (op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED))
+				{
+					error = "io_uring lacks accept/recv/send/cancel";
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool fail(const char *what, std::string& error)
+		{
+			error = std::string(what) + ": " + std::strerror(errno);
+			return false;
+		}
+
+		struct io_uring_sqe* sqe()
+		{
+			unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+			if (sq_local_tail - head >= sq_entries)
+			{
+				submit();
+				head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+				if (sq_local_tail - head >= sq_entries)
+					return nullptr;
+			}
+
+			unsigned index = sq_local_tail & sq_mask;
+			struct io_uring_sqe *e = &sqes[index];
+			std::memset(e, 0, sizeof(*e));
+			sq_array[index] = index;
+			sq_local_tail++;
+			pending++;
+			return e;
+		}
+
+		void submit()
+		{
+			__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+
+			while (pending > 0)
+			{
+				int n = uring_enter(fd, pending, 0, 0);
+				if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					// completion queue backpressure, retried after the next reap
+					break;
+				}
+				pending -= (unsigned)n;
+				if (n == 0)
+					break;
+			}
+		}
+
+		void recycle(unsigned short bid)
+		{
+			// not buf_ring->bufs: the kernel header's flexible array member
+			// picks up a padding byte in c++ and lands at the wrong offset
+			unsigned mask = buffer_count - 1;
+			struct io_uring_buf *buf = (struct io_uring_buf*)buf_ring + (buf_tail & mask);
+			buf->addr = (uint64_t)(uintptr_t)(buffers + (std::size_t)bid * buffer_size);
+			buf->len = buffer_size;
+			buf->bid = bid;
+			buf_tail++;
+			__atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+		}
+
+		int fd;
+
+		asio::posix::stream_descriptor event;
+
+		uint64_t event_value;
+
+		void *sq_ring;
+
+		std::size_t sq_ring_size;
+
+		unsigned *sq_head;
+
+		unsigned *sq_tail;
+
+		unsigned *sq_flags;
+
+		unsigned sq_mask;
+
+		unsigned sq_entries;
+
+		unsigned *sq_array;
+
+		struct io_uring_sqe *sqes;
+
+		std::size_t sqes_size;
+
+		unsigned sq_local_tail;
+
+		unsigned pending;
+
+		void *cq_ring;
+
+		std::size_t cq_ring_size;
+
+		unsigned *cq_head;
+
+		unsigned *cq_tail;
+
+		unsigned cq_mask;
+
+		struct io_uring_cqe *cqes;
+
+		struct io_uring_buf_ring *buf_ring;
+
+		std::size_t buf_ring_size;
+
+		char *buffers;
+
+		std::size_t buffers_size;
+
+		unsigned buffer_count;
+
+		unsigned buffer_size;
+
+		unsigned short buf_tail;
+
+		// operations the kernel may still complete
+		std::unordered_set<Operation*> operations;
+	};
+
+	UringEngine* UringEngine::create(asio::io_service& io_service, unsigned entries,
+		unsigned buffers, unsigned buffer_size, std::string& error)
+	{
+		UringEngine *engine = new UringEngine(io_service);
+
+		engine->ring_ = new Ring(io_service);
+
+		if (!engine->ring_->init(round_pow2(entries), buffers, buffer_size, error))
+		{
+			delete engine;
+			return nullptr;
+		}
+
+		engine->do_wait();
+
+		return engine;
+	}
+
+	UringEngine::UringEngine(asio::io_service& io_service)
+		: io_service_(io_service)
+		, ring_(nullptr)
+		, multishot_(true)
+		, submit_scheduled_(false)
+	{
+
+	}
+
+	UringEngine::~UringEngine()
+	{
+		delete ring_;
+	}
+
+	UringEngine::SocketPtr UringEngine::attach(int fd)
+	{
+		return std::make_shared<Socket>(fd);
+	}
+
+	void UringEngine::accept(const SocketPtr& socket, AcceptHandler handler)
+	{
+		if (socket->closed || socket->accept_op)
+			return;
+
+		socket->accept_handler = std::move(handler);
+
+		Operation *op = new Operation{ Operation::kAccept, socket };
+		ring_->operations.insert(op);
+		socket->accept_op = op;
+
+		arm_accept(op);
+	}
+
+	void UringEngine::recv(const SocketPtr& socket, RecvHandler handler)
+	{
+		if (socket->closed || socket->recv_op)
+			return;
+
+		socket->recv_handler = std::move(handler);
+
+		Operation *op = new Operation{ Operation::kRecv, socket };
+		ring_->operations.insert(op);
+		socket->recv_op = op;
+
+		arm_recv(op);
+	}
+
+	void UringEngine::send(const SocketPtr& socket, const char *data, std::size_t size)
+	{
+		if (socket->closed || size == 0)
+			return;
+
+		socket->pending.insert(socket->pending.end(), data, data + size);
+
+		if (!socket->send_op)
+			start_send(socket);
+	}
+
+	void UringEngine::close(const SocketPtr& socket)
+	{
+		if (socket->closed)
+			return;
+
+		socket->closed = true;
+		socket->pending.clear();
+
+		if (socket->accept_op)
+			cancel(socket->accept_op);
+
+		if (socket->recv_op)
+			cancel(socket->recv_op);
+	}
+
+	void UringEngine::arm_accept(Operation *op)
+	{
+		struct io_uring_sqe *e = ring_->sqe();
+		if (!e)
+		{
+			// the ring is saturated, try again once completions drain
+			io_service_.post([this, op]() { arm_accept(op); });
+			return;
+		}
+
+		e->opcode = IORING_OP_ACCEPT;
+		e->fd = op->socket->fd;
+		e->accept_flags = SOCK_CLOEXEC;
+		if (multishot_)
+			e->ioprio |= IORING_ACCEPT_MULTISHOT;
+		e->user_data = (uint64_t)(uintptr_t)op;
+
+		schedule_submit();
+	}
+
+	void UringEngine::arm_recv(Operation *op)
+	{
+		struct io_uring_sqe *e = ring_->sqe();
+		if (!e)
+		{
+			io_service_.post([this, op]() { arm_recv(op); });
+			return;
+		}
+
+		e->opcode = IORING_OP_RECV;
+		e->fd = op->socket->fd;
+		e->flags = IOSQE_BUFFER_SELECT;
+		e->buf_group = kBufferGroup;
+		if (multishot_)
+			e->ioprio |= IORING_RECV_MULTISHOT;
+		e->user_data = (uint64_t)(uintptr_t)op;
+
+		schedule_submit();
+	}
+
+	void UringEngine::start_send(const SocketPtr& socket)
+	{
+		if (!socket->send_op)
+		{
+			socket->sending.swap(socket->pending);
+			socket->pending.clear();
+			socket->sent = 0;
+
+			Operation *op = new Operation{ Operation::kSend, socket };
+			ring_->operations.insert(op);
+			socket->send_op = op;
+		}
+
+		struct io_uring_sqe *e = ring_->sqe();
+		if (!e)
+		{
+			SocketPtr s = socket;
+			io_service_.post([this, s]() { start_send(s); });
+			return;
+		}
+
+		e->opcode = IORING_OP_SEND;
+		e->fd = socket->fd;
+		e->addr = (uint64_t)(uintptr_t)(socket->sending.data() + socket->sent);
+		e->len = (uint32_t)(socket->sending.size() - socket->sent);
+		e->msg_flags = MSG_NOSIGNAL;
+		e->user_data = (uint64_t)(uintptr_t)socket->send_op;
+
+		schedule_submit();
+	}
+
+	void UringEngine::cancel(Operation *target)
+	{
+		struct io_uring_sqe *e = ring_->sqe();
+		if (!e)
+		{
+			// the target is still registered until its final completion
+			io_service_.post([this, target]() {
+				if (ring_->operations.count(target))
+					cancel(target);
+			});
+			return;
+		}
+
+		Operation *op = new Operation{ Operation::kCancel, nullptr };
+		ring_->operations.insert(op);
+
+		e->opcode = IORING_OP_ASYNC_CANCEL;
+		e->addr = (uint64_t)(uintptr_t)target;
+		e->user_data = (uint64_t)(uintptr_t)op;
+
+		schedule_submit();
+	}
+
+	void UringEngine::schedule_submit()
+	{
+		// one io_uring_enter for everything queued by the current handler
+		if (submit_scheduled_)
+			return;
+
+		submit_scheduled_ = true;
+
+		io_service_.post([this]() {
+			submit_scheduled_ = false;
+			ring_->submit();
+		});
+	}
+
+	void UringEngine::do_wait()
+	{
+		ring_->event.async_read_some(asio::buffer(&ring_->event_value, sizeof(ring_->event_value)),
+			[this](const asio::error_code& ec, std::size_t) {
+			if (ec == asio::error::operation_aborted)
+				return;
+
+			reap();
+			do_wait();
+		});
+	}
+
+	void UringEngine::reap()
+	{
+		Ring *r = ring_;
+
+		for (;;)
+		{
+			unsigned head = *r->cq_head;
+			unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+			if (head == tail)
+			{
+				// completions the kernel kept aside while the queue was full
+				if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+				{
+					uring_enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS);
+					if (*r->cq_head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+						continue;
+				}
+				break;
+			}
+
+			struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+			Operation *op = (Operation*)(uintptr_t)cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+
+			__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+			complete(op, res, flags);
+		}
+
+		if (r->pending > 0)
+			r->submit();
+	}
+
+	void UringEngine::complete(Operation *op, int res, unsigned flags)
+	{
+		Ring *r = ring_;
+
+		bool more = (flags & IORING_CQE_F_MORE) != 0;
+
+		auto finish = [r](Operation *op) {
+			r->operations.erase(op);
+			delete op;
+		};
+
+		switch (op->type)
+		{
+		case Operation::kCancel:
+			finish(op);
+			break;
+
+		case Operation::kAccept:
+		{
+			SocketPtr socket = op->socket;
+
+			if (res == -EINVAL && multishot_ && !more && !socket->closed)
+			{
+				// kernel without multishot, re-arm after every connection
+				multishot_ = false;
+				arm_accept(op);
+				break;
+			}
+
+			if (socket->closed)
+			{
+				if (res >= 0)
+					::close(res);
+			}
+			else if (res >= 0)
+			{
+				socket->accept_handler(res, asio::error_code());
+			}
+			else if (res != -EAGAIN && res != -EINTR && res != -ECANCELED)
+			{
+				socket->accept_handler(-1, asio::error_code(-res, asio::error::get_system_category()));
+			}
+
+			if (more)
+				break;
+
+			if (!socket->closed)
+			{
+				arm_accept(op);
+				break;
+			}
+
+			socket->accept_op = nullptr;
+			socket->accept_handler = nullptr;
+			finish(op);
+			break;
+		}
+
+		case Operation::kRecv:
+		{
+			SocketPtr socket = op->socket;
+
+			bool has_buffer = (flags & IORING_CQE_F_BUFFER) != 0;
+			unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+			if (!socket->closed)
+			{
+				if (res == -EINVAL && multishot_ && !more)
+				{
+					multishot_ = false;
+					arm_recv(op);
+					break;
+				}
+
+				// all buffers were taken, they are back by the time we see this
+				if (res == -ENOBUFS || res == -EAGAIN || res == -EINTR)
+				{
+					if (!more)
+						arm_recv(op);
+					break;
+				}
+
+				if (res > 0)
+				{
+					socket->recv_handler(r->buffers + (std::size_t)bid * r->buffer_size,
+						(std::size_t)res, asio::error_code());
+
+					if (has_buffer)
+						r->recycle(bid);
+
+					if (!more && !socket->closed)
+						arm_recv(op);
+
+					// a handler that closed the socket hears back on the final completion
+					if (more || !socket->closed)
+						break;
+				}
+			}
+			else if (has_buffer)
+			{
+				r->recycle(bid);
+			}
+
+			if (more)
+				break;
+
+			asio::error_code ec;
+			if (socket->closed)
+				ec = asio::error::operation_aborted;
+			else if (res < 0)
+				ec = asio::error_code(-res, asio::error::get_system_category());
+
+			RecvHandler handler;
+			handler.swap(socket->recv_handler);
+			socket->recv_op = nullptr;
+			finish(op);
+
+			handler(nullptr, 0, ec);
+			break;
+		}
+
+		case Operation::kSend:
+		{
+			SocketPtr socket = op->socket;
+
+			if (res == -EAGAIN || res == -EINTR)
+			{
+				start_send(socket);
+				break;
+			}
+
+			if (res < 0 || socket->closed)
+			{
+				// let the reader see the failure and tear the session down
+				if (res < 0 && !socket->closed)
+					::shutdown(socket->fd, SHUT_RDWR);
+
+				socket->sending.clear();
+				socket->pending.clear();
+				socket->send_op = nullptr;
+				finish(op);
+				break;
+			}
+
+			socket->sent += (std::size_t)res;
+
+			if (socket->sent < socket->sending.size())
+			{
+				start_send(socket);
+				break;
+			}
+
+			socket->sending.clear();
+			socket->send_op = nullptr;
+			finish(op);
+
+			if (!socket->pending.empty())
+				start_send(socket);
+			break;
+		}
+		}
+	}
+#else
+	struct UringEngine::Ring
+	{
+	};
+
+	UringEngine* UringEngine::create(asio::io_service& io_service, unsigned entries,
+		unsigned buffers, unsigned buffer_size, std::string& error)
+	{
+		error = "io_uring is not supported on this platform";
+		return nullptr;
+	}
+
+	UringEngine::UringEngine(asio::io_service& io_service)
+		: io_service_(io_service)
+		, ring_(nullptr)
+		, multishot_(false)
+		, submit_scheduled_(false)
+	{
+
+	}
+
+	UringEngine::~UringEngine()
+	{
+		delete ring_;
+	}
+
+	UringEngine::SocketPtr UringEngine::attach(int fd)
+	{
+		return std::make_shared<Socket>(fd);
+	}
+
+	void UringEngine::accept(const SocketPtr& socket, AcceptHandler handler)
+	{
+	}
+
+	void UringEngine::recv(const SocketPtr& socket, RecvHandler handler)
+	{
+	}
+
+	void UringEngine::send(const SocketPtr& socket, const char *data, std::size_t size)
+	{
+	}
+
+	void UringEngine::close(const SocketPtr& socket)
+	{
+	}
+
+	void UringEngine::do_wait()
+	{
+	}
+
+	void UringEngine::reap()
+	{
+	}
+
+	void UringEngine::complete(Operation *op, int res, unsigned flags)
+	{
+	}
+
+	void UringEngine::arm_accept(Operation *op)
+	{
+	}
+
+	void UringEngine::arm_recv(Operation *op)
+	{
+	}
+
+	void UringEngine::start_send(const SocketPtr& socket)
+	{
+	}
+
+	void UringEngine::cancel(Operation *op)
+	{
+	}
+
+	void UringEngine::schedule_submit()
+	{
+	}
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef TENGINE_URING_HPP
+#define TENGINE_URING_HPP
+
+#include "asio.hpp"
+
+#include "allocator.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace tengine
+{
+	// io_uring backend for stream sockets, driven from the network thread.
+	// completions are signalled through an eventfd watched by the io_service,
+	// so uring sockets and asio sockets share the same thread. accept and recv
+	// are multishot where the kernel supports it, received data lands in a
+	// registered buffer ring, and queued sends go out as one sendmsg batch.
+	// every call except create must be made on the io_service thread.
+	class UringEngine : public Allocator
+	{
+	public:
+		class Socket;
+
+		typedef std::shared_ptr<Socket> SocketPtr;
+
+		typedef std::function<void(int fd, const asio::error_code& ec)> AcceptHandler;
+
+		// size 0 without an error means the peer closed the connection.
+		// data is only valid during the call.
+		typedef std::function<void(const char *data, std::size_t size,
+			const asio::error_code& ec)> RecvHandler;
+
+		// nullptr and a reason when io_uring is unusable on this kernel
+		static UringEngine* create(asio::io_service& io_service, unsigned entries,
+			unsigned buffers, unsigned buffer_size, std::string& error);
+
+		UringEngine(const UringEngine&) = delete;
+
+		UringEngine& operator=(const UringEngine&) = delete;
+
+		~UringEngine();
+
+		asio::io_service& io_service() { return io_service_; }
+
+		// the caller keeps owning fd and closes it after close(socket)
+		SocketPtr attach(int fd);
+
+		void accept(const SocketPtr& socket, AcceptHandler handler);
+
+		void recv(const SocketPtr& socket, RecvHandler handler);
+
+		void send(const SocketPtr& socket, const char *data, std::size_t size);
+
+		// cancel outstanding operations, a pending recv handler is called
+		// once more with operation_aborted
+		void close(const SocketPtr& socket);
+
+	private:
+		// ring mappings and descriptors, platform specific
+		struct Ring;
+
+		struct Operation;
+
+		UringEngine(asio::io_service& io_service);
+
+		void do_wait();
+
+		void reap();
+
+		void complete(Operation *op, int res, unsigned flags);
+
+		void arm_accept(Operation *op);
+
+		void arm_recv(Operation *op);
+
+		void start_send(const SocketPtr& socket);
+
+		void cancel(Operation *op);
+
+		void schedule_submit();
+
+		asio::io_service& io_service_;
+
+		Ring *ring_;
+
+		bool multishot_;
+
+		bool submit_scheduled_;
+	};
+}
+
+#endif
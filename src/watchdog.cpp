@@ -185,8 +185,7 @@ namespace tengine
 
 	WatchDog::WatchDog(Context& context)
 		: Service(context)
-		, executor_(new Executor())
-		, timer_(executor_->io_service())
+		, timer_(context.service_executor().io_service())
 		, file_watchers_()
 	{
 
@@ -196,9 +195,8 @@ namespace tengine
 	{
 		timer_.cancel();
 
-		delete executor_;
-		executor_ = nullptr;
-
+		for (auto& watcher : file_watchers_)
+			delete watcher.second;
 	}
 
 	int WatchDog::init(const char* name)
@@ -211,8 +209,6 @@ namespace tengine
 
 		context_.register_name(this, "WatchDog");
 
-		executor_->run();
-
 		do_watch();
 
 		return 0;
@@ -263,7 +259,7 @@ namespace tengine
 
 		Watcher *watcher = new Watcher(*this, src->id(), p, filter);
 
-		asio::post(executor_->executor(),
+		asio::post(context_.service_executor().executor(),
 			[=]
 		{
 			if (file_watchers_.find(key) == file_watchers_.end())
@@ -279,7 +275,7 @@ namespace tengine
 	{
 		std::string key = path.string();
 
-		asio::post(executor_->executor(),
+		asio::post(context_.service_executor().executor(),
 			[=]
 		{
 			if (path.empty())
@@ -16,8 +16,6 @@ namespace fs = std::experimental::filesystem;
 
 namespace tengine
 {
-	class Executor;
-
 	class Watcher;
 
     class WatchDog : public Service
@@ -43,8 +41,7 @@ namespace tengine
 
 		void do_watch();
 
-		Executor *executor_;
-
+		// runs on the context service loop, as do all watcher updates
 		asio::steady_timer timer_;
 
 		std::map<std::string, Watcher*> file_watchers_;
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# gossip.py [gossip_node binary]: runs a few members on loopback and checks
+# that they find each other, that a killed member is suspected and then
+# declared dead by all the others, that it rejoins when restarted, that a
+# member with another key is kept out and that a member leaving is seen
+# dead. exits non-zero on the first check that fails
+
+import os
+import signal
+import subprocess
+import sys
+import threading
+import time
+
+BINARY = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "bin", "gossip_node")
+BASE_PORT = 27500
+KEY = "gossip test key"
+NODES = 4
+
+
+class Member(object):
+    def __init__(self, node, key=KEY):
+        self.node = node
+        self.view = {}
+        # every (node, state) this member has seen
+        self.seen = set()
+        seeds = [str(BASE_PORT + 1)] if node != 1 else []
+        self.process = subprocess.Popen([BINARY, str(node), str(BASE_PORT + node), key] + seeds,
+                                        stdout=subprocess.PIPE, universal_newlines=True)
+        self.reader = threading.Thread(target=self.read)
+        self.reader.daemon = True
+        self.reader.start()
+
+    def read(self):
+        for line in self.process.stdout:
+            fields = line.split()
+            if not fields or fields[0] != "view":
+                continue
+            view = {}
+            for item in fields[1:]:
+                node, state, _ = item.split(":")
+                view[int(node)] = state
+                self.seen.add((int(node), state))
+            self.view = view
+
+    def state(self, node):
+        return self.view.get(node)
+
+    def stop(self, sig=signal.SIGTERM):
+        if self.process.poll() is None:
+            self.process.send_signal(sig)
+        self.process.wait()
+
+
+def wait(what, predicate, limit=15):
+    start = time.time()
+    while time.time() - start < limit:
+        if predicate():
+            print("ok %s (%.1fs)" % (what, time.time() - start))
+            return
+        time.sleep(0.05)
+    print("FAILED %s" % what)
+    raise SystemExit(1)
+
+
+def main():
+    members = {}
+    try:
+        for node in range(1, NODES + 1):
+            members[node] = Member(node)
+
+        wait("%d members see each other alive" % NODES, lambda: all(
+            all(m.state(node) == "alive" for node in members) for m in members.values()))
+
+        # a crash: no goodbye, the others have to find out by probing
+        victim = NODES
+        members[victim].stop(signal.SIGKILL)
+        survivors = [m for node, m in members.items() if node != victim]
+
+        wait("killed member %d is dead everywhere" % victim,
+             lambda: all(m.state(victim) == "dead" for m in survivors))
+        for m in survivors:
+            if (victim, "suspect") not in m.seen:
+                print("FAILED member %d declared %d dead without suspecting it first" % (m.node, victim))
+                raise SystemExit(1)
+        print("ok each survivor suspected %d before declaring it dead" % victim)
+
+        members[victim] = Member(victim)
+        wait("restarted member %d rejoins" % victim, lambda: all(
+            all(m.state(node) == "alive" for node in members) for m in members.values()))
+
+        # another cluster's key: its packets are dropped, and so are ours there
+        stranger = NODES + 1
+        members[stranger] = Member(stranger, key="another key")
+        time.sleep(2)
+        known = [m.node for node, m in members.items() if node != stranger and m.state(stranger)]
+        if known or len(members[stranger].view) != 1:
+            print("FAILED member with another key got in: known to %s, knows %s" % (known, members[stranger].view))
+            raise SystemExit(1)
+        print("ok member with another key is kept out")
+        members.pop(stranger).stop()
+
+        # a clean exit tells the others
+        leaver = 2
+        members.pop(leaver).stop()
+        wait("member %d leaving is dead everywhere" % leaver,
+             lambda: all(m.state(leaver) == "dead" for m in members.values()), limit=2)
+    finally:
+        for m in members.values():
+            m.stop()
+
+
+if __name__ == "__main__":
+    main()
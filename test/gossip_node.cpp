@@ -0,0 +1,83 @@
+#include "membership.hpp"
+#include "resolver.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+using namespace tengine;
+
+namespace
+{
+	std::atomic<bool> stopped(false);
+}
+
+// gossip_node <node> <port> <key> [seed port ...]: one member on loopback
+// with short timers, printing its view every 100ms as
+// "view <node>:<state>:<incarnation> ..." until SIGTERM. driven by gossip.py
+int main(int argc, char *argv[])
+{
+	if (argc < 4)
+	{
+		fprintf(stderr, "usage: %s node port key [seed port ...]\n", argv[0]);
+		return 2;
+	}
+
+	signal(SIGTERM, [](int) { stopped = true; });
+	signal(SIGINT, [](int) { stopped = true; });
+
+	Membership::Options options;
+	options.node = atoi(argv[1]);
+	options.port = atoi(argv[2]);
+	options.key = argv[3];
+	options.probe_interval = 100;
+	options.probe_timeout = 40;
+	options.sync_interval = 1000;
+	options.dead_timeout = 30000;
+
+	for (int i = 4; i < argc; i++)
+		options.seeds.push_back(std::string("127.0.0.1:") + argv[i]);
+
+	asio::io_service io_service;
+	asio::io_service::work work(io_service);
+	Resolver resolver(io_service, 60, 5);
+
+	auto membership = std::make_shared<Membership>(resolver, io_service, options);
+
+	std::thread thread([&io_service]() { io_service.run(); });
+
+	if (membership->start() != 0)
+	{
+		io_service.stop();
+		thread.join();
+		return 1;
+	}
+
+	while (!stopped)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		std::string line = "view";
+		for (auto& member : membership->members())
+		{
+			line += " " + std::to_string(member.node) + ":" + Membership::state_name(member.state)
+				+ ":" + std::to_string(member.incarnation);
+		}
+
+		fprintf(stdout, "%s\n", line.c_str());
+		fflush(stdout);
+	}
+
+	// tells the others we are leaving
+	membership->close();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	io_service.stop();
+	thread.join();
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include "test.hpp"
+
+#include "kcp.hpp"
+
+#include <cstring>
+#include <deque>
+
+using namespace tengine;
+
+namespace
+{
+	// ikcp segment header, little endian
+	std::string segment(uint32_t conv, uint8_t cmd, uint8_t frg, uint16_t wnd, uint32_t ts,
+		uint32_t sn, uint32_t una, const std::string& data)
+	{
+		std::string bytes;
+		auto put = [&bytes](uint32_t value, int size)
+		{
+			for (int i = 0; i < size; i++)
+				bytes += (char)(value >> (8 * i));
+		};
+
+		put(conv, 4);
+		put(cmd, 1);
+		put(frg, 1);
+		put(wnd, 2);
+		put(ts, 4);
+		put(sn, 4);
+		put(una, 4);
+		put((uint32_t)data.size(), 4);
+		return bytes + data;
+	}
+
+	// two ends wired back to back, dropping every drop-th packet when set
+	struct Link
+	{
+		std::deque<std::string> to_a;
+		std::deque<std::string> to_b;
+		int sent = 0;
+		int drop = 0;
+
+		Kcp::Output output(std::deque<std::string>& queue)
+		{
+			return [this, &queue](const char *data, std::size_t size)
+			{
+				if (drop > 0 && ++sent % drop == 0)
+					return;
+				queue.push_back(std::string(data, size));
+			};
+		}
+	};
+
+	void deliver(Kcp& kcp, std::deque<std::string>& queue)
+	{
+		while (!queue.empty())
+		{
+			kcp.input(queue.front().data(), queue.front().size());
+			queue.pop_front();
+		}
+	}
+}
+
+TEST(kcp_segment_encoding)
+{
+	std::vector<std::string> packets;
+	Kcp kcp(0x11223344, [&packets](const char *data, std::size_t size) { packets.push_back(std::string(data, size)); });
+
+	CHECK_EQ(kcp.send("hello", 5), 0);
+
+	// like ikcp the congestion window opens at the end of the first flush
+	kcp.update(1000);
+	CHECK(packets.empty());
+	kcp.update(1100);
+
+	// push 81, whole message so frg 0, our receive window 128, first sn
+	CHECK_EQ(packets.size(), (std::size_t)1);
+	if (packets.empty())
+		return;
+
+	CHECK(packets[0] == segment(0x11223344, 81, 0, 128, 1100, 0, 0, "hello"));
+
+	CHECK_EQ(Kcp::conv(packets[0].data(), packets[0].size()), (uint32_t)0x11223344);
+	CHECK_EQ(Kcp::conv(packets[0].data(), Kcp::kOverhead - 1), (uint32_t)0);
+}
+
+TEST(kcp_input_from_ikcp)
+{
+	std::vector<std::string> packets;
+	Kcp kcp(7, [&packets](const char *data, std::size_t size) { packets.push_back(std::string(data, size)); });
+	kcp.update(0);
+
+	// two fragments, the last one first
+	std::string second = segment(7, 81, 0, 32, 50, 1, 0, "world");
+	std::string first = segment(7, 81, 1, 32, 50, 0, 0, "hello ");
+	std::string message;
+
+	CHECK_EQ(kcp.input(second.data(), second.size()), 0);
+	CHECK(kcp.recv(message) < 0);
+	CHECK_EQ(kcp.input(first.data(), first.size()), 0);
+	CHECK_EQ(kcp.recv(message), 11);
+	CHECK_EQ(message, std::string("hello world"));
+
+	// both acked in one packet: ack 82 with the sender's ts, una 2
+	kcp.update(100);
+	CHECK_EQ(packets.size(), (std::size_t)1);
+	CHECK(!packets.empty() && packets[0] == segment(7, 82, 0, 128, 50, 1, 2, "")
+		+ segment(7, 82, 0, 128, 50, 0, 2, ""));
+}
+
+TEST(kcp_input_rejects_malformed)
+{
+	Kcp kcp(7, nullptr);
+	kcp.update(0);
+
+	std::string ok = segment(7, 81, 0, 32, 0, 0, 0, "data");
+	CHECK_EQ(kcp.input(ok.data(), Kcp::kOverhead - 1), -1);
+
+	std::string other = segment(8, 81, 0, 32, 0, 0, 0, "data");
+	CHECK_EQ(kcp.input(other.data(), other.size()), -1);
+
+	// claims more data than there is
+	CHECK_EQ(kcp.input(ok.data(), ok.size() - 1), -2);
+
+	std::string command = segment(7, 99, 0, 32, 0, 0, 0, "data");
+	CHECK_EQ(kcp.input(command.data(), command.size()), -3);
+
+	std::string message;
+	CHECK(kcp.recv(message) < 0);
+}
+
+TEST(kcp_fragments_and_loss)
+{
+	Link link;
+	Kcp a(1, link.output(link.to_b));
+	Kcp b(1, link.output(link.to_a));
+	a.window(128, 128);
+	b.window(128, 128);
+
+	// 128 fragments of the default mss
+	std::string big;
+	for (int i = 0; i < 1376 * 128; i++)
+		big += (char)('a' + i % 26);
+
+	// a message must fit the peer's receive window in fragments
+	CHECK_EQ(a.send(big.data(), big.size()), -2);
+
+	big.resize(100000);
+
+	link.drop = 5;
+	CHECK_EQ(a.send(big.data(), big.size()), 0);
+	CHECK_EQ(a.send("tail", 4), 0);
+
+	std::string message;
+	std::vector<std::string> received;
+	for (uint32_t now = 0; now < 60000 && received.size() < 2; now += 10)
+	{
+		a.update(now);
+		b.update(now);
+		deliver(b, link.to_b);
+		deliver(a, link.to_a);
+
+		while (b.recv(message) >= 0)
+			received.push_back(message);
+	}
+
+	CHECK_EQ(received.size(), (std::size_t)2);
+	CHECK(received.size() == 2 && received[0] == big && received[1] == "tail");
+	CHECK(!a.dead());
+}
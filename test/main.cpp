@@ -0,0 +1,41 @@
+#include "test.hpp"
+
+#include <cstring>
+
+// tests [name ...]: runs every case, or those named
+int main(int argc, char *argv[])
+{
+	int failed = 0;
+	int ran = 0;
+
+	for (auto& test : tengine::test::cases())
+	{
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; i++)
+		{
+			if (std::strcmp(argv[i], test.name) == 0)
+				selected = true;
+		}
+
+		if (!selected)
+			continue;
+
+		tengine::test::failures() = 0;
+		test.function();
+		ran++;
+
+		if (tengine::test::failures() > 0)
+		{
+			failed++;
+			fprintf(stderr, "FAILED %s\n", test.name);
+		}
+		else
+		{
+			fprintf(stdout, "ok %s\n", test.name);
+		}
+	}
+
+	fprintf(stdout, "%d of %d passed\n", ran - failed, ran);
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+#include "test.hpp"
+
+#include "membership.hpp"
+#include "resolver.hpp"
+
+#include "openssl/hmac.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace tengine;
+
+namespace
+{
+	const int kPort = 27411;
+
+	const char *kKey = "test cluster key";
+
+	// Membership's kSync, a packet nobody answers when seq is 0
+	const char kSync = 3;
+
+	std::string be16(int value)
+	{
+		std::string bytes;
+		bytes += (char)(value >> 8);
+		bytes += (char)value;
+		return bytes;
+	}
+
+	// a packet from `from` carrying members, tagged under key
+	std::string packet(int from, const std::vector<Membership::Member>& members, const std::string& key)
+	{
+		std::string data;
+		data += kSync;
+		data += (char)0;
+		data += be16(from);
+		data += std::string(4, '\0');
+		data += be16(0);
+		data += be16((int)members.size());
+
+		for (auto& member : members)
+			Membership::put_member(data, member, 1400);
+
+		unsigned char tag[EVP_MAX_MD_SIZE];
+		unsigned int size = sizeof(tag);
+		HMAC(EVP_sha256(), key.data(), (int)key.size(), (const unsigned char*)data.data(), data.size(), tag, &size);
+		data.append((const char*)tag, 16);
+		return data;
+	}
+
+	Membership::Member member(int node, Membership::State state, uint32_t incarnation)
+	{
+		Membership::Member member;
+		member.node = node;
+		member.host = "127.0.0.1";
+		member.port = kPort + node;
+		member.router_port = 0;
+		member.incarnation = incarnation;
+		member.state = state;
+		return member;
+	}
+
+	template<typename Predicate>
+	bool eventually(Predicate predicate)
+	{
+		for (int i = 0; i < 200; i++)
+		{
+			if (predicate())
+				return true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return predicate();
+	}
+
+	bool find(Membership& membership, int node, Membership::Member& found)
+	{
+		for (auto& member : membership.members())
+		{
+			if (member.node == node)
+			{
+				found = member;
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+TEST(membership_member_encoding)
+{
+	Membership::Member member;
+	member.node = 0x0102;
+	member.host = "10.0.0.2";
+	member.port = 0x1234;
+	member.router_port = 0x5678;
+	member.incarnation = 0x0a0b0c0d;
+	member.state = Membership::kSuspect;
+	member.services = { "Login", "Chat" };
+
+	std::string data;
+	CHECK(Membership::put_member(data, member, 1400));
+
+	// big endian, whatever the host
+	const char expected[] = "\x01\x08\x01\x02\x0a\x0b\x0c\x0d\x12\x34\x56\x78\x0a" "10.0.0.2" "Login,Chat";
+	CHECK_EQ(data, std::string(expected, sizeof(expected) - 1));
+
+	Membership::Member decoded;
+	CHECK_EQ(Membership::get_member(data.data(), data.size(), decoded), data.size());
+	CHECK_EQ(decoded.node, member.node);
+	CHECK_EQ(decoded.host, member.host);
+	CHECK_EQ(decoded.port, member.port);
+	CHECK_EQ(decoded.router_port, member.router_port);
+	CHECK_EQ(decoded.incarnation, member.incarnation);
+	CHECK(decoded.state == member.state);
+	CHECK(decoded.services == member.services);
+
+	// cut short anywhere, nothing is decoded
+	for (std::size_t size = 0; size < data.size(); size++)
+		CHECK_EQ(Membership::get_member(data.data(), size, decoded), (std::size_t)0);
+
+	// the member and a 16 byte tag must fit
+	std::string full(1400 - 16 - data.size() + 1, 'x');
+	CHECK(!Membership::put_member(full, member, 1400));
+	full.pop_back();
+	CHECK(Membership::put_member(full, member, 1400));
+	CHECK_EQ(full.size(), (std::size_t)1400 - 16);
+}
+
+TEST(membership_merge)
+{
+	asio::io_service io_service;
+	asio::io_service::work work(io_service);
+	Resolver resolver(io_service, 60, 5);
+
+	Membership::Options options;
+	options.node = 1;
+	options.port = kPort + 1;
+	options.key = kKey;
+	// nothing probes or syncs during the test, only our packets move it
+	options.probe_interval = 60000;
+	options.sync_interval = 60000;
+
+	auto membership = std::make_shared<Membership>(resolver, io_service, options);
+
+	std::thread thread([&io_service]() { io_service.run(); });
+
+	CHECK_EQ(membership->start(), 0);
+	CHECK(eventually([&]() { return !membership->members()[0].host.empty(); }));
+
+	asio::ip::udp::socket socket(io_service, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::udp::endpoint to(asio::ip::address_v4::loopback(), (unsigned short)(kPort + 1));
+
+	uint64_t handled = 0;
+	auto deliver = [&](const std::vector<Membership::Member>& members, const std::string& key)
+	{
+		socket.send_to(asio::buffer(packet(2, members, key)), to);
+		handled++;
+		return eventually([&]()
+		{
+			Membership::Stats stats = membership->stats();
+			return stats.packets_received + stats.packets_rejected == handled;
+		});
+	};
+
+	Membership::Member found;
+
+	// another cluster's key
+	CHECK(deliver({ member(2, Membership::kAlive, 5) }, "some other key"));
+	CHECK_EQ(membership->stats().packets_rejected, (uint64_t)1);
+	CHECK(!find(*membership, 2, found));
+
+	// a suspect we never knew is no use
+	CHECK(deliver({ member(3, Membership::kSuspect, 5) }, kKey));
+	CHECK(!find(*membership, 3, found));
+
+	CHECK(deliver({ member(2, Membership::kAlive, 5) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kAlive && found.incarnation == 5);
+
+	// suspicion of the same incarnation sticks, alive news of it does not undo it
+	CHECK(deliver({ member(2, Membership::kSuspect, 5) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kSuspect);
+	CHECK(deliver({ member(2, Membership::kAlive, 5) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kSuspect);
+
+	// a refutation does
+	CHECK(deliver({ member(2, Membership::kAlive, 6) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kAlive && found.incarnation == 6);
+
+	// stale death is ignored, current death is not
+	CHECK(deliver({ member(2, Membership::kDead, 5) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kAlive);
+	CHECK(deliver({ member(2, Membership::kDead, 6) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kDead);
+
+	// a dead member is not suspected back to life, only a rejoin revives it
+	CHECK(deliver({ member(2, Membership::kSuspect, 7) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kDead);
+	CHECK(deliver({ member(2, Membership::kAlive, 7) }, kKey));
+	CHECK(find(*membership, 2, found) && found.state == Membership::kAlive && found.incarnation == 7);
+
+	// suspected ourselves, we outbid the rumour
+	uint32_t incarnation = membership->members()[0].incarnation;
+	CHECK(deliver({ member(1, Membership::kSuspect, incarnation) }, kKey));
+	CHECK_EQ(membership->members()[0].incarnation, incarnation + 1);
+	CHECK(membership->members()[0].state == Membership::kAlive);
+	CHECK_EQ(membership->stats().refuted, (uint64_t)1);
+
+	membership->close();
+	io_service.stop();
+	thread.join();
+}
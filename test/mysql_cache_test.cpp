@@ -0,0 +1,146 @@
+#include "test.hpp"
+
+#include "mysql_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace tengine;
+
+namespace
+{
+	typedef std::vector<std::string> Tables;
+
+	Tables reads(const char *sql)
+	{
+		return MySqlCache::read_tables(sql, std::strlen(sql));
+	}
+
+	// the tables of a write, "*" for one whose tables can't be told and
+	// "-" for anything that is not a write
+	Tables writes(const char *sql)
+	{
+		Tables tables;
+		if (!MySqlCache::write_tables(sql, std::strlen(sql), tables))
+			return Tables{ "-" };
+		if (tables.empty())
+			return Tables{ "*" };
+		return tables;
+	}
+
+	bool read_only(const char *sql)
+	{
+		return MySqlCache::read_only(sql, std::strlen(sql));
+	}
+}
+
+TEST(mysql_cache_read_tables)
+{
+	CHECK(reads("SELECT * FROM users WHERE id = 1") == Tables({ "users" }));
+
+	// names compare in lower case, without the schema or quotes
+	CHECK(reads("select * from `Game`.`Users` u") == Tables({ "users" }));
+
+	CHECK(reads("SELECT * FROM a x, b AS y, c WHERE x.id = y.id") == Tables({ "a", "b", "c" }));
+
+	CHECK(reads("SELECT * FROM a LEFT JOIN b ON a.id = b.id INNER JOIN c USING (id)")
+		== Tables({ "a", "b", "c" }));
+
+	// a table once however often it is read
+	CHECK(reads("SELECT * FROM a JOIN a AS b ON a.parent = b.id") == Tables({ "a" }));
+
+	CHECK(reads("SELECT * FROM a WHERE id IN (SELECT a_id FROM b WHERE c = 1)")
+		== Tables({ "a", "b" }));
+	CHECK(reads("SELECT * FROM (SELECT * FROM b) x JOIN c ON x.id = c.id") == Tables({ "b", "c" }));
+
+	// FROM in a string or a comment is no table
+	CHECK(reads("SELECT 'from x' FROM a -- from y\n") == Tables({ "a" }));
+	CHECK(reads("SELECT /* FROM x */ 1 FROM a WHERE b = \"JOIN y\"") == Tables({ "a" }));
+
+	CHECK(reads("SELECT 1").empty());
+}
+
+TEST(mysql_cache_write_tables)
+{
+	CHECK(writes("INSERT INTO users (id, name) VALUES (1, 'a')") == Tables({ "users" }));
+	CHECK(writes("insert low_priority ignore into `db`.`Users` set id = 1") == Tables({ "users" }));
+	CHECK(writes("REPLACE INTO a VALUES (1)") == Tables({ "a" }));
+	CHECK(writes("UPDATE a SET x = 1 WHERE id = 2") == Tables({ "a" }));
+	CHECK(writes("DELETE FROM a WHERE id = 2") == Tables({ "a" }));
+	CHECK(writes("TRUNCATE TABLE a") == Tables({ "a" }));
+	CHECK(writes("ALTER TABLE a ADD COLUMN b INT") == Tables({ "a" }));
+	CHECK(writes("DROP TABLE IF EXISTS a, b") == Tables({ "a", "b" }));
+	CHECK(writes("RENAME TABLE a TO b, c TO d") == Tables({ "a", "b", "c", "d" }));
+
+	// only the target of an INSERT ... SELECT is written
+	CHECK(writes("INSERT INTO a SELECT * FROM b") == Tables({ "a" }));
+
+	// every table of a multi table UPDATE or DELETE
+	CHECK(writes("UPDATE a, b SET a.x = b.x WHERE a.id = b.id") == Tables({ "a", "b" }));
+	CHECK(writes("UPDATE a JOIN b ON a.id = b.id SET a.x = 1") == Tables({ "a", "b" }));
+
+	Tables tables = writes("DELETE x, y FROM a AS x JOIN b AS y ON x.id = y.id");
+	CHECK(std::find(tables.begin(), tables.end(), "a") != tables.end());
+	CHECK(std::find(tables.begin(), tables.end(), "b") != tables.end());
+
+	tables = writes("DELETE a.*, b.* FROM a, b WHERE a.id = b.id");
+	CHECK(tables == Tables({ "a", "b" }));
+
+	tables = writes("DELETE FROM a, b USING a JOIN b ON a.id = b.id WHERE a.x = 1");
+	CHECK(std::find(tables.begin(), tables.end(), "a") != tables.end());
+	CHECK(std::find(tables.begin(), tables.end(), "b") != tables.end());
+
+	// a subquery's tables count as well, better too many than too few
+	tables = writes("UPDATE a SET x = 1 WHERE id IN (SELECT a_id FROM b)");
+	CHECK(tables == Tables({ "a", "b" }));
+
+	// quoted and commented
+	CHECK(writes("/* job 7 */ UPDATE `a` SET note = 'UPDATE b' -- c\n") == Tables({ "a" }));
+
+	// a write all the same
+	CHECK(writes("INSERT INTO (1)") == Tables({ "*" }));
+
+	CHECK(writes("SELECT * FROM a") == Tables({ "-" }));
+	CHECK(writes("") == Tables({ "-" }));
+	CHECK(writes("-- INSERT INTO a\nSELECT 1") == Tables({ "-" }));
+}
+
+TEST(mysql_cache_read_only)
+{
+	CHECK(read_only("SELECT * FROM a"));
+	CHECK(read_only("select * from a join b on a.id = b.id"));
+	CHECK(read_only("(SELECT 1) UNION (SELECT 2)"));
+	CHECK(read_only("SHOW TABLES"));
+	CHECK(read_only("DESCRIBE a"));
+	CHECK(read_only("EXPLAIN SELECT * FROM a"));
+	CHECK(read_only("WITH x AS (SELECT * FROM a) SELECT * FROM x"));
+	CHECK(read_only("SELECT * FROM a WHERE id IN (SELECT a_id FROM b)"));
+
+	// row locks need the primary
+	CHECK(!read_only("SELECT * FROM a WHERE id = 1 FOR UPDATE"));
+	CHECK(!read_only("SELECT * FROM a FOR SHARE"));
+	CHECK(!read_only("SELECT * FROM a LOCK IN SHARE MODE"));
+
+	// INTO writes a variable or a file
+	CHECK(!read_only("SELECT id INTO @id FROM a"));
+	CHECK(!read_only("SELECT * FROM a INTO OUTFILE '/tmp/a'"));
+
+	// session state
+	CHECK(!read_only("SELECT LAST_INSERT_ID()"));
+	CHECK(!read_only("SELECT found_rows ()"));
+	CHECK(!read_only("SELECT GET_LOCK('x', 1)"));
+
+	// a column may carry the name of a function
+	CHECK(read_only("SELECT row_count FROM stats"));
+
+	CHECK(!read_only("WITH x AS (SELECT 1) UPDATE a SET b = 1"));
+	CHECK(!read_only("INSERT INTO a VALUES (1)"));
+	CHECK(!read_only("UPDATE a SET b = 1"));
+	CHECK(!read_only(""));
+
+	// the words only count outside strings and comments
+	CHECK(read_only("SELECT 'FOR UPDATE' FROM a"));
+	CHECK(read_only("SELECT * FROM a /* INTO @x */ -- LOCK IN SHARE MODE\n"));
+	CHECK(read_only("SELECT \"LAST_INSERT_ID()\" FROM a"));
+	CHECK(!read_only("/* SELECT */ DELETE FROM a"));
+}
@@ -0,0 +1,87 @@
+#include "test.hpp"
+
+#include "mysql_packet.hpp"
+
+using namespace tengine;
+
+namespace
+{
+	std::string lenenc(uint64_t value)
+	{
+		std::string out;
+		MySqlPacket::put_lenenc(out, value);
+		return out;
+	}
+}
+
+TEST(mysql_lenenc_encoding)
+{
+	// one byte below 0xfb, which marks NULL in a row
+	CHECK_EQ(lenenc(0), std::string(1, '\0'));
+	CHECK_EQ(lenenc(0xfa), std::string("\xfa"));
+	CHECK_EQ(lenenc(0xfb), std::string("\xfc\xfb\x00", 3));
+	CHECK_EQ(lenenc(0xffff), std::string("\xfc\xff\xff"));
+	CHECK_EQ(lenenc(0x10000), std::string("\xfd\x00\x00\x01", 4));
+	CHECK_EQ(lenenc(0xffffff), std::string("\xfd\xff\xff\xff"));
+	CHECK_EQ(lenenc(0x1000000), std::string("\xfe\x00\x00\x00\x01\x00\x00\x00\x00", 9));
+	CHECK_EQ(lenenc(0x0102030405060708ull), std::string("\xfe\x08\x07\x06\x05\x04\x03\x02\x01"));
+
+	const uint64_t values[] = { 0, 1, 0xfa, 0xfb, 0xfc, 0xffff, 0x10000, 0xffffff, 0x1000000, ~0ull };
+	for (uint64_t value : values)
+	{
+		std::string data = lenenc(value);
+		MySqlPacket::Reader reader(data.data(), data.size());
+		CHECK_EQ(reader.lenenc(), value);
+		CHECK(reader.ok());
+		CHECK_EQ(reader.left(), (std::size_t)0);
+	}
+}
+
+TEST(mysql_packet_reader)
+{
+	// an OK packet: header, 1 row affected, insert id 300, autocommit, no warnings
+	std::string ok("\x00\x01\xfc\x2c\x01\x02\x00\x00\x00", 9);
+	MySqlPacket::Reader reader(ok.data(), ok.size());
+	CHECK_EQ(reader.peek(), (uint8_t)0);
+	CHECK_EQ(reader.uint(1), (uint64_t)0);
+	CHECK_EQ(reader.lenenc(), (uint64_t)1);
+	CHECK_EQ(reader.lenenc(), (uint64_t)300);
+	CHECK_EQ(reader.uint(2), (uint64_t)2);
+	CHECK_EQ(reader.uint(2), (uint64_t)0);
+	CHECK(reader.ok());
+	CHECK_EQ(reader.peek(), (uint8_t)0);
+
+	std::string strings("\x03" "abc" "def\0" "ghi" "\x05" "xyz", 16);
+	MySqlPacket::Reader text(strings.data(), strings.size());
+	CHECK_EQ(text.lenenc_string(), std::string("abc"));
+	CHECK_EQ(text.null_string(), std::string("def"));
+	// no terminator: the rest of the packet
+	CHECK_EQ(text.null_string(), std::string("ghi\x05xyz"));
+	CHECK(text.ok());
+	CHECK_EQ(text.rest(), std::string());
+}
+
+TEST(mysql_packet_reader_overrun)
+{
+	// the string claims 5 bytes, 3 are there
+	std::string data("\x05" "abc", 4);
+	MySqlPacket::Reader reader(data.data(), data.size());
+	CHECK_EQ(reader.lenenc_string(), std::string());
+	CHECK(!reader.ok());
+
+	// everything after reads empty
+	CHECK_EQ(reader.left(), (std::size_t)0);
+	CHECK_EQ(reader.uint(1), (uint64_t)0);
+	CHECK_EQ(reader.rest(), std::string());
+	CHECK(!reader.ok());
+
+	// a 3 byte length cut short
+	std::string length("\xfd\x01\x02", 3);
+	MySqlPacket::Reader cut(length.data(), length.size());
+	CHECK_EQ(cut.lenenc(), (uint64_t)0);
+	CHECK(!cut.ok());
+
+	MySqlPacket::Reader empty("", 0);
+	empty.skip(1);
+	CHECK(!empty.ok());
+}
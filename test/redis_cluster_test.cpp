@@ -0,0 +1,46 @@
+#include "test.hpp"
+
+#include "redis_cluster.hpp"
+
+#include <cstring>
+
+using namespace tengine;
+
+namespace
+{
+	uint16_t slot(const char *key)
+	{
+		return RedisCluster::slot(key, std::strlen(key));
+	}
+}
+
+TEST(redis_cluster_slot)
+{
+	// crc16 xmodem, the check value of the cluster spec, 0x31c3 mod 16384
+	CHECK_EQ(slot("123456789"), (uint16_t)(0x31c3 % 16384));
+
+	// as CLUSTER KEYSLOT answers
+	CHECK_EQ(slot("foo"), (uint16_t)12182);
+	CHECK_EQ(slot("bar"), (uint16_t)5061);
+	CHECK_EQ(slot(""), (uint16_t)0);
+
+	// binary keys hash every byte
+	CHECK(RedisCluster::slot("a\0b", 3) != RedisCluster::slot("a\0c", 3));
+}
+
+TEST(redis_cluster_hash_tags)
+{
+	CHECK_EQ(slot("{user1000}.following"), slot("{user1000}.followers"));
+	CHECK_EQ(slot("{user1000}.following"), slot("user1000"));
+
+	// only the first tag counts
+	CHECK_EQ(slot("foo{bar}{zap}"), slot("bar"));
+
+	// an empty tag hashes the whole key
+	CHECK_EQ(slot("foo{}{bar}"), RedisCluster::slot("foo{}{bar}", 10));
+	CHECK(slot("foo{}{bar}") != slot("bar"));
+
+	// the tag runs to the first close after the first open
+	CHECK_EQ(slot("foo{{bar}}zap"), slot("{bar"));
+	CHECK_EQ(slot("foo{bar"), RedisCluster::slot("foo{bar", 7));
+}
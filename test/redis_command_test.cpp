@@ -0,0 +1,96 @@
+#include "test.hpp"
+
+#include "redis_command.hpp"
+
+using namespace tengine;
+
+TEST(redis_command_encoding)
+{
+	std::string buffer;
+	RedisCommand::begin(buffer, 3);
+	RedisCommand::arg(buffer, "SET", 3);
+	RedisCommand::arg(buffer, "key", 3);
+	// binary safe: sizes, not separators, delimit arguments
+	RedisCommand::arg(buffer, "a\r\nb\0c", 6);
+
+	const char expected[] = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$6\r\na\r\nb\0c\r\n";
+	CHECK_EQ(buffer, std::string(expected, sizeof(expected) - 1));
+
+	buffer.clear();
+	RedisCommand::begin(buffer, 2);
+	RedisCommand::arg(buffer, "GET", 3);
+	RedisCommand::arg(buffer, "", 0);
+	CHECK_EQ(buffer, std::string("*2\r\n$3\r\nGET\r\n$0\r\n\r\n"));
+
+	// multi digit lengths
+	buffer.clear();
+	std::string value(1234, 'v');
+	RedisCommand::begin(buffer, 10);
+	RedisCommand::arg(buffer, value.data(), value.size());
+	CHECK_EQ(buffer, "*10\r\n$1234\r\n" + value + "\r\n");
+}
+
+TEST(redis_command_line)
+{
+	std::string buffer;
+	CHECK(RedisCommand::line(buffer, "  SET key   value ", 18));
+	CHECK_EQ(buffer, std::string("*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n"));
+
+	// no format: a % is just a byte
+	buffer.clear();
+	CHECK(RedisCommand::line(buffer, "GET %s", 6));
+	CHECK_EQ(buffer, std::string("*2\r\n$3\r\nGET\r\n$2\r\n%s\r\n"));
+
+	buffer.clear();
+	CHECK(!RedisCommand::line(buffer, "   ", 3));
+	CHECK(!RedisCommand::line(buffer, "", 0));
+	CHECK(buffer.empty());
+}
+
+TEST(redis_command_parse)
+{
+	std::string buffer;
+	RedisCommand::begin(buffer, 3);
+	RedisCommand::arg(buffer, "HSET", 4);
+	RedisCommand::arg(buffer, "h\r\n", 3);
+	RedisCommand::arg(buffer, "", 0);
+
+	RedisCommand::Arg args[3];
+	CHECK_EQ(RedisCommand::parse(buffer, args, 3), (std::size_t)3);
+	CHECK_EQ(std::string(args[0].data, args[0].size), std::string("HSET"));
+	CHECK_EQ(std::string(args[1].data, args[1].size), std::string("h\r\n"));
+	CHECK_EQ(args[2].size, (std::size_t)0);
+
+	// only the first max are pointed at, the count is still all of them
+	RedisCommand::Arg first[1];
+	CHECK_EQ(RedisCommand::parse(buffer, first, 1), (std::size_t)3);
+	CHECK_EQ(std::string(first[0].data, first[0].size), std::string("HSET"));
+
+	// cut inside the second argument: only the whole ones come back
+	CHECK_EQ(RedisCommand::parse(buffer.substr(0, 16), args, 3), (std::size_t)1);
+
+	CHECK_EQ(RedisCommand::parse("", args, 3), (std::size_t)0);
+	CHECK_EQ(RedisCommand::parse("$3\r\nGET\r\n", args, 3), (std::size_t)0);
+}
+
+TEST(redis_command_pool)
+{
+	std::string buffer = RedisCommand::acquire();
+	buffer.reserve(1000);
+	std::size_t capacity = buffer.capacity();
+	buffer = "*1\r\n$4\r\nPING\r\n";
+
+	RedisCommand::release(buffer);
+
+	// cleared, capacity kept for the next command
+	std::string reused = RedisCommand::acquire();
+	CHECK(reused.empty());
+	CHECK(reused.capacity() >= capacity);
+	RedisCommand::release(reused);
+
+	// one large value does not pin its memory in the pool
+	std::string large = RedisCommand::acquire();
+	large.reserve(1 << 20);
+	RedisCommand::release(large);
+	CHECK(large.capacity() < (std::size_t)(1 << 20));
+}
@@ -0,0 +1,71 @@
+#ifndef TENGINE_TEST_HPP
+#define TENGINE_TEST_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace tengine
+{
+	namespace test
+	{
+		typedef void (*Function)();
+
+		struct Case
+		{
+			const char *name;
+			Function function;
+		};
+
+		inline std::vector<Case>& cases()
+		{
+			static std::vector<Case> cases;
+			return cases;
+		}
+
+		// checks that failed in the running case
+		inline int& failures()
+		{
+			static int failures = 0;
+			return failures;
+		}
+
+		struct Register
+		{
+			Register(const char *name, Function function)
+			{
+				Case test = { name, function };
+				cases().push_back(test);
+			}
+		};
+
+		inline void fail(const char *file, int line, const std::string& what)
+		{
+			failures()++;
+			fprintf(stderr, "%s:%d: %s\n", file, line, what.c_str());
+		}
+	}
+}
+
+// TEST(name) { ... } registers a case, run by test/main.cpp in file order
+#define TEST(name) \
+	static void test_##name(); \
+	static tengine::test::Register register_##name(#name, test_##name); \
+	static void test_##name()
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+			tengine::test::fail(__FILE__, __LINE__, "CHECK(" #condition ")"); \
+	} while (0)
+
+// a and b are evaluated once each
+#define CHECK_EQ(a, b) \
+	do { \
+		auto check_a = (a); \
+		auto check_b = (b); \
+		if (!(check_a == check_b)) \
+			tengine::test::fail(__FILE__, __LINE__, "CHECK_EQ(" #a ", " #b ")"); \
+	} while (0)
+
+#endif // ! TENGINE_TEST_HPP